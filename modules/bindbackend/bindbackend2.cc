@@ -34,6 +34,7 @@
 #include <sstream>
 #include <boost/algorithm/string.hpp>
 #include <system_error>
+#include <thread>
 
 #include "pdns/dnsseckeeper.hh"
 #include "pdns/dnssecinfra.hh"
@@ -74,6 +75,11 @@
 Bind2Backend::state_t Bind2Backend::s_state;
 int Bind2Backend::s_first=1;
 bool Bind2Backend::s_ignore_broken_records=false;
+bool Bind2Backend::s_precompile_records=false;
+std::atomic<bool> Bind2Backend::s_loading(false);
+AtomicCounter Bind2Backend::s_zones_to_load(0);
+AtomicCounter Bind2Backend::s_zones_parsed(0);
+AtomicCounter Bind2Backend::s_zones_rejected(0);
 
 pthread_rwlock_t Bind2Backend::s_state_lock=PTHREAD_RWLOCK_INITIALIZER;
 pthread_mutex_t Bind2Backend::s_supermaster_config_lock=PTHREAD_MUTEX_INITIALIZER; // protects writes to config file
@@ -530,7 +536,20 @@ void Bind2Backend::insertRecord(BB2DomainInfo& bb2, const DNSName &qname, const
   bdr.qtype=qtype.getCode();
   bdr.content=content; 
   bdr.nsec3hash = hashed;
-  
+
+  // SOA records may need defaults filled in, and are not worth it anyway: leave them to DNSBackend::get()
+  if(s_precompile_records && bdr.qtype != QType::SOA && bdr.qtype != 0) {
+    try {
+      if(bdr.qtype == QType::TXT && !content.empty() && content[0] != '"')
+        bdr.drc = DNSRecordContent::mastermake(bdr.qtype, QClass::IN, "\""+content+"\"");
+      else
+        bdr.drc = DNSRecordContent::mastermake(bdr.qtype, QClass::IN, content);
+    }
+    catch(...) {
+      // served through the content string, failing at query time as before
+    }
+  }
+
   if (auth) // Set auth on empty non-terminals
     bdr.auth=*auth;
   else
@@ -602,6 +621,13 @@ string Bind2Backend::DLListRejectsHandler(const vector<string>&parts, Utility::p
   return ret.str();
 }
 
+string Bind2Backend::DLLoadStatusHandler(const vector<string>&parts, Utility::pid_t ppid)
+{
+  ostringstream ret;
+  ret<<(s_loading ? "loading" : "done")<<": "<<s_zones_parsed<<" of "<<s_zones_to_load<<" zone file(s) parsed, "<<s_zones_rejected<<" rejected";
+  return ret.str();
+}
+
 string Bind2Backend::DLAddDomainHandler(const vector<string>&parts, Utility::pid_t ppid)
 {
   if(parts.size() < 3)
@@ -654,12 +680,19 @@ Bind2Backend::Bind2Backend(const string &suffix, bool loadZones)
 
   setArgPrefix("bind"+suffix);
   d_logprefix="[bind"+suffix+"backend]";
+  d_suffix=suffix;
   d_hybrid=mustDo("hybrid");
   d_transaction_id=0;
   s_ignore_broken_records=mustDo("ignore-broken-records");
+  s_precompile_records=mustDo("precompile-records");
 
-  if (!loadZones && d_hybrid)
+  if (!loadZones) {
+    // metadata only, this is also used by the zone parsing threads while the first
+    // instance holds s_startup_lock, so it must not be taken here
+    if (!d_hybrid)
+      setupDNSSEC();
     return;
+  }
 
   Lock l(&s_startup_lock);
   
@@ -668,16 +701,16 @@ Bind2Backend::Bind2Backend(const string &suffix, bool loadZones)
     return;
   }
   
-  if(loadZones) {
-    loadConfig();
-    s_first=0;
-  }
+  // only the server declares receiver-threads, tools like pdnsutil need every zone parsed before they continue
+  loadConfig(nullptr, ::arg().parmIsset("receiver-threads"));
+  s_first=0;
   
   extern DynListener *dl;
   dl->registerFunc("BIND-RELOAD-NOW", &DLReloadNowHandler, "bindbackend: reload domains", "<domains>");
   dl->registerFunc("BIND-DOMAIN-STATUS", &DLDomStatusHandler, "bindbackend: list status of all domains", "[domains]");
   dl->registerFunc("BIND-LIST-REJECTS", &DLListRejectsHandler, "bindbackend: list rejected domains");
   dl->registerFunc("BIND-ADD-ZONE", &DLAddDomainHandler, "bindbackend: add zone", "<domain> <filename>");
+  dl->registerFunc("BIND-LOAD-STATUS", &DLLoadStatusHandler, "bindbackend: show progress of parsing the zones from the configuration");
 }
 
 Bind2Backend::~Bind2Backend()
@@ -793,11 +826,41 @@ void Bind2Backend::doEmptyNonTerminals(BB2DomainInfo& bbd, bool nsec3zone, NSEC3
   }
 }
 
-void Bind2Backend::loadConfig(string* status)
+// clears the loading flag when going out of scope, unless the load has been handed over to loadZonesInThreads()
+class LoadingFlagGuard
+{
+public:
+  LoadingFlagGuard(std::atomic<bool>& flag): d_flag(flag)
+  {
+  }
+  ~LoadingFlagGuard()
+  {
+    if(!d_handedOver)
+      d_flag=false;
+  }
+  void handOver()
+  {
+    d_handedOver=true;
+  }
+private:
+  std::atomic<bool>& d_flag;
+  bool d_handedOver{false};
+};
+
+void Bind2Backend::loadConfig(string* status, bool background)
 {
   static int domain_id=1;
 
   if(!getArg("config").empty()) {
+    if(s_loading.exchange(true)) {
+      string msg=" Not parsing domains, a previous load is still in progress";
+      if(status)
+        *status=msg;
+      g_log<<Logger::Warning<<d_logprefix<<msg<<endl;
+      return;
+    }
+    LoadingFlagGuard loadingGuard(s_loading);
+
     BindParser BP;
     try {
       BP.parse(getArg("config"));
@@ -836,6 +899,10 @@ void Bind2Backend::loadConfig(string* status)
     }
 
     sort(domains.begin(), domains.end()); // put stuff in inode order
+
+    unsigned int threads=getArgAsNum("parse-threads");
+    auto jobs=std::make_shared<vector<ZoneLoadJob> >();
+
     for(vector<BindDomainInfo>::const_iterator i=domains.begin();
         i!=domains.end();
         ++i) 
@@ -880,48 +947,12 @@ void Bind2Backend::loadConfig(string* status)
 
         newnames.insert(bbd.d_name);
         if(filenameChanged || !bbd.d_loaded || !bbd.current()) {
-          g_log<<Logger::Info<<d_logprefix<<" parsing '"<<i->name<<"' from file '"<<i->filename<<"'"<<endl;
-
-          try {
-            parseZoneFile(&bbd);
-          }
-          catch(PDNSException &ae) {
-            ostringstream msg;
-            msg<<" error at "+nowTime()+" parsing '"<<i->name<<"' from file '"<<i->filename<<"': "<<ae.reason;
-
-            if(status)
-              *status+=msg.str();
-	    bbd.d_status=msg.str();
-
-            g_log<<Logger::Warning<<d_logprefix<<msg.str()<<endl;
-            rejected++;
-          }
-          catch(std::system_error &ae) {
-            ostringstream msg;
-            if (ae.code().value() == ENOENT && isNew && i->type == "slave")
-              msg<<" error at "+nowTime()<<" no file found for new slave domain '"<<i->name<<"'. Has not been AXFR'd yet";
-            else
-              msg<<" error at "+nowTime()+" parsing '"<<i->name<<"' from file '"<<i->filename<<"': "<<ae.what();
-
-            if(status)
-              *status+=msg.str();
-            bbd.d_status=msg.str();
-            g_log<<Logger::Warning<<d_logprefix<<msg.str()<<endl;
-            rejected++;
-          }
-          catch(std::exception &ae) {
-            ostringstream msg;
-            msg<<" error at "+nowTime()+" parsing '"<<i->name<<"' from file '"<<i->filename<<"': "<<ae.what();
-
-            if(status)
-              *status+=msg.str();
-            bbd.d_status=msg.str();
-
-            g_log<<Logger::Warning<<d_logprefix<<msg.str()<<endl;
-            rejected++;
+          if(threads > 1 && isNew) {
+            // make the zone known right away, lookups are refused with a SERVFAIL until it has been parsed
+            bbd.d_status="queued for parsing at "+nowTime();
+            safePutBBDomainInfo(bbd);
           }
-	  safePutBBDomainInfo(bbd);
-	  
+          jobs->push_back({bbd, isNew, i->type == "slave", false});
         }
       }
     vector<DNSName> diff;
@@ -938,13 +969,143 @@ void Bind2Backend::loadConfig(string* status)
     set_difference(newnames.begin(), newnames.end(), oldnames.begin(), oldnames.end(), back_inserter(diff));
     newdomains=diff.size();
 
-    ostringstream msg;
-    msg<<" Done parsing domains, "<<rejected<<" rejected, "<<newdomains<<" new, "<<remdomains<<" removed"; 
+    s_zones_to_load=jobs->size();
+    s_zones_parsed=0;
+    s_zones_rejected=0;
+
+    if(threads > 1) {
+      if(background) {
+        std::thread t(loadZonesInThreads, d_suffix, jobs, threads, rejected, newdomains, remdomains, nullptr);
+        loadingGuard.handOver();
+        t.detach();
+      }
+      else {
+        loadingGuard.handOver();
+        loadZonesInThreads(d_suffix, jobs, threads, rejected, newdomains, remdomains, status);
+      }
+      return;
+    }
+
+    for(auto& job : *jobs) {
+      string msg;
+      if(!loadZone(job.bbd, job.isNew, job.isSlave, msg)) {
+        ++s_zones_rejected;
+        if(status)
+          *status+=msg;
+      }
+      ++s_zones_parsed;
+    }
+
+    string msg=loadSummary(rejected, newdomains, remdomains);
     if(status)
-      *status=msg.str();
+      *status=msg;
+
+    g_log<<Logger::Error<<d_logprefix<<msg<<endl;
+  }
+}
+
+// parses one zone and stores the result in s_state, returns false and sets msg if the zone was rejected
+bool Bind2Backend::loadZone(BB2DomainInfo& bbd, bool isNew, bool isSlave, string& msg)
+{
+  g_log<<Logger::Info<<d_logprefix<<" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"'"<<endl;
 
-    g_log<<Logger::Error<<d_logprefix<<msg.str()<<endl;
+  bool loaded=false;
+  ostringstream err;
+  try {
+    parseZoneFile(&bbd);
+    loaded=true;
   }
+  catch(PDNSException &ae) {
+    err<<" error at "+nowTime()+" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"': "<<ae.reason;
+  }
+  catch(std::system_error &ae) {
+    if (ae.code().value() == ENOENT && isNew && isSlave)
+      err<<" error at "+nowTime()<<" no file found for new slave domain '"<<bbd.d_name<<"'. Has not been AXFR'd yet";
+    else
+      err<<" error at "+nowTime()+" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"': "<<ae.what();
+  }
+  catch(std::exception &ae) {
+    err<<" error at "+nowTime()+" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"': "<<ae.what();
+  }
+
+  if(!loaded) {
+    msg=err.str();
+    bbd.d_status=msg;
+    g_log<<Logger::Warning<<d_logprefix<<msg<<endl;
+  }
+  safePutBBDomainInfo(bbd);
+  return loaded;
+}
+
+void Bind2Backend::loadZonesInThreads(const string& suffix, std::shared_ptr<vector<ZoneLoadJob>> jobs, unsigned int threads, unsigned int rejected, unsigned int newdomains, unsigned int remdomains, string* status)
+{
+  LoadingFlagGuard loadingGuard(s_loading);
+  const string logprefix="[bind"+suffix+"backend]";
+  std::atomic<size_t> next(0);
+  std::mutex statusLock;
+  vector<std::thread> workers;
+
+  g_log<<Logger::Warning<<logprefix<<" Parsing "<<jobs->size()<<" zone file(s) using "<<threads<<" threads"<<endl;
+
+  for(unsigned int n = 0; n < threads; ++n) {
+    workers.emplace_back([&]() {
+      try {
+        Bind2Backend bb2(suffix, false); // every thread needs its own DNSSEC database handle
+        size_t idx;
+        while((idx = next++) < jobs->size()) {
+          ZoneLoadJob& job = jobs->at(idx);
+          string msg;
+          bool loaded=bb2.loadZone(job.bbd, job.isNew, job.isSlave, msg);
+          job.done=true;
+          if(!loaded) {
+            ++s_zones_rejected;
+            if(status) {
+              std::lock_guard<std::mutex> l(statusLock);
+              *status+=msg;
+            }
+          }
+          auto parsed = ++s_zones_parsed;
+          if(parsed % 10000 == 0)
+            g_log<<Logger::Warning<<logprefix<<" Parsed "<<parsed<<" of "<<jobs->size()<<" zone file(s)"<<endl;
+        }
+      }
+      catch(const PDNSException& ae) {
+        g_log<<Logger::Error<<logprefix<<" Zone parsing thread failed: "<<ae.reason<<endl;
+      }
+      catch(const std::exception& e) {
+        g_log<<Logger::Error<<logprefix<<" Zone parsing thread failed: "<<e.what()<<endl;
+      }
+    });
+  }
+
+  for(auto& worker : workers)
+    worker.join();
+
+  // zones left behind by a failed thread would otherwise stay queued forever
+  for(auto& job : *jobs) {
+    if(job.done)
+      continue;
+    string msg=" error at "+nowTime()+" parsing '"+job.bbd.d_name.toLogString()+"' from file '"+job.bbd.d_filename+"': zone parsing thread failed";
+    job.bbd.d_status=msg;
+    safePutBBDomainInfo(job.bbd);
+    ++s_zones_rejected;
+    ++s_zones_parsed;
+    if(status)
+      *status+=msg;
+  }
+
+  string msg=loadSummary(rejected, newdomains, remdomains);
+  if(status)
+    *status=msg;
+
+  g_log<<Logger::Error<<logprefix<<msg<<endl;
+}
+
+string Bind2Backend::loadSummary(unsigned int rejected, unsigned int newdomains, unsigned int remdomains)
+{
+  ostringstream msg;
+  msg<<" Done parsing domains, "<<rejected+s_zones_rejected<<" rejected, "<<newdomains<<" new, "<<remdomains<<" removed"; 
+  return msg.str();
 }
 
 void Bind2Backend::queueReloadAndStore(unsigned int id)
@@ -1156,6 +1317,17 @@ bool Bind2Backend::get(DNSResourceRecord &r)
   return true;
 }
 
+bool Bind2Backend::get(DNSZoneRecord &zr)
+{
+  // only precompiled records of a lookup are handed out directly, anything else is parsed from its content
+  if(!d_handle.d_records || d_handle.d_list || !d_handle.getPrecompiled(zr))
+    return DNSBackend::get(zr);
+
+  if(d_handle.mustlog)
+    g_log<<Logger::Warning<<"Returning: '"<<QType(zr.dr.d_type).getName()<<"' of '"<<zr.dr.d_name<<"', content: '"<<zr.dr.d_content->getZoneRepresentation()<<"'"<<endl;
+  return true;
+}
+
 bool Bind2Backend::handle::get(DNSResourceRecord &r)
 {
   if(d_list)
@@ -1206,6 +1378,31 @@ bool Bind2Backend::handle::get_normal(DNSResourceRecord &r)
   return true;
 }
 
+bool Bind2Backend::handle::getPrecompiled(DNSZoneRecord &zr)
+{
+  while(d_iter!=d_end_iter && !(qtype.getCode()==QType::ANY || (d_iter)->qtype==qtype.getCode())) {
+    d_iter++;
+  }
+  if(d_iter==d_end_iter || !d_iter->drc) {
+    return false;
+  }
+
+  zr.dr.d_name=qname.empty() ? domain : (qname+domain);
+  zr.dr.d_type=d_iter->qtype;
+  zr.dr.d_class=QClass::IN;
+  zr.dr.d_ttl=d_iter->ttl;
+  zr.dr.d_place=DNSResourceRecord::ANSWER;
+  zr.dr.d_clen=0;
+  zr.dr.d_content=d_iter->drc;
+  zr.domain_id=id;
+  zr.scopeMask=0;
+  zr.auth=d_iter->auth;
+
+  d_iter++;
+
+  return true;
+}
+
 bool Bind2Backend::list(const DNSName& target, int id, bool include_disabled)
 {
   BB2DomainInfo bbd;
@@ -1386,6 +1583,8 @@ class Bind2Factory : public BackendFactory
          declare(suffix,"dnssec-db","Filename to store & access our DNSSEC metadatabase, empty for none", "");         
          declare(suffix,"dnssec-db-journal-mode","SQLite3 journal mode", "WAL");
          declare(suffix,"hybrid","Store DNSSEC metadata in other backend","no");
+         declare(suffix,"precompile-records","Parse the content of records when loading zones instead of when answering","no");
+         declare(suffix,"parse-threads","Number of threads used to parse the zone files, zones are parsed in the background at startup when larger than 1","1");
       }
 
       DNSBackend *make(const string &suffix="")
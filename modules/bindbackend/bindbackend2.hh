@@ -30,6 +30,7 @@
 #include <time.h>
 #include <fstream>
 #include <mutex>
+#include <atomic>
 #include <boost/utility.hpp>
 
 #include <boost/tuple/tuple.hpp>
@@ -61,6 +62,7 @@ struct Bind2DNSRecord
   DNSName qname;
   string content;
   string nsec3hash;
+  shared_ptr<DNSRecordContent> drc; //!< content parsed at load time, only with bind-precompile-records
   uint32_t ttl;
   uint16_t qtype;
   mutable bool auth;
@@ -187,6 +189,7 @@ public:
   void lookup(const QType &, const DNSName &qdomain, int zoneId, DNSPacket *p=nullptr) override;
   bool list(const DNSName &target, int id, bool include_disabled=false) override;
   bool get(DNSResourceRecord &) override;
+  bool get(DNSZoneRecord &) override;
   void getAllDomains(vector<DomainInfo> *domains, bool include_disabled=false) override;
 
   static DNSBackend *maker();
@@ -249,6 +252,7 @@ private:
   {
   public:
     bool get(DNSResourceRecord &);
+    bool getPrecompiled(DNSZoneRecord &);
     void reset();
     
     handle();
@@ -291,6 +295,7 @@ private:
 
   string d_transaction_tmpname;
   string d_logprefix;
+  string d_suffix;
   set<string> alsoNotify; //!< this is used to store the also-notify list of interested peers.
   std::unique_ptr<ofstream> d_of;
   handle d_handle;
@@ -298,6 +303,7 @@ private:
   static int s_first;                                  //!< this is raised on construction to prevent multiple instances of us being generated
   int d_transaction_id;
   static bool s_ignore_broken_records;
+  static bool s_precompile_records;
   bool d_hybrid;
 
   BB2DomainInfo createDomainEntry(const DNSName& domain, const string &filename); //!< does not insert in s_state
@@ -311,7 +317,22 @@ private:
   static string DLAddDomainHandler(const vector<string>&parts, Utility::pid_t ppid);
   static void fixupOrderAndAuth(BB2DomainInfo& bbd, bool nsec3zone, NSEC3PARAMRecordContent ns3pr);
   void doEmptyNonTerminals(BB2DomainInfo& bbd, bool nsec3zone, NSEC3PARAMRecordContent ns3pr);
-  void loadConfig(string *status=0);
+  struct ZoneLoadJob
+  {
+    BB2DomainInfo bbd;
+    bool isNew;
+    bool isSlave;
+    bool done;
+  };
+  static std::atomic<bool> s_loading;
+  static AtomicCounter s_zones_to_load;
+  static AtomicCounter s_zones_parsed;
+  static AtomicCounter s_zones_rejected;
+  static string DLLoadStatusHandler(const vector<string>&parts, Utility::pid_t ppid);
+  static string loadSummary(unsigned int rejected, unsigned int newdomains, unsigned int remdomains);
+  static void loadZonesInThreads(const string& suffix, std::shared_ptr<vector<ZoneLoadJob>> jobs, unsigned int threads, unsigned int rejected, unsigned int newdomains, unsigned int remdomains, string* status);
+  bool loadZone(BB2DomainInfo& bbd, bool isNew, bool isSlave, string& msg);
+  void loadConfig(string *status=0, bool background=false);
   static void nukeZoneRecords(BB2DomainInfo *bbd);
 
 };
@@ -74,6 +74,7 @@ public:
     declare(suffix, "id-query", "Basic with ID query", record_query+" disabled=0 and type=? and name=? and domain_id=?");
     declare(suffix, "any-query", "Any query", record_query+" disabled=0 and name=?");
     declare(suffix, "any-id-query", "Any with ID query", record_query+" disabled=0 and name=? and domain_id=?");
+    declare(suffix, "any-names-id-query", "Any with ID query for 8 names at once", record_query+" disabled=0 and name in (?,?,?,?,?,?,?,?) and domain_id=?");
 
     declare(suffix, "list-query", "AXFR query", record_query+" (disabled=0 OR disabled=?) and domain_id=? order by name, type");
     declare(suffix, "list-subzone-query", "Subzone listing", record_query+" disabled=0 and (name=? OR name like ?) and domain_id=?");
@@ -87,6 +87,7 @@ public:
     declare(suffix, "id-query", "Basic with ID query", record_query+" disabled=0 and type=:qtype and name=:qname and domain_id=:domain_id");
     declare(suffix, "any-query", "Any query", record_query+" disabled=0 and name=:qname");
     declare(suffix, "any-id-query", "Any with ID query", record_query+" disabled=0 and name=:qname and domain_id=:domain_id");
+    declare(suffix, "any-names-id-query", "Any with ID query for 8 names at once", record_query+" disabled=0 and name in (:qname1,:qname2,:qname3,:qname4,:qname5,:qname6,:qname7,:qname8) and domain_id=:domain_id");
 
     declare(suffix, "list-query", "AXFR query", record_query+" (disabled=0 OR :include_disabled) and domain_id=:domain_id order by name, type");
     declare(suffix, "list-subzone-query", "Subzone listing", record_query+" disabled=0 and (name=:zone OR name like :wildzone) and domain_id=:domain_id");
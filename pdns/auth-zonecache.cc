@@ -0,0 +1,109 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "auth-zonecache.hh"
+#include "statbag.hh"
+extern StatBag S;
+
+AuthZoneCache::AuthZoneCache()
+{
+  S.declare("zone-cache-hit", "Number of zone lookups answered from the zone cache");
+  S.declare("zone-cache-miss", "Number of zone lookups not found in the zone cache");
+  S.declare("zone-cache-size", "Number of zones in the zone cache");
+
+  d_statnumhit = S.getPointer("zone-cache-hit");
+  d_statnummiss = S.getPointer("zone-cache-miss");
+  d_statnumentries = S.getPointer("zone-cache-size");
+}
+
+void AuthZoneCache::replace(const std::vector<Zone>& zones)
+{
+  std::shared_ptr<SuffixMatchTree<Zone>> tree;
+  std::set<DNSName> seen;
+  for (const auto& zone : zones) {
+    /* the zones are listed in backend order, and the first backend
+       serving a zone wins, as it does without the cache */
+    if (!seen.insert(zone.name).second) {
+      continue;
+    }
+    if (!tree) {
+      tree = std::make_shared<SuffixMatchTree<Zone>>();
+    }
+    tree->add(zone.name, zone);
+  }
+
+  std::lock_guard<std::mutex> lock(d_lock);
+  d_tree = std::move(tree);
+  d_lastRefresh = time(nullptr);
+  *d_statnumentries = seen.size();
+}
+
+void AuthZoneCache::invalidate()
+{
+  std::lock_guard<std::mutex> lock(d_lock);
+  d_tree.reset();
+  d_lastRefresh = 0;
+  *d_statnumentries = 0;
+}
+
+bool AuthZoneCache::needsRefresh(time_t now)
+{
+  if (!isEnabled()) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(d_lock);
+  return now >= d_lastRefresh + d_refreshInterval;
+}
+
+std::shared_ptr<const SuffixMatchTree<AuthZoneCache::Zone>> AuthZoneCache::getTree()
+{
+  std::lock_guard<std::mutex> lock(d_lock);
+  return d_tree;
+}
+
+bool AuthZoneCache::getBestZone(const DNSName& qname, Zone& zone)
+{
+  if (!isEnabled()) {
+    return false;
+  }
+
+  /* the tree is never modified once published, we only hold a reference
+     so that a concurrent refresh does not free it under our feet */
+  auto tree = getTree();
+  if (!tree) {
+    return false;
+  }
+
+  const Zone* found = tree->lookup(qname);
+  if (found == nullptr) {
+    (*d_statnummiss)++;
+    return false;
+  }
+
+  (*d_statnumhit)++;
+  zone = *found;
+  return true;
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include "dnsname.hh"
+#include "misc.hh"
+
+/* In-memory map of every zone apex known to the backends, periodically rebuilt
+   from getAllDomains(), so that UeberBackend::getAuth() can find the best
+   zone for a name with a single suffix tree walk instead of asking every
+   backend for an SOA at every label. */
+class AuthZoneCache : public boost::noncopyable
+{
+public:
+  struct Zone
+  {
+    DNSName name;
+    size_t backend{0}; //!< index of the backend serving this zone in UeberBackend::backends
+    int id{-1};
+  };
+
+  AuthZoneCache();
+
+  //! zones should be listed in backend order, an empty list disables the cache until the next refresh
+  void replace(const std::vector<Zone>& zones);
+  void invalidate(); //!< stop answering from the cache until the next refresh
+
+  //! Find the most specific zone containing qname
+  bool getBestZone(const DNSName& qname, Zone& zone);
+
+  bool isEnabled() const
+  {
+    return d_refreshInterval > 0;
+  }
+
+  void setRefreshInterval(time_t interval)
+  {
+    d_refreshInterval = interval;
+  }
+
+  bool needsRefresh(time_t now);
+
+  uint64_t size()
+  {
+    return *d_statnumentries;
+  }
+
+private:
+  std::shared_ptr<const SuffixMatchTree<Zone>> getTree();
+
+  std::mutex d_lock;
+  std::shared_ptr<const SuffixMatchTree<Zone>> d_tree;
+  time_t d_lastRefresh{0};
+  time_t d_refreshInterval{0};
+
+  AtomicCounter *d_statnumhit;
+  AtomicCounter *d_statnummiss;
+  AtomicCounter *d_statnumentries;
+};
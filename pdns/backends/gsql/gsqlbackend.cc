@@ -57,6 +57,7 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
   d_IdQuery=getArg("id-query");
   d_ANYNoIdQuery=getArg("any-query");
   d_ANYIdQuery=getArg("any-id-query");
+  d_ANYNamesIdQuery=getArg("any-names-id-query");
 
   d_listQuery=getArg("list-query");
   d_listSubZoneQuery=getArg("list-subzone-query");
@@ -126,6 +127,7 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
   d_IdQuery_stmt = NULL;
   d_ANYNoIdQuery_stmt = NULL;
   d_ANYIdQuery_stmt = NULL;
+  d_ANYNamesIdQuery_stmt = NULL;
   d_listQuery_stmt = NULL;
   d_listSubZoneQuery_stmt = NULL;
   d_InfoOfDomainsZoneQuery_stmt = NULL;
@@ -1084,6 +1086,43 @@ void GSQLBackend::lookup(const QType &qtype,const DNSName &qname, int domain_id,
   d_qname=qname;
 }
 
+const size_t GSQLBackend::s_anyNamesIdQueryNames;
+
+void GSQLBackend::lookupNames(const vector<DNSName>& names, int domain_id, vector<DNSZoneRecord>& records, DNSPacket *pkt_p)
+{
+  if(domain_id < 0) {
+    DNSBackend::lookupNames(names, domain_id, records, pkt_p);
+    return;
+  }
+
+  DNSZoneRecord dzr;
+  for(size_t offset = 0; offset < names.size(); offset += s_anyNamesIdQueryNames) {
+    try {
+      reconnectIfNeeded();
+
+      d_query_name = "any-names-id-query";
+      d_query_stmt = &d_ANYNamesIdQuery_stmt;
+      // the query has a fixed number of names, pad with the last one
+      for(size_t idx = 0; idx < s_anyNamesIdQueryNames; idx++) {
+        (*d_query_stmt)->
+          bind("qname" + std::to_string(idx + 1), names.at(std::min(offset + idx, names.size() - 1)));
+      }
+      (*d_query_stmt)->
+        bind("domain_id", domain_id)->
+        execute();
+    }
+    catch(SSqlException &e) {
+      throw PDNSException("GSQLBackend unable to lookup '" + names.at(offset).toLogString() + "' and other names: "+e.txtReason());
+    }
+
+    // records carry the name found in the database
+    d_qname.clear();
+    while(DNSBackend::get(dzr)) {
+      records.push_back(dzr);
+    }
+  }
+}
+
 bool GSQLBackend::list(const DNSName &target, int domain_id, bool include_disabled)
 {
   DLOG(g_log<<"GSQLBackend constructing handle for list of domain id '"<<domain_id<<"'"<<endl);
@@ -61,6 +61,7 @@ public:
       d_IdQuery_stmt = d_db->prepare(d_IdQuery, 3);
       d_ANYNoIdQuery_stmt = d_db->prepare(d_ANYNoIdQuery, 1);
       d_ANYIdQuery_stmt = d_db->prepare(d_ANYIdQuery, 2);
+      d_ANYNamesIdQuery_stmt = d_db->prepare(d_ANYNamesIdQuery, s_anyNamesIdQueryNames + 1);
       d_listQuery_stmt = d_db->prepare(d_listQuery, 2);
       d_listSubZoneQuery_stmt = d_db->prepare(d_listSubZoneQuery, 3);
       d_MasterOfDomainsZoneQuery_stmt = d_db->prepare(d_MasterOfDomainsZoneQuery, 1);
@@ -122,6 +123,7 @@ public:
     d_IdQuery_stmt.reset();
     d_ANYNoIdQuery_stmt.reset();
     d_ANYIdQuery_stmt.reset();
+    d_ANYNamesIdQuery_stmt.reset();
     d_listQuery_stmt.reset();
     d_listSubZoneQuery_stmt.reset();
     d_MasterOfDomainsZoneQuery_stmt.reset();
@@ -178,6 +180,7 @@ public:
   }
 
   void lookup(const QType &, const DNSName &qdomain, int zoneId, DNSPacket *p=nullptr) override;
+  void lookupNames(const vector<DNSName>& names, int zoneId, vector<DNSZoneRecord>& records, DNSPacket *p=nullptr) override;
   bool list(const DNSName &target, int domain_id, bool include_disabled=false) override;
   bool get(DNSResourceRecord &r) override;
   void getAllDomains(vector<DomainInfo> *domains, bool include_disabled=false) override;
@@ -260,6 +263,8 @@ protected:
   }
 
 private:
+  static const size_t s_anyNamesIdQueryNames = 8; //!< number of names in any-names-id-query
+
   string d_query_name;
   DNSName d_qname;
   SSqlStatement::result_t d_result;
@@ -268,6 +273,7 @@ private:
   string d_IdQuery;
   string d_ANYNoIdQuery;
   string d_ANYIdQuery;
+  string d_ANYNamesIdQuery;
 
   string d_listQuery;
   string d_listSubZoneQuery;
@@ -342,6 +348,7 @@ private:
   unique_ptr<SSqlStatement> d_IdQuery_stmt;
   unique_ptr<SSqlStatement> d_ANYNoIdQuery_stmt;
   unique_ptr<SSqlStatement> d_ANYIdQuery_stmt;
+  unique_ptr<SSqlStatement> d_ANYNamesIdQuery_stmt;
   unique_ptr<SSqlStatement> d_listQuery_stmt;
   unique_ptr<SSqlStatement> d_listSubZoneQuery_stmt;
   unique_ptr<SSqlStatement> d_MasterOfDomainsZoneQuery_stmt;
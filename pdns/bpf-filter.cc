@@ -25,6 +25,11 @@
 
 #include <sys/syscall.h>
 #include <linux/bpf.h>
+#ifdef HAVE_XDP_FILTER
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif /* HAVE_XDP_FILTER */
 
 #include "ext/libbpf/libbpf.h"
 
@@ -36,7 +41,7 @@ static __u64 ptr_to_u64(void *ptr)
 }
 
 int bpf_create_map(enum bpf_map_type map_type, int key_size, int value_size,
-		   int max_entries)
+		   int max_entries, int map_flags)
 {
   union bpf_attr attr;
   memset(&attr, 0, sizeof(attr));
@@ -44,6 +49,7 @@ int bpf_create_map(enum bpf_map_type map_type, int key_size, int value_size,
   attr.key_size = key_size;
   attr.value_size = value_size;
   attr.max_entries = max_entries;
+  attr.map_flags = map_flags;
   return syscall(SYS_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
 }
 
@@ -422,4 +428,365 @@ std::vector<std::tuple<DNSName, uint16_t, uint64_t> > BPFFilter::getQNameStats()
   }
   return result;
 }
+
+#ifdef HAVE_XDP_FILTER
+
+struct XDPTrieKeyV4
+{
+  uint32_t prefixlen;
+  uint8_t addr[4];
+};
+
+struct XDPTrieKeyV6
+{
+  uint32_t prefixlen;
+  uint8_t addr[16];
+};
+
+struct XDPPrefixValue
+{
+  uint64_t counter;
+  /* 0 means blocked, otherwise the number of nanoseconds between two queries */
+  uint64_t interval;
+  /* how far ahead of the current time the theoretical arrival time can be, in nanoseconds */
+  uint64_t tolerance;
+};
+
+/* attach (progFD) or detach (-1) an XDP program via a RTM_SETLINK netlink message */
+static void setLinkXDPFD(int ifIndex, int progFD, uint32_t flags)
+{
+  struct {
+    struct nlmsghdr nh;
+    struct ifinfomsg ifinfo;
+    char attrbuf[64];
+  } req;
+  memset(&req, 0, sizeof(req));
+  req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+  req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+  req.nh.nlmsg_type = RTM_SETLINK;
+  req.ifinfo.ifi_family = AF_UNSPEC;
+  req.ifinfo.ifi_index = ifIndex;
+
+  struct nlattr* xdp = reinterpret_cast<struct nlattr*>(reinterpret_cast<char*>(&req) + NLMSG_ALIGN(req.nh.nlmsg_len));
+  xdp->nla_type = NLA_F_NESTED | IFLA_XDP;
+  xdp->nla_len = NLA_HDRLEN;
+
+  struct nlattr* fd = reinterpret_cast<struct nlattr*>(reinterpret_cast<char*>(xdp) + xdp->nla_len);
+  fd->nla_type = IFLA_XDP_FD;
+  fd->nla_len = NLA_HDRLEN + sizeof(progFD);
+  memcpy(reinterpret_cast<char*>(fd) + NLA_HDRLEN, &progFD, sizeof(progFD));
+  xdp->nla_len += NLA_ALIGN(fd->nla_len);
+
+  if (flags != 0) {
+    struct nlattr* fl = reinterpret_cast<struct nlattr*>(reinterpret_cast<char*>(xdp) + xdp->nla_len);
+    fl->nla_type = IFLA_XDP_FLAGS;
+    fl->nla_len = NLA_HDRLEN + sizeof(flags);
+    memcpy(reinterpret_cast<char*>(fl) + NLA_HDRLEN, &flags, sizeof(flags));
+    xdp->nla_len += NLA_ALIGN(fl->nla_len);
+  }
+  req.nh.nlmsg_len += NLA_ALIGN(xdp->nla_len);
+
+  BPFFilter::FDWrapper sock;
+  sock.fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (sock.fd == -1) {
+    throw std::runtime_error("Error creating a netlink socket: " + stringerror());
+  }
+
+  struct sockaddr_nl sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.nl_family = AF_NETLINK;
+  if (bind(sock.fd, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)) != 0) {
+    throw std::runtime_error("Error binding a netlink socket: " + stringerror());
+  }
+
+  if (send(sock.fd, &req, req.nh.nlmsg_len, 0) < 0) {
+    throw std::runtime_error("Error sending a netlink message: " + stringerror());
+  }
+
+  char buffer[4096];
+  ssize_t got = recv(sock.fd, buffer, sizeof(buffer), 0);
+  if (got < 0) {
+    throw std::runtime_error("Error receiving the netlink answer: " + stringerror());
+  }
+
+  for (struct nlmsghdr* nh = reinterpret_cast<struct nlmsghdr*>(buffer); NLMSG_OK(nh, static_cast<size_t>(got)); nh = NLMSG_NEXT(nh, got)) {
+    if (nh->nlmsg_type == NLMSG_ERROR) {
+      const struct nlmsgerr* err = reinterpret_cast<const struct nlmsgerr*>(NLMSG_DATA(nh));
+      if (err->error != 0) {
+        throw std::runtime_error(std::string(progFD == -1 ? "Error detaching" : "Error attaching") + " the XDP program: " + stringerror(-err->error));
+      }
+      return;
+    }
+  }
+}
+
+XDPFilter::XDPFilter(const std::string& interface, const std::set<uint16_t>& ports, uint32_t maxV4Prefixes, uint32_t maxV6Prefixes, uint32_t maxSources, Mode mode): d_interface(interface), d_maxV4(maxV4Prefixes), d_maxV6(maxV6Prefixes)
+{
+  d_ifIndex = if_nametoindex(interface.c_str());
+  if (d_ifIndex == 0) {
+    throw std::runtime_error("Unable to find the index of interface '" + interface + "': " + stringerror());
+  }
+
+  if (ports.empty()) {
+    throw std::runtime_error("At least one port is required to create an XDP filter");
+  }
+
+  d_portsmap.fd = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(uint16_t), sizeof(uint8_t), 64);
+  if (d_portsmap.fd == -1) {
+    throw std::runtime_error("Error creating a BPF ports map: " + stringerror());
+  }
+
+  /* the kernel requires LPM tries not to be preallocated */
+  d_v4map.fd = bpf_create_map(BPF_MAP_TYPE_LPM_TRIE, sizeof(struct XDPTrieKeyV4), sizeof(struct XDPPrefixValue), (int) maxV4Prefixes, BPF_F_NO_PREALLOC);
+  if (d_v4map.fd == -1) {
+    throw std::runtime_error("Error creating a BPF v4 prefixes map of size " + std::to_string(maxV4Prefixes) + ": " + stringerror());
+  }
+
+  d_v6map.fd = bpf_create_map(BPF_MAP_TYPE_LPM_TRIE, sizeof(struct XDPTrieKeyV6), sizeof(struct XDPPrefixValue), (int) maxV6Prefixes, BPF_F_NO_PREALLOC);
+  if (d_v6map.fd == -1) {
+    throw std::runtime_error("Error creating a BPF v6 prefixes map of size " + std::to_string(maxV6Prefixes) + ": " + stringerror());
+  }
+
+  /* the state of the token buckets, keyed by source address. When the map is full the
+     least recently used source is evicted, which at worst gives it a fresh bucket */
+  d_sourcesmap.fd = bpf_create_map(BPF_MAP_TYPE_LRU_HASH, 16, sizeof(uint64_t), (int) maxSources);
+  if (d_sourcesmap.fd == -1) {
+    throw std::runtime_error("Error creating a BPF sources map of size " + std::to_string(maxSources) + ": " + stringerror());
+  }
+
+  if (ports.size() > 64) {
+    throw std::runtime_error("Too many ports for an XDP filter (" + std::to_string(ports.size()) + "), the maximum is 64");
+  }
+  for (const auto port : ports) {
+    uint16_t key = htons(port);
+    uint8_t value = 1;
+    if (bpf_update_elem(d_portsmap.fd, &key, &value, BPF_ANY) != 0) {
+      throw std::runtime_error("Error adding port " + std::to_string(port) + " to the XDP filter: " + stringerror());
+    }
+  }
+
+  struct bpf_insn xdp_filter[] = {
+#include "bpf-filter.xdp.ebpf"
+  };
+
+  d_prog.fd = bpf_prog_load(BPF_PROG_TYPE_XDP,
+                            xdp_filter,
+                            sizeof(xdp_filter),
+                            "GPL",
+                            0);
+  if (d_prog.fd == -1) {
+    throw std::runtime_error("Error loading the XDP filter: " + stringerror());
+  }
+
+  if (mode == Mode::Native) {
+    d_xdpFlags = XDP_FLAGS_DRV_MODE;
+  }
+  else if (mode == Mode::Generic) {
+    d_xdpFlags = XDP_FLAGS_SKB_MODE;
+  }
+
+  /* an XDP program stays attached after we exit, so replace any program
+     left over by a previous instance */
+  setLinkXDPFD(d_ifIndex, d_prog.fd, d_xdpFlags);
+}
+
+XDPFilter::~XDPFilter()
+{
+  try {
+    setLinkXDPFD(d_ifIndex, -1, d_xdpFlags);
+  }
+  catch (const std::exception& e) {
+  }
+}
+
+bool XDPFilter::block(const Netmask& nm, const boost::optional<struct timespec>& until)
+{
+  return insert(nm, 0, 0, until);
+}
+
+bool XDPFilter::rateLimit(const Netmask& nm, uint32_t qps, uint32_t burst, const boost::optional<struct timespec>& until)
+{
+  if (qps == 0) {
+    throw std::runtime_error("Invalid rate of 0 queries per second for " + nm.toString());
+  }
+  return insert(nm, qps, burst, until);
+}
+
+bool XDPFilter::shouldReplace(Entry& existing, uint32_t qps, uint32_t burst, const boost::optional<struct timespec>& until)
+{
+  if (!until) {
+    /* a static entry always replaces the existing one */
+    return true;
+  }
+
+  if (!existing.d_until) {
+    /* do not override a static entry with a dynamic one */
+    return false;
+  }
+
+  if (existing.d_qps == qps && existing.d_burst == burst) {
+    /* only extend the duration */
+    if (*existing.d_until < *until) {
+      existing.d_until = until;
+    }
+    return false;
+  }
+
+  if (existing.d_qps == 0) {
+    /* a rate-limit does not replace, nor extend, a block */
+    return false;
+  }
+
+  return true;
+}
+
+bool XDPFilter::insert(const Netmask& nm, uint32_t qps, uint32_t burst, const boost::optional<struct timespec>& until)
+{
+  const Netmask masked(nm.getMaskedNetwork(), nm.getBits());
+  struct XDPPrefixValue value;
+  memset(&value, 0, sizeof(value));
+  if (qps > 0) {
+    value.interval = 1000000000ULL / qps;
+    value.tolerance = value.interval * (burst > 1 ? burst - 1 : 0);
+  }
+
+  std::lock_guard<std::mutex> lock(d_mutex);
+
+  auto existing = d_entries.find(masked);
+  if (existing != d_entries.end()) {
+    if (!shouldReplace(existing->second, qps, burst, until)) {
+      return false;
+    }
+    /* keep the number of dropped packets */
+    value.counter = getCounter(masked);
+  }
+  else if ((masked.isIpv4() && d_v4Count >= d_maxV4) || (masked.isIpv6() && d_v6Count >= d_maxV6)) {
+    throw std::runtime_error("Table full when trying to block " + masked.toString());
+  }
+
+  int res = -1;
+  if (masked.isIpv4()) {
+    struct XDPTrieKeyV4 key;
+    key.prefixlen = masked.getBits();
+    memcpy(key.addr, &masked.getNetwork().sin4.sin_addr.s_addr, sizeof(key.addr));
+    res = bpf_update_elem(d_v4map.fd, &key, &value, BPF_ANY);
+  }
+  else if (masked.isIpv6()) {
+    struct XDPTrieKeyV6 key;
+    key.prefixlen = masked.getBits();
+    memcpy(key.addr, masked.getNetwork().sin6.sin6_addr.s6_addr, sizeof(key.addr));
+    res = bpf_update_elem(d_v6map.fd, &key, &value, BPF_ANY);
+  }
+
+  if (res != 0) {
+    throw std::runtime_error("Error adding blocked prefix " + masked.toString() + ": " + stringerror());
+  }
+
+  if (existing == d_entries.end()) {
+    if (masked.isIpv4()) {
+      d_v4Count++;
+    }
+    else {
+      d_v6Count++;
+    }
+  }
+
+  Entry& entry = d_entries[masked];
+  entry.d_netmask = masked;
+  entry.d_until = until;
+  entry.d_qps = qps;
+  entry.d_burst = burst;
+  return true;
+}
+
+void XDPFilter::removeFromMap(const Netmask& nm)
+{
+  int res = -1;
+  if (nm.isIpv4()) {
+    struct XDPTrieKeyV4 key;
+    key.prefixlen = nm.getBits();
+    memcpy(key.addr, &nm.getNetwork().sin4.sin_addr.s_addr, sizeof(key.addr));
+    res = bpf_delete_elem(d_v4map.fd, &key);
+    if (res == 0) {
+      d_v4Count--;
+    }
+  }
+  else if (nm.isIpv6()) {
+    struct XDPTrieKeyV6 key;
+    key.prefixlen = nm.getBits();
+    memcpy(key.addr, nm.getNetwork().sin6.sin6_addr.s6_addr, sizeof(key.addr));
+    res = bpf_delete_elem(d_v6map.fd, &key);
+    if (res == 0) {
+      d_v6Count--;
+    }
+  }
+
+  if (res != 0) {
+    throw std::runtime_error("Error removing blocked prefix " + nm.toString() + ": " + stringerror());
+  }
+}
+
+uint64_t XDPFilter::getCounter(const Netmask& nm)
+{
+  struct XDPPrefixValue value;
+  memset(&value, 0, sizeof(value));
+  if (nm.isIpv4()) {
+    struct XDPTrieKeyV4 key;
+    key.prefixlen = nm.getBits();
+    memcpy(key.addr, &nm.getNetwork().sin4.sin_addr.s_addr, sizeof(key.addr));
+    bpf_lookup_elem(d_v4map.fd, &key, &value);
+  }
+  else if (nm.isIpv6()) {
+    struct XDPTrieKeyV6 key;
+    key.prefixlen = nm.getBits();
+    memcpy(key.addr, nm.getNetwork().sin6.sin6_addr.s6_addr, sizeof(key.addr));
+    bpf_lookup_elem(d_v6map.fd, &key, &value);
+  }
+  return value.counter;
+}
+
+void XDPFilter::unblock(const Netmask& nm)
+{
+  const Netmask masked(nm.getMaskedNetwork(), nm.getBits());
+  std::lock_guard<std::mutex> lock(d_mutex);
+  auto it = d_entries.find(masked);
+  if (it == d_entries.end()) {
+    throw std::runtime_error("Trying to unblock a prefix that is not blocked: " + masked.toString());
+  }
+  removeFromMap(masked);
+  d_entries.erase(it);
+}
+
+void XDPFilter::purgeExpired(const struct timespec& now)
+{
+  std::lock_guard<std::mutex> lock(d_mutex);
+  for (auto it = d_entries.begin(); it != d_entries.end(); ) {
+    if (it->second.d_until && *(it->second.d_until) < now) {
+      try {
+        removeFromMap(it->first);
+      }
+      catch (const std::exception& e) {
+      }
+      it = d_entries.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+std::vector<XDPFilter::Entry> XDPFilter::getEntries()
+{
+  std::vector<Entry> result;
+  std::lock_guard<std::mutex> lock(d_mutex);
+  result.reserve(d_entries.size());
+  for (const auto& entry : d_entries) {
+    result.push_back(entry.second);
+    result.back().d_counter = getCounter(entry.first);
+  }
+  return result;
+}
+
+#endif /* HAVE_XDP_FILTER */
+
 #endif /* HAVE_EBPF */
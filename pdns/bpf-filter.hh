@@ -22,12 +22,22 @@
 #pragma once
 #include "config.h"
 
+#include <map>
 #include <mutex>
+#include <set>
+
+#include <boost/optional.hpp>
 
 #include "iputils.hh"
 
 #ifdef HAVE_EBPF
 
+#include <linux/if_link.h>
+
+#ifdef XDP_FLAGS_DRV_MODE
+#define HAVE_XDP_FILTER 1
+#endif
+
 class BPFFilter
 {
 public:
@@ -40,7 +50,7 @@ public:
   void unblock(const DNSName& qname, uint16_t qtype=255);
   std::vector<std::pair<ComboAddress, uint64_t> > getAddrStats();
   std::vector<std::tuple<DNSName, uint16_t, uint64_t> > getQNameStats();
-private:
+
   struct FDWrapper
   {
     ~FDWrapper()
@@ -51,6 +61,7 @@ private:
     }
     int fd{-1};
   };
+private:
   std::mutex d_mutex;
   uint32_t d_maxV4;
   uint32_t d_maxV6;
@@ -66,4 +77,73 @@ private:
   FDWrapper d_qnamefilter;
 };
 
+#ifdef HAVE_XDP_FILTER
+/* An XDP program attached to a network interface, dropping the UDP and TCP
+   packets sent to one of our ports from a blocked prefix before the kernel
+   allocates a socket buffer for them. Prefixes can also be rate-limited instead
+   of blocked, in which case every source address in that prefix gets its own
+   token bucket (qps, burst), enforced on UDP packets only. */
+class XDPFilter
+{
+public:
+  enum class Mode : uint8_t { Auto, Native, Generic };
+
+  struct Entry
+  {
+    Netmask d_netmask;
+    boost::optional<struct timespec> d_until{boost::none};
+    /* number of packets dropped */
+    uint64_t d_counter{0};
+    /* 0 means blocked */
+    uint32_t d_qps{0};
+    uint32_t d_burst{0};
+  };
+
+  XDPFilter(const std::string& interface, const std::set<uint16_t>& ports, uint32_t maxV4Prefixes, uint32_t maxV6Prefixes, uint32_t maxSources, Mode mode);
+  ~XDPFilter();
+
+  /* entries without an expiration time (none) are never removed by purgeExpired(),
+     and are not overridden by the ones having one. Return false if the existing
+     entry for that prefix was kept, see shouldReplace() */
+  bool block(const Netmask& nm, const boost::optional<struct timespec>& until=boost::none);
+  bool rateLimit(const Netmask& nm, uint32_t qps, uint32_t burst, const boost::optional<struct timespec>& until=boost::none);
+  void unblock(const Netmask& nm);
+  void purgeExpired(const struct timespec& now);
+  std::vector<Entry> getEntries();
+
+  const std::string& getInterface() const
+  {
+    return d_interface;
+  }
+
+  /* whether an existing entry should be replaced by a new one with these parameters,
+     qps being 0 for a block. The stricter entry wins: a block replaces a rate-limit,
+     along with its expiration time, while a rate-limit with an expiration time never
+     replaces a block, which keeps its own. A rate-limit with different parameters
+     replaces the existing one. If the parameters are the same, the existing entry is
+     kept and gets the later of the two expiration times */
+  static bool shouldReplace(Entry& existing, uint32_t qps, uint32_t burst, const boost::optional<struct timespec>& until);
+
+private:
+  bool insert(const Netmask& nm, uint32_t qps, uint32_t burst, const boost::optional<struct timespec>& until);
+  void removeFromMap(const Netmask& nm);
+  uint64_t getCounter(const Netmask& nm);
+
+  std::map<Netmask, Entry> d_entries;
+  std::mutex d_mutex;
+  const std::string d_interface;
+  uint32_t d_maxV4;
+  uint32_t d_maxV6;
+  uint32_t d_v4Count{0};
+  uint32_t d_v6Count{0};
+  uint32_t d_xdpFlags{0};
+  int d_ifIndex{0};
+  BPFFilter::FDWrapper d_portsmap;
+  BPFFilter::FDWrapper d_v4map;
+  BPFFilter::FDWrapper d_v6map;
+  BPFFilter::FDWrapper d_sourcesmap;
+  BPFFilter::FDWrapper d_prog;
+};
+#endif /* HAVE_XDP_FILTER */
+
 #endif /* HAVE_EBPF */
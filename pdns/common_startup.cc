@@ -50,6 +50,7 @@ ArgvMap theArg;
 StatBag S;  //!< Statistics are gathered across PDNS via the StatBag class S
 AuthPacketCache PC; //!< This is the main PacketCache, shared across all threads
 AuthQueryCache QC;
+AuthZoneCache g_zoneCache;
 std::unique_ptr<DNSProxy> DP{nullptr};
 std::unique_ptr<DynListener> dl{nullptr};
 CommunicatorClass Communicator;
@@ -93,7 +94,7 @@ void declareArguments()
   ::arg().set("query-local-address","Source IP address for sending queries")="0.0.0.0";
   ::arg().set("query-local-address6","Source IPv6 address for sending queries")="::";
   ::arg().set("overload-queue-length","Maximum queuelength moving to packetcache only")="0";
-  ::arg().set("max-queue-length","Maximum queuelength before considering situation lost")="5000";
+  ::arg().set("max-queue-length","Maximum queuelength before answering with SERVFAIL")="5000";
 
   ::arg().set("retrieval-threads", "Number of AXFR-retrieval threads for slave operation")="2";
   ::arg().setSwitch("api", "Enable/disable the REST API (including HTTP listener)")="no";
@@ -117,6 +118,7 @@ void declareArguments()
   ::arg().set("distributor-threads","Default number of Distributor (backend) threads to start")="3";
   ::arg().set("signing-threads","Default number of signer threads to start")="3";
   ::arg().set("receiver-threads","Default number of receiver threads to start")="1";
+  ::arg().set("udp-batch-size","Maximum number of UDP queries read, and of packet cache answers sent, with a single system call")="32";
   ::arg().set("queue-limit","Maximum number of milliseconds to queue a query")="1500"; 
   ::arg().set("resolver","Use this resolver for ALIAS and the internal stub resolver")="no";
   ::arg().set("udp-truncation-threshold", "Maximum UDP response size before we truncate")="1232";
@@ -165,6 +167,7 @@ void declareArguments()
   ::arg().set("carbon-interval", "Number of seconds between carbon (graphite) updates")="30";
 
   ::arg().set("cache-ttl","Seconds to store packets in the PacketCache")="20";
+  ::arg().setSwitch("coalesce-lookups","Fetch the records of the query name and its ancestors with a single backend call")="no";
   ::arg().set("negquery-cache-ttl","Seconds to store negative query results in the QueryCache")="60";
   ::arg().set("query-cache-ttl","Seconds to store query results in the QueryCache")="20";
   ::arg().set("soa-minimum-ttl","Default SOA minimum ttl")="3600";
@@ -187,6 +190,8 @@ void declareArguments()
   ::arg().set("max-tcp-transactions-per-conn","Maximum number of subsequent queries per TCP connection")="0";
   ::arg().set("max-tcp-connection-duration","Maximum time in seconds that a TCP DNS connection is allowed to stay open.")="0";
   ::arg().set("tcp-idle-timeout","Maximum time in seconds that a TCP DNS connection is allowed to stay open while being idle")="5";
+  ::arg().set("tcp-worker-threads","Number of event loops handling the TCP connections")="2";
+  ::arg().set("tcp-transfer-threads","Number of threads sending AXFR and IXFR responses")="2";
 
   ::arg().setSwitch("no-shuffle","Set this to prevent random shuffling of answers - for regression testing")="off";
 
@@ -195,6 +200,7 @@ void declareArguments()
 
   ::arg().set("max-cache-entries", "Maximum number of entries in the query cache")="1000000";
   ::arg().set("max-packet-cache-entries", "Maximum number of entries in the packet cache")="1000000";
+  ::arg().set("max-nsec3-hash-cache-entries", "Maximum number of NSEC3 hashes kept in the NSEC3 hash cache, 0 to disable")="100000";
   ::arg().set("max-signature-cache-entries", "Maximum number of signatures cache entries")="";
   ::arg().set("max-ent-entries", "Maximum number of empty non-terminals in a zone")="100000";
   ::arg().set("entropy-source", "If set, read entropy from this file")="/dev/urandom";
@@ -224,6 +230,8 @@ void declareArguments()
 
   ::arg().set("lua-axfr-script", "Script to be used to edit incoming AXFRs")="";
   ::arg().set("xfr-max-received-mbytes", "Maximum number of megabytes received from an incoming XFR")="100";
+
+  ::arg().set("zone-cache-refresh-interval","Seconds between two refreshes of the in-memory list of zones, 0 to disable")="300";
   ::arg().set("axfr-fetch-timeout", "Maximum time in seconds for inbound AXFR to start or be idle after starting")="10";
 
   ::arg().set("tcp-fast-open", "Enable TCP Fast Open support on the listening sockets, using the supplied numerical value as the queue size")="0";
@@ -296,6 +304,7 @@ void declareStats(void)
   S.declare("udp6-answers","Number of IPv6 answers sent out over UDP");
   S.declare("udp6-queries","Number of IPv6 UDP queries received");
   S.declare("overload-drops","Queries dropped because backends overloaded");
+  S.declare("overload-servfails","Queries answered with SERVFAIL because the backend queue was full");
 
   S.declare("rd-queries", "Number of recursion desired questions");
   S.declare("recursion-unanswered", "Number of packets unanswered by configured recursor");
@@ -341,6 +350,11 @@ void declareStats(void)
   S.declare("user-msec", "Number of msec spent in user time", getSysUserTimeMsec);
   S.declare("meta-cache-size", "Number of entries in the metadata cache", DNSSECKeeper::dbdnssecCacheSizes);
   S.declare("key-cache-size", "Number of entries in the key cache", DNSSECKeeper::dbdnssecCacheSizes);
+  S.declare("nsec3-hash-cache-hit", "Number of NSEC3 hashes found in the NSEC3 hash cache");
+  S.declare("nsec3-hash-cache-miss", "Number of NSEC3 hashes not found in the NSEC3 hash cache");
+  S.declare("signature-cache-evictions", "Number of signatures evicted from the signature cache to make room for new ones");
+  S.declare("signature-cache-hit", "Number of signatures found in the signature cache");
+  S.declare("signature-cache-miss", "Number of signatures not found in the signature cache");
   S.declare("signature-cache-size", "Number of entries in the signature cache", signatureCacheSize);
 
   S.declare("servfail-packets","Number of times a server-failed packet was sent out");
@@ -376,6 +390,55 @@ static void sendout(std::unique_ptr<DNSPacket>& a)
   avg_latency=(int)(0.999*avg_latency+0.001*diff);
 }
 
+//! Rebuilds the zone cache from the zones listed by the backends whenever it is due for a refresh
+static void zoneCacheRefreshThread()
+{
+  setThreadName("pdns/zonecache");
+  UeberBackend B;
+  bool complete = true; // whether every backend listed its zones at the last refresh
+
+  for(;;) {
+    if(g_zoneCache.needsRefresh(time(nullptr))) {
+      try {
+        vector<AuthZoneCache::Zone> zones;
+        for(size_t idx = 0; idx < B.backends.size(); ++idx) {
+          vector<DomainInfo> domains;
+          B.backends[idx]->getAllDomains(&domains);
+          if(domains.empty()) {
+            // this backend is either empty or unable to list its zones, in which case
+            // a zone it serves below one of the cached zones would be shadowed by it
+            if(complete) {
+              g_log<<Logger::Warning<<"Backend '"<<B.backends[idx]->getPrefix()<<"' did not list any zone, not using the zone cache until it does"<<endl;
+            }
+            complete = false;
+            zones.clear();
+            break;
+          }
+          for(const auto& di : domains) {
+            AuthZoneCache::Zone zone;
+            zone.name = di.zone;
+            zone.backend = idx;
+            zone.id = di.id;
+            zones.push_back(zone);
+          }
+        }
+        if(!zones.empty()) {
+          complete = true;
+        }
+        g_zoneCache.replace(zones);
+        DLOG(g_log<<Logger::Debug<<"Refreshed the zone cache with "<<zones.size()<<" zones"<<endl);
+      }
+      catch(const PDNSException& e) {
+        g_log<<Logger::Error<<"Error while refreshing the zone cache: "<<e.reason<<endl;
+      }
+      catch(const std::exception& e) {
+        g_log<<Logger::Error<<"Error while refreshing the zone cache: "<<e.what()<<endl;
+      }
+    }
+    sleep(1);
+  }
+}
+
 //! The qthread receives questions over the internet via the Nameserver class, and hands them to the Distributor for further processing
 static void qthread(unsigned int num)
 try
@@ -398,8 +461,7 @@ try
   int diff;
   bool logDNSQueries = ::arg().mustDo("log-dns-queries");
   shared_ptr<UDPNameserver> NS;
-  std::string buffer;
-  buffer.resize(DNSPacket::s_udpTruncationThreshold);
+  UDPBatch batch(::arg().asNum("udp-batch-size"));
 
   // If we have SO_REUSEPORT then create a new port for all receiver threads
   // other than the first one.
@@ -413,73 +475,72 @@ try
   }
 
   for(;;) {
-    if(!NS->receive(question, buffer)) { // receive a packet         inline
-      continue;                    // packet was broken, try again
-    }
-
-    numreceived++;
-
-    if(question.d_remote.getSocklen()==sizeof(sockaddr_in))
-      numreceived4++;
-    else
-      numreceived6++;
-
-    if(question.d_dnssecOk)
-      numreceiveddo++;
+    size_t received = NS->receive(batch); // receive as many packets as are waiting, up to the batch size
+    for(size_t idx = 0; idx < received; idx++) {
+      if(!NS->parse(batch, idx, question)) {
+        continue;                    // packet was broken, try the next one
+      }
 
-     if(question.d.qr)
-       continue;
+      numreceived++;
 
-    S.ringAccount("queries", question.qdomain, question.qtype);
-    S.ringAccount("remotes", question.d_remote);
-    if(logDNSQueries) {
-      string remote;
-      if(question.hasEDNSSubnet()) 
-        remote = question.getRemote().toString() + "<-" + question.getRealRemote().toString();
+      if(question.d_remote.getSocklen()==sizeof(sockaddr_in))
+        numreceived4++;
       else
-        remote = question.getRemote().toString();
-      g_log << Logger::Notice<<"Remote "<< remote <<" wants '" << question.qdomain<<"|"<<question.qtype.getName() << 
-        "', do = " <<question.d_dnssecOk <<", bufsize = "<< question.getMaxReplyLen();
-      if(question.d_ednsRawPacketSizeLimit > 0 && question.getMaxReplyLen() != (unsigned int)question.d_ednsRawPacketSizeLimit)
-        g_log<<" ("<<question.d_ednsRawPacketSizeLimit<<")";
-      g_log<<": ";
-    }
+        numreceived6++;
+
+      if(question.d_dnssecOk)
+        numreceiveddo++;
+
+       if(question.d.qr)
+         continue;
+
+      S.ringAccount("queries", question.qdomain, question.qtype);
+      S.ringAccount("remotes", question.d_remote);
+      if(logDNSQueries) {
+        string remote;
+        if(question.hasEDNSSubnet()) 
+          remote = question.getRemote().toString() + "<-" + question.getRealRemote().toString();
+        else
+          remote = question.getRemote().toString();
+        g_log << Logger::Notice<<"Remote "<< remote <<" wants '" << question.qdomain<<"|"<<question.qtype.getName() << 
+          "', do = " <<question.d_dnssecOk <<", bufsize = "<< question.getMaxReplyLen();
+        if(question.d_ednsRawPacketSizeLimit > 0 && question.getMaxReplyLen() != (unsigned int)question.d_ednsRawPacketSizeLimit)
+          g_log<<" ("<<question.d_ednsRawPacketSizeLimit<<")";
+        g_log<<": ";
+      }
 
-    if(PC.enabled() && (question.d.opcode != Opcode::Notify && question.d.opcode != Opcode::Update) && question.couldBeCached()) {
-      bool haveSomething=PC.get(question, cached); // does the PacketCache recognize this question?
-      if (haveSomething) {
-        if(logDNSQueries)
-          g_log<<"packetcache HIT"<<endl;
-        cached.setRemote(&question.d_remote);  // inlined
-        cached.setSocket(question.getSocket());                               // inlined
-        cached.d_anyLocal = question.d_anyLocal;
-        cached.setMaxReplyLen(question.getMaxReplyLen());
-        cached.d.rd=question.d.rd; // copy in recursion desired bit
-        cached.d.id=question.d.id;
-        cached.commitD(); // commit d to the packet                        inlined
-        NS->send(cached); // answer it then                              inlined
-        diff=question.d_dt.udiff();
-        avg_latency=(int)(0.999*avg_latency+0.001*diff); // 'EWMA'
-        continue;
+      if(PC.enabled() && (question.d.opcode != Opcode::Notify && question.d.opcode != Opcode::Update) && question.couldBeCached()) {
+        bool haveSomething=PC.get(question, cached); // does the PacketCache recognize this question?
+        if (haveSomething) {
+          if(logDNSQueries)
+            g_log<<"packetcache HIT"<<endl;
+          cached.setRemote(&question.d_remote);  // inlined
+          cached.setSocket(question.getSocket());                               // inlined
+          cached.d_anyLocal = question.d_anyLocal;
+          cached.setMaxReplyLen(question.getMaxReplyLen());
+          cached.d.rd=question.d.rd; // copy in recursion desired bit
+          cached.d.id=question.d.id;
+          cached.commitD(); // commit d to the packet                        inlined
+          NS->queue(batch, cached); // answer it then, along with the other hits of this batch
+          diff=question.d_dt.udiff();
+          avg_latency=(int)(0.999*avg_latency+0.001*diff); // 'EWMA'
+          continue;
+        }
       }
-    }
 
-    if(distributor->isOverloaded()) {
-      if(logDNSQueries) 
-        g_log<<"Dropped query, backends are overloaded"<<endl;
-      overloadDrops++;
-      continue;
-    }
+      if(distributor->isOverloaded()) {
+        if(logDNSQueries) 
+          g_log<<"Dropped query, backends are overloaded"<<endl;
+        overloadDrops++;
+        continue;
+      }
         
-    if(PC.enabled() && logDNSQueries)
-      g_log<<"packetcache MISS"<<endl;
+      if(PC.enabled() && logDNSQueries)
+        g_log<<"packetcache MISS"<<endl;
 
-    try {
       distributor->question(question, &sendout); // otherwise, give to the distributor
     }
-    catch(DistributorFatal& df) { // when this happens, we have leaked loads of memory. Bailing out time.
-      _exit(1);
-    }
+    NS->flush(batch);
   }
 }
 catch(PDNSException& pe)
@@ -527,6 +588,7 @@ void mainthread()
    PC.setTTL(::arg().asNum("cache-ttl"));
    PC.setMaxEntries(::arg().asNum("max-packet-cache-entries"));
    QC.setMaxEntries(::arg().asNum("max-cache-entries"));
+   g_zoneCache.setRefreshInterval(::arg().asNum("zone-cache-refresh-interval"));
 
    stubParseResolveConf();
 
@@ -623,6 +685,11 @@ void mainthread()
 
   std::thread carbonThread(carbonDumpThread); // runs even w/o carbon, might change @ runtime    
 
+  if(g_zoneCache.isEnabled()) {
+    std::thread zoneCacheThread(zoneCacheRefreshThread);
+    zoneCacheThread.detach();
+  }
+
 #ifdef HAVE_SYSTEMD
   /* If we are here, notify systemd that we are ay-ok! This might have some
    * timing issues with the backend-threads. e.g. if the initial MySQL connection
@@ -27,6 +27,7 @@
 #include <queue>
 #include <vector>
 #include <pthread.h>
+#include <sched.h>
 #include "threadname.hh"
 #include <unistd.h>
 #include "logger.hh"
@@ -36,6 +37,7 @@
 #include "arguments.hh"
 #include <atomic>
 #include "statbag.hh"
+#include "mpmcqueue.hh"
 
 extern StatBag S;
 
@@ -112,12 +114,18 @@ public:
   }
 
 private:
+  void shed(Question& q, callback_t& callback);
+
   int nextid;
   time_t d_last_started;
   unsigned int d_overloadQueueLength, d_maxQueueLength;
   int d_num_threads;
   std::atomic<unsigned int> d_queued{0}, d_running{0};
-  std::vector<std::pair<int,int>> d_pipes;
+  std::atomic<time_t> d_lastShedLog{0};
+  /* shared by all the backend threads, so that the first idle one picks the next question */
+  std::unique_ptr<MPMCQueue<QuestionData*>> d_queue;
+  /* counts the questions in d_queue, backend threads sleep on it */
+  Semaphore d_queueSem;
 };
 
 //template<class Answer, class Question, class Backend>::nextid;
@@ -154,15 +162,9 @@ template<class Answer, class Question, class Backend>MultiThreadDistributor<Answ
   d_last_started=time(0);
 
   pthread_t tid;
-  
 
-  for(int i=0; i < n; ++i) {
-    int fds[2];
-    if(pipe(fds) < 0)
-      unixDie("Creating pipe");
-    d_pipes.push_back({fds[0],fds[1]});
-  }
-  
+  d_queue = make_unique<MPMCQueue<QuestionData*>>(std::max(d_maxQueueLength, 1U));
+
   if (n<1) {
     g_log<<Logger::Error<<"Asked for fewer than 1 threads, nothing to do"<<endl;
     _exit(1);
@@ -183,7 +185,7 @@ template<class Answer, class Question, class Backend>void *MultiThreadDistributo
   setThreadName("pdns/distributo");
   pthread_detach(pthread_self());
   MultiThreadDistributor *us=static_cast<MultiThreadDistributor *>(p);
-  int ournum=us->d_running++;
+  us->d_running++;
 
   try {
     std::unique_ptr<Backend> b= make_unique<Backend>(); // this will answer our questions
@@ -192,8 +194,11 @@ template<class Answer, class Question, class Backend>void *MultiThreadDistributo
     for(;;) {
     
       QuestionData* tempQD = nullptr;
-      if(read(us->d_pipes[ournum].first, &tempQD, sizeof(tempQD)) != sizeof(tempQD))
-	unixDie("read");
+      if(us->d_queueSem.wait() < 0)
+        unixDie("wait");
+      // the question is there, but the producer that took this slot might not have published it yet
+      while(!us->d_queue->pop(tempQD))
+        sched_yield();
       --us->d_queued;
       std::unique_ptr<QuestionData> QD = std::unique_ptr<QuestionData>(tempQD);
       tempQD = nullptr;
@@ -304,30 +309,49 @@ retry:
   return 0;
 }
 
-struct DistributorFatal{};
-
 template<class Answer, class Question, class Backend>int MultiThreadDistributor<Answer,Question,Backend>::question(Question& q, callback_t callback)
 {
-  // this is passed to other process over pipe and released there
-  auto QD=new QuestionData(q);
-  auto ret = QD->id = nextid++; // might be deleted after write!
-  QD->callback=callback;
-
   ++d_queued;
-  if(write(d_pipes[QD->id % d_pipes.size()].second, &QD, sizeof(QD)) != sizeof(QD)) {
+  if(d_queued > d_maxQueueLength) {
     --d_queued;
-    delete QD;
-    unixDie("write");
+    shed(q, callback);
+    return -1;
   }
 
-  if(d_queued > d_maxQueueLength) {
-    g_log<<Logger::Error<< d_queued <<" questions waiting for database/backend attention. Limit is "<<::arg().asNum("max-queue-length")<<", respawning"<<endl;
-    // this will leak the entire contents of all pipes, nothing will be freed. Respawn when this happens!
-    throw DistributorFatal();
+  // this is passed to a backend thread via the queue and released there
+  auto QD=make_unique<QuestionData>(q);
+  auto ret = QD->id = nextid++;
+  QD->callback=callback;
+
+  QuestionData* tempQD = QD.get();
+  if(!d_queue->push(std::move(tempQD))) {
+    --d_queued;
+    shed(q, callback);
+    return -1;
   }
+  QD.release();
+  d_queueSem.post();
 
   return ret;
 }
 
+// the backends can't keep up, answer right away instead of letting the queue grow
+template<class Answer, class Question, class Backend>void MultiThreadDistributor<Answer,Question,Backend>::shed(Question& q, callback_t& callback)
+{
+  S.inc("overload-servfails");
+  S.inc("servfail-packets");
+  S.ringAccount("servfail-queries", q.qdomain, q.qtype);
+
+  time_t now = time(nullptr);
+  time_t last = d_lastShedLog.load();
+  if(last != now && d_lastShedLog.compare_exchange_strong(last, now)) {
+    g_log<<Logger::Error<<d_queued<<" questions waiting for database/backend attention. Limit is "<<d_maxQueueLength<<", answering with SERVFAIL"<<endl;
+  }
+
+  std::unique_ptr<Answer> a=q.replyPacket();
+  a->setRcode(RCode::ServFail);
+  callback(a);
+}
+
 #endif // DISTRIBUTOR_HH
 
@@ -255,6 +255,17 @@ bool DNSBackend::getSOA(const DNSName &domain, SOAData &sd)
   return true;
 }
 
+void DNSBackend::lookupNames(const vector<DNSName>& names, int zoneId, vector<DNSZoneRecord>& records, DNSPacket *pkt_p)
+{
+  DNSZoneRecord dzr;
+  for(const auto& name : names) {
+    this->lookup(QType(QType::ANY), name, zoneId, pkt_p);
+    while(this->get(dzr)) {
+      records.push_back(dzr);
+    }
+  }
+}
+
 bool DNSBackend::get(DNSZoneRecord& dzr)
 {
   //  cout<<"DNSBackend::get(DNSZoneRecord&) called - translating into DNSResourceRecord query"<<endl;
@@ -125,6 +125,9 @@ public:
   virtual bool get(DNSResourceRecord &)=0; //!< retrieves one DNSResource record, returns false if no more were available
   virtual bool get(DNSZoneRecord &r);
 
+  //! Appends the records of all types for each of the names to records. The default does one ANY lookup() per name, backends able to do it in one go should override this
+  virtual void lookupNames(const vector<DNSName>& names, int zoneId, vector<DNSZoneRecord>& records, DNSPacket *pkt_p=nullptr);
+
   //! Initiates a list of the specified domain
   /** Once initiated, DNSResourceRecord objects can be retrieved using get(). Should return false
       if the backend does not consider itself responsible for the id passed.
@@ -0,0 +1,472 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "dnsdist-cache-shm.hh"
+#include "dns.hh"
+#include "misc.hh"
+
+const size_t SharedPacketCacheStore::s_defaultSlotSize;
+const time_t SharedPacketCacheStore::s_staleLockDelay;
+const uint32_t SharedPacketCacheStore::s_version;
+
+static const char s_shmMagic[8] = { 'D', 'D', 'P', 'C', 'S', 'H', 'M', '\0' };
+/* slots start on a cache line boundary */
+static const size_t s_shmHeaderSize = 64;
+
+SharedPacketCacheStore::SharedPacketCacheStore(const std::string& path, size_t slotsCount, size_t slotSize): d_path(path), d_slotsCount(slotsCount), d_slotSize(slotSize)
+{
+  static_assert(sizeof(FileHeader) <= s_shmHeaderSize, "The shared packet cache header does not fit in the space reserved for it");
+
+  if (d_slotsCount == 0) {
+    throw std::runtime_error("The shared packet cache at '" + d_path + "' needs at least one slot");
+  }
+
+  /* keep the slots 8-byte aligned */
+  d_slotSize = ((d_slotSize + 7) / 8) * 8;
+  if (d_slotSize < sizeof(SlotHeader) + sizeof(dnsheader) || d_slotSize > (sizeof(SlotHeader) + std::numeric_limits<uint16_t>::max())) {
+    throw std::runtime_error("Invalid slot size " + std::to_string(slotSize) + " for the shared packet cache at '" + d_path + "', it should be between " + std::to_string(sizeof(SlotHeader) + sizeof(dnsheader)) + " and " + std::to_string(sizeof(SlotHeader) + std::numeric_limits<uint16_t>::max()));
+  }
+
+  d_mappedSize = s_shmHeaderSize + d_slotsCount * d_slotSize;
+
+  int fd = open(d_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to open the shared packet cache file '" + d_path + "': " + stringerror());
+  }
+
+  try {
+    /* prevent two processes from initializing the same file at the same time */
+    if (flock(fd, LOCK_EX) != 0) {
+      throw std::runtime_error("Unable to lock the shared packet cache file '" + d_path + "': " + stringerror());
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      throw std::runtime_error("Unable to stat the shared packet cache file '" + d_path + "': " + stringerror());
+    }
+
+    bool created = false;
+    if (st.st_size == 0) {
+      if (ftruncate(fd, d_mappedSize) != 0) {
+        throw std::runtime_error("Unable to resize the shared packet cache file '" + d_path + "' to " + std::to_string(d_mappedSize) + " bytes: " + stringerror());
+      }
+      created = true;
+    }
+    else if (static_cast<size_t>(st.st_size) != d_mappedSize) {
+      throw std::runtime_error("The existing shared packet cache file '" + d_path + "' has a size of " + std::to_string(st.st_size) + " bytes, expected " + std::to_string(d_mappedSize) + ", please remove it or use the same number of entries and slot size");
+    }
+
+    void* addr = mmap(nullptr, d_mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      throw std::runtime_error("Unable to map the shared packet cache file '" + d_path + "': " + stringerror());
+    }
+
+    d_header = reinterpret_cast<FileHeader*>(addr);
+    d_slots = reinterpret_cast<char*>(addr) + s_shmHeaderSize;
+
+    if (created) {
+      /* a freshly truncated file is zero-filled, so every slot is already empty */
+      d_header->version = s_version;
+      d_header->slotSize = d_slotSize;
+      d_header->slotsCount = d_slotsCount;
+      d_header->entries.store(0);
+      memcpy(d_header->magic, s_shmMagic, sizeof(d_header->magic));
+    }
+    else if (memcmp(d_header->magic, s_shmMagic, sizeof(s_shmMagic)) != 0 || d_header->version != s_version || d_header->slotSize != d_slotSize || d_header->slotsCount != d_slotsCount) {
+      munmap(addr, d_mappedSize);
+      d_header = nullptr;
+      d_slots = nullptr;
+      throw std::runtime_error("The existing shared packet cache file '" + d_path + "' has an incompatible layout, please remove it or use the same number of entries and slot size");
+    }
+
+    flock(fd, LOCK_UN);
+  }
+  catch (...) {
+    close(fd);
+    throw;
+  }
+
+  /* the mapping stays valid after the descriptor has been closed */
+  close(fd);
+}
+
+SharedPacketCacheStore::~SharedPacketCacheStore()
+{
+  if (d_header != nullptr) {
+    munmap(d_header, d_mappedSize);
+  }
+}
+
+SharedPacketCacheStore::SlotHeader& SharedPacketCacheStore::getSlot(size_t idx) const
+{
+  return *reinterpret_cast<SlotHeader*>(d_slots + (idx * d_slotSize));
+}
+
+static inline uint64_t makeSlotSeq(uint32_t counter, uint32_t lockedAt)
+{
+  return (static_cast<uint64_t>(lockedAt) << 32) | counter;
+}
+
+/* on success the slot counter is seq + 1, and unlockSlot() should be called with seq if
+   the slot has not been modified, seq + 2 otherwise */
+bool SharedPacketCacheStore::lockSlot(SlotHeader& slot, uint32_t& seq) const
+{
+  const uint32_t now = time(nullptr);
+  uint64_t current = slot.seq.load(std::memory_order_acquire);
+  const uint32_t counter = static_cast<uint32_t>(current);
+
+  if (counter & 1) {
+    /* a writer that died while holding the slot would leave it locked forever,
+       so take it over once the lock is old enough */
+    const uint32_t lockedAt = static_cast<uint32_t>(current >> 32);
+    if (static_cast<int64_t>(now) - static_cast<int64_t>(lockedAt) < s_staleLockDelay) {
+      return false;
+    }
+
+    if (!slot.seq.compare_exchange_strong(current, makeSlotSeq(counter + 2, now), std::memory_order_acq_rel)) {
+      return false;
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+    /* the content might have been partially written, get rid of it. The entries count
+       might be off by one, which does not matter much */
+    slot.validity = 0;
+    slot.len = 0;
+    slot.key = 0;
+    seq = counter + 1;
+    return true;
+  }
+
+  if (!slot.seq.compare_exchange_strong(current, makeSlotSeq(counter + 1, now), std::memory_order_acq_rel)) {
+    return false;
+  }
+
+  std::atomic_thread_fence(std::memory_order_release);
+  seq = counter;
+  return true;
+}
+
+void SharedPacketCacheStore::unlockSlot(SlotHeader& slot, uint32_t seq) const
+{
+  slot.seq.store(makeSlotSeq(seq, 0), std::memory_order_release);
+}
+
+void SharedPacketCacheStore::clearSlot(SlotHeader& slot)
+{
+  slot.validity = 0;
+  slot.len = 0;
+  slot.key = 0;
+  d_header->entries--;
+}
+
+static bool qnameMatches(const uint8_t* stored, uint8_t storedLen, const std::string& dnsQName)
+{
+  if (storedLen != dnsQName.size()) {
+    return false;
+  }
+
+  for (size_t idx = 0; idx < storedLen; idx++) {
+    if (dns_tolower(stored[idx]) != dns_tolower(dnsQName.at(idx))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void storeSubnet(const boost::optional<Netmask>& subnet, uint8_t& family, uint8_t& bits, uint8_t* addr)
+{
+  family = 0;
+  bits = 0;
+  memset(addr, 0, 16);
+
+  if (!subnet) {
+    return;
+  }
+
+  const ComboAddress& network = subnet->getNetwork();
+  bits = subnet->getBits();
+  if (network.isIPv4()) {
+    family = 4;
+    memcpy(addr, &network.sin4.sin_addr, sizeof(network.sin4.sin_addr));
+  }
+  else {
+    family = 6;
+    memcpy(addr, &network.sin6.sin6_addr, sizeof(network.sin6.sin6_addr));
+  }
+}
+
+static boost::optional<Netmask> loadSubnet(uint8_t family, uint8_t bits, const uint8_t* addr)
+{
+  if (family == 4) {
+    return Netmask(makeComboAddressFromRaw(4, reinterpret_cast<const char*>(addr), 4), bits);
+  }
+  else if (family == 6) {
+    return Netmask(makeComboAddressFromRaw(6, reinterpret_cast<const char*>(addr), 16), bits);
+  }
+  return boost::none;
+}
+
+SharedPacketCacheStore::InsertResult SharedPacketCacheStore::insert(uint32_t key, const Entry& entry, const std::string& dnsQName, const char* response)
+{
+  if (entry.len > getMaxResponseSize() || dnsQName.size() > sizeof(SlotHeader::qname) - 1) {
+    return InsertResult::TooLarge;
+  }
+
+  auto& slot = getSlot(key % d_slotsCount);
+  uint32_t seq;
+  if (!lockSlot(slot, seq)) {
+    return InsertResult::Busy;
+  }
+
+  const bool wasEmpty = slot.validity == 0;
+  if (!wasEmpty) {
+    uint8_t family, bits, addr[16];
+    storeSubnet(entry.subnet, family, bits, addr);
+
+    bool matches = slot.key == key && slot.queryFlags == entry.queryFlags && slot.dnssecOK == entry.dnssecOK && slot.tcp == entry.tcp && slot.qtype == entry.qtype && slot.qclass == entry.qclass && slot.subnetFamily == family && slot.subnetBits == bits && memcmp(slot.subnetAddr, addr, sizeof(addr)) == 0 && qnameMatches(slot.qname, slot.qnameLen, dnsQName);
+
+    /* in case of collision, don't override the existing entry
+       except if it has expired */
+    if (!matches && slot.validity > entry.added) {
+      unlockSlot(slot, seq);
+      return InsertResult::Collision;
+    }
+
+    /* if the existing entry had a longer TTD, keep it */
+    if (matches && entry.validity <= slot.validity) {
+      unlockSlot(slot, seq);
+      return InsertResult::Kept;
+    }
+  }
+
+  slot.key = key;
+  slot.added = entry.added;
+  slot.validity = entry.validity;
+  slot.qtype = entry.qtype;
+  slot.qclass = entry.qclass;
+  slot.queryFlags = entry.queryFlags;
+  slot.len = entry.len;
+  slot.tcp = entry.tcp ? 1 : 0;
+  slot.dnssecOK = entry.dnssecOK ? 1 : 0;
+  storeSubnet(entry.subnet, slot.subnetFamily, slot.subnetBits, slot.subnetAddr);
+  slot.qnameLen = dnsQName.size();
+  memcpy(slot.qname, dnsQName.c_str(), dnsQName.size());
+  memcpy(reinterpret_cast<char*>(&slot) + sizeof(SlotHeader), response, entry.len);
+
+  unlockSlot(slot, seq + 2);
+
+  if (wasEmpty) {
+    d_header->entries++;
+  }
+
+  return InsertResult::Inserted;
+}
+
+SharedPacketCacheStore::LookupResult SharedPacketCacheStore::get(uint32_t key, const std::string& dnsQName, Entry& entry, char* response, size_t responseSize) const
+{
+  const auto& slot = getSlot(key % d_slotsCount);
+
+  const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+  if (seq & 1) {
+    return LookupResult::Busy;
+  }
+
+  if (slot.validity == 0 || slot.key != key) {
+    return LookupResult::NotFound;
+  }
+
+  entry.added = slot.added;
+  entry.validity = slot.validity;
+  entry.qtype = slot.qtype;
+  entry.qclass = slot.qclass;
+  entry.queryFlags = slot.queryFlags;
+  entry.len = slot.len;
+  entry.tcp = slot.tcp != 0;
+  entry.dnssecOK = slot.dnssecOK != 0;
+  const uint8_t family = slot.subnetFamily;
+  const uint8_t bits = slot.subnetBits;
+  uint8_t addr[16];
+  memcpy(addr, slot.subnetAddr, sizeof(addr));
+  const bool nameMatches = qnameMatches(slot.qname, slot.qnameLen, dnsQName);
+
+  /* the length might be garbage if a writer is updating the slot,
+     so don't trust it before checking the sequence number */
+  const bool fits = entry.len <= responseSize && entry.len <= getMaxResponseSize();
+  if (fits) {
+    memcpy(response, reinterpret_cast<const char*>(&slot) + sizeof(SlotHeader), entry.len);
+  }
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (slot.seq.load(std::memory_order_relaxed) != seq) {
+    return LookupResult::Busy;
+  }
+
+  if (!nameMatches) {
+    return LookupResult::Collision;
+  }
+
+  if (!fits) {
+    return LookupResult::NotFound;
+  }
+
+  entry.subnet = loadSubnet(family, bits, addr);
+  return LookupResult::Found;
+}
+
+size_t SharedPacketCacheStore::purgeExpired(size_t upTo, time_t now)
+{
+  size_t removed = 0;
+
+  for (size_t idx = 0; idx < d_slotsCount && getEntriesCount() > upTo; idx++) {
+    auto& slot = getSlot(idx);
+    if (slot.validity == 0 || slot.validity > now) {
+      continue;
+    }
+
+    uint32_t seq;
+    if (!lockSlot(slot, seq)) {
+      continue;
+    }
+
+    if (slot.validity != 0 && slot.validity <= now) {
+      clearSlot(slot);
+      ++removed;
+    }
+    unlockSlot(slot, seq + 2);
+  }
+
+  return removed;
+}
+
+size_t SharedPacketCacheStore::expunge(size_t upTo)
+{
+  size_t removed = 0;
+
+  for (size_t idx = 0; idx < d_slotsCount && getEntriesCount() > upTo; idx++) {
+    auto& slot = getSlot(idx);
+    if (slot.validity == 0) {
+      continue;
+    }
+
+    uint32_t seq;
+    if (!lockSlot(slot, seq)) {
+      continue;
+    }
+
+    if (slot.validity != 0) {
+      clearSlot(slot);
+      ++removed;
+    }
+    unlockSlot(slot, seq + 2);
+  }
+
+  return removed;
+}
+
+size_t SharedPacketCacheStore::expungeByName(const DNSName& name, uint16_t qtype, bool suffixMatch)
+{
+  size_t removed = 0;
+
+  for (size_t idx = 0; idx < d_slotsCount; idx++) {
+    auto& slot = getSlot(idx);
+    if (slot.validity == 0 || (qtype != QType::ANY && slot.qtype != qtype)) {
+      continue;
+    }
+
+    uint32_t seq;
+    if (!lockSlot(slot, seq)) {
+      continue;
+    }
+
+    if (slot.validity != 0 && (qtype == QType::ANY || slot.qtype == qtype)) {
+      try {
+        DNSName qname(reinterpret_cast<const char*>(slot.qname), slot.qnameLen, 0, false);
+        if (qname == name || (suffixMatch && qname.isPartOf(name))) {
+          clearSlot(slot);
+          ++removed;
+        }
+      }
+      catch (const std::exception& e) {
+        /* not a valid name, this entry can't be of any use */
+        clearSlot(slot);
+      }
+    }
+    unlockSlot(slot, seq + 2);
+  }
+
+  return removed;
+}
+
+uint64_t SharedPacketCacheStore::visit(const std::function<void(uint32_t, const DNSName&, const Entry&)>& visitor) const
+{
+  uint64_t count = 0;
+
+  for (size_t idx = 0; idx < d_slotsCount; idx++) {
+    const auto& slot = getSlot(idx);
+    const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    if ((seq & 1) || slot.validity == 0) {
+      continue;
+    }
+
+    Entry entry;
+    const uint32_t key = slot.key;
+    entry.added = slot.added;
+    entry.validity = slot.validity;
+    entry.qtype = slot.qtype;
+    entry.qclass = slot.qclass;
+    entry.queryFlags = slot.queryFlags;
+    entry.len = slot.len;
+    entry.tcp = slot.tcp != 0;
+    entry.dnssecOK = slot.dnssecOK != 0;
+    const uint8_t qnameLen = slot.qnameLen;
+    char qnameRaw[sizeof(slot.qname)];
+    memcpy(qnameRaw, slot.qname, qnameLen);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq) {
+      continue;
+    }
+
+    DNSName qname;
+    try {
+      qname = DNSName(qnameRaw, qnameLen, 0, false);
+    }
+    catch (const std::exception& e) {
+    }
+
+    visitor(key, qname, entry);
+    count++;
+  }
+
+  return count;
+}
+
+uint64_t SharedPacketCacheStore::getEntriesCount() const
+{
+  return d_header->entries.load();
+}
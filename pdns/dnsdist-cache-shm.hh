@@ -0,0 +1,139 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+
+#include "dnsname.hh"
+#include "iputils.hh"
+
+/* Storage for the packet cache living in a memory-mapped file, usually under /dev/shm,
+   so that it can be shared between several dnsdist processes and survives a restart.
+
+   The file is made of a small header followed by fixed-size slots, the slot used for a
+   given key being key % slotsCount. There is no lock: every slot is protected by a
+   sequence counter, odd while a writer is updating it. Writers never wait for a busy
+   slot, they just give up, and readers retry neither, reporting the lookup as deferred.
+   The time at which a writer took the slot is stored along with the counter, so that a
+   slot left odd by a process that died while updating it can be taken over and cleared
+   once s_staleLockDelay seconds have passed.
+   Expiration times are stored as wall-clock values so they remain valid across restarts.
+*/
+class SharedPacketCacheStore : boost::noncopyable
+{
+public:
+  struct Entry
+  {
+    boost::optional<Netmask> subnet;
+    time_t added{0};
+    time_t validity{0};
+    uint16_t qtype{0};
+    uint16_t qclass{0};
+    uint16_t queryFlags{0};
+    uint16_t len{0};
+    bool tcp{false};
+    bool dnssecOK{false};
+  };
+
+  enum class InsertResult : uint8_t { Inserted, Busy, Collision, Kept, TooLarge };
+  enum class LookupResult : uint8_t { Found, Busy, NotFound, Collision };
+
+  /* opens (or creates) the file at path, throwing std::runtime_error if an existing file
+     does not have the expected layout */
+  SharedPacketCacheStore(const std::string& path, size_t slotsCount, size_t slotSize);
+  ~SharedPacketCacheStore();
+
+  /* dnsQName is the qname in wire format */
+  InsertResult insert(uint32_t key, const Entry& entry, const std::string& dnsQName, const char* response);
+  /* on success, the cached response is copied into 'response' whose size is responseSize */
+  LookupResult get(uint32_t key, const std::string& dnsQName, Entry& entry, char* response, size_t responseSize) const;
+
+  size_t purgeExpired(size_t upTo, time_t now);
+  size_t expunge(size_t upTo);
+  size_t expungeByName(const DNSName& name, uint16_t qtype, bool suffixMatch);
+
+  /* calls visitor(key, qname, entry) for every entry stored in the cache */
+  uint64_t visit(const std::function<void(uint32_t, const DNSName&, const Entry&)>& visitor) const;
+
+  uint64_t getEntriesCount() const;
+  size_t getMaxResponseSize() const
+  {
+    return d_slotSize - sizeof(SlotHeader);
+  }
+  const std::string& getPath() const
+  {
+    return d_path;
+  }
+
+  static const size_t s_defaultSlotSize{2048};
+  static const time_t s_staleLockDelay{10};
+
+private:
+  struct FileHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t slotSize;
+    uint64_t slotsCount;
+    std::atomic<uint64_t> entries;
+  };
+
+  struct SlotHeader
+  {
+    /* sequence counter in the lower 32 bits, time at which the slot was locked in the upper ones */
+    std::atomic<uint64_t> seq;
+    uint32_t key;
+    uint32_t padding;
+    int64_t added;
+    int64_t validity;
+    uint16_t qtype;
+    uint16_t qclass;
+    uint16_t queryFlags;
+    uint16_t len;
+    uint8_t tcp;
+    uint8_t dnssecOK;
+    uint8_t qnameLen;
+    uint8_t subnetFamily;
+    uint8_t subnetBits;
+    uint8_t subnetAddr[16];
+    uint8_t qname[256];
+  };
+
+  SlotHeader& getSlot(size_t idx) const;
+  bool lockSlot(SlotHeader& slot, uint32_t& seq) const;
+  void unlockSlot(SlotHeader& slot, uint32_t seq) const;
+  void clearSlot(SlotHeader& slot);
+
+  static const uint32_t s_version{2};
+
+  std::string d_path;
+  FileHeader* d_header{nullptr};
+  char* d_slots{nullptr};
+  size_t d_mappedSize{0};
+  size_t d_slotsCount;
+  size_t d_slotSize;
+};
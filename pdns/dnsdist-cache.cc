@@ -26,6 +26,7 @@
 #include "dnsparser.hh"
 #include "dnsdist-cache.hh"
 #include "dnsdist-ecs.hh"
+#include "dnsdist-queryview.hh"
 #include "ednsoptions.hh"
 #include "ednssubnet.hh"
 
@@ -91,6 +92,31 @@ bool DNSDistPacketCache::cachedValueMatches(const CacheValue& cachedValue, uint1
   return true;
 }
 
+/* same as above, but comparing the cached qname to the qname of the query in wire
+   format, case-insensitively, so that the DNSName of the query does not have to be built */
+bool DNSDistPacketCache::cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, const char* qname, size_t qnameLen, uint16_t qtype, uint16_t qclass, bool tcp, bool dnssecOK, const boost::optional<Netmask>& subnet) const
+{
+  if (cachedValue.queryFlags != queryFlags || cachedValue.dnssecOK != dnssecOK || cachedValue.tcp != tcp || cachedValue.qtype != qtype || cachedValue.qclass != qclass) {
+    return false;
+  }
+
+  const auto& cachedQName = cachedValue.qname.getStorage();
+  if (cachedQName.size() != qnameLen) {
+    return false;
+  }
+  for (size_t idx = 0; idx < qnameLen; idx++) {
+    if (dns_tolower(cachedQName[idx]) != dns_tolower(qname[idx])) {
+      return false;
+    }
+  }
+
+  if (d_parseECS && cachedValue.subnet != subnet) {
+    return false;
+  }
+
+  return true;
+}
+
 void DNSDistPacketCache::insertLocked(CacheShard& shard, uint32_t key, CacheValue& newValue)
 {
   auto& map = shard.d_map;
@@ -162,13 +188,36 @@ void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& su
     }
   }
 
+  const time_t now = time(nullptr);
+
+  if (d_sharedStore) {
+    SharedPacketCacheStore::Entry entry;
+    entry.subnet = subnet;
+    entry.added = now;
+    entry.validity = now + minTTL;
+    entry.qtype = qtype;
+    entry.qclass = qclass;
+    entry.queryFlags = queryFlags;
+    entry.len = responseLen;
+    entry.tcp = tcp;
+    entry.dnssecOK = dnssecOK;
+
+    auto result = d_sharedStore->insert(key, entry, qname.toDNSString(), response);
+    if (result == SharedPacketCacheStore::InsertResult::Busy) {
+      d_deferredInserts++;
+    }
+    else if (result == SharedPacketCacheStore::InsertResult::Collision) {
+      d_insertCollisions++;
+    }
+    return;
+  }
+
   uint32_t shardIndex = getShardIndex(key);
 
   if (d_shards.at(shardIndex).d_entriesCount >= (d_maxEntries / d_shardCount)) {
     return;
   }
 
-  const time_t now = time(nullptr);
   time_t newValidity = now + minTTL;
   CacheValue newValue;
   newValue.qname = qname;
@@ -201,10 +250,46 @@ void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& su
   }
 }
 
+/* copies the cached response into the response buffer, restoring the ID and the
+   case of the qname from the query. Returns false if the cached response is too short. */
+static bool copyCachedResponse(char* response, uint16_t* responseLen, uint16_t queryId, const char* dnsQName, size_t dnsQNameLen, const char* cached, uint16_t cachedLen)
+{
+  if (cachedLen > sizeof(dnsheader) && cachedLen < (sizeof(dnsheader) + dnsQNameLen)) {
+    return false;
+  }
+
+  memcpy(response, &queryId, sizeof(queryId));
+  memcpy(response + sizeof(queryId), cached + sizeof(queryId), sizeof(dnsheader) - sizeof(queryId));
+
+  if (cachedLen == sizeof(dnsheader)) {
+    /* DNS header only */
+    *responseLen = cachedLen;
+    return true;
+  }
+
+  /* the qname usually comes from the query, which is very often our response buffer */
+  memmove(response + sizeof(dnsheader), dnsQName, dnsQNameLen);
+  if (cachedLen > (sizeof(dnsheader) + dnsQNameLen)) {
+    memcpy(response + sizeof(dnsheader) + dnsQNameLen, cached + sizeof(dnsheader) + dnsQNameLen, cachedLen - (sizeof(dnsheader) + dnsQNameLen));
+  }
+  *responseLen = cachedLen;
+  return true;
+}
+
 bool DNSDistPacketCache::get(const DNSQuestion& dq, uint16_t consumed, uint16_t queryId, char* response, uint16_t* responseLen, uint32_t* keyOut, boost::optional<Netmask>& subnet, bool dnssecOK, uint32_t allowExpired, bool skipAging)
 {
-  std::string dnsQName(dq.qname->toDNSString());
-  uint32_t key = getKey(dnsQName, consumed, reinterpret_cast<const unsigned char*>(dq.dh), dq.len, dq.tcp);
+  /* the qname of a query is almost never compressed, so we can hash it and copy it
+     from the packet instead of serializing the DNSName */
+  const size_t dnsQNameLen = dq.qname.getWireLength();
+  const char* dnsQName = reinterpret_cast<const char*>(dq.dh) + sizeof(dnsheader);
+  std::string serializedQName;
+  if (consumed != dnsQNameLen + 4 || dq.len < sizeof(dnsheader) + consumed) {
+    serializedQName = dq.qname->toDNSString();
+    dnsQName = serializedQName.c_str();
+  }
+
+  const uint32_t qnameHash = dq.qnameHash ? *dq.qnameHash : DNSQueryView::hashQName(dnsQName, dnsQNameLen);
+  uint32_t key = getKey(qnameHash, consumed, reinterpret_cast<const unsigned char*>(dq.dh), dq.len, dq.tcp);
 
   if (keyOut)
     *keyOut = key;
@@ -213,6 +298,10 @@ bool DNSDistPacketCache::get(const DNSQuestion& dq, uint16_t consumed, uint16_t
     getClientSubnet(reinterpret_cast<const char*>(dq.dh), consumed, dq.len, subnet);
   }
 
+  if (d_sharedStore) {
+    return getShared(dq, std::string(dnsQName, dnsQNameLen), key, queryId, response, responseLen, subnet, dnssecOK, allowExpired, skipAging);
+  }
+
   uint32_t shardIndex = getShardIndex(key);
   time_t now = time(nullptr);
   time_t age;
@@ -248,31 +337,22 @@ bool DNSDistPacketCache::get(const DNSQuestion& dq, uint16_t consumed, uint16_t
     }
 
     /* check for collision */
-    if (!cachedValueMatches(value, *(getFlagsFromDNSHeader(dq.dh)), *dq.qname, dq.qtype, dq.qclass, dq.tcp, dnssecOK, subnet)) {
+    const bool matches = dq.qname.isBuilt() ? cachedValueMatches(value, *(getFlagsFromDNSHeader(dq.dh)), *dq.qname, dq.qtype, dq.qclass, dq.tcp, dnssecOK, subnet) : cachedValueMatches(value, *(getFlagsFromDNSHeader(dq.dh)), dnsQName, dnsQNameLen, dq.qtype, dq.qclass, dq.tcp, dnssecOK, subnet);
+    if (!matches) {
       d_lookupCollisions++;
       return false;
     }
 
-    memcpy(response, &queryId, sizeof(queryId));
-    memcpy(response + sizeof(queryId), value.value.c_str() + sizeof(queryId), sizeof(dnsheader) - sizeof(queryId));
+    if (!copyCachedResponse(response, responseLen, queryId, dnsQName, dnsQNameLen, value.value.c_str(), value.len)) {
+      return false;
+    }
 
     if (value.len == sizeof(dnsheader)) {
       /* DNS header only, our work here is done */
-      *responseLen = value.len;
       d_hits++;
       return true;
     }
 
-    const size_t dnsQNameLen = dnsQName.length();
-    if (value.len < (sizeof(dnsheader) + dnsQNameLen)) {
-      return false;
-    }
-
-    memcpy(response + sizeof(dnsheader), dnsQName.c_str(), dnsQNameLen);
-    if (value.len > (sizeof(dnsheader) + dnsQNameLen)) {
-      memcpy(response + sizeof(dnsheader) + dnsQNameLen, value.value.c_str() + sizeof(dnsheader) + dnsQNameLen, value.len - (sizeof(dnsheader) + dnsQNameLen));
-    }
-    *responseLen = value.len;
     if (!stale) {
       age = now - value.added;
     }
@@ -289,12 +369,92 @@ bool DNSDistPacketCache::get(const DNSQuestion& dq, uint16_t consumed, uint16_t
   return true;
 }
 
+bool DNSDistPacketCache::getShared(const DNSQuestion& dq, const std::string& dnsQName, uint32_t key, uint16_t queryId, char* response, uint16_t* responseLen, const boost::optional<Netmask>& subnet, bool dnssecOK, uint32_t allowExpired, bool skipAging)
+{
+  /* we can't copy directly into the response buffer because it holds
+     the query, which we need to keep intact if the lookup fails */
+  static thread_local std::vector<char> buffer;
+  if (buffer.size() < d_sharedStore->getMaxResponseSize()) {
+    buffer.resize(d_sharedStore->getMaxResponseSize());
+  }
+
+  SharedPacketCacheStore::Entry value;
+  auto result = d_sharedStore->get(key, dnsQName, value, buffer.data(), buffer.size());
+  if (result == SharedPacketCacheStore::LookupResult::Busy) {
+    d_deferredLookups++;
+    return false;
+  }
+  else if (result == SharedPacketCacheStore::LookupResult::NotFound) {
+    d_misses++;
+    return false;
+  }
+  else if (result == SharedPacketCacheStore::LookupResult::Collision) {
+    d_lookupCollisions++;
+    return false;
+  }
+
+  const time_t now = time(nullptr);
+  bool stale = false;
+  if (value.validity <= now) {
+    if ((now - value.validity) >= static_cast<time_t>(allowExpired)) {
+      d_misses++;
+      return false;
+    }
+    stale = true;
+  }
+
+  if (*responseLen < value.len || value.len < sizeof(dnsheader)) {
+    return false;
+  }
+
+  /* check for collision */
+  if (value.queryFlags != *(getFlagsFromDNSHeader(dq.dh)) || value.dnssecOK != dnssecOK || value.tcp != dq.tcp || value.qtype != dq.qtype || value.qclass != dq.qclass || (d_parseECS && value.subnet != subnet)) {
+    d_lookupCollisions++;
+    return false;
+  }
+
+  if (!copyCachedResponse(response, responseLen, queryId, dnsQName.c_str(), dnsQName.size(), buffer.data(), value.len)) {
+    return false;
+  }
+
+  if (value.len > sizeof(dnsheader) && !d_dontAge && !skipAging) {
+    time_t age;
+    if (!stale) {
+      age = now - value.added;
+    }
+    else {
+      age = (value.validity - value.added) - d_staleTTL;
+    }
+    ageDNSPacket(response, *responseLen, age);
+  }
+
+  d_hits++;
+  return true;
+}
+
+void DNSDistPacketCache::enableSharedMemory(const std::string& path, size_t slotSize)
+{
+  d_sharedStore = std::unique_ptr<SharedPacketCacheStore>(new SharedPacketCacheStore(path, d_maxEntries, slotSize));
+
+  /* release the memory reserved for the in-process maps, we won't use them */
+  for (auto& shard : d_shards) {
+    WriteLock w(&shard.d_lock);
+    std::unordered_map<uint32_t,CacheValue> empty;
+    shard.d_map.swap(empty);
+  }
+}
+
 /* Remove expired entries, until the cache has at most
    upTo entries in it.
 */
 size_t DNSDistPacketCache::purgeExpired(size_t upTo)
 {
   size_t removed = 0;
+
+  if (d_sharedStore) {
+    return d_sharedStore->purgeExpired(upTo, time(nullptr));
+  }
+
   uint64_t size = getSize();
 
   if (size == 0 || upTo >= size) {
@@ -336,6 +496,11 @@ size_t DNSDistPacketCache::purgeExpired(size_t upTo)
 size_t DNSDistPacketCache::expunge(size_t upTo)
 {
   size_t removed = 0;
+
+  if (d_sharedStore) {
+    return d_sharedStore->expunge(upTo);
+  }
+
   const uint64_t size = getSize();
 
   if (upTo >= size) {
@@ -370,6 +535,11 @@ size_t DNSDistPacketCache::expungeByName(const DNSName& name, uint16_t qtype, bo
 {
   size_t removed = 0;
 
+  if (d_sharedStore) {
+    return d_sharedStore->expungeByName(name, qtype, suffixMatch);
+  }
+
+
   for (uint32_t shardIndex = 0; shardIndex < d_shardCount; shardIndex++) {
     WriteLock w(&d_shards.at(shardIndex).d_lock);
     auto& map = d_shards[shardIndex].d_map;
@@ -399,6 +569,11 @@ uint64_t DNSDistPacketCache::getSize()
 {
   uint64_t count = 0;
 
+  if (d_sharedStore) {
+    return d_sharedStore->getEntriesCount();
+  }
+
+
   for (uint32_t shardIndex = 0; shardIndex < d_shardCount; shardIndex++) {
     count += d_shards.at(shardIndex).d_entriesCount;
   }
@@ -411,15 +586,14 @@ uint32_t DNSDistPacketCache::getMinTTL(const char* packet, uint16_t length, bool
   return getDNSPacketMinTTL(packet, length, seenNoDataSOA);
 }
 
-uint32_t DNSDistPacketCache::getKey(const std::string& qname, uint16_t consumed, const unsigned char* packet, uint16_t packetLen, bool tcp)
+uint32_t DNSDistPacketCache::getKey(uint32_t qnameHash, uint16_t consumed, const unsigned char* packet, uint16_t packetLen, bool tcp)
 {
-  uint32_t result = 0;
+  /* the hash of the lowercased qname comes first so it can be computed while parsing the query */
+  uint32_t result = qnameHash;
   /* skip the query ID */
   if (packetLen < sizeof(dnsheader))
     throw std::range_error("Computing packet cache key for an invalid packet size");
   result = burtle(packet + 2, sizeof(dnsheader) - 2, result);
-  string lc(toLower(qname));
-  result = burtle((const unsigned char*) lc.c_str(), lc.length(), result);
   if (packetLen < sizeof(dnsheader) + consumed) {
     throw std::range_error("Computing packet cache key for an invalid packet");
   }
@@ -456,6 +630,22 @@ uint64_t DNSDistPacketCache::dump(int fd)
 
   uint64_t count = 0;
   time_t now = time(nullptr);
+
+  if (d_sharedStore) {
+    fprintf(fp, "; stored in %s\n", d_sharedStore->getPath().c_str());
+    count = d_sharedStore->visit([fp,now](uint32_t key, const DNSName& qname, const SharedPacketCacheStore::Entry& value) {
+      try {
+        fprintf(fp, "%s %" PRId64 " %s ; key %" PRIu32 ", length %" PRIu16 ", tcp %d, added %" PRId64 "\n", qname.toString().c_str(), static_cast<int64_t>(value.validity - now), QType(value.qtype).getName().c_str(), key, value.len, value.tcp, static_cast<int64_t>(value.added));
+      }
+      catch(...) {
+        fprintf(fp, "; error printing '%s'\n", qname.empty() ? "EMPTY" : qname.toString().c_str());
+      }
+    });
+
+    fclose(fp);
+    return count;
+  }
+
   for (uint32_t shardIndex = 0; shardIndex < d_shardCount; shardIndex++) {
     ReadLock w(&d_shards.at(shardIndex).d_lock);
     auto& map = d_shards[shardIndex].d_map;
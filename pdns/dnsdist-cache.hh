@@ -24,6 +24,7 @@
 #include <atomic>
 #include <unordered_map>
 
+#include "dnsdist-cache-shm.hh"
 #include "iputils.hh"
 #include "lock.hh"
 
@@ -65,8 +66,18 @@ public:
     d_keepStaleData = keep;
   }
 
+  /* store the entries in a memory-mapped file instead of the process' heap,
+     so that they can be shared with other processes and survive a restart.
+     Needs to be called before the cache is used. */
+  void enableSharedMemory(const std::string& path, size_t slotSize);
+  bool isShared() const
+  {
+    return d_sharedStore != nullptr;
+  }
+
   static uint32_t getMinTTL(const char* packet, uint16_t length, bool* seenNoDataSOA);
-  static uint32_t getKey(const std::string& qname, uint16_t consumed, const unsigned char* packet, uint16_t packetLen, bool tcp);
+  /* qnameHash is the hash of the lowercased qname, see DNSQueryView::hashQName() */
+  static uint32_t getKey(uint32_t qnameHash, uint16_t consumed, const unsigned char* packet, uint16_t packetLen, bool tcp);
   static bool getClientSubnet(const char* packet, unsigned int consumed, uint16_t len, boost::optional<Netmask>& subnet);
 
 private:
@@ -110,8 +121,12 @@ private:
   };
 
   bool cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, const DNSName& qname, uint16_t qtype, uint16_t qclass, bool tcp, bool dnssecOK, const boost::optional<Netmask>& subnet) const;
+  bool cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, const char* qname, size_t qnameLen, uint16_t qtype, uint16_t qclass, bool tcp, bool dnssecOK, const boost::optional<Netmask>& subnet) const;
   uint32_t getShardIndex(uint32_t key) const;
   void insertLocked(CacheShard& shard, uint32_t key, CacheValue& newValue);
+  bool getShared(const DNSQuestion& dq, const std::string& dnsQName, uint32_t key, uint16_t queryId, char* response, uint16_t* responseLen, const boost::optional<Netmask>& subnet, bool dnssecOK, uint32_t allowExpired, bool skipAging);
+
+  std::unique_ptr<SharedPacketCacheStore> d_sharedStore{nullptr};
 
   std::vector<CacheShard> d_shards;
 
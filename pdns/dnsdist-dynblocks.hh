@@ -23,6 +23,7 @@
 
 #include <unordered_set>
 
+#include "bpf-filter.hh"
 #include "dolog.hh"
 #include "dnsdist-rings.hh"
 #include "statnode.hh"
@@ -206,14 +207,22 @@ public:
     counts_t counts;
     StatNode statNodeRoot;
 
-    size_t entriesCount = 0;
-    if (hasQueryRules()) {
-      entriesCount += g_rings.getNumberOfQueryEntries();
+#ifdef HAVE_XDP_FILTER
+    if (d_xdpFilter) {
+      d_xdpFilter->purgeExpired(now);
     }
-    if (hasResponseRules()) {
-      entriesCount += g_rings.getNumberOfResponseEntries();
+#endif /* HAVE_XDP_FILTER */
+
+    if (g_rings.getSketches() == nullptr) {
+      size_t entriesCount = 0;
+      if (hasQueryRules()) {
+        entriesCount += g_rings.getNumberOfQueryEntries();
+      }
+      if (hasResponseRules()) {
+        entriesCount += g_rings.getNumberOfResponseEntries();
+      }
+      counts.reserve(entriesCount);
     }
-    counts.reserve(entriesCount);
 
     processQueryRules(counts, now);
     processResponseRules(counts, statNodeRoot, now);
@@ -234,6 +243,11 @@ public:
       }
 
       if (d_queryRateRule.rateExceeded(counters.queries, now)) {
+#ifdef HAVE_XDP_FILTER
+        if (d_xdpFilter && d_xdpRateLimit && addXDPRateLimit(now, requestor, d_queryRateRule)) {
+          continue;
+        }
+#endif /* HAVE_XDP_FILTER */
         addBlock(blocks, now, requestor, d_queryRateRule, updated);
         continue;
       }
@@ -359,6 +373,19 @@ public:
     d_beQuiet = quiet;
   }
 
+#ifdef HAVE_XDP_FILTER
+  /* blocks resulting in a drop are also pushed to the XDP filter, for the prefix
+     of the offending client. If rateLimit is set, clients exceeding the query rate
+     rule are rate-limited at that rate by the XDP filter instead of being blocked */
+  void setXDPFilter(std::shared_ptr<XDPFilter> filter, bool rateLimit, uint8_t v4Prefix, uint8_t v6Prefix)
+  {
+    d_xdpFilter = filter;
+    d_xdpRateLimit = rateLimit;
+    d_xdpV4Prefix = v4Prefix;
+    d_xdpV6Prefix = v6Prefix;
+  }
+#endif /* HAVE_XDP_FILTER */
+
 private:
   bool checkIfQueryTypeMatches(const Rings::Query& query)
   {
@@ -430,7 +457,47 @@ private:
     }
     blocks->insert(Netmask(requestor)).second = db;
     updated = true;
+
+#ifdef HAVE_XDP_FILTER
+    const auto action = rule.d_action != DNSAction::Action::None ? rule.d_action : g_dynBlockAction;
+    if (d_xdpFilter && !warning && action == DNSAction::Action::Drop) {
+      const Netmask prefix(requestor, requestor.isIPv4() ? d_xdpV4Prefix : d_xdpV6Prefix);
+      try {
+        d_xdpFilter->block(prefix, until);
+      }
+      catch (const std::exception& e) {
+        vinfolog("Unable to insert a XDP block for %s: %s", prefix.toString(), e.what());
+      }
+    }
+#endif /* HAVE_XDP_FILTER */
+  }
+
+#ifdef HAVE_XDP_FILTER
+  /* returns false if the rate-limit could not be inserted */
+  bool addXDPRateLimit(const struct timespec& now, const ComboAddress& requestor, const DynBlockRule& rule)
+  {
+    if (d_excludedSubnets.match(requestor)) {
+      return true;
+    }
+
+    struct timespec until = now;
+    until.tv_sec += rule.d_blockDuration;
+    const Netmask prefix(requestor, requestor.isIPv4() ? d_xdpV4Prefix : d_xdpV6Prefix);
+    bool inserted = false;
+    try {
+      inserted = d_xdpFilter->rateLimit(prefix, rule.d_rate, rule.d_rate, until);
+    }
+    catch (const std::exception& e) {
+      vinfolog("Unable to insert a XDP rate-limit for %s: %s", prefix.toString(), e.what());
+      return false;
+    }
+
+    if (!d_beQuiet && inserted) {
+      warnlog("Rate-limiting %s to %d qps for %d seconds via XDP: %s", prefix.toString(), rule.d_rate, rule.d_blockDuration, rule.d_blockReason);
+    }
+    return true;
   }
+#endif /* HAVE_XDP_FILTER */
 
   void addOrRefreshBlockSMT(SuffixMatchTree<DynBlock>& blocks, const struct timespec& now, const DNSName& name, const DynBlockRule& rule, bool& updated)
   {
@@ -500,6 +567,22 @@ private:
     return hasQueryRules() || hasResponseRules();
   }
 
+  /* merges the sketches for that rule, extrapolating the counts if the rule covers
+     a longer period than the sketches */
+  template<typename F> void mergeSketches(DynBlockSketches& sketches, DynBlockSketches::Type type, uint16_t value, DynBlockRule& rule, const struct timespec& now, const F& add)
+  {
+    DynBlockSketches::counts_t sketchCounts;
+    const unsigned int covered = sketches.getCounts(type, value, now, rule.d_seconds, sketchCounts);
+    if (rule.d_seconds == 0) {
+      rule.d_minTime.tv_sec -= covered;
+    }
+    const double factor = rule.d_seconds > covered ? static_cast<double>(rule.d_seconds) / covered : 1.0;
+
+    for (const auto& entry : sketchCounts) {
+      add(entry.first, static_cast<uint64_t>(entry.second * factor));
+    }
+  }
+
   void processQueryRules(counts_t& counts, const struct timespec& now)
   {
     if (!hasQueryRules()) {
@@ -514,11 +597,25 @@ private:
       rule.second.d_cutOff.tv_sec -= rule.second.d_seconds;
     }
 
-    for (const auto& shard : g_rings.d_shards) {
-      std::lock_guard<std::mutex> rl(shard->queryLock);
-      for(const auto& c : shard->queryRing) {
+    auto sketches = g_rings.getSketches();
+    if (sketches) {
+      if (d_queryRateRule.isEnabled()) {
+        mergeSketches(*sketches, DynBlockSketches::Type::Queries, 0, d_queryRateRule, now, [&counts](const ComboAddress& requestor, uint64_t count) {
+            counts[requestor].queries += count;
+          });
+      }
+      for (auto& rule : d_qtypeRules) {
+        const uint16_t qtype = rule.first;
+        mergeSketches(*sketches, DynBlockSketches::Type::QTypes, qtype, rule.second, now, [&counts, qtype](const ComboAddress& requestor, uint64_t count) {
+            counts[requestor].d_qtypeCounts[qtype] += count;
+          });
+      }
+      return;
+    }
+
+    g_rings.forEachQuery([this, &counts, &now](const Rings::Query& c) {
         if (now < c.when) {
-          continue;
+          return;
         }
 
         bool qRateMatches = d_queryRateRule.matches(c.when);
@@ -533,8 +630,7 @@ private:
             entry.d_qtypeCounts[c.qtype]++;
           }
         }
-      }
-    }
+      });
   }
 
   void processResponseRules(counts_t& counts, StatNode& root, const struct timespec& now)
@@ -554,11 +650,36 @@ private:
       rule.second.d_cutOff.tv_sec -= rule.second.d_seconds;
     }
 
-    for (const auto& shard : g_rings.d_shards) {
-      std::lock_guard<std::mutex> rl(shard->respLock);
-      for(const auto& c : shard->respRing) {
+    auto sketches = g_rings.getSketches();
+    if (sketches) {
+      if (d_respRateRule.isEnabled()) {
+        mergeSketches(*sketches, DynBlockSketches::Type::ResponseBytes, 0, d_respRateRule, now, [&counts](const ComboAddress& requestor, uint64_t count) {
+            counts[requestor].respBytes += count;
+          });
+      }
+      for (auto& rule : d_rcodeRules) {
+        const uint8_t rcode = rule.first;
+        mergeSketches(*sketches, DynBlockSketches::Type::RCodes, rcode, rule.second, now, [&counts, rcode](const ComboAddress& requestor, uint64_t count) {
+            counts[requestor].d_rcodeCounts[rcode] += count;
+          });
+      }
+
+      if (!hasSuffixMatchRules()) {
+        return;
+      }
+    }
+
+    g_rings.forEachResponse([this, &counts, &root, &now, sketches](const Rings::Response& c) {
         if (now < c.when) {
-          continue;
+          return;
+        }
+
+        if (sketches) {
+          /* only the suffix match rule needs the names, the other ones have been handled already */
+          if (d_suffixMatchRule.matches(c.when)) {
+            root.submit(c.name, c.dh.rcode, boost::none);
+          }
+          return;
         }
 
         bool respRateMatches = d_respRateRule.matches(c.when);
@@ -578,8 +699,7 @@ private:
         if (suffixMatchRuleMatches) {
           root.submit(c.name, c.dh.rcode, boost::none);
         }
-      }
-    }
+      });
   }
 
   std::map<uint8_t, DynBlockRule> d_rcodeRules;
@@ -591,5 +711,11 @@ private:
   SuffixMatchNode d_excludedDomains;
   smtVisitor_t d_smtVisitor;
   dnsdist_ffi_stat_node_visitor_t d_smtVisitorFFI;
+#ifdef HAVE_XDP_FILTER
+  std::shared_ptr<XDPFilter> d_xdpFilter{nullptr};
+  uint8_t d_xdpV4Prefix{32};
+  uint8_t d_xdpV6Prefix{128};
+  bool d_xdpRateLimit{false};
+#endif /* HAVE_XDP_FILTER */
   bool d_beQuiet{false};
 };
@@ -1144,12 +1144,9 @@ public:
 
   DNSAction::Action operator()(DNSQuestion* dq, std::string* ruleresult) const override
   {
-    std::vector<std::string> keys = d_key->getKeys(*dq);
     std::string result;
-    for (const auto& key : keys) {
-      if (d_kvs->getValue(key, result) == true) {
-        break;
-      }
+    if (!d_key->lookup(*d_kvs, *dq, &result)) {
+      result.clear();
     }
 
     if (!dq->qTag) {
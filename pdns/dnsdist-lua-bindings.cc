@@ -68,6 +68,9 @@ void setupLuaBindings(bool client)
   g_lua.writeVariable("wrandom", ServerPolicy{"wrandom", wrandom, false});
   g_lua.writeVariable("whashed", ServerPolicy{"whashed", whashed, false});
   g_lua.writeVariable("chashed", ServerPolicy{"chashed", chashed, false});
+  g_lua.writeVariable("maglev", ServerPolicy{"maglev", maglev, false});
+  g_lua.writeVariable("lowestLatency", ServerPolicy{"lowestLatency", lowestLatency, false});
+  g_lua.writeVariable("powerOfTwoChoices", ServerPolicy{"powerOfTwoChoices", powerOfTwoChoices, false});
   g_lua.writeVariable("leastOutstanding", ServerPolicy{"leastOutstanding", leastOutstanding, false});
 
   /* ServerPool */
@@ -84,6 +87,13 @@ void setupLuaBindings(bool client)
     });
   g_lua.registerFunction("getECS", &ServerPool::getECS);
   g_lua.registerFunction("setECS", &ServerPool::setECS);
+  g_lua.registerFunction<double(std::shared_ptr<ServerPool>::*)(double)>("getLatencyPercentile", [](std::shared_ptr<ServerPool> pool, double percentile) {
+      setLuaNoSideEffect();
+      if (!pool) {
+        return 0.0;
+      }
+      return pool->getLatencySnapshot().getPercentile(percentile) / 1000.0;
+    });
 
   /* DownstreamState */
   g_lua.registerFunction<void(DownstreamState::*)(int)>("setQPS", [](DownstreamState& s, int lim) { s.qps = lim ? QPSLimiter(lim, lim) : QPSLimiter(); });
@@ -100,6 +110,10 @@ void setupLuaBindings(bool client)
       s->pools.erase(pool);
     });
   g_lua.registerFunction<uint64_t(DownstreamState::*)()>("getOutstanding", [](const DownstreamState& s) { return s.outstanding.load(); });
+  g_lua.registerFunction<double(DownstreamState::*)(double)>("getLatencyPercentile", [](const DownstreamState& s, double percentile) {
+      setLuaNoSideEffect();
+      return s.latencyHistogram.getSnapshot().getPercentile(percentile) / 1000.0;
+    });
   g_lua.registerFunction("isUp", &DownstreamState::isUp);
   g_lua.registerFunction("setDown", &DownstreamState::setDown);
   g_lua.registerFunction("setUp", &DownstreamState::setUp);
@@ -236,6 +250,22 @@ void setupLuaBindings(bool client)
       return fe.local.toStringWithPort();
     });
   g_lua.registerMember("muted", &ClientState::muted);
+  g_lua.registerFunction<void(ClientState::*)(std::shared_ptr<DNSDistPacketCache>)>("setHotCache", [](ClientState& frontend, std::shared_ptr<DNSDistPacketCache> cache) {
+      if (g_configurationDone) {
+        g_outputBuffer = "setHotCache cannot be used at runtime!\n";
+        errlog("setHotCache cannot be used at runtime!");
+        return;
+      }
+      frontend.hotCache = cache;
+    });
+  g_lua.registerFunction<std::shared_ptr<DNSDistPacketCache>(ClientState::*)()>("getHotCache", [](const ClientState& frontend) {
+      setLuaNoSideEffect();
+      return frontend.hotCache;
+    });
+  g_lua.registerFunction<double(ClientState::*)(double)>("getLatencyPercentile", [](const ClientState& fe, double percentile) {
+      setLuaNoSideEffect();
+      return fe.latencyHistogram.getSnapshot().getPercentile(percentile) / 1000.0;
+    });
 #ifdef HAVE_EBPF
   g_lua.registerFunction<void(ClientState::*)(std::shared_ptr<BPFFilter>)>("attachFilter", [](ClientState& frontend, std::shared_ptr<BPFFilter> bpf) {
       if (bpf) {
@@ -355,6 +385,118 @@ void setupLuaBindings(bool client)
         dbpf->includeRange(Netmask(*boost::get<std::string>(&ranges)));
       }
     });
+
+#ifdef HAVE_XDP_FILTER
+  g_lua.writeFunction("newXDPFilter", [client](const std::string& interface, boost::optional<std::unordered_map<std::string, boost::variant<std::string, uint32_t, std::vector<std::pair<int, uint16_t>>>>> vars) {
+      if (client) {
+        return std::shared_ptr<XDPFilter>(nullptr);
+      }
+
+      std::set<uint16_t> ports;
+      uint32_t maxV4 = 1024;
+      uint32_t maxV6 = 1024;
+      uint32_t maxSources = 65536;
+      XDPFilter::Mode mode = XDPFilter::Mode::Auto;
+
+      if (vars) {
+        if (vars->count("ports")) {
+          const auto& value = vars->at("ports");
+          if (value.type() == typeid(uint32_t)) {
+            ports.insert(boost::get<uint32_t>(value));
+          }
+          else if (value.type() == typeid(std::vector<std::pair<int, uint16_t>>)) {
+            for (const auto& port : boost::get<std::vector<std::pair<int, uint16_t>>>(value)) {
+              ports.insert(port.second);
+            }
+          }
+        }
+        if (vars->count("maxV4Prefixes")) {
+          maxV4 = boost::get<uint32_t>(vars->at("maxV4Prefixes"));
+        }
+        if (vars->count("maxV6Prefixes")) {
+          maxV6 = boost::get<uint32_t>(vars->at("maxV6Prefixes"));
+        }
+        if (vars->count("maxSources")) {
+          maxSources = boost::get<uint32_t>(vars->at("maxSources"));
+        }
+        if (vars->count("mode")) {
+          const auto value = boost::get<std::string>(vars->at("mode"));
+          if (value == "native") {
+            mode = XDPFilter::Mode::Native;
+          }
+          else if (value == "generic") {
+            mode = XDPFilter::Mode::Generic;
+          }
+          else if (value != "auto") {
+            throw std::runtime_error("Invalid XDP mode '" + value + "', valid values are 'auto', 'native' and 'generic'");
+          }
+        }
+      }
+
+      if (ports.empty()) {
+        ports.insert(53);
+      }
+
+      auto filter = std::make_shared<XDPFilter>(interface, ports, maxV4, maxV6, maxSources, mode);
+      g_xdpFilters.push_back(filter);
+      return filter;
+    });
+
+  g_lua.registerFunction<void(std::shared_ptr<XDPFilter>::*)(const std::string& nm, boost::optional<int> seconds)>("block", [](std::shared_ptr<XDPFilter> xdp, const std::string& nm, boost::optional<int> seconds) {
+      if (xdp) {
+        boost::optional<struct timespec> until{boost::none};
+        if (seconds) {
+          struct timespec now;
+          gettime(&now);
+          now.tv_sec += *seconds;
+          until = now;
+        }
+        xdp->block(Netmask(nm), until);
+      }
+    });
+
+  g_lua.registerFunction<void(std::shared_ptr<XDPFilter>::*)(const std::string& nm, uint32_t qps, boost::optional<uint32_t> burst, boost::optional<int> seconds)>("rateLimit", [](std::shared_ptr<XDPFilter> xdp, const std::string& nm, uint32_t qps, boost::optional<uint32_t> burst, boost::optional<int> seconds) {
+      if (xdp) {
+        boost::optional<struct timespec> until{boost::none};
+        if (seconds) {
+          struct timespec now;
+          gettime(&now);
+          now.tv_sec += *seconds;
+          until = now;
+        }
+        xdp->rateLimit(Netmask(nm), qps, burst ? *burst : qps, until);
+      }
+    });
+
+  g_lua.registerFunction<void(std::shared_ptr<XDPFilter>::*)(const std::string& nm)>("unblock", [](std::shared_ptr<XDPFilter> xdp, const std::string& nm) {
+      if (xdp) {
+        xdp->unblock(Netmask(nm));
+      }
+    });
+
+  g_lua.registerFunction<void(std::shared_ptr<XDPFilter>::*)()>("purgeExpired", [](std::shared_ptr<XDPFilter> xdp) {
+      if (xdp) {
+        struct timespec now;
+        gettime(&now);
+        xdp->purgeExpired(now);
+      }
+    });
+
+  g_lua.registerFunction<std::string(std::shared_ptr<XDPFilter>::*)()>("getStats", [](const std::shared_ptr<XDPFilter> xdp) {
+      setLuaNoSideEffect();
+      std::string res;
+      if (xdp) {
+        for (const auto& entry : xdp->getEntries()) {
+          res += entry.d_netmask.toString() + ": " + std::to_string(entry.d_counter);
+          if (entry.d_qps > 0) {
+            res += " (" + std::to_string(entry.d_qps) + " qps, burst " + std::to_string(entry.d_burst) + ")";
+          }
+          res += "\n";
+        }
+      }
+      return res;
+    });
+#endif /* HAVE_XDP_FILTER */
 #endif /* HAVE_EBPF */
 
   /* EDNSOptionView */
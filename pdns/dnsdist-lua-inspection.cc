@@ -32,29 +32,19 @@ static std::unordered_map<unsigned int, vector<boost::variant<string,double>>> g
   map<DNSName, unsigned int> counts;
   unsigned int total=0;
   {
-    for (const auto& shard : g_rings.d_shards) {
-      std::lock_guard<std::mutex> rl(shard->respLock);
-      if(!labels) {
-        for(const auto& a : shard->respRing) {
-          if(!pred(a))
-            continue;
+    g_rings.forEachResponse([&counts, &total, &labels, &pred](const Rings::Response& a) {
+        if(!pred(a))
+          return;
+        if(!labels) {
           counts[a.name]++;
-          total++;
         }
-      }
-      else {
-        unsigned int lab = *labels;
-        for(const auto& a : shard->respRing) {
-          if(!pred(a))
-            continue;
-
+        else {
           DNSName temp(a.name);
-          temp.trimToLabels(lab);
+          temp.trimToLabels(*labels);
           counts[temp]++;
-          total++;
         }
-      }
-    }
+        total++;
+      });
   }
   //      cout<<"Looked at "<<total<<" responses, "<<counts.size()<<" different ones"<<endl;
   vector<pair<unsigned int, DNSName>> rcounts;
@@ -107,19 +97,15 @@ static void statNodeRespRing(statvisitor_t visitor, unsigned int seconds)
   cutoff.tv_sec -= seconds;
 
   StatNode root;
-  for (const auto& shard : g_rings.d_shards) {
-    std::lock_guard<std::mutex> rl(shard->respLock);
-
-    for(const auto& c : shard->respRing) {
+  g_rings.forEachResponse([&root, &now, &cutoff, seconds](const Rings::Response& c) {
       if (now < c.when)
-        continue;
+        return;
 
       if (seconds && c.when < cutoff)
-        continue;
+        return;
 
       root.submit(c.name, c.dh.rcode, boost::none);
-    }
-  }
+    });
 
   StatNode::Stat node;
   root.visit([visitor](const StatNode* node_, const StatNode::Stat& self, const StatNode::Stat& children) {
@@ -131,20 +117,16 @@ static vector<pair<unsigned int, std::unordered_map<string,string> > > getRespRi
   typedef std::unordered_map<string,string>  entry_t;
   vector<pair<unsigned int, entry_t > > ret;
 
-  for (const auto& shard : g_rings.d_shards) {
-    std::lock_guard<std::mutex> rl(shard->respLock);
-
-    entry_t e;
-    unsigned int count=1;
-    for(const auto& c : shard->respRing) {
+  entry_t e;
+  unsigned int count=1;
+  g_rings.forEachResponse([&ret, &e, &count, &rcode](const Rings::Response& c) {
       if(rcode && (rcode.get() != c.dh.rcode))
-        continue;
+        return;
       e["qname"]=c.name.toString();
       e["rcode"]=std::to_string(c.dh.rcode);
       ret.push_back(std::make_pair(count,e));
       count++;
-    }
-  }
+    });
 
   return ret;
 }
@@ -159,20 +141,16 @@ static counts_t exceedRespGen(unsigned int rate, int seconds, std::function<void
 
   counts.reserve(g_rings.getNumberOfResponseEntries());
 
-  for (const auto& shard : g_rings.d_shards) {
-    std::lock_guard<std::mutex> rl(shard->respLock);
-    for(const auto& c : shard->respRing) {
-
+  g_rings.forEachResponse([&counts, &cutoff, &mintime, &now, seconds, &T](const Rings::Response& c) {
       if(seconds && c.when < cutoff)
-        continue;
+        return;
       if(now < c.when)
-        continue;
+        return;
 
       T(counts, c);
       if(c.when < mintime)
         mintime = c.when;
-    }
-  }
+    });
 
   double delta = seconds ? seconds : DiffTime(now, mintime);
   return filterScore(counts, delta, rate);
@@ -188,18 +166,15 @@ static counts_t exceedQueryGen(unsigned int rate, int seconds, std::function<voi
 
   counts.reserve(g_rings.getNumberOfQueryEntries());
 
-  for (const auto& shard : g_rings.d_shards) {
-    std::lock_guard<std::mutex> rl(shard->queryLock);
-    for(const auto& c : shard->queryRing) {
+  g_rings.forEachQuery([&counts, &cutoff, &mintime, &now, seconds, &T](const Rings::Query& c) {
       if(seconds && c.when < cutoff)
-        continue;
+        return;
       if(now < c.when)
-        continue;
+        return;
       T(counts, c);
       if(c.when < mintime)
         mintime = c.when;
-    }
-  }
+    });
 
   double delta = seconds ? seconds : DiffTime(now, mintime);
   return filterScore(counts, delta, rate);
@@ -230,15 +205,10 @@ void setupLuaInspection()
       auto top = top_.get_value_or(10);
       map<ComboAddress, unsigned int,ComboAddress::addressOnlyLessThan > counts;
       unsigned int total=0;
-      {
-        for (const auto& shard : g_rings.d_shards) {
-          std::lock_guard<std::mutex> rl(shard->queryLock);
-          for(const auto& c : shard->queryRing) {
-            counts[c.requestor]++;
-            total++;
-          }
-        }
-      }
+      g_rings.forEachQuery([&counts, &total](const Rings::Query& c) {
+          counts[c.requestor]++;
+          total++;
+        });
       vector<pair<unsigned int, ComboAddress>> rcounts;
       rcounts.reserve(counts.size());
       for(const auto& c : counts)
@@ -263,26 +233,17 @@ void setupLuaInspection()
       setLuaNoSideEffect();
       map<DNSName, unsigned int> counts;
       unsigned int total=0;
-      if(!labels) {
-        for (const auto& shard : g_rings.d_shards) {
-          std::lock_guard<std::mutex> rl(shard->queryLock);
-          for(const auto& a : shard->queryRing) {
+      g_rings.forEachQuery([&counts, &total, &labels](const Rings::Query& a) {
+          if(!labels) {
             counts[a.name]++;
-            total++;
           }
-        }
-      }
-      else {
-	unsigned int lab = *labels;
-        for (const auto& shard : g_rings.d_shards) {
-          std::lock_guard<std::mutex> rl(shard->queryLock);
-          for(auto a : shard->queryRing) {
-            a.name.trimToLabels(lab);
-            counts[a.name]++;
-            total++;
+          else {
+            DNSName temp(a.name);
+            temp.trimToLabels(*labels);
+            counts[temp]++;
           }
-        }
-      }
+          total++;
+        });
       // cout<<"Looked at "<<total<<" queries, "<<counts.size()<<" different ones"<<endl;
       vector<pair<unsigned int, DNSName>> rcounts;
       rcounts.reserve(counts.size());
@@ -311,27 +272,20 @@ void setupLuaInspection()
 
   g_lua.writeFunction("getResponseRing", []() {
       setLuaNoSideEffect();
-      size_t totalEntries = 0;
-      std::vector<boost::circular_buffer<Rings::Response>> rings;
-      rings.reserve(g_rings.getNumberOfShards());
-      for (const auto& shard : g_rings.d_shards) {
-        {
-          std::lock_guard<std::mutex> rl(shard->respLock);
-          rings.push_back(shard->respRing);
-        }
-        totalEntries += rings.back().size();
-      }
+      std::vector<Rings::Response> responses;
+      responses.reserve(g_rings.getNumberOfResponseEntries());
+      g_rings.forEachResponse([&responses](const Rings::Response& r) {
+          responses.push_back(r);
+        });
       vector<std::unordered_map<string, boost::variant<string, unsigned int> > > ret;
-      ret.reserve(totalEntries);
+      ret.reserve(responses.size());
       decltype(ret)::value_type item;
-      for (size_t idx = 0; idx < rings.size(); idx++) {
-        for(const auto& r : rings[idx]) {
-          item["name"]=r.name.toString();
-          item["qtype"]=r.qtype;
-          item["rcode"]=r.dh.rcode;
-          item["usec"]=r.usec;
-          ret.push_back(item);
-        }
+      for(const auto& r : responses) {
+        item["name"]=r.name.toString();
+        item["qtype"]=r.qtype;
+        item["rcode"]=r.dh.rcode;
+        item["usec"]=r.usec;
+        ret.push_back(item);
       }
       return ret;
     });
@@ -410,20 +364,12 @@ void setupLuaInspection()
       std::vector<Rings::Response> rr;
       qr.reserve(g_rings.getNumberOfQueryEntries());
       rr.reserve(g_rings.getNumberOfResponseEntries());
-      for (const auto& shard : g_rings.d_shards) {
-        {
-          std::lock_guard<std::mutex> rl(shard->queryLock);
-          for (const auto& entry : shard->queryRing) {
-            qr.push_back(entry);
-          }
-        }
-        {
-          std::lock_guard<std::mutex> rl(shard->respLock);
-          for (const auto& entry : shard->respRing) {
-            rr.push_back(entry);
-          }
-        }
-      }
+      g_rings.forEachQuery([&qr](const Rings::Query& entry) {
+          qr.push_back(entry);
+        });
+      g_rings.forEachResponse([&rr](const Rings::Response& entry) {
+          rr.push_back(entry);
+        });
 
       sort(qr.begin(), qr.end(), [](const decltype(qr)::value_type& a, const decltype(qr)::value_type& b) {
         return b.when < a.when;
@@ -507,24 +453,19 @@ void setupLuaInspection()
 
       double totlat=0;
       unsigned int size=0;
-      {
-        for (const auto& shard : g_rings.d_shards) {
-          std::lock_guard<std::mutex> rl(shard->respLock);
-          for(const auto& r : shard->respRing) {
-            /* skip actively discovered timeouts */
-            if (r.usec == std::numeric_limits<unsigned int>::max())
-              continue;
-
-            ++size;
-            auto iter = histo.lower_bound(r.usec);
-            if(iter != histo.end())
-              iter->second++;
-            else
-              histo.rbegin()++;
-            totlat+=r.usec;
-          }
-        }
-      }
+      g_rings.forEachResponse([&histo, &size, &totlat](const Rings::Response& r) {
+          /* skip actively discovered timeouts */
+          if (r.usec == std::numeric_limits<unsigned int>::max())
+            return;
+
+          ++size;
+          auto iter = histo.lower_bound(r.usec);
+          if(iter != histo.end())
+            iter->second++;
+          else
+            histo.rbegin()++;
+          totlat+=r.usec;
+        });
 
       if (size == 0) {
         g_outputBuffer = "No traffic yet.\n";
@@ -778,4 +719,23 @@ void setupLuaInspection()
   });
   g_lua.registerFunction("setQuiet", &DynBlockRulesGroup::setQuiet);
   g_lua.registerFunction("toString", &DynBlockRulesGroup::toString);
+#ifdef HAVE_XDP_FILTER
+  g_lua.registerFunction<void(std::shared_ptr<DynBlockRulesGroup>::*)(std::shared_ptr<XDPFilter>, boost::optional<std::unordered_map<std::string, boost::variant<bool, uint32_t>>>)>("setXDPFilter", [](std::shared_ptr<DynBlockRulesGroup>& group, std::shared_ptr<XDPFilter> filter, boost::optional<std::unordered_map<std::string, boost::variant<bool, uint32_t>>> vars) {
+    bool rateLimit = false;
+    uint8_t v4Prefix = 32;
+    uint8_t v6Prefix = 128;
+    if (vars) {
+      if (vars->count("rateLimit")) {
+        rateLimit = boost::get<bool>(vars->at("rateLimit"));
+      }
+      if (vars->count("v4Prefix")) {
+        v4Prefix = std::min(boost::get<uint32_t>(vars->at("v4Prefix")), static_cast<uint32_t>(32));
+      }
+      if (vars->count("v6Prefix")) {
+        v6Prefix = std::min(boost::get<uint32_t>(vars->at("v6Prefix")), static_cast<uint32_t>(128));
+      }
+    }
+    group->setXDPFilter(filter, rateLimit, v4Prefix, v6Prefix);
+  });
+#endif /* HAVE_XDP_FILTER */
 }
@@ -20,6 +20,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #include "dnsdist.hh"
+#include "dnsdist-compiled-rules.hh"
 #include "dnsdist-lua.hh"
 #include "dnsdist-rules.hh"
 
@@ -447,6 +448,30 @@ void setupLuaRules()
       showRules(&g_rulactions, vars);
     });
 
+  g_lua.writeFunction("showRulesIndexing", [](boost::optional<ruleparams_t> vars) {
+      setLuaNoSideEffect();
+      size_t truncateRuleWidth = string::npos;
+      if (vars && vars->count("truncateRuleWidth")) {
+        truncateRuleWidth = boost::get<int>((*vars)["truncateRuleWidth"]);
+      }
+
+      auto rules = g_rulactions.getLocal();
+      size_t indexed = 0;
+      int num = 0;
+      boost::format fmt("%-3d %-7s %11d %9d %s\n");
+      g_outputBuffer += (fmt % "#" % "Indexed" % "Evaluations" % "Matches" % "Rule").str();
+      for(const auto& lim : *rules) {
+        bool isIndexed = CompiledRuleSet::isIndexable(*lim.d_rule);
+        if (isIndexed) {
+          indexed++;
+        }
+        string name = lim.d_rule->toString().substr(0, truncateRuleWidth);
+        g_outputBuffer += (fmt % num % (isIndexed ? "yes" : "no") % lim.d_rule->d_evaluations % lim.d_rule->d_matches % name).str();
+        ++num;
+      }
+      g_outputBuffer += std::to_string(indexed) + " out of " + std::to_string(rules->size()) + " rules are indexed\n";
+    });
+
   g_lua.writeFunction("RDRule", []() {
       return std::shared_ptr<DNSRule>(new RDRule());
     });
@@ -113,6 +113,20 @@ static void parseLocalBindVars(boost::optional<localbind_t> vars, bool& reusePor
   }
 }
 
+/* only for plain DNS frontends (setLocal, addLocal) */
+static bool parsePacketRingVar(boost::optional<localbind_t>& vars, const std::string& interface, bool& usePacketRing)
+{
+  if (vars && vars->count("packetRing")) {
+    usePacketRing = boost::get<bool>((*vars)["packetRing"]);
+    if (usePacketRing && interface.empty()) {
+      errlog("Error, the 'packetRing' option requires an 'interface' to be set!");
+      g_outputBuffer="Error, the 'packetRing' option requires an 'interface' to be set!\n";
+      return false;
+    }
+  }
+  return true;
+}
+
 #if defined(HAVE_DNS_OVER_TLS) || defined(HAVE_DNS_OVER_HTTPS)
 static bool loadTLSCertificateAndKeys(const std::string& context, std::vector<std::pair<std::string, std::string>>& pairs, boost::variant<std::string, std::vector<std::pair<int,std::string>>> certFiles, boost::variant<std::string, std::vector<std::pair<int,std::string>>> keyFiles)
 {
@@ -354,7 +368,11 @@ void setupLuaConfig(bool client)
       }
 
       if(vars.count("checkInterval")) {
-        ret->checkInterval=static_cast<unsigned int>(std::stoul(boost::get<string>(vars["checkInterval"])));
+        /* in seconds, sub-second values are allowed */
+        ret->checkInterval=static_cast<unsigned int>(std::stod(boost::get<string>(vars["checkInterval"])) * 1000);
+        if (ret->checkInterval == 0) {
+          ret->checkInterval = 1;
+        }
       }
 
       if(vars.count("tcpConnectTimeout")) {
@@ -404,6 +422,69 @@ void setupLuaConfig(bool client)
         ret->checkFunction= boost::get<DownstreamState::checkfunc_t>(vars["checkFunction"]);
       }
 
+      if(vars.count("healthCheckMode")) {
+        auto mode = boost::get<string>(vars["healthCheckMode"]);
+        if (pdns_iequals(mode, "lazy")) {
+          ret->healthCheckMode = DownstreamState::HealthCheckMode::Lazy;
+        }
+        else if (pdns_iequals(mode, "active")) {
+          ret->healthCheckMode = DownstreamState::HealthCheckMode::Active;
+        }
+        else {
+          errlog("Error creating new server: unsupported health check mode '%s', expecting 'active' or 'lazy'", mode);
+          return ret;
+        }
+      }
+
+      if(vars.count("lazyHealthCheckThreshold")) {
+        const auto threshold = boost::get<string>(vars["lazyHealthCheckThreshold"]);
+        int value = -1;
+        try {
+          value = std::stoi(threshold);
+        }
+        catch(const std::exception& e) {
+        }
+        if (value < 0 || value > 100) {
+          g_outputBuffer="Error creating new server: invalid lazyHealthCheckThreshold value '" + threshold + "', expecting a percentage between 0 and 100";
+          errlog("Error creating new server: invalid lazyHealthCheckThreshold value '%s', expecting a percentage between 0 and 100", threshold);
+          return ret;
+        }
+        ret->lazyHealthCheckThreshold = static_cast<uint8_t>(value);
+      }
+
+      if(vars.count("lazyHealthCheckMinSampleCount")) {
+        const auto minSampleCount = boost::get<string>(vars["lazyHealthCheckMinSampleCount"]);
+        int value = -1;
+        try {
+          value = std::stoi(minSampleCount);
+        }
+        catch(const std::exception& e) {
+        }
+        if (value < 0 || value > std::numeric_limits<uint16_t>::max()) {
+          g_outputBuffer="Error creating new server: invalid lazyHealthCheckMinSampleCount value '" + minSampleCount + "', expecting a number between 0 and 65535";
+          errlog("Error creating new server: invalid lazyHealthCheckMinSampleCount value '%s', expecting a number between 0 and 65535", minSampleCount);
+          return ret;
+        }
+        ret->lazyHealthCheckMinSampleCount = static_cast<uint16_t>(value);
+      }
+
+      if(vars.count("lazyHealthCheckFailedInterval")) {
+        /* in seconds, sub-second values are allowed but a check every time the health check thread wakes up is not */
+        const auto failedInterval = boost::get<string>(vars["lazyHealthCheckFailedInterval"]);
+        double value = -1;
+        try {
+          value = std::stod(failedInterval);
+        }
+        catch(const std::exception& e) {
+        }
+        if (!(value >= 0.001 && value <= std::numeric_limits<unsigned int>::max() / 1000)) {
+          g_outputBuffer="Error creating new server: invalid lazyHealthCheckFailedInterval value '" + failedInterval + "', expecting a positive number of seconds";
+          errlog("Error creating new server: invalid lazyHealthCheckFailedInterval value '%s', expecting a positive number of seconds", failedInterval);
+          return ret;
+        }
+        ret->lazyHealthCheckFailedInterval = static_cast<unsigned int>(value * 1000);
+      }
+
       if(vars.count("checkTimeout")) {
         ret->checkTimeout = std::stoi(boost::get<string>(vars["checkTimeout"]));
       }
@@ -555,8 +636,12 @@ void setupLuaConfig(bool client)
       int tcpFastOpenQueueSize = 0;
       std::string interface;
       std::set<int> cpus;
+      bool usePacketRing = false;
 
       parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus);
+      if (!parsePacketRingVar(vars, interface, usePacketRing)) {
+        return;
+      }
 
       try {
 	ComboAddress loc(addr, 53);
@@ -571,7 +656,9 @@ void setupLuaConfig(bool client)
         }
 
         // only works pre-startup, so no sync necessary
-        g_frontends.push_back(std::unique_ptr<ClientState>(new ClientState(loc, false, reusePort, tcpFastOpenQueueSize, interface, cpus)));
+        auto udpCS = std::unique_ptr<ClientState>(new ClientState(loc, false, reusePort, tcpFastOpenQueueSize, interface, cpus));
+        udpCS->usePacketRing = usePacketRing;
+        g_frontends.push_back(std::move(udpCS));
         g_frontends.push_back(std::unique_ptr<ClientState>(new ClientState(loc, true, reusePort, tcpFastOpenQueueSize, interface, cpus)));
       }
       catch(const std::exception& e) {
@@ -591,13 +678,19 @@ void setupLuaConfig(bool client)
       int tcpFastOpenQueueSize = 0;
       std::string interface;
       std::set<int> cpus;
+      bool usePacketRing = false;
 
       parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus);
+      if (!parsePacketRingVar(vars, interface, usePacketRing)) {
+        return;
+      }
 
       try {
 	ComboAddress loc(addr, 53);
         // only works pre-startup, so no sync necessary
-        g_frontends.push_back(std::unique_ptr<ClientState>(new ClientState(loc, false, reusePort, tcpFastOpenQueueSize, interface, cpus)));
+        auto udpCS = std::unique_ptr<ClientState>(new ClientState(loc, false, reusePort, tcpFastOpenQueueSize, interface, cpus));
+        udpCS->usePacketRing = usePacketRing;
+        g_frontends.push_back(std::move(udpCS));
         g_frontends.push_back(std::unique_ptr<ClientState>(new ClientState(loc, true, reusePort, tcpFastOpenQueueSize, interface, cpus)));
       }
       catch(std::exception& e) {
@@ -992,6 +1085,15 @@ void setupLuaConfig(bool client)
 
   g_lua.writeFunction("setUDPTimeout", [](int timeout) { g_udpTimeout=timeout; });
 
+  g_lua.writeFunction("setUDPTimeoutCheckInterval", [](int interval) {
+      if (interval < 1 || interval > 60000) {
+        g_outputBuffer="The UDP timeout check interval should be between 1 and 60000 milliseconds\n";
+        errlog("The UDP timeout check interval should be between 1 and 60000 milliseconds");
+        return;
+      }
+      g_udpTimeoutCheckInterval=interval;
+    });
+
   g_lua.writeFunction("setMaxUDPOutstanding", [](uint16_t max) {
       if (!g_configurationDone) {
         g_maxOutstanding = max;
@@ -1600,14 +1702,45 @@ void setupLuaConfig(bool client)
       g_rings.setCapacity(capacity, numberOfShards ? *numberOfShards : 1);
     });
 
+  g_lua.writeFunction("setDynBlocksSketches", [](size_t capacity, boost::optional<size_t> window) {
+      setLuaSideEffect();
+      if (g_configurationDone) {
+        errlog("setDynBlocksSketches() cannot be used at runtime!");
+        g_outputBuffer="setDynBlocksSketches() cannot be used at runtime!\n";
+        return;
+      }
+      g_rings.enableSketches(capacity, window ? *window : 10);
+    });
+
+  g_lua.writeFunction("setRingBuffersPerThread", [](bool enabled) {
+      setLuaSideEffect();
+      if (g_configurationDone) {
+        errlog("setRingBuffersPerThread() cannot be used at runtime!");
+        g_outputBuffer="setRingBuffersPerThread() cannot be used at runtime!\n";
+        return;
+      }
+      g_rings.setPerThreadRings(enabled);
+    });
+
   g_lua.writeFunction("setRingBuffersLockRetries", [](size_t retries) {
       setLuaSideEffect();
       g_rings.setNumberOfLockRetries(retries);
     });
 
+  g_lua.writeFunction("setLatencyPolicyPercentile", [](double percentile) {
+      setLuaSideEffect();
+      if (percentile <= 0 || percentile > 100) {
+        g_outputBuffer = "The percentile should be larger than 0 and lower than or equal to 100\n";
+        errlog("The percentile should be larger than 0 and lower than or equal to 100");
+        return;
+      }
+      g_latencyPolicyPercentile = percentile;
+    });
+
   g_lua.writeFunction("setWHashedPertubation", [](uint32_t pertub) {
       setLuaSideEffect();
       g_hashperturb = pertub;
+      ++g_maglevGeneration;
     });
 
   g_lua.writeFunction("setTCPUseSinglePipe", [](bool flag) {
@@ -1805,6 +1938,14 @@ void setupLuaConfig(bool client)
         frontend->d_serverTokens = boost::get<const string>((*vars)["serverTokens"]);
       }
 
+      if (vars->count("numberOfThreads")) {
+        int numberOfThreads = boost::get<int>((*vars)["numberOfThreads"]);
+        if (numberOfThreads < 1) {
+          throw std::runtime_error("addDOHLocal: the number of threads should be at least 1, not " + std::to_string(numberOfThreads));
+        }
+        frontend->d_numberOfThreads = numberOfThreads;
+      }
+
       if (vars->count("customResponseHeaders")) {
         for (auto const& headerMap : boost::get<std::map<std::string,std::string>>((*vars)["customResponseHeaders"])) {
           std::pair<std::string,std::string> headerResponse = std::make_pair(boost::to_lower_copy(headerMap.first), headerMap.second);
@@ -1815,9 +1956,15 @@ void setupLuaConfig(bool client)
       parseTLSConfig(frontend->d_tlsConfig, "addDOHLocal", vars);
     }
     g_dohlocals.push_back(frontend);
-    auto cs = std::unique_ptr<ClientState>(new ClientState(frontend->d_local, true, reusePort, tcpFastOpenQueueSize, interface, cpus));
-    cs->dohFrontend = frontend;
-    g_frontends.push_back(std::move(cs));
+    if (frontend->d_numberOfThreads > 1) {
+      /* every thread has its own listening socket */
+      reusePort = true;
+    }
+    for (size_t idx = 0; idx < frontend->d_numberOfThreads; idx++) {
+      auto cs = std::unique_ptr<ClientState>(new ClientState(frontend->d_local, true, reusePort, tcpFastOpenQueueSize, interface, cpus));
+      cs->dohFrontend = frontend;
+      g_frontends.push_back(std::move(cs));
+    }
 #else
     throw std::runtime_error("addDOHLocal() called but DNS over HTTPS support is not present!");
 #endif
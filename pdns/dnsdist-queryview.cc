@@ -0,0 +1,111 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dnsdist-queryview.hh"
+#include "misc.hh"
+
+/* lowercase eight bytes at once (SWAR), only touching the 'A' to 'Z' range like dns_tolower() */
+static inline uint64_t toLower8(uint64_t word)
+{
+  static const uint64_t ones = 0x0101010101010101ULL;
+  static const uint64_t highBits = 0x8080808080808080ULL;
+  const uint64_t heptets = word & ~highBits;
+  /* the high bit of each byte is set if the byte is >= 'A', and if it is > 'Z' */
+  const uint64_t geA = heptets + (0x80 - 'A') * ones;
+  const uint64_t gtZ = heptets + (0x7f - 'Z') * ones;
+  const uint64_t upper = ~word & (geA ^ gtZ) & highBits;
+  return word | (upper >> 2);
+}
+
+uint32_t DNSQueryView::hashQName(const char* qname, uint16_t qnameLen)
+{
+  unsigned char lowered[256];
+  if (qnameLen > sizeof(lowered)) {
+    throw std::range_error("Computing the hash of an invalid qname");
+  }
+
+  size_t idx = 0;
+  for (; idx + sizeof(uint64_t) <= qnameLen; idx += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, qname + idx, sizeof(word));
+    word = toLower8(word);
+    memcpy(lowered + idx, &word, sizeof(word));
+  }
+  for (; idx < qnameLen; idx++) {
+    lowered[idx] = dns_tolower(qname[idx]);
+  }
+
+  return burtle(lowered, qnameLen, 0);
+}
+
+bool DNSQueryView::parse(const char* packet, uint16_t len)
+{
+  d_qname = boost::none;
+  d_packet = packet;
+  d_len = len;
+  d_qnameLen = 0;
+
+  /* header, at least the root label, qtype and qclass */
+  if (len < sizeof(dnsheader) + 1 + 4 || getHeader()->qdcount == 0) {
+    return false;
+  }
+
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(packet);
+  const size_t end = len - 4;
+  size_t pos = sizeof(dnsheader);
+  while (pos < end) {
+    const uint8_t labelLen = data[pos];
+    if (labelLen == 0) {
+      break;
+    }
+    if (labelLen & 0xc0) {
+      /* compression pointer or extended label type */
+      return false;
+    }
+    pos += labelLen + 1;
+  }
+
+  if (pos >= end || data[pos] != 0) {
+    return false;
+  }
+  pos++;
+
+  const size_t qnameLen = pos - sizeof(dnsheader);
+  if (qnameLen > 255) {
+    return false;
+  }
+
+  d_qnameLen = qnameLen;
+  d_qtype = (data[pos] << 8) + data[pos + 1];
+  d_qclass = (data[pos + 2] << 8) + data[pos + 3];
+  d_qnameHash = hashQName(getQNameWire(), d_qnameLen);
+
+  return true;
+}
+
+const DNSName& DNSQueryView::getQName()
+{
+  if (!d_qname) {
+    d_qname = DNSName(d_packet, d_len, sizeof(dnsheader), false);
+  }
+  return *d_qname;
+}
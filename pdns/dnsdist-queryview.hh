@@ -0,0 +1,154 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <boost/optional.hpp>
+
+#include "dnsname.hh"
+#include "dnsparser.hh"
+
+/* A read-only view of a DNS query, borrowing the packet buffer instead of copying it.
+   parse() validates the header and the qname in a single pass over the label lengths,
+   computing the hash of the lowercased qname used by the packet cache at the same time,
+   without any allocation. The qname is only turned into a DNSName when getQName() is
+   called.
+*/
+class DNSQueryView
+{
+public:
+  /* returns false if the packet is too short, does not hold a question or if the qname
+     is invalid or uses compression, in which case the slow path should be used instead */
+  bool parse(const char* packet, uint16_t len);
+
+  const struct dnsheader* getHeader() const
+  {
+    return reinterpret_cast<const struct dnsheader*>(d_packet);
+  }
+
+  /* the qname in wire format, case preserved */
+  const char* getQNameWire() const
+  {
+    return d_packet + sizeof(dnsheader);
+  }
+
+  uint16_t getQNameWireLength() const
+  {
+    return d_qnameLen;
+  }
+
+  /* size of the question section, qtype and qclass included */
+  uint16_t getConsumed() const
+  {
+    return d_qnameLen + 4;
+  }
+
+  uint16_t getQType() const
+  {
+    return d_qtype;
+  }
+
+  uint16_t getQClass() const
+  {
+    return d_qclass;
+  }
+
+  uint32_t getQNameHash() const
+  {
+    return d_qnameHash;
+  }
+
+  const DNSName& getQName();
+
+  /* moves the qname out of the view, which still holds an empty name afterwards */
+  DNSName releaseQName()
+  {
+    getQName();
+    return std::move(*d_qname);
+  }
+
+  /* hash of the qname in wire format, lowercased, as used by the packet cache */
+  static uint32_t hashQName(const char* qname, uint16_t qnameLen);
+
+private:
+  boost::optional<DNSName> d_qname{boost::none};
+  const char* d_packet{nullptr};
+  uint32_t d_qnameHash{0};
+  uint16_t d_len{0};
+  uint16_t d_qnameLen{0};
+  uint16_t d_qtype{0};
+  uint16_t d_qclass{0};
+};
+
+/* The qname of a DNSQuestion: either an existing DNSName, or the qname of a DNSQueryView,
+   which is then only turned into a DNSName the first time it is dereferenced, so that
+   queries that do not hit a rule looking at the qname never pay for it.
+*/
+class DNSQuestionName
+{
+public:
+  DNSQuestionName(const DNSName* name): d_name(name)
+  {
+  }
+
+  DNSQuestionName(DNSQueryView* view): d_view(view)
+  {
+  }
+
+  const DNSName& operator*() const
+  {
+    return get();
+  }
+
+  const DNSName* operator->() const
+  {
+    return &get();
+  }
+
+  /* whether the DNSName has been built already. If not, the qname is only available
+     in wire format via getWire() */
+  bool isBuilt() const
+  {
+    return d_name != nullptr;
+  }
+
+  const char* getWire() const
+  {
+    return d_view->getQNameWire();
+  }
+
+  uint16_t getWireLength() const
+  {
+    return d_name != nullptr ? d_name->wirelength() : d_view->getQNameWireLength();
+  }
+
+private:
+  const DNSName& get() const
+  {
+    if (d_name == nullptr) {
+      d_name = &d_view->getQName();
+    }
+    return *d_name;
+  }
+
+  mutable const DNSName* d_name{nullptr};
+  DNSQueryView* d_view{nullptr};
+};
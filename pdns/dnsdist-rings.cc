@@ -22,15 +22,31 @@
 
 #include "dnsdist-rings.hh"
 
+std::atomic<uint64_t> Rings::s_nextId{1};
+
+Rings::ThreadRings* Rings::acquireThreadRings()
+{
+  std::lock_guard<std::mutex> lock(d_threadRings->lock);
+  /* reuse the rings of a thread that has exited, keeping their entries */
+  for (auto& rings : d_threadRings->rings) {
+    if (!rings->inUse) {
+      rings->inUse = true;
+      return rings.get();
+    }
+  }
+
+  d_threadRings->rings.push_back(std::unique_ptr<ThreadRings>(new ThreadRings(d_perThreadCapacity)));
+  auto& rings = d_threadRings->rings.back();
+  rings->inUse = true;
+  return rings.get();
+}
+
 size_t Rings::numDistinctRequestors()
 {
   std::set<ComboAddress, ComboAddress::addressOnlyLessThan> s;
-  for (const auto& shard : d_shards) {
-    std::lock_guard<std::mutex> rl(shard->queryLock);
-    for(const auto& q : shard->queryRing) {
+  forEachQuery([&s](const Query& q) {
       s.insert(q.requestor);
-    }
-  }
+    });
   return s.size();
 }
 
@@ -38,22 +54,14 @@ std::unordered_map<int, vector<boost::variant<string,double>>> Rings::getTopBand
 {
   map<ComboAddress, unsigned int, ComboAddress::addressOnlyLessThan> counts;
   uint64_t total=0;
-  for (const auto& shard : d_shards) {
-    {
-      std::lock_guard<std::mutex> rl(shard->queryLock);
-      for(const auto& q : shard->queryRing) {
-        counts[q.requestor]+=q.size;
-        total+=q.size;
-      }
-    }
-    {
-      std::lock_guard<std::mutex> rl(shard->respLock);
-      for(const auto& r : shard->respRing) {
-        counts[r.requestor]+=r.size;
-        total+=r.size;
-      }
-    }
-  }
+  forEachQuery([&counts, &total](const Query& q) {
+      counts[q.requestor]+=q.size;
+      total+=q.size;
+    });
+  forEachResponse([&counts, &total](const Response& r) {
+      counts[r.requestor]+=r.size;
+      total+=r.size;
+    });
 
   typedef vector<pair<unsigned int, ComboAddress>> ret_t;
   ret_t rcounts;
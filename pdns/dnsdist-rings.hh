@@ -21,16 +21,97 @@
  */
 #pragma once
 
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <time.h>
 #include <unordered_map>
+#include <vector>
 
 #include <boost/variant.hpp>
 
 #include "circular_buffer.hh"
+#include "dnsdist-sketches.hh"
 #include "dnsname.hh"
 #include "iputils.hh"
 
+/* A ring buffer with a single writer, the thread owning it, that never takes a lock.
+   Every slot has a sequence number, incremented before and after the entry is written,
+   so readers copy the entry and then check that the sequence number still matches the
+   one expected for that position, discarding entries overwritten while being copied.
+   The entries have to be trivially copyable. */
+template<typename T>
+class SingleWriterRing
+{
+public:
+  SingleWriterRing(size_t capacity): d_slots(capacity > 0 ? capacity : 1)
+  {
+  }
+
+  /* only the owning thread is allowed to call this one */
+  template<typename F> void push(const F& fill)
+  {
+    const uint64_t pos = d_pos.load(std::memory_order_relaxed);
+    auto& slot = d_slots[pos % d_slots.size()];
+    const uint64_t seq = slot.d_seq.load(std::memory_order_relaxed);
+    slot.d_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    fill(slot.d_entry);
+    slot.d_seq.store(seq + 2, std::memory_order_release);
+    d_pos.store(pos + 1, std::memory_order_release);
+  }
+
+  template<typename F> void visit(const F& visitor) const
+  {
+    const uint64_t pos = d_pos.load(std::memory_order_acquire);
+    const uint64_t start = std::max(d_start.load(std::memory_order_acquire), pos > d_slots.size() ? pos - d_slots.size() : 0);
+
+    T entry;
+    for (uint64_t idx = start; idx < pos; idx++) {
+      const auto& slot = d_slots[idx % d_slots.size()];
+      /* the slot for position 'idx' has been written (idx / size) + 1 times */
+      const uint64_t expected = ((idx / d_slots.size()) + 1) * 2;
+      if (slot.d_seq.load(std::memory_order_acquire) != expected) {
+        continue;
+      }
+      memcpy(&entry, &slot.d_entry, sizeof(entry));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.d_seq.load(std::memory_order_relaxed) != expected) {
+        continue;
+      }
+      visitor(entry);
+    }
+  }
+
+  size_t size() const
+  {
+    const uint64_t pos = d_pos.load(std::memory_order_acquire);
+    const uint64_t start = std::max(d_start.load(std::memory_order_acquire), pos > d_slots.size() ? pos - d_slots.size() : 0);
+    return pos - start;
+  }
+
+  size_t capacity() const
+  {
+    return d_slots.size();
+  }
+
+  /* safe to call from any thread, the existing entries are not removed but ignored from now on */
+  void clear()
+  {
+    d_start.store(d_pos.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+private:
+  struct Slot
+  {
+    std::atomic<uint64_t> d_seq{0};
+    T d_entry;
+  };
+
+  std::vector<Slot> d_slots;
+  std::atomic<uint64_t> d_pos{0};
+  std::atomic<uint64_t> d_start{0};
+};
 
 struct Rings {
   struct Query
@@ -54,6 +135,51 @@ struct Rings {
     ComboAddress ds; // who handled it
   };
 
+  /* trivially copyable versions of the entries above, with the name in wire format,
+     used by the per-thread rings */
+  struct PackedQuery
+  {
+    struct timespec when;
+    ComboAddress requestor;
+    struct dnsheader dh;
+    uint16_t size;
+    uint16_t qtype;
+    uint8_t nameLen;
+    char name[255];
+  };
+  struct PackedResponse
+  {
+    struct timespec when;
+    ComboAddress requestor;
+    ComboAddress ds;
+    struct dnsheader dh;
+    unsigned int usec;
+    unsigned int size;
+    uint16_t qtype;
+    uint8_t nameLen;
+    char name[255];
+  };
+
+  struct ThreadRings
+  {
+    ThreadRings(size_t capacity): queryRing(capacity), respRing(capacity)
+    {
+    }
+
+    SingleWriterRing<PackedQuery> queryRing;
+    SingleWriterRing<PackedResponse> respRing;
+    /* whether a thread is currently writing to these rings, protected by the lock of the registry */
+    bool inUse{false};
+  };
+
+  /* the per-thread rings of a Rings object. The rings of a thread that exited are kept, so that
+     their entries can still be inspected, and handed over to the next thread needing rings */
+  struct ThreadRingsRegistry
+  {
+    std::vector<std::unique_ptr<ThreadRings>> rings;
+    std::mutex lock;
+  };
+
   struct Shard
   {
     boost::circular_buffer<Query> queryRing;
@@ -62,7 +188,7 @@ struct Rings {
     std::mutex respLock;
   };
 
-  Rings(size_t capacity=10000, size_t numberOfShards=1, size_t nbLockTries=5, bool keepLockingStats=false): d_blockingQueryInserts(0), d_blockingResponseInserts(0), d_deferredQueryInserts(0), d_deferredResponseInserts(0), d_nbQueryEntries(0), d_nbResponseEntries(0), d_currentShardId(0), d_numberOfShards(numberOfShards), d_nbLockTries(nbLockTries), d_keepLockingStats(keepLockingStats)
+  Rings(size_t capacity=10000, size_t numberOfShards=1, size_t nbLockTries=5, bool keepLockingStats=false): d_blockingQueryInserts(0), d_blockingResponseInserts(0), d_deferredQueryInserts(0), d_deferredResponseInserts(0), d_nbQueryEntries(0), d_nbResponseEntries(0), d_currentShardId(0), d_id(s_nextId++), d_numberOfShards(numberOfShards), d_nbLockTries(nbLockTries), d_keepLockingStats(keepLockingStats)
   {
     setCapacity(capacity, numberOfShards);
     if (numberOfShards <= 1) {
@@ -80,6 +206,7 @@ struct Rings {
 
     d_shards.resize(numberOfShards);
     d_numberOfShards = numberOfShards;
+    d_perThreadCapacity = newCapacity / numberOfShards;
 
     /* resize all the rings */
     for (auto& shard : d_shards) {
@@ -113,18 +240,148 @@ struct Rings {
     return d_numberOfShards;
   }
 
+  /* This function should only be called at configuration time before any query or response has been inserted.
+     Every thread inserting queries or responses then gets its own rings, of capacity / numberOfShards entries,
+     instead of using the shared, locked, shards. */
+  void setPerThreadRings(bool enabled)
+  {
+    d_perThread = enabled;
+  }
+
+  bool hasPerThreadRings() const
+  {
+    return d_perThread;
+  }
+
+  /* the number of per-thread rings allocated so far, which is the largest number of threads
+     that have been inserting entries at the same time */
+  size_t getNumberOfThreadRings() const
+  {
+    std::lock_guard<std::mutex> lock(d_threadRings->lock);
+    return d_threadRings->rings.size();
+  }
+
+  /* the number of entries over all the shards or, with per-thread rings, over the rings of all
+     the threads, exited ones included. Since each thread gets capacity / numberOfShards entries,
+     this can exceed the capacity when more threads than shards are inserting entries */
   size_t getNumberOfQueryEntries() const
   {
+    if (d_perThread) {
+      size_t total = 0;
+      std::lock_guard<std::mutex> lock(d_threadRings->lock);
+      for (const auto& rings : d_threadRings->rings) {
+        total += rings->queryRing.size();
+      }
+      return total;
+    }
     return d_nbQueryEntries;
   }
 
   size_t getNumberOfResponseEntries() const
   {
+    if (d_perThread) {
+      size_t total = 0;
+      std::lock_guard<std::mutex> lock(d_threadRings->lock);
+      for (const auto& rings : d_threadRings->rings) {
+        total += rings->respRing.size();
+      }
+      return total;
+    }
     return d_nbResponseEntries;
   }
 
+  /* calls the visitor for every query present in the rings. The per-thread rings are
+     read without blocking the writers, entries overwritten while being read are skipped */
+  template<typename F> void forEachQuery(const F& visitor) const
+  {
+    if (d_perThread) {
+      Query query;
+      std::lock_guard<std::mutex> lock(d_threadRings->lock);
+      for (const auto& rings : d_threadRings->rings) {
+        rings->queryRing.visit([&visitor,&query](const PackedQuery& packed) {
+            query.when = packed.when;
+            query.requestor = packed.requestor;
+            query.name = unpackName(packed.name, packed.nameLen);
+            query.size = packed.size;
+            query.qtype = packed.qtype;
+            query.dh = packed.dh;
+            visitor(query);
+          });
+      }
+      return;
+    }
+
+    for (const auto& shard : d_shards) {
+      std::lock_guard<std::mutex> rl(shard->queryLock);
+      for (const auto& query : shard->queryRing) {
+        visitor(query);
+      }
+    }
+  }
+
+  template<typename F> void forEachResponse(const F& visitor) const
+  {
+    if (d_perThread) {
+      Response response;
+      std::lock_guard<std::mutex> lock(d_threadRings->lock);
+      for (const auto& rings : d_threadRings->rings) {
+        rings->respRing.visit([&visitor,&response](const PackedResponse& packed) {
+            response.when = packed.when;
+            response.requestor = packed.requestor;
+            response.name = unpackName(packed.name, packed.nameLen);
+            response.qtype = packed.qtype;
+            response.usec = packed.usec;
+            response.size = packed.size;
+            response.dh = packed.dh;
+            response.ds = packed.ds;
+            visitor(response);
+          });
+      }
+      return;
+    }
+
+    for (const auto& shard : d_shards) {
+      std::lock_guard<std::mutex> rl(shard->respLock);
+      for (const auto& response : shard->respRing) {
+        visitor(response);
+      }
+    }
+  }
+
+  /* This function should only be called at configuration time before any query or response has been inserted.
+     A capacity of 0 disables the sketches. */
+  void enableSketches(size_t capacity, size_t window)
+  {
+    if (capacity == 0) {
+      d_sketches.reset();
+      return;
+    }
+    d_sketches = std::unique_ptr<DynBlockSketches>(new DynBlockSketches(capacity, window));
+  }
+
+  DynBlockSketches* getSketches() const
+  {
+    return d_sketches.get();
+  }
+
   void insertQuery(const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, uint16_t size, const struct dnsheader& dh)
   {
+    if (d_sketches) {
+      d_sketches->insertQuery(when, requestor, qtype);
+    }
+
+    if (d_perThread) {
+      getThreadRings().queryRing.push([&](PackedQuery& entry) {
+          entry.when = when;
+          entry.requestor = requestor;
+          entry.dh = dh;
+          entry.size = size;
+          entry.qtype = qtype;
+          packName(name, entry.name, entry.nameLen);
+        });
+      return;
+    }
+
     for (size_t idx = 0; idx < d_nbLockTries; idx++) {
       auto& shard = getOneShard();
       std::unique_lock<std::mutex> wl(shard->queryLock, std::try_to_lock);
@@ -146,8 +403,50 @@ struct Rings {
     insertQueryLocked(shard, when, requestor, name, qtype, size, dh);
   }
 
+  /* same as above with the qname in wire format, which saves building a DNSName when
+     per-thread rings are in use */
+  void insertQuery(const struct timespec& when, const ComboAddress& requestor, const char* name, uint16_t nameLen, uint16_t qtype, uint16_t size, const struct dnsheader& dh)
+  {
+    if (!d_perThread) {
+      insertQuery(when, requestor, unpackName(name, static_cast<uint8_t>(std::min(nameLen, static_cast<uint16_t>(255)))), qtype, size, dh);
+      return;
+    }
+
+    if (d_sketches) {
+      d_sketches->insertQuery(when, requestor, qtype);
+    }
+
+    getThreadRings().queryRing.push([&](PackedQuery& entry) {
+        entry.when = when;
+        entry.requestor = requestor;
+        entry.dh = dh;
+        entry.size = size;
+        entry.qtype = qtype;
+        entry.nameLen = static_cast<uint8_t>(std::min(nameLen, static_cast<uint16_t>(255)));
+        memcpy(entry.name, name, entry.nameLen);
+      });
+  }
+
   void insertResponse(const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, unsigned int usec, unsigned int size, const struct dnsheader& dh, const ComboAddress& backend)
   {
+    if (d_sketches) {
+      d_sketches->insertResponse(when, requestor, dh.rcode, size);
+    }
+
+    if (d_perThread) {
+      getThreadRings().respRing.push([&](PackedResponse& entry) {
+          entry.when = when;
+          entry.requestor = requestor;
+          entry.ds = backend;
+          entry.dh = dh;
+          entry.usec = usec;
+          entry.size = size;
+          entry.qtype = qtype;
+          packName(name, entry.name, entry.nameLen);
+        });
+      return;
+    }
+
     for (size_t idx = 0; idx < d_nbLockTries; idx++) {
       auto& shard = getOneShard();
       std::unique_lock<std::mutex> wl(shard->respLock, std::try_to_lock);
@@ -182,6 +481,18 @@ struct Rings {
       }
     }
 
+    {
+      std::lock_guard<std::mutex> lock(d_threadRings->lock);
+      for (auto& rings : d_threadRings->rings) {
+        rings->queryRing.clear();
+        rings->respRing.clear();
+      }
+    }
+
+    if (d_sketches) {
+      d_sketches->clear();
+    }
+
     d_nbQueryEntries.store(0);
     d_nbResponseEntries.store(0);
     d_currentShardId.store(0);
@@ -208,6 +519,64 @@ private:
     return d_shards[getShardId()];
   }
 
+  /* the rings of the last Rings object a thread inserted into, released when the thread exits
+     so that they can be reused by another one */
+  struct ThreadRingsHandle
+  {
+    ~ThreadRingsHandle()
+    {
+      release();
+    }
+
+    void release()
+    {
+      /* the Rings object, and thus the rings, might already be gone */
+      auto registry = d_registry.lock();
+      if (registry && d_rings != nullptr) {
+        std::lock_guard<std::mutex> lock(registry->lock);
+        d_rings->inUse = false;
+      }
+      d_registry.reset();
+      d_rings = nullptr;
+      d_ringsId = 0;
+    }
+
+    std::weak_ptr<ThreadRingsRegistry> d_registry;
+    ThreadRings* d_rings{nullptr};
+    uint64_t d_ringsId{0};
+  };
+
+  ThreadRings& getThreadRings()
+  {
+    /* the Rings object is identified by a unique ID instead of its address so that
+       a new object at the same address does not get the rings of a destroyed one */
+    static thread_local ThreadRingsHandle t_handle;
+    if (t_handle.d_ringsId != d_id) {
+      t_handle.release();
+      t_handle.d_rings = acquireThreadRings();
+      t_handle.d_registry = d_threadRings;
+      t_handle.d_ringsId = d_id;
+    }
+    return *t_handle.d_rings;
+  }
+
+  ThreadRings* acquireThreadRings();
+
+  static void packName(const DNSName& name, char* out, uint8_t& outLen)
+  {
+    const auto& storage = name.getStorage();
+    outLen = static_cast<uint8_t>(std::min(storage.size(), static_cast<size_t>(255)));
+    memcpy(out, storage.data(), outLen);
+  }
+
+  static DNSName unpackName(const char* name, uint8_t nameLen)
+  {
+    if (nameLen == 0) {
+      return DNSName();
+    }
+    return DNSName(name, nameLen, 0, false);
+  }
+
   void insertQueryLocked(std::unique_ptr<Shard>& shard, const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, uint16_t size, const struct dnsheader& dh)
   {
     if (!shard->queryRing.full()) {
@@ -224,13 +593,20 @@ private:
     shard->respRing.push_back({when, requestor, name, qtype, usec, size, dh, backend});
   }
 
+  static std::atomic<uint64_t> s_nextId;
+
+  std::shared_ptr<ThreadRingsRegistry> d_threadRings{std::make_shared<ThreadRingsRegistry>()};
+  std::unique_ptr<DynBlockSketches> d_sketches{nullptr};
   std::atomic<size_t> d_nbQueryEntries;
   std::atomic<size_t> d_nbResponseEntries;
   std::atomic<size_t> d_currentShardId;
 
+  const uint64_t d_id;
   size_t d_numberOfShards;
+  size_t d_perThreadCapacity{0};
   size_t d_nbLockTries = 5;
   bool d_keepLockingStats{false};
+  bool d_perThread{false};
 };
 
 extern Rings g_rings;
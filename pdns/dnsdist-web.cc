@@ -245,6 +245,22 @@ static json11::Json::array someResponseRulesToJson(GlobalStateHolder<vector<T>>*
   return responseRules;
 }
 
+static void addPrometheusLatencyHistogram(std::ostringstream& output, const std::string& name, const std::string& labels, const LatencyHistogram::Snapshot& snapshot)
+{
+  /* the histogram itself has much finer buckets, we only export a subset of the boundaries, in milliseconds */
+  static const std::vector<std::pair<uint64_t, std::string>> boundaries = {
+    { 100, "0.1" }, { 250, "0.25" }, { 500, "0.5" }, { 1000, "1" }, { 2500, "2.5" }, { 5000, "5" }, { 10000, "10" },
+    { 25000, "25" }, { 50000, "50" }, { 100000, "100" }, { 250000, "250" }, { 500000, "500" }, { 1000000, "1000" }
+  };
+
+  for (const auto& boundary : boundaries) {
+    output << name << "_bucket{" << labels << ",le=\"" << boundary.second << "\"} " << snapshot.getCountUpTo(boundary.first) << "\n";
+  }
+  output << name << "_bucket{" << labels << ",le=\"+Inf\"} " << snapshot.getCount() << "\n";
+  output << name << "_sum{" << labels << "} " << snapshot.getSum() / 1000.0 << "\n";
+  output << name << "_count{" << labels << "} " << snapshot.getCount() << "\n";
+}
+
 static void connectionThread(int sock, ComboAddress remote)
 {
   setThreadName("dnsdist/webConn");
@@ -397,6 +413,29 @@ static void connectionThread(int sock, ComboAddress remote)
         resp.body=my_json.dump();
         resp.headers["Content-Type"] = "application/json";
       }
+      else if(command=="xdpblocklist") {
+        Json::object obj;
+#ifdef HAVE_XDP_FILTER
+        struct timespec now;
+        gettime(&now);
+        for (const auto& xdp : g_xdpFilters) {
+          for (const auto& entry : xdp->getEntries()) {
+            Json::object thing
+            {
+              {"interface", xdp->getInterface()},
+              {"seconds", entry.d_until ? (double)(entry.d_until->tv_sec - now.tv_sec) : -1.0},
+              {"blocks", (double)entry.d_counter},
+              {"qps", (double)entry.d_qps},
+              {"burst", (double)entry.d_burst}
+            };
+            obj.insert({entry.d_netmask.toString(), thing});
+          }
+        }
+#endif /* HAVE_XDP_FILTER */
+        Json my_json = obj;
+        resp.body=my_json.dump();
+        resp.headers["Content-Type"] = "application/json";
+      }
       else {
         resp.status=404;
       }
@@ -475,6 +514,8 @@ static void connectionThread(int sock, ComboAddress remote)
         output << "# TYPE " << statesbase << "drops "                  << "counter"                                                           << "\n";
         output << "# HELP " << statesbase << "latency "                << "Server's latency when answering questions in milliseconds"         << "\n";
         output << "# TYPE " << statesbase << "latency "                << "gauge"                                                             << "\n";
+        output << "# HELP " << statesbase << "healthchecklatency "     << "Server's latency when answering the last successful health check in milliseconds" << "\n";
+        output << "# TYPE " << statesbase << "healthchecklatency "     << "gauge"                                                             << "\n";
         output << "# HELP " << statesbase << "senderrors "             << "Total number of OS send errors while relaying queries"              << "\n";
         output << "# TYPE " << statesbase << "senderrors "             << "counter"                                                           << "\n";
         output << "# HELP " << statesbase << "outstanding "            << "Current number of queries that are waiting for a backend response" << "\n";
@@ -499,6 +540,10 @@ static void connectionThread(int sock, ComboAddress remote)
         output << "# TYPE " << statesbase << "tcpavgqueriesperconn "   << "gauge"                                                             << "\n";
         output << "# HELP " << statesbase << "tcpavgconnduration "     << "The average duration of a TCP connection (ms)"                     << "\n";
         output << "# TYPE " << statesbase << "tcpavgconnduration "     << "gauge"                                                             << "\n";
+        output << "# HELP " << statesbase << "p2cselections "          << "The number of times this server has been selected by the powerOfTwoChoices policy" << "\n";
+        output << "# TYPE " << statesbase << "p2cselections "          << "counter"                                                           << "\n";
+        output << "# HELP " << statesbase << "latency_histogram "      << "Histogram of the server's latency when answering UDP questions in milliseconds" << "\n";
+        output << "# TYPE " << statesbase << "latency_histogram "      << "histogram"                                                         << "\n";
 
         for (const auto& state : *states) {
           string serverName;
@@ -510,13 +555,15 @@ static void connectionThread(int sock, ComboAddress remote)
 
           boost::replace_all(serverName, ".", "_");
 
-          const std::string label = boost::str(boost::format("{server=\"%1%\",address=\"%2%\"}")
+          const std::string labels = boost::str(boost::format("server=\"%1%\",address=\"%2%\"")
             % serverName % state->remote.toStringWithPort());
+          const std::string label = "{" + labels + "}";
 
           output << statesbase << "queries"                << label << " " << state->queries.load()             << "\n";
           output << statesbase << "responses"              << label << " " << state->responses.load()           << "\n";
           output << statesbase << "drops"                  << label << " " << state->reuseds.load()             << "\n";
           output << statesbase << "latency"                << label << " " << state->latencyUsec/1000.0         << "\n";
+          output << statesbase << "healthchecklatency"     << label << " " << state->checkLatencyUsec/1000.0    << "\n";
           output << statesbase << "senderrors"             << label << " " << state->sendErrors.load()          << "\n";
           output << statesbase << "outstanding"            << label << " " << state->outstanding.load()         << "\n";
           output << statesbase << "order"                  << label << " " << state->order                      << "\n";
@@ -529,6 +576,8 @@ static void connectionThread(int sock, ComboAddress remote)
           output << statesbase << "tcpcurrentconnections"  << label << " " << state->tcpCurrentConnections      << "\n";
           output << statesbase << "tcpavgqueriesperconn"   << label << " " << state->tcpAvgQueriesPerConnection << "\n";
           output << statesbase << "tcpavgconnduration"     << label << " " << state->tcpAvgConnectionDuration   << "\n";
+          output << statesbase << "p2cselections"          << label << " " << state->p2cSelections              << "\n";
+          addPrometheusLatencyHistogram(output, statesbase + "latency_histogram", labels, state->latencyHistogram.getSnapshot());
         }
 
         const string frontsbase = "dnsdist_frontend_";
@@ -565,6 +614,18 @@ static void connectionThread(int sock, ComboAddress remote)
 
         output << "# HELP " << frontsbase << "tlshandshakefailures " << "Amount of TLS handshake failures" << "\n";
         output << "# TYPE " << frontsbase << "tlshandshakefailures " << "counter" << "\n";
+        output << "# HELP " << frontsbase << "packetringframes " << "Amount of frames received from the packet ring" << "\n";
+        output << "# TYPE " << frontsbase << "packetringframes " << "counter" << "\n";
+        output << "# HELP " << frontsbase << "packetringignoredframes " << "Amount of frames received from the packet ring that did not contain a valid query for this frontend" << "\n";
+        output << "# TYPE " << frontsbase << "packetringignoredframes " << "counter" << "\n";
+        output << "# HELP " << frontsbase << "packetringresponses " << "Amount of responses sent via the packet ring" << "\n";
+        output << "# TYPE " << frontsbase << "packetringresponses " << "counter" << "\n";
+        output << "# HELP " << frontsbase << "packetringfallbackresponses " << "Amount of responses that could not be sent via the packet ring and were sent from the UDP socket instead" << "\n";
+        output << "# TYPE " << frontsbase << "packetringfallbackresponses " << "counter" << "\n";
+        output << "# HELP " << frontsbase << "hotcachehits " << "Amount of queries answered from the hot cache of this frontend, before the rules are applied" << "\n";
+        output << "# TYPE " << frontsbase << "hotcachehits " << "counter" << "\n";
+        output << "# HELP " << frontsbase << "latency_histogram " << "Histogram of the latency of the responses received from a backend over UDP, in milliseconds" << "\n";
+        output << "# TYPE " << frontsbase << "latency_histogram " << "histogram" << "\n";
 
         std::map<std::string,uint64_t> frontendDuplicates;
         for (const auto& front : g_frontends) {
@@ -580,11 +641,22 @@ static void connectionThread(int sock, ComboAddress remote)
             threadNumber = dupPair.first->second;
             ++(dupPair.first->second);
           }
-          const std::string label = boost::str(boost::format("{frontend=\"%1%\",proto=\"%2%\",thread=\"%3%\"} ")
+          const std::string labels = boost::str(boost::format("frontend=\"%1%\",proto=\"%2%\",thread=\"%3%\"")
             % frontName % proto % threadNumber);
+          const std::string label = "{" + labels + "} ";
 
           output << frontsbase << "queries" << label << front->queries.load() << "\n";
           output << frontsbase << "responses" << label << front->responses.load() << "\n";
+          if (front->hotCache != nullptr) {
+            output << frontsbase << "hotcachehits" << label << front->hotCacheHits.load() << "\n";
+          }
+          addPrometheusLatencyHistogram(output, frontsbase + "latency_histogram", labels, front->latencyHistogram.getSnapshot());
+          if (front->packetRing != nullptr) {
+            output << frontsbase << "packetringframes" << label << front->packetRing->d_frames.load() << "\n";
+            output << frontsbase << "packetringignoredframes" << label << front->packetRing->d_ignoredFrames.load() << "\n";
+            output << frontsbase << "packetringresponses" << label << front->packetRing->d_ringResponses.load() << "\n";
+            output << frontsbase << "packetringfallbackresponses" << label << front->packetRing->d_fallbackResponses.load() << "\n";
+          }
           if (front->isTCP()) {
             output << frontsbase << "tcpdiedreadingquery" << label << front->tcpDiedReadingQuery.load() << "\n";
             output << frontsbase << "tcpdiedsendingresponse" << label << front->tcpDiedSendingResponse.load() << "\n";
@@ -693,6 +765,8 @@ static void connectionThread(int sock, ComboAddress remote)
         output << "# TYPE dnsdist_pool_servers " << "gauge" << "\n";
         output << "# HELP dnsdist_pool_active_servers " << "Number of available servers in that pool" << "\n";
         output << "# TYPE dnsdist_pool_active_servers " << "gauge" << "\n";
+        output << "# HELP dnsdist_pool_latency_histogram " << "Histogram of the latency of the servers in that pool when answering UDP questions in milliseconds" << "\n";
+        output << "# TYPE dnsdist_pool_latency_histogram " << "histogram" << "\n";
 
         output << "# HELP dnsdist_pool_cache_size " << "Maximum number of entries that this cache can hold" << "\n";
         output << "# TYPE dnsdist_pool_cache_size " << "gauge" << "\n";
@@ -719,10 +793,12 @@ static void connectionThread(int sock, ComboAddress remote)
           if (poolName.empty()) {
             poolName = "_default_";
           }
-          const string label = "{pool=\"" + poolName + "\"}";
+          const string labels = "pool=\"" + poolName + "\"";
+          const string label = "{" + labels + "}";
           const std::shared_ptr<ServerPool> pool = entry.second;
           output << "dnsdist_pool_servers" << label << " " << pool->countServers(false) << "\n";
           output << "dnsdist_pool_active_servers" << label << " " << pool->countServers(true) << "\n";
+          addPrometheusLatencyHistogram(output, "dnsdist_pool_latency_histogram", labels, pool->getLatencySnapshot());
 
           if (pool->packetCache != nullptr) {
             const auto& cache = pool->packetCache;
@@ -776,6 +852,7 @@ static void connectionThread(int sock, ComboAddress remote)
           {"order", (double)a->order},
           {"pools", pools},
           {"latency", (double)(a->latencyUsec/1000.0)},
+          {"healthCheckLatency", (double)(a->checkLatencyUsec/1000.0)},
           {"queries", (double)a->queries},
           {"responses", (double)a->responses},
           {"sendErrors", (double)a->sendErrors},
@@ -787,6 +864,7 @@ static void connectionThread(int sock, ComboAddress remote)
           {"tcpCurrentConnections", (double)a->tcpCurrentConnections},
           {"tcpAvgQueriesPerConnection", (double)a->tcpAvgQueriesPerConnection},
           {"tcpAvgConnectionDuration", (double)a->tcpAvgConnectionDuration},
+          {"p2cSelections", (double)a->p2cSelections},
           {"dropRate", (double)a->dropRate}
         };
 
@@ -819,6 +897,7 @@ static void connectionThread(int sock, ComboAddress remote)
           { "tcpCurrentConnections", (double) front->tcpCurrentConnections },
           { "tcpAvgQueriesPerConnection", (double) front->tcpAvgQueriesPerConnection },
           { "tcpAvgConnectionDuration", (double) front->tcpAvgConnectionDuration },
+          { "hotCacheHits", (double) front->hotCacheHits },
           { "tlsNewSessions", (double) front->tlsNewSessions },
           { "tlsResumptions", (double) front->tlsResumptions },
           { "tlsUnknownTicketKey", (double) front->tlsUnknownTicketKey },
@@ -836,6 +915,12 @@ static void connectionThread(int sock, ComboAddress remote)
         else if (front->dohFrontend != nullptr) {
           errorCounters = &front->dohFrontend->d_tlsCounters;
         }
+        if (front->packetRing != nullptr) {
+          frontend["packetRingFrames"] = (double)front->packetRing->d_frames;
+          frontend["packetRingIgnoredFrames"] = (double)front->packetRing->d_ignoredFrames;
+          frontend["packetRingResponses"] = (double)front->packetRing->d_ringResponses;
+          frontend["packetRingFallbackResponses"] = (double)front->packetRing->d_fallbackResponses;
+        }
         if (errorCounters != nullptr) {
           frontend["tlsHandshakeFailuresDHKeyTooSmall"] = (double)errorCounters->d_dhKeyTooSmall;
           frontend["tlsHandshakeFailuresInappropriateFallBack"] = (double)errorCounters->d_inappropriateFallBack;
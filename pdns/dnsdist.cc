@@ -28,6 +28,7 @@
 #include <limits>
 #include <netinet/tcp.h>
 #include <pwd.h>
+#include <random>
 #include <sys/resource.h>
 #include <unistd.h>
 
@@ -43,9 +44,13 @@
 
 #include "dnsdist.hh"
 #include "dnsdist-cache.hh"
+#include "dnsdist-compiled-rules.hh"
 #include "dnsdist-console.hh"
 #include "dnsdist-ecs.hh"
+#include "dnsdist-healthchecks.hh"
 #include "dnsdist-lua.hh"
+#include "dnsdist-maglev.hh"
+#include "dnsdist-queryview.hh"
 #include "dnsdist-rings.hh"
 #include "dnsdist-secpoll.hh"
 #include "dnsdist-xpf.hh"
@@ -98,6 +103,9 @@ std::vector<std::shared_ptr<DNSCryptContext>> g_dnsCryptLocals;
 #ifdef HAVE_EBPF
 shared_ptr<BPFFilter> g_defaultBPFFilter;
 std::vector<std::shared_ptr<DynBPFFilter> > g_dynBPFFilters;
+#ifdef HAVE_XDP_FILTER
+std::vector<std::shared_ptr<XDPFilter> > g_xdpFilters;
+#endif /* HAVE_XDP_FILTER */
 #endif /* HAVE_EBPF */
 std::vector<std::unique_ptr<ClientState>> g_frontends;
 GlobalStateHolder<pools_t> g_pools;
@@ -137,6 +145,7 @@ DNSAction::Action g_dynBlockAction = DNSAction::Action::Drop;
 int g_tcpRecvTimeout{2};
 int g_tcpSendTimeout{2};
 int g_udpTimeout{2};
+std::atomic<unsigned int> g_udpTimeoutCheckInterval{100};
 
 bool g_servFailOnNoPolicy{false};
 bool g_truncateTC{false};
@@ -560,10 +569,6 @@ try {
         /* read the potential DOHUnit state as soon as possible, but don't use it
            until we have confirmed that we own this state by updating usageIndicator */
         auto du = ids->du;
-        /* setting age to 0 to prevent the maintainer thread from
-           cleaning this IDS while we process the response.
-        */
-        ids->age = 0;
         int origFD = ids->origFD;
 
         unsigned int consumed = 0;
@@ -614,13 +619,10 @@ try {
 #ifdef HAVE_DNS_OVER_HTTPS
             // DoH query
             du->response = std::string(response, responseLen);
-            if (send(du->rsock, &du, sizeof(du), 0) != sizeof(du)) {
-              /* at this point we have the only remaining pointer on this
-                 DOHUnit object since we did set ids->du to nullptr earlier,
-                 except if we got the response before the pointer could be
-                 released by the frontend */
-              du->release();
-            }
+            /* at this point we hold the pointer that was stored in the IDS,
+               since we did set ids->du to nullptr earlier, and we pass it
+               to the DoH thread */
+            queueDOHUnitResponse(du);
 #endif /* HAVE_DNS_OVER_HTTPS */
             du = nullptr;
           }
@@ -660,6 +662,10 @@ try {
           break;
         }
         dss->latencyUsec = (127.0 * dss->latencyUsec / 128.0) + udiff/128.0;
+        dss->latencyHistogram.record(udiff);
+        if (ids->cs) {
+          ids->cs->latencyHistogram.record(udiff);
+        }
 
         doLatencyStats(udiff);
 
@@ -774,6 +780,7 @@ void DownstreamState::setId(const boost::uuids::uuid& newId)
   if (!hashes.empty()) {
     hash();
   }
+  ++g_maglevGeneration;
 }
 
 void DownstreamState::setWeight(int newWeight)
@@ -786,6 +793,23 @@ void DownstreamState::setWeight(int newWeight)
   if (!hashes.empty()) {
     hash();
   }
+  ++g_maglevGeneration;
+}
+
+void DownstreamState::updateLatencyPercentile(double percentile)
+{
+  /* only use the latencies recorded since the last update, so that the value reflects
+     the current behaviour of the server, but wait until we have enough of them */
+  static const uint64_t minimumSamples = 10;
+  auto current = latencyHistogram.getSnapshot();
+  const auto window = current.getDelta(latencyWindowStart);
+  if (window.getCount() >= minimumSamples) {
+    latencyPercentileUsec = window.getPercentile(percentile);
+    latencyWindowStart = std::move(current);
+  }
+  /* otherwise keep the last value, and keep accumulating latencies until we have enough of them.
+     The lowestLatency policy still sends a share of the queries to a slow server, so it does
+     not need to pretend that the server got faster to measure it again */
 }
 
 DownstreamState::DownstreamState(const ComboAddress& remote_, const ComboAddress& sourceAddr_, unsigned int sourceItf_, const std::string& sourceItfName_, size_t numberOfSockets): sourceItfName(sourceItfName_), remote(remote_), sourceAddr(sourceAddr_), sourceItf(sourceItf_)
@@ -793,6 +817,7 @@ DownstreamState::DownstreamState(const ComboAddress& remote_, const ComboAddress
   pthread_rwlock_init(&d_lock, nullptr);
   id = getUniqueID();
   threadStarted.clear();
+  ++g_maglevGeneration;
 
   mplexer = std::unique_ptr<FDMultiplexer>(FDMultiplexer::getMultiplexerSilent());
 
@@ -846,6 +871,120 @@ shared_ptr<DownstreamState> leastOutstanding(const NumberedServerVector& servers
   return poss.begin()->second;
 }
 
+std::atomic<double> g_latencyPolicyPercentile{99.0};
+
+shared_ptr<DownstreamState> lowestLatency(const NumberedServerVector& servers, const DNSQuestion* dq)
+{
+  /* the percentile is computed every second by the maintenance thread, from the latency histogram of each server.
+     Always sending to the fastest one would overload it, and the others would not be measured anymore,
+     so the server is picked randomly, weighted by the inverse of its latency times its load */
+  static thread_local std::minstd_rand t_generator(random());
+
+  vector<pair<double, const shared_ptr<DownstreamState>*>> poss;
+  poss.reserve(servers.size());
+  uint64_t measuredSum = 0;
+  size_t measuredCount = 0;
+  for (const auto& d : servers) {
+    if (!d.second->isUp()) {
+      continue;
+    }
+    const uint64_t latency = d.second->latencyPercentileUsec.load();
+    if (latency > 0) {
+      measuredSum += latency;
+      measuredCount++;
+    }
+    poss.push_back({static_cast<double>(latency), &d.second});
+  }
+
+  if (poss.empty()) {
+    return shared_ptr<DownstreamState>();
+  }
+  if (poss.size() == 1) {
+    return *poss.at(0).second;
+  }
+
+  /* a server that has not been measured yet gets the average latency of the others, not an advantage */
+  const double unmeasured = measuredCount > 0 ? static_cast<double>(measuredSum) / measuredCount : 1.0;
+  double total = 0.0;
+  for (auto& entry : poss) {
+    const double latency = entry.first > 0 ? entry.first : unmeasured;
+    total += 1.0 / (latency * ((*entry.second)->outstanding.load() + 1));
+    entry.first = total;
+  }
+
+  const double r = std::uniform_real_distribution<double>(0.0, total)(t_generator);
+  auto p = upper_bound(poss.begin(), poss.end(), r, [](double r_, const decltype(poss)::value_type& a) { return r_ < a.first; });
+  if (p == poss.end()) {
+    return *poss.back().second;
+  }
+  return *p->second;
+}
+
+static double getP2CScore(const DownstreamState& server)
+{
+  /* a server with a low latency but already a lot of queries in the air is likely to be slow
+     for the next one as well. The latency is offset by one microsecond so that servers without
+     any measured latency yet are still compared on their load */
+  return (server.latencyUsec + 1.0) * (server.outstanding.load() + 1);
+}
+
+shared_ptr<DownstreamState> powerOfTwoChoices(const NumberedServerVector& servers, const DNSQuestion* dq)
+{
+  static thread_local std::minstd_rand t_generator(random());
+  const size_t count = servers.size();
+  if (count == 0) {
+    return shared_ptr<DownstreamState>();
+  }
+  if (count == 1) {
+    if (!servers[0].second->isUp()) {
+      return shared_ptr<DownstreamState>();
+    }
+    ++servers[0].second->p2cSelections;
+    return servers[0].second;
+  }
+
+  /* sample two distinct servers */
+  const shared_ptr<DownstreamState>* first = &servers[t_generator() % count].second;
+  const shared_ptr<DownstreamState>* second = nullptr;
+  {
+    const size_t firstIdx = first - &servers[0].second;
+    size_t secondIdx = t_generator() % (count - 1);
+    if (secondIdx >= firstIdx) {
+      secondIdx++;
+    }
+    second = &servers[secondIdx].second;
+  }
+
+  if (!(*first)->isUp() || !(*second)->isUp()) {
+    /* slow path, sample among the servers that are up */
+    vector<const shared_ptr<DownstreamState>*> usable;
+    usable.reserve(count);
+    for (const auto& d : servers) {
+      if (d.second->isUp()) {
+        usable.push_back(&d.second);
+      }
+    }
+    if (usable.empty()) {
+      return shared_ptr<DownstreamState>();
+    }
+    if (usable.size() == 1) {
+      ++(*usable.at(0))->p2cSelections;
+      return *usable.at(0);
+    }
+    const size_t firstIdx = t_generator() % usable.size();
+    size_t secondIdx = t_generator() % (usable.size() - 1);
+    if (secondIdx >= firstIdx) {
+      secondIdx++;
+    }
+    first = usable.at(firstIdx);
+    second = usable.at(secondIdx);
+  }
+
+  const shared_ptr<DownstreamState>& selected = getP2CScore(**second) < getP2CScore(**first) ? *second : *first;
+  ++selected->p2cSelections;
+  return selected;
+}
+
 shared_ptr<DownstreamState> valrandom(unsigned int val, const NumberedServerVector& servers, const DNSQuestion* dq)
 {
   vector<pair<int, shared_ptr<DownstreamState>>> poss;
@@ -928,6 +1067,81 @@ shared_ptr<DownstreamState> chashed(const NumberedServerVector& servers, const D
   return shared_ptr<DownstreamState>();
 }
 
+std::atomic<uint64_t> g_maglevGeneration{0};
+
+struct MaglevCacheEntry
+{
+  std::vector<const DownstreamState*> d_backends;
+  std::unique_ptr<MaglevTable> d_table;
+  uint64_t d_generation;
+};
+
+static const MaglevTable& getMaglevTable(const NumberedServerVector& servers)
+{
+  /* every thread keeps the tables built for the last sets of servers it has seen,
+     so that the lookup does not require any lock. Building a table for a new set
+     (pool membership change, or a Lua policy passing a subset) takes a fraction of a
+     millisecond, and only happens once per thread */
+  static thread_local std::vector<MaglevCacheEntry> t_tables;
+  static const size_t maxTables = 8;
+  const uint64_t generation = g_maglevGeneration.load();
+
+  for (const auto& entry : t_tables) {
+    if (entry.d_generation != generation || entry.d_backends.size() != servers.size()) {
+      continue;
+    }
+    bool match = true;
+    for (size_t idx = 0; idx < servers.size(); idx++) {
+      if (entry.d_backends[idx] != servers[idx].second.get()) {
+        match = false;
+        break;
+      }
+    }
+    if (match) {
+      return *entry.d_table;
+    }
+  }
+
+  MaglevCacheEntry entry;
+  entry.d_generation = generation;
+  entry.d_backends.reserve(servers.size());
+  std::vector<MaglevTable::Backend> backends;
+  backends.reserve(servers.size());
+  for (const auto& server : servers) {
+    entry.d_backends.push_back(server.second.get());
+    const uint32_t seed = burtle(server.second->id.data, server.second->id.size(), g_hashperturb);
+    backends.push_back({seed, static_cast<uint32_t>(server.second->weight)});
+  }
+  entry.d_table = std::unique_ptr<MaglevTable>(new MaglevTable(backends));
+
+  /* remove the stale ones first, then the oldest one if we are still full */
+  t_tables.erase(std::remove_if(t_tables.begin(), t_tables.end(), [generation](const MaglevCacheEntry& existing) { return existing.d_generation != generation; }), t_tables.end());
+  if (t_tables.size() >= maxTables) {
+    t_tables.erase(t_tables.begin());
+  }
+  t_tables.push_back(std::move(entry));
+  return *t_tables.back().d_table;
+}
+
+shared_ptr<DownstreamState> maglev(const NumberedServerVector& servers, const DNSQuestion* dq)
+{
+  if (servers.empty()) {
+    return shared_ptr<DownstreamState>();
+  }
+
+  const auto& table = getMaglevTable(servers);
+  const uint32_t qhash = dq->qname->hash(g_hashperturb);
+  const size_t idx = table.lookup(qhash, [&servers](size_t candidate) {
+      return servers[candidate].second->isUp();
+    });
+  if (idx != MaglevTable::npos) {
+    return servers[idx].second;
+  }
+
+  /* most of the servers are down, fall back to a weighted hash over the remaining ones */
+  return whashed(servers, dq);
+}
+
 shared_ptr<DownstreamState> roundrobin(const NumberedServerVector& servers, const DNSQuestion* dq)
 {
   NumberedServerVector poss;
@@ -1116,9 +1330,14 @@ bool processRulesResult(const DNSAction::Action& action, DNSQuestion& dq, std::s
 }
 
 
-static bool applyRulesToQuery(LocalHolders& holders, DNSQuestion& dq, const struct timespec& now)
+static void recordQuery(const DNSQuestion& dq, const struct timespec& now)
 {
-  g_rings.insertQuery(now, *dq.remote, *dq.qname, dq.qtype, dq.len, *dq.dh);
+  if (!dq.qname.isBuilt() && g_rings.hasPerThreadRings()) {
+    g_rings.insertQuery(now, *dq.remote, dq.qname.getWire(), dq.qname.getWireLength(), dq.qtype, dq.len, *dq.dh);
+  }
+  else {
+    g_rings.insertQuery(now, *dq.remote, *dq.qname, dq.qtype, dq.len, *dq.dh);
+  }
 
   if(g_qcount.enabled) {
     string qname = (*dq.qname).toLogString();
@@ -1136,6 +1355,13 @@ static bool applyRulesToQuery(LocalHolders& holders, DNSQuestion& dq, const stru
       g_qcount.records[qname]++;
     }
   }
+}
+
+/* returns false if the query should be dropped. 'handled' is set to true when a dynamic
+   block has been applied, meaning that the rules should be skipped */
+static bool applyDynBlocksToQuery(LocalHolders& holders, DNSQuestion& dq, const struct timespec& now, bool& handled)
+{
+  handled = true;
 
   if(auto got = holders.dynNMGBlock->lookup(*dq.remote)) {
     auto updateBlockStats = [&got]() {
@@ -1194,7 +1420,9 @@ static bool applyRulesToQuery(LocalHolders& holders, DNSQuestion& dq, const stru
     }
   }
 
-  if(auto got = holders.dynSMTBlock->lookup(*dq.qname)) {
+  /* don't build the qname for nothing when there is no suffix-based dynamic block */
+  const auto& dynSMTBlock = *holders.dynSMTBlock;
+  if(auto got = (dynSMTBlock.endNode || !dynSMTBlock.children.empty()) ? dynSMTBlock.lookup(*dq.qname) : nullptr) {
     auto updateBlockStats = [&got]() {
       ++g_stats.dynBlocked;
       got->blocks++;
@@ -1249,18 +1477,28 @@ static bool applyRulesToQuery(LocalHolders& holders, DNSQuestion& dq, const stru
     }
   }
 
+  handled = false;
+  return true;
+}
+
+static bool applyRuleActionsToQuery(LocalHolders& holders, DNSQuestion& dq)
+{
   DNSAction::Action action=DNSAction::Action::None;
   string ruleresult;
   bool drop = false;
-  for(const auto& lr : *holders.rulactions) {
-    if(lr.d_rule->matches(&dq)) {
-      lr.d_rule->d_matches++;
-      action=(*lr.d_action)(&dq, &ruleresult);
-      if (processRulesResult(action, dq, ruleresult, drop)) {
-        break;
-      }
-    }
-  }
+  const auto& rulactions = *holders.rulactions;
+  /* our local holder keeps the rules we compiled from alive until it gets a new version,
+     so that version can't be allocated at the same address */
+  if (holders.compiledRulactionsSource != &rulactions) {
+    holders.compiledRulactions = std::make_shared<CompiledRuleSet>(rulactions);
+    holders.compiledRulactionsSource = &rulactions;
+  }
+  holders.compiledRulactions->forEachMatch(dq, [&](size_t idx) {
+    const auto& lr = rulactions[idx];
+    lr.d_rule->d_matches++;
+    action=(*lr.d_action)(&dq, &ruleresult);
+    return processRulesResult(action, dq, ruleresult, drop);
+  });
 
   if (drop) {
     return false;
@@ -1269,6 +1507,21 @@ static bool applyRulesToQuery(LocalHolders& holders, DNSQuestion& dq, const stru
   return true;
 }
 
+static bool applyRulesToQuery(LocalHolders& holders, DNSQuestion& dq, const struct timespec& now)
+{
+  recordQuery(dq, now);
+
+  bool handled = false;
+  if (!applyDynBlocksToQuery(holders, dq, now, handled)) {
+    return false;
+  }
+  if (handled) {
+    return true;
+  }
+
+  return applyRuleActionsToQuery(holders, dq);
+}
+
 ssize_t udpClientSendRequestToBackend(const std::shared_ptr<DownstreamState>& ss, const int sd, const char* request, const size_t requestLen, bool healthCheck)
 {
   ssize_t result;
@@ -1303,9 +1556,10 @@ ssize_t udpClientSendRequestToBackend(const std::shared_ptr<DownstreamState>& ss
   return result;
 }
 
+/* msgh is nullptr when the query has not been received from a socket, dest is then already set */
 static bool isUDPQueryAcceptable(ClientState& cs, LocalHolders& holders, const struct msghdr* msgh, const ComboAddress& remote, ComboAddress& dest)
 {
-  if (msgh->msg_flags & MSG_TRUNC) {
+  if (msgh != nullptr && msgh->msg_flags & MSG_TRUNC) {
     /* message was too large for our buffer */
     vinfolog("Dropping message too large for our buffer");
     ++g_stats.nonCompliantQueries;
@@ -1321,6 +1575,10 @@ static bool isUDPQueryAcceptable(ClientState& cs, LocalHolders& holders, const s
   cs.queries++;
   ++g_stats.queries;
 
+  if (msgh == nullptr) {
+    return true;
+  }
+
   if (HarvestDestinationAddress(msgh, &dest)) {
     /* we don't get the port, only the address */
     dest.sin4.sin_port = cs.local.sin4.sin_port;
@@ -1447,7 +1705,42 @@ ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders&
     struct timespec now;
     gettime(&now);
 
-    if (!applyRulesToQuery(holders, dq, now)) {
+    /* the hot cache of this frontend is looked up before the rules are applied, as long as
+       no rule needs to see the cache hits. The query is still inserted into the rings and the
+       dynamic blocks are still applied, so that they keep working for clients getting cache hits */
+    /* set when the hot cache has been looked up without success for this exact query */
+    bool hotCacheMissed = false;
+    if (cs.hotCache && !dq.skipCache && holders.cacheHitRespRulactions->empty()) {
+      recordQuery(dq, now);
+
+      bool handled = false;
+      if (!applyDynBlocksToQuery(holders, dq, now, handled)) {
+        return ProcessQueryResult::Drop;
+      }
+
+      if (!handled) {
+        uint16_t cachedResponseSize = dq.size;
+        dq.dnssecOK = (getEDNSZ(dq) & EDNS_HEADER_FLAG_DO);
+        if (cs.hotCache->get(dq, dq.consumed, dq.dh->id, reinterpret_cast<char*>(dq.dh), &cachedResponseSize, &dq.cacheKey, dq.subnet, dq.dnssecOK)) {
+          dq.len = cachedResponseSize;
+
+          if (!prepareOutgoingResponse(holders, cs, dq, true)) {
+            return ProcessQueryResult::Drop;
+          }
+
+          ++cs.hotCacheHits;
+          return ProcessQueryResult::SendAnswer;
+        }
+
+        const uint16_t lookedUpLen = dq.len;
+        const uint16_t lookedUpFlags = *getFlagsFromDNSHeader(dq.dh);
+        if (!applyRuleActionsToQuery(holders, dq)) {
+          return ProcessQueryResult::Drop;
+        }
+        hotCacheMissed = dq.len == lookedUpLen && *getFlagsFromDNSHeader(dq.dh) == lookedUpFlags;
+      }
+    }
+    else if (!applyRulesToQuery(holders, dq, now)) {
       return ProcessQueryResult::Drop;
     }
 
@@ -1485,10 +1778,17 @@ ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders&
       dq.dnssecOK = (getEDNSZ(dq) & EDNS_HEADER_FLAG_DO);
     }
 
+    /* no need to look up the unmodified query again in the cache that just missed, which
+       would also count the miss twice, unless we are now willing to serve expired entries */
+    bool alreadyMissed = hotCacheMissed && dq.packetCache == cs.hotCache && allowExpired == 0;
+
     if (dq.useECS && ((selectedBackend && selectedBackend->useECS) || (!selectedBackend && serverPool->getECS()))) {
       // we special case our cache in case a downstream explicitly gave us a universally valid response with a 0 scope
       if (dq.packetCache && !dq.skipCache && (!selectedBackend || !selectedBackend->disableZeroScope) && dq.packetCache->isECSParsingEnabled()) {
-        if (dq.packetCache->get(dq, dq.consumed, dq.dh->id, reinterpret_cast<char*>(dq.dh), &cachedResponseSize, &dq.cacheKeyNoECS, dq.subnet, dq.dnssecOK, allowExpired)) {
+        if (alreadyMissed) {
+          dq.cacheKeyNoECS = dq.cacheKey;
+        }
+        else if (dq.packetCache->get(dq, dq.consumed, dq.dh->id, reinterpret_cast<char*>(dq.dh), &cachedResponseSize, &dq.cacheKeyNoECS, dq.subnet, dq.dnssecOK, allowExpired)) {
           dq.len = cachedResponseSize;
 
           if (!prepareOutgoingResponse(holders, cs, dq, true)) {
@@ -1508,10 +1808,12 @@ ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders&
         vinfolog("Dropping query from %s because we couldn't insert the ECS value", dq.remote->toStringWithPort());
         return ProcessQueryResult::Drop;
       }
+      /* the query might have been altered */
+      alreadyMissed = false;
     }
 
     if (dq.packetCache && !dq.skipCache) {
-      if (dq.packetCache->get(dq, dq.consumed, dq.dh->id, reinterpret_cast<char*>(dq.dh), &cachedResponseSize, &dq.cacheKey, dq.subnet, dq.dnssecOK, allowExpired)) {
+      if (!alreadyMissed && dq.packetCache->get(dq, dq.consumed, dq.dh->id, reinterpret_cast<char*>(dq.dh), &cachedResponseSize, &dq.cacheKey, dq.subnet, dq.dnssecOK, allowExpired)) {
         dq.len = cachedResponseSize;
 
         if (!prepareOutgoingResponse(holders, cs, dq, true)) {
@@ -1556,7 +1858,9 @@ ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders&
   return ProcessQueryResult::Drop;
 }
 
-static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct msghdr* msgh, const ComboAddress& remote, ComboAddress& dest, char* query, uint16_t len, size_t queryBufferSize, struct mmsghdr* responsesVect, unsigned int* queuedResponses, struct iovec* respIOV, cmsgbuf_aligned* respCBuf)
+/* if immediateResponseLen is not nullptr, a response that can be sent right away is left in the query buffer
+   for the caller to send, and its size is stored into immediateResponseLen */
+static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct msghdr* msgh, const ComboAddress& remote, ComboAddress& dest, char* query, uint16_t len, size_t queryBufferSize, struct mmsghdr* responsesVect, unsigned int* queuedResponses, struct iovec* respIOV, cmsgbuf_aligned* respCBuf, uint16_t* immediateResponseLen=nullptr)
 {
   assert(responsesVect == nullptr || (queuedResponses != nullptr && respIOV != nullptr && respCBuf != nullptr));
   uint16_t queryId = 0;
@@ -1588,8 +1892,24 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
 
     uint16_t qtype, qclass;
     unsigned int consumed = 0;
-    DNSName qname(query, len, sizeof(dnsheader), false, &qtype, &qclass, &consumed);
-    DNSQuestion dq(&qname, qtype, qclass, consumed, dest.sin4.sin_family != 0 ? &dest : &cs.local, &remote, dh, queryBufferSize, len, false, &queryRealTime);
+    DNSQueryView view;
+    DNSName slowPathQName;
+    DNSQuestionName qname(&slowPathQName);
+    const bool fastPath = view.parse(query, len);
+    if (fastPath) {
+      /* the DNSName will only be built if something actually needs it */
+      qname = DNSQuestionName(&view);
+      qtype = view.getQType();
+      qclass = view.getQClass();
+      consumed = view.getConsumed();
+    }
+    else {
+      slowPathQName = DNSName(query, len, sizeof(dnsheader), false, &qtype, &qclass, &consumed);
+    }
+    DNSQuestion dq(qname, qtype, qclass, consumed, dest.sin4.sin_family != 0 ? &dest : &cs.local, &remote, dh, queryBufferSize, len, false, &queryRealTime);
+    if (fastPath) {
+      dq.qnameHash = view.getQNameHash();
+    }
     dq.dnsCryptQuery = std::move(dnsCryptQuery);
     std::shared_ptr<DownstreamState> ss{nullptr};
     auto result = processQuery(dq, cs, holders, ss);
@@ -1599,6 +1919,10 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
     }
 
     if (result == ProcessQueryResult::SendAnswer) {
+      if (dq.delayMsec == 0 && immediateResponseLen != nullptr) {
+        *immediateResponseLen = dq.len;
+        return;
+      }
 #if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
       if (dq.delayMsec == 0 && responsesVect != nullptr) {
         queueResponse(cs, reinterpret_cast<char*>(dq.dh), dq.len, *dq.local, *dq.remote, responsesVect[*queuedResponses], respIOV, respCBuf);
@@ -1617,7 +1941,6 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
 
     unsigned int idOffset = (ss->idOffset++) % ss->idStates.size();
     IDState* ids = &ss->idStates[idOffset];
-    ids->age = 0;
     DOHUnit* du = nullptr;
 
     /* that means that the state was in use, possibly with an allocated
@@ -1646,7 +1969,7 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
     ids->cs = &cs;
     ids->origFD = cs.udpFD;
     ids->origID = dh->id;
-    setIDStateFromDNSQuestion(*ids, dq, std::move(qname));
+    setIDStateFromDNSQuestion(*ids, dq, fastPath ? view.releaseQName() : std::move(slowPathQName));
 
     /* If we couldn't harvest the real dest addr, still
        write down the listening addr since it will be useful
@@ -1818,148 +2141,52 @@ catch(...)
   errlog("UDP client thread died because of an exception: %s", "unknown");
 }
 
-uint16_t getRandomDNSID()
-{
-#ifdef HAVE_LIBSODIUM
-  return (randombytes_random() % 65536);
-#else
-  return (random() % 65536);
-#endif
-}
-
-static bool upCheck(const shared_ptr<DownstreamState>& ds)
+#ifdef HAVE_PACKET_RING
+// same as udpClientThread, except that queries are read from a packet ring and immediate responses sent via it
+static void packetRingThread(ClientState* cs)
 try
 {
-  DNSName checkName = ds->checkName;
-  uint16_t checkType = ds->checkType.getCode();
-  uint16_t checkClass = ds->checkClass;
-  dnsheader checkHeader;
-  memset(&checkHeader, 0, sizeof(checkHeader));
-
-  checkHeader.qdcount = htons(1);
-  checkHeader.id = getRandomDNSID();
-
-  checkHeader.rd = true;
-  if (ds->setCD) {
-    checkHeader.cd = true;
-  }
-
-  if (ds->checkFunction) {
-    std::lock_guard<std::mutex> lock(g_luamutex);
-    auto ret = ds->checkFunction(checkName, checkType, checkClass, &checkHeader);
-    checkName = std::get<0>(ret);
-    checkType = std::get<1>(ret);
-    checkClass = std::get<2>(ret);
-  }
-
-  vector<uint8_t> packet;
-  DNSPacketWriter dpw(packet, checkName, checkType, checkClass);
-  dnsheader * requestHeader = dpw.getHeader();
-  *requestHeader = checkHeader;
+  setThreadName("dnsdist/pktRing");
+  LocalHolders holders;
 
-  Socket sock(ds->remote.sin4.sin_family, SOCK_DGRAM);
-  sock.setNonBlocking();
-  if (!IsAnyAddress(ds->sourceAddr)) {
-    sock.setReuseAddr();
-    if (!ds->sourceItfName.empty()) {
-#ifdef SO_BINDTODEVICE
-      int res = setsockopt(sock.getHandle(), SOL_SOCKET, SO_BINDTODEVICE, ds->sourceItfName.c_str(), ds->sourceItfName.length());
-      if (res != 0 && g_verboseHealthChecks) {
-        infolog("Error settting SO_BINDTODEVICE on the health check socket for backend '%s': %s", ds->getNameWithAddr(), stringerror());
-      }
-#endif
+  cs->packetRing->run([cs, &holders](const PacketRingFrontend::Query& ringQuery, char* packet, uint16_t& len, size_t packetSize) {
+    if (len > s_udpIncomingBufferSize || len < sizeof(struct dnsheader)) {
+      ++g_stats.nonCompliantQueries;
+      return false;
     }
-    sock.bind(ds->sourceAddr);
-  }
-  sock.connect(ds->remote);
-  ssize_t sent = udpClientSendRequestToBackend(ds, sock.getHandle(), reinterpret_cast<char*>(&packet[0]), packet.size(), true);
-  if (sent < 0) {
-    int ret = errno;
-    if (g_verboseHealthChecks)
-      infolog("Error while sending a health check query to backend %s: %d", ds->getNameWithAddr(), ret);
-    return false;
-  }
 
-  int ret = waitForRWData(sock.getHandle(), true, /* ms to seconds */ ds->checkTimeout / 1000, /* remaining ms to us */ (ds->checkTimeout % 1000) * 1000);
-  if(ret < 0 || !ret) { // error, timeout, both are down!
-    if (ret < 0) {
-      ret = errno;
-      if (g_verboseHealthChecks)
-        infolog("Error while waiting for the health check response from backend %s: %d", ds->getNameWithAddr(), ret);
-    }
-    else {
-      if (g_verboseHealthChecks)
-        infolog("Timeout while waiting for the health check response from backend %s", ds->getNameWithAddr());
+    ComboAddress dest = ringQuery.local;
+    uint16_t responseLen = 0;
+    processUDPQuery(*cs, holders, nullptr, ringQuery.remote, dest, packet, len, packetSize, nullptr, nullptr, nullptr, nullptr, &responseLen);
+    if (responseLen == 0) {
+      return false;
     }
-    return false;
-  }
-
-  string reply;
-  ComboAddress from;
-  sock.recvFrom(reply, from);
-
-  /* we are using a connected socket but hey.. */
-  if (from != ds->remote) {
-    if (g_verboseHealthChecks)
-      infolog("Invalid health check response received from %s, expecting one from %s", from.toStringWithPort(), ds->remote.toStringWithPort());
-    return false;
-  }
 
-  const dnsheader * responseHeader = reinterpret_cast<const dnsheader *>(reply.c_str());
-
-  if (reply.size() < sizeof(*responseHeader)) {
-    if (g_verboseHealthChecks)
-      infolog("Invalid health check response of size %d from backend %s, expecting at least %d", reply.size(), ds->getNameWithAddr(), sizeof(*responseHeader));
-    return false;
-  }
-
-  if (responseHeader->id != requestHeader->id) {
-    if (g_verboseHealthChecks)
-      infolog("Invalid health check response id %d from backend %s, expecting %d", responseHeader->id, ds->getNameWithAddr(), requestHeader->id);
-    return false;
-  }
-
-  if (!responseHeader->qr) {
-    if (g_verboseHealthChecks)
-      infolog("Invalid health check response from backend %s, expecting QR to be set", ds->getNameWithAddr());
-    return false;
-  }
-
-  if (responseHeader->rcode == RCode::ServFail) {
-    if (g_verboseHealthChecks)
-      infolog("Backend %s responded to health check with ServFail", ds->getNameWithAddr());
-    return false;
-  }
-
-  if (ds->mustResolve && (responseHeader->rcode == RCode::NXDomain || responseHeader->rcode == RCode::Refused)) {
-    if (g_verboseHealthChecks)
-      infolog("Backend %s responded to health check with %s while mustResolve is set", ds->getNameWithAddr(), responseHeader->rcode == RCode::NXDomain ? "NXDomain" : "Refused");
-    return false;
-  }
-
-  uint16_t receivedType;
-  uint16_t receivedClass;
-  DNSName receivedName(reply.c_str(), reply.size(), sizeof(dnsheader), false, &receivedType, &receivedClass);
-
-  if (receivedName != checkName || receivedType != checkType || receivedClass != checkClass) {
-    if (g_verboseHealthChecks)
-      infolog("Backend %s responded to health check with an invalid qname (%s vs %s), qtype (%s vs %s) or qclass (%d vs %d)", ds->getNameWithAddr(), receivedName.toLogString(), checkName.toLogString(), QType(receivedType).getName(), QType(checkType).getName(), receivedClass, checkClass);
-    return false;
-  }
-
-  return true;
+    len = responseLen;
+    return true;
+  }, cs->udpFD);
 }
-catch(const std::exception& e)
+catch(const std::exception &e)
 {
-  if (g_verboseHealthChecks)
-    infolog("Error checking the health of backend %s: %s", ds->getNameWithAddr(), e.what());
-  return false;
+  errlog("Packet ring thread died because of exception: %s", e.what());
+}
+catch(const PDNSException &e)
+{
+  errlog("Packet ring thread died because of PowerDNS exception: %s", e.reason);
 }
 catch(...)
 {
-  if (g_verboseHealthChecks)
-    infolog("Unknown exception while checking the health of backend %s", ds->getNameWithAddr());
-  return false;
+  errlog("Packet ring thread died because of an exception: %s", "unknown");
+}
+#endif /* HAVE_PACKET_RING */
+
+uint16_t getRandomDNSID()
+{
+#ifdef HAVE_LIBSODIUM
+  return (randombytes_random() % 65536);
+#else
+  return (random() % 65536);
+#endif
 }
 
 uint64_t g_maxTCPClientThreads{10};
@@ -2036,6 +2263,13 @@ void maintThread()
       counter = 0;
     }
 
+    {
+      auto states = g_dstates.getLocal();
+      for (const auto& dss : *states) {
+        dss->updateLatencyPercentile(g_latencyPolicyPercentile.load());
+      }
+    }
+
     // ponder pruning g_dynblocks of expired entries here
   }
 }
@@ -2058,111 +2292,133 @@ static void healthChecksThread()
 {
   setThreadName("dnsdist/healthC");
 
-  int interval = 1;
+  std::unique_ptr<FDMultiplexer> mplexer(FDMultiplexer::getMultiplexerSilent());
+  struct timespec lastStats;
+  gettime(&lastStats);
 
   for(;;) {
-    sleep(interval);
-
-    if(g_tcpclientthreads->getQueuedCount() > 1 && !g_tcpclientthreads->hasReachedMaxThreads())
-      g_tcpclientthreads->addTCPClientThread();
+    struct timespec now;
+    gettime(&now);
 
     auto states = g_dstates.getLocal(); // this points to the actual shared_ptrs!
-    for(auto& dss : *states) {
-      if(++dss->lastCheck < dss->checkInterval)
-        continue;
-      dss->lastCheck = 0;
-      if(dss->availability==DownstreamState::Availability::Auto) {
-        bool newState=upCheck(dss);
-        if (newState) {
-          /* check succeeded */
-          dss->currentCheckFailures = 0;
-
-          if (!dss->upStatus) {
-            /* we were marked as down */
-            dss->consecutiveSuccessfulChecks++;
-            if (dss->consecutiveSuccessfulChecks < dss->minRiseSuccesses) {
-              /* if we need more than one successful check to rise
-                 and we didn't reach the threshold yet,
-                 let's stay down */
-              newState = false;
-            }
-          }
-        }
-        else {
-          /* check failed */
-          dss->consecutiveSuccessfulChecks = 0;
-
-          if (dss->upStatus) {
-            /* we are currently up */
-            dss->currentCheckFailures++;
-            if (dss->currentCheckFailures < dss->maxCheckFailures) {
-              /* we need more than one failure to be marked as down,
-                 and we did not reach the threshold yet, let's stay down */
-              newState = true;
-            }
-          }
-        }
+    unsigned int nextDue = queueDueHealthChecks(*mplexer, *states, now);
 
-        if(newState != dss->upStatus) {
-          warnlog("Marking downstream %s as '%s'", dss->getNameWithAddr(), newState ? "up" : "down");
+    if (DiffTime(lastStats, now) >= 1.0) {
+      lastStats = now;
 
-          if (newState && !dss->connected) {
-            newState = dss->reconnect();
+      if(g_tcpclientthreads->getQueuedCount() > 1 && !g_tcpclientthreads->hasReachedMaxThreads())
+        g_tcpclientthreads->addTCPClientThread();
 
-            if (dss->connected && !dss->threadStarted.test_and_set()) {
-              dss->tid = thread(responderThread, dss);
-            }
-          }
-
-          dss->upStatus = newState;
-          dss->currentCheckFailures = 0;
-          dss->consecutiveSuccessfulChecks = 0;
-          if (g_snmpAgent && g_snmpTrapsEnabled) {
-            g_snmpAgent->sendBackendStatusChangeTrap(dss);
-          }
-        }
+      for(auto& dss : *states) {
+        auto delta = dss->sw.udiffAndSet()/1000000.0;
+        dss->queryLoad = 1.0*(dss->queries.load() - dss->prev.queries.load())/delta;
+        dss->dropRate = 1.0*(dss->reuseds.load() - dss->prev.reuseds.load())/delta;
+        dss->prev.queries.store(dss->queries.load());
+        dss->prev.reuseds.store(dss->reuseds.load());
       }
+    }
 
-      auto delta = dss->sw.udiffAndSet()/1000000.0;
-      dss->queryLoad = 1.0*(dss->queries.load() - dss->prev.queries.load())/delta;
-      dss->dropRate = 1.0*(dss->reuseds.load() - dss->prev.reuseds.load())/delta;
-      dss->prev.queries.store(dss->queries.load());
-      dss->prev.reuseds.store(dss->reuseds.load());
-      
-      for(IDState& ids  : dss->idStates) { // timeouts
-        int64_t usageIndicator = ids.usageIndicator;
-        if(IDState::isInUse(usageIndicator) && ids.age++ > g_udpTimeout) {
-          /* We mark the state as unused as soon as possible
-             to limit the risk of racing with the
-             responder thread.
-          */
-          auto oldDU = ids.du;
+    /* wake up at least once per second to update the statistics, and to pick up new backends */
+    handleQueuedHealthChecks(*mplexer, std::min(nextDue, 1000U));
+  }
+}
 
-          if (!ids.tryMarkUnused(usageIndicator)) {
-            /* this state has been altered in the meantime,
-               don't go anywhere near it */
-            continue;
-          }
-          ids.du = nullptr;
-          handleDOHTimeout(oldDU);
-          ids.age = 0;
-          dss->reuseds++;
-          --dss->outstanding;
-          ++g_stats.downstreamTimeouts; // this is an 'actively' discovered timeout
-          vinfolog("Had a downstream timeout from %s (%s) for query for %s|%s from %s",
-                   dss->remote.toStringWithPort(), dss->name,
-                   ids.qname.toLogString(), QType(ids.qtype).getName(), ids.origRemote.toStringWithPort());
-
-          struct timespec ts;
-          gettime(&ts);
-
-          struct dnsheader fake;
-          memset(&fake, 0, sizeof(fake));
-          fake.id = ids.origID;
-
-          g_rings.insertResponse(ts, ids.origRemote, ids.qname, ids.qtype, std::numeric_limits<unsigned int>::max(), 0, fake, dss->remote);
-        }          
-      }
+static void handleDownstreamTimeout(DownstreamState& dss, IDState& ids, int64_t usageIndicator)
+{
+  /* We mark the state as unused as soon as possible
+     to limit the risk of racing with the
+     responder thread.
+  */
+  auto oldDU = ids.du;
+
+  if (!ids.tryMarkUnused(usageIndicator)) {
+    /* this state has been altered in the meantime,
+       don't go anywhere near it */
+    return;
+  }
+  ids.du = nullptr;
+  handleDOHTimeout(oldDU);
+  dss.reuseds++;
+  --dss.outstanding;
+  ++g_stats.downstreamTimeouts; // this is an 'actively' discovered timeout
+  vinfolog("Had a downstream timeout from %s (%s) for query for %s|%s from %s",
+           dss.remote.toStringWithPort(), dss.name,
+           ids.qname.toLogString(), QType(ids.qtype).getName(), ids.origRemote.toStringWithPort());
+
+  struct timespec ts;
+  gettime(&ts);
+
+  struct dnsheader fake;
+  memset(&fake, 0, sizeof(fake));
+  fake.id = ids.origID;
+
+  g_rings.insertResponse(ts, ids.origRemote, ids.qname, ids.qtype, std::numeric_limits<unsigned int>::max(), 0, fake, dss.remote);
+}
+
+/* States are handed out in order, via the idOffset counter, so instead of scanning all of them
+   we record the value of the counter at every tick. Every query that got a state before the value
+   recorded at a tick older than the timeout has expired if its state is still in use, unless the
+   state has been reused by a more recent query since, so we only need to look at the states handed
+   out during the ticks that just became older than the timeout. */
+static void handleDownstreamTimeouts(DownstreamState& dss, const struct timespec& now)
+{
+  const size_t statesCount = dss.idStates.size();
+  if (statesCount == 0) {
+    return;
+  }
+
+  dss.idOffsetMarks.push_back({now, dss.idOffset.load()});
+
+  struct timespec cutOff = now;
+  cutOff.tv_sec -= g_udpTimeout;
+
+  uint64_t upTo = dss.timeoutsCheckedUpTo;
+  while (!dss.idOffsetMarks.empty() && !(cutOff < dss.idOffsetMarks.front().first)) {
+    upTo = dss.idOffsetMarks.front().second;
+    dss.idOffsetMarks.pop_front();
+  }
+
+  uint64_t from = dss.timeoutsCheckedUpTo;
+  const uint64_t current = dss.idOffset.load();
+  if (current - from > statesCount) {
+    /* the older ones have been reused anyway */
+    from = current - statesCount;
+  }
+
+  for (uint64_t counter = from; counter < upTo; counter++) {
+    IDState& ids = dss.idStates[counter % statesCount];
+    int64_t usageIndicator = ids.usageIndicator;
+    if (!IDState::isInUse(usageIndicator)) {
+      continue;
+    }
+
+    /* the state has been handed out again to a more recent query, which
+       will be checked in due time. The counter is incremented before the
+       state is marked as used, so we can't see the new usage indicator
+       without seeing the new counter as well. */
+    if (dss.idOffset.load() - counter > statesCount) {
+      continue;
+    }
+
+    handleDownstreamTimeout(dss, ids, usageIndicator);
+  }
+
+  dss.timeoutsCheckedUpTo = std::max(dss.timeoutsCheckedUpTo, upTo);
+}
+
+static void udpTimeoutsThread()
+{
+  setThreadName("dnsdist/timeouts");
+
+  for (;;) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(g_udpTimeoutCheckInterval.load()));
+
+    struct timespec now;
+    gettime(&now);
+
+    auto states = g_dstates.getLocal(); // this points to the actual shared_ptrs!
+    for (auto& dss : *states) {
+      handleDownstreamTimeouts(*dss, now);
     }
   }
 }
@@ -2336,8 +2592,25 @@ static void setUpLocalBind(std::unique_ptr<ClientState>& cs)
 #endif
   }
 
+  if (cs->usePacketRing && !cs->tcp) {
+#ifdef HAVE_PACKET_RING
+    try {
+      cs->packetRing = std::make_shared<PacketRingFrontend>(itf, cs->local);
+      /* the socket is still used to send the responses we get from the backends */
+      setUDPSocketDropAllFilter(fd);
+    }
+    catch(const std::exception& e) {
+      errlog("Error while setting up the packet ring on local address '%s': %s, exiting", cs->local.toStringWithPort(), e.what());
+      _exit(EXIT_FAILURE);
+    }
+#else
+    warnlog("A packet ring has been configured on local address '%s' but is not supported", cs->local.toStringWithPort());
+#endif /* HAVE_PACKET_RING */
+  }
+
 #ifdef HAVE_EBPF
-  if (g_defaultBPFFilter) {
+  /* attaching a filter would replace the one dropping everything on a packet ring frontend */
+  if (g_defaultBPFFilter && cs->packetRing == nullptr) {
     cs->attachFilter(g_defaultBPFFilter);
     vinfolog("Attaching default BPF Filter to %s frontend %s", (!cs->tcp ? "UDP" : "TCP"), cs->local.toStringWithPort());
   }
@@ -2790,11 +3063,22 @@ try
 
   checkFileDescriptorsLimits(udpBindsCount, tcpBindsCount);
 
-  for(auto& dss : g_dstates.getCopy()) { // it is a copy, but the internal shared_ptrs are the real deal
-    if(dss->availability==DownstreamState::Availability::Auto) {
-      bool newState=upCheck(dss);
-      warnlog("Marking downstream %s as '%s'", dss->getNameWithAddr(), newState ? "up" : "down");
-      dss->upStatus = newState;
+  {
+    /* send all the initial health checks at once, then wait for all of them to be done */
+    std::unique_ptr<FDMultiplexer> mplexer(FDMultiplexer::getMultiplexerSilent());
+    for(auto& dss : g_dstates.getCopy()) { // it is a copy, but the internal shared_ptrs are the real deal
+      if(dss->availability==DownstreamState::Availability::Auto) {
+        if (dss->healthCheckMode == DownstreamState::HealthCheckMode::Lazy) {
+          /* lazy health checks only start when queries fail */
+          updateHealthCheckResult(dss, true, true);
+        }
+        else if (!queueHealthCheck(*mplexer, dss, true)) {
+          updateHealthCheckResult(dss, true, false);
+        }
+      }
+    }
+    while (mplexer->getWatchedFDCount(false) > 0) {
+      handleQueuedHealthChecks(*mplexer, 100);
     }
   }
 
@@ -2809,6 +3093,17 @@ try
 #endif /* HAVE_DNS_OVER_HTTPS */
       continue;
     }
+#ifdef HAVE_PACKET_RING
+    if (cs->packetRing != nullptr) {
+      warnlog("Using a packet ring on interface %s for UDP queries to %s", cs->packetRing->getInterface(), cs->local.toStringWithPort());
+      thread t1(packetRingThread, cs.get());
+      if (!cs->cpus.empty()) {
+        mapThreadToCPUList(t1.native_handle(), cs->cpus);
+      }
+      t1.detach();
+      continue;
+    }
+#endif /* HAVE_PACKET_RING */
     if (cs->udpFD >= 0) {
       thread t1(udpClientThread, cs.get());
       if (!cs->cpus.empty()) {
@@ -2831,6 +3126,9 @@ try
   thread stattid(maintThread);
   stattid.detach();
   
+  thread timeoutsthread(udpTimeoutsThread);
+  timeoutsthread.detach();
+
   thread healththread(healthChecksThread);
 
   if (!g_secPollSuffix.empty()) {
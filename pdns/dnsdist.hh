@@ -24,6 +24,7 @@
 #include "ext/luawrapper/include/LuaContext.hpp"
 
 #include <atomic>
+#include <deque>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -39,6 +40,9 @@
 #include "dnscrypt.hh"
 #include "dnsdist-cache.hh"
 #include "dnsdist-dynbpf.hh"
+#include "dnsdist-histogram.hh"
+#include "dnsdist-packetring.hh"
+#include "dnsdist-queryview.hh"
 #include "dnsname.hh"
 #include "doh.hh"
 #include "ednsoptions.hh"
@@ -61,7 +65,7 @@ typedef std::unordered_map<string, string> QTag;
 
 struct DNSQuestion
 {
-  DNSQuestion(const DNSName* name, uint16_t type, uint16_t class_, unsigned int consumed_, const ComboAddress* lc, const ComboAddress* rem, struct dnsheader* header, size_t bufferSize, uint16_t queryLen, bool isTcp, const struct timespec* queryTime_):
+  DNSQuestion(const DNSQuestionName& name, uint16_t type, uint16_t class_, unsigned int consumed_, const ComboAddress* lc, const ComboAddress* rem, struct dnsheader* header, size_t bufferSize, uint16_t queryLen, bool isTcp, const struct timespec* queryTime_):
     qname(name), local(lc), remote(rem), dh(header), queryTime(queryTime_), size(bufferSize), consumed(consumed_), tempFailureTTL(boost::none), qtype(type), qclass(class_), len(queryLen), ecsPrefixLength(rem->sin4.sin_family == AF_INET ? g_ECSSourcePrefixV4 : g_ECSSourcePrefixV6), tcp(isTcp), ecsOverride(g_ECSOverride) {
     const uint16_t* flags = getFlagsFromDNSHeader(dh);
     origFlags = *flags;
@@ -77,7 +81,7 @@ struct DNSQuestion
   boost::optional<Netmask> subnet;
   std::string sni; /* Server Name Indication, if any (DoT or DoH) */
   std::string poolname;
-  const DNSName* qname{nullptr};
+  DNSQuestionName qname;
   const ComboAddress* local{nullptr};
   const ComboAddress* remote{nullptr};
   std::shared_ptr<QTag> qTag{nullptr};
@@ -91,6 +95,8 @@ struct DNSQuestion
   unsigned int consumed{0};
   int delayMsec{0};
   boost::optional<uint32_t> tempFailureTTL;
+  /* hash of the lowercased qname, if already computed while parsing the query */
+  boost::optional<uint32_t> qnameHash{boost::none};
   uint32_t cacheKeyNoECS;
   uint32_t cacheKey;
   const uint16_t qtype;
@@ -113,7 +119,7 @@ struct DNSQuestion
 
 struct DNSResponse : DNSQuestion
 {
-  DNSResponse(const DNSName* name, uint16_t type, uint16_t class_, unsigned int consumed_, const ComboAddress* lc, const ComboAddress* rem, struct dnsheader* header, size_t bufferSize, uint16_t responseLen, bool isTcp, const struct timespec* queryTime_):
+  DNSResponse(const DNSQuestionName& name, uint16_t type, uint16_t class_, unsigned int consumed_, const ComboAddress* lc, const ComboAddress* rem, struct dnsheader* header, size_t bufferSize, uint16_t responseLen, bool isTcp, const struct timespec* queryTime_):
     DNSQuestion(name, type, class_, consumed_, lc, rem, header, bufferSize, responseLen, isTcp, queryTime_) { }
   DNSResponse(const DNSResponse&) = delete;
   DNSResponse& operator=(const DNSResponse&) = delete;
@@ -540,7 +546,7 @@ struct ClientState;
 struct IDState
 {
   IDState(): sentTime(true), delayMsec(0), tempFailureTTL(boost::none) { origDest.sin4.sin_family = 0;}
-  IDState(const IDState& orig): origRemote(orig.origRemote), origDest(orig.origDest), age(orig.age)
+  IDState(const IDState& orig): origRemote(orig.origRemote), origDest(orig.origDest)
   {
     usageIndicator.store(orig.usageIndicator.load());
     origFD = orig.origFD;
@@ -632,7 +638,6 @@ struct IDState
   DOHUnit* du{nullptr};
   uint32_t cacheKey;                                          // 4
   uint32_t cacheKeyNoECS;                                     // 4
-  uint16_t age;                                               // 4
   uint16_t qtype;                                             // 2
   uint16_t qclass;                                            // 2
   uint16_t origID;                                            // 2
@@ -674,9 +679,13 @@ struct ClientState
   std::shared_ptr<DNSCryptContext> dnscryptCtx{nullptr};
   std::shared_ptr<TLSFrontend> tlsFrontend{nullptr};
   std::shared_ptr<DOHFrontend> dohFrontend{nullptr};
+  std::shared_ptr<PacketRingFrontend> packetRing{nullptr};
+  /* looked up before the rules are applied, can only be set at configuration time */
+  std::shared_ptr<DNSDistPacketCache> hotCache{nullptr};
   std::string interface;
   std::atomic<uint64_t> queries{0};
   mutable std::atomic<uint64_t> responses{0};
+  std::atomic<uint64_t> hotCacheHits{0};
   std::atomic<uint64_t> tcpDiedReadingQuery{0};
   std::atomic<uint64_t> tcpDiedSendingResponse{0};
   std::atomic<uint64_t> tcpGaveUp{0};
@@ -695,6 +704,7 @@ struct ClientState
   std::atomic<double> tcpAvgQueriesPerConnection{0.0};
   /* in ms */
   std::atomic<double> tcpAvgConnectionDuration{0.0};
+  mutable LatencyHistogram latencyHistogram;
   int udpFD{-1};
   int tcpFD{-1};
   int fastOpenQueueSize{0};
@@ -702,6 +712,7 @@ struct ClientState
   bool tcp;
   bool reuseport;
   bool ready{false};
+  bool usePacketRing{false};
 
   int getSocket() const
   {
@@ -736,6 +747,9 @@ struct ClientState
     else if (dnscryptCtx) {
       result += " (DNSCrypt)";
     }
+    else if (packetRing) {
+      result += " (packet ring)";
+    }
 
     return result;
   }
@@ -831,6 +845,10 @@ public:
 
 extern std::unique_ptr<TCPClientCollection> g_tcpclientthreads;
 
+/* bumped whenever a backend is created or destroyed, or its ID or weight changes,
+   invalidating the Maglev tables */
+extern std::atomic<uint64_t> g_maglevGeneration;
+
 struct DownstreamState
 {
    typedef std::function<std::tuple<DNSName, uint16_t, uint16_t>(const DNSName&, uint16_t, uint16_t, dnsheader*)> checkfunc_t;
@@ -845,6 +863,8 @@ struct DownstreamState
         fd = -1;
       }
     }
+    /* a new backend might be allocated at the same address */
+    ++g_maglevGeneration;
   }
   boost::uuids::uuid id;
   std::set<unsigned int> hashes;
@@ -858,12 +878,16 @@ struct DownstreamState
   const ComboAddress remote;
   QPSLimiter qps;
   vector<IDState> idStates;
+  /* value of idOffset at each tick of the timeouts thread, only used by that thread */
+  std::deque<std::pair<struct timespec, uint64_t>> idOffsetMarks;
   const ComboAddress sourceAddr;
   checkfunc_t checkFunction;
   DNSName checkName{"a.root-servers.net."};
   QType checkType{QType::A};
   uint16_t checkClass{QClass::IN};
   std::atomic<uint64_t> idOffset{0};
+  /* every state handed out before this value of idOffset has been checked for timeout */
+  uint64_t timeoutsCheckedUpTo{0};
   std::atomic<uint64_t> sendErrors{0};
   std::atomic<uint64_t> outstanding{0};
   std::atomic<uint64_t> reuseds{0};
@@ -880,9 +904,18 @@ struct DownstreamState
   std::atomic<uint64_t> tcpReadTimeouts{0};
   std::atomic<uint64_t> tcpWriteTimeouts{0};
   std::atomic<uint64_t> tcpCurrentConnections{0};
+  /* number of times this server has been selected by the powerOfTwoChoices policy */
+  std::atomic<uint64_t> p2cSelections{0};
   std::atomic<double> tcpAvgQueriesPerConnection{0.0};
   /* in ms */
   std::atomic<double> tcpAvgConnectionDuration{0.0};
+  /* duration of the last successful health check, in microseconds */
+  std::atomic<double> checkLatencyUsec{0.0};
+  LatencyHistogram latencyHistogram;
+  /* the configured percentile of the latency over the last window, in microseconds, used by the lowestLatency policy */
+  std::atomic<uint64_t> latencyPercentileUsec{0};
+  /* snapshot of the histogram at the start of the current window, only used by the maintenance thread */
+  LatencyHistogram::Snapshot latencyWindowStart;
   string name;
   size_t socketsOffset{0};
   double queryLoad{0.0};
@@ -893,8 +926,15 @@ struct DownstreamState
   int tcpConnectTimeout{5};
   int tcpRecvTimeout{30};
   int tcpSendTimeout{30};
-  unsigned int checkInterval{1};
-  unsigned int lastCheck{0};
+  unsigned int checkInterval{1000}; /* in milliseconds */
+  /* interval between two health checks while a backend in lazy mode is down, in milliseconds */
+  unsigned int lazyHealthCheckFailedInterval{30000};
+  /* the fields below are only used by the health checks thread */
+  struct timespec nextCheck{0, 0};
+  struct {
+    uint64_t queries{0};
+    uint64_t reuseds{0};
+  } lazyHealthCheckLast;
   const unsigned int sourceItf{0};
   uint16_t retries{5};
   uint16_t xpfRRCode{0};
@@ -903,9 +943,17 @@ struct DownstreamState
   uint8_t consecutiveSuccessfulChecks{0};
   uint8_t maxCheckFailures{1};
   uint8_t minRiseSuccesses{1};
+  /* percentage of timeouts over the last check interval triggering a health check in lazy mode */
+  uint8_t lazyHealthCheckThreshold{20};
+  uint16_t lazyHealthCheckMinSampleCount{1};
   StopWatch sw;
   set<string> pools;
   enum class Availability { Up, Down, Auto} availability{Availability::Auto};
+  /* in lazy mode, health checks are only sent when queries to a backend that is up time out,
+     and periodically while it is down */
+  enum class HealthCheckMode { Active, Lazy } healthCheckMode{HealthCheckMode::Active};
+  /* only used by the health checks thread */
+  bool checkInProgress{false};
   bool mustResolve{false};
   bool upStatus{false};
   bool useECS{false};
@@ -954,6 +1002,7 @@ struct DownstreamState
   void hash();
   void setId(const boost::uuids::uuid& newId);
   void setWeight(int newWeight);
+  void updateLatencyPercentile(double percentile);
 
   void updateTCPMetrics(size_t nbQueries, uint64_t durationMs)
   {
@@ -979,6 +1028,8 @@ public:
   virtual bool matches(const DNSQuestion* dq) const =0;
   virtual string toString() const = 0;
   mutable std::atomic<uint64_t> d_matches{0};
+  /* number of times matches() has been called, rules handled by the compiled rule set index are not counted */
+  mutable std::atomic<uint64_t> d_evaluations{0};
 };
 
 using NumberedServerVector = NumberedVector<shared_ptr<DownstreamState>>;
@@ -1038,6 +1089,16 @@ struct ServerPool
     return result;
   }
 
+  /* the latency histograms of the servers in this pool, merged */
+  LatencyHistogram::Snapshot getLatencySnapshot()
+  {
+    LatencyHistogram::Snapshot result;
+    for (const auto& server : getServers()) {
+      result.add(server.second->latencyHistogram.getSnapshot());
+    }
+    return result;
+  }
+
   void addServer(shared_ptr<DownstreamState>& server)
   {
     WriteLock wl(&d_lock);
@@ -1140,6 +1201,7 @@ extern bool g_fixupCase;
 extern int g_tcpRecvTimeout;
 extern int g_tcpSendTimeout;
 extern int g_udpTimeout;
+extern std::atomic<unsigned int> g_udpTimeoutCheckInterval;
 extern uint16_t g_maxOutstanding;
 extern std::atomic<bool> g_configurationDone;
 extern uint64_t g_maxTCPClientThreads;
@@ -1155,6 +1217,7 @@ extern bool g_apiReadWrite;
 extern std::string g_apiConfigDirectory;
 extern bool g_servFailOnNoPolicy;
 extern uint32_t g_hashperturb;
+extern std::atomic<double> g_latencyPolicyPercentile;
 extern bool g_useTCPSinglePipe;
 extern uint16_t g_downstreamTCPCleanupInterval;
 extern size_t g_udpVectorSize;
@@ -1165,8 +1228,13 @@ extern bool g_roundrobinFailOnNoServer;
 #ifdef HAVE_EBPF
 extern shared_ptr<BPFFilter> g_defaultBPFFilter;
 extern std::vector<std::shared_ptr<DynBPFFilter> > g_dynBPFFilters;
+#ifdef HAVE_XDP_FILTER
+extern std::vector<std::shared_ptr<XDPFilter> > g_xdpFilters;
+#endif /* HAVE_XDP_FILTER */
 #endif /* HAVE_EBPF */
 
+class CompiledRuleSet;
+
 struct LocalHolders
 {
   LocalHolders(): acl(g_ACL.getLocal()), policy(g_policy.getLocal()), rulactions(g_rulactions.getLocal()), cacheHitRespRulactions(g_cachehitresprulactions.getLocal()), selfAnsweredRespRulactions(g_selfansweredresprulactions.getLocal()), servers(g_dstates.getLocal()), dynNMGBlock(g_dynblockNMG.getLocal()), dynSMTBlock(g_dynblockSMT.getLocal()), pools(g_pools.getLocal())
@@ -1182,6 +1250,9 @@ struct LocalHolders
   LocalStateHolder<NetmaskTree<DynBlock> > dynNMGBlock;
   LocalStateHolder<SuffixMatchTree<DynBlock> > dynSMTBlock;
   LocalStateHolder<pools_t> pools;
+  /* compiled version of the rules in 'rulactions', and the rules it has been compiled from */
+  std::shared_ptr<CompiledRuleSet> compiledRulactions;
+  const vector<DNSDistRuleAction>* compiledRulactionsSource{nullptr};
 };
 
 struct dnsheader;
@@ -1198,6 +1269,9 @@ std::shared_ptr<DownstreamState> leastOutstanding(const NumberedServerVector& se
 std::shared_ptr<DownstreamState> wrandom(const NumberedServerVector& servers, const DNSQuestion* dq);
 std::shared_ptr<DownstreamState> whashed(const NumberedServerVector& servers, const DNSQuestion* dq);
 std::shared_ptr<DownstreamState> chashed(const NumberedServerVector& servers, const DNSQuestion* dq);
+std::shared_ptr<DownstreamState> maglev(const NumberedServerVector& servers, const DNSQuestion* dq);
+std::shared_ptr<DownstreamState> lowestLatency(const NumberedServerVector& servers, const DNSQuestion* dq);
+std::shared_ptr<DownstreamState> powerOfTwoChoices(const NumberedServerVector& servers, const DNSQuestion* dq);
 std::shared_ptr<DownstreamState> roundrobin(const NumberedServerVector& servers, const DNSQuestion* dq);
 
 struct WebserverConfig
@@ -0,0 +1 @@
+../dnsdist-cache-shm.cc
\ No newline at end of file
@@ -0,0 +1 @@
+../dnsdist-cache-shm.hh
\ No newline at end of file
@@ -0,0 +1,288 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <algorithm>
+#include <typeinfo>
+
+#include "dnsdist-compiled-rules.hh"
+#include "dnsdist-rules.hh"
+
+static int compareLabels(const char* a, size_t aLen, const char* b, size_t bLen)
+{
+  const size_t len = std::min(aLen, bLen);
+  for (size_t idx = 0; idx < len; idx++) {
+    const unsigned char ca = dns_tolower(a[idx]);
+    const unsigned char cb = dns_tolower(b[idx]);
+    if (ca != cb) {
+      return ca < cb ? -1 : 1;
+    }
+  }
+  if (aLen == bLen) {
+    return 0;
+  }
+  return aLen < bLen ? -1 : 1;
+}
+
+static std::string toLowerLabel(const std::string& label)
+{
+  std::string result(label);
+  for (auto& c : result) {
+    c = dns_tolower(c);
+  }
+  return result;
+}
+
+bool CompiledRuleSet::isIndexable(const DNSRule& rule)
+{
+  const auto& type = typeid(rule);
+  if (type == typeid(QNameRule)) {
+    return !dynamic_cast<const QNameRule&>(rule).getQName().empty();
+  }
+  return type == typeid(AllRule) || type == typeid(QNameSetRule) || type == typeid(SuffixMatchNodeRule) || type == typeid(NetmaskGroupRule) || type == typeid(QTypeRule);
+}
+
+size_t CompiledRuleSet::getNameChild(size_t parent, const std::string& label)
+{
+  const std::string lower = toLowerLabel(label);
+  auto& children = d_nameNodes.at(parent).d_children;
+  auto it = std::lower_bound(children.begin(), children.end(), lower, [](const std::pair<std::string, size_t>& child, const std::string& l) { return child.first < l; });
+  if (it != children.end() && it->first == lower) {
+    return it->second;
+  }
+
+  const size_t child = d_nameNodes.size();
+  children.insert(it, { lower, child });
+  /* might invalidate 'children' */
+  d_nameNodes.emplace_back();
+  return child;
+}
+
+size_t CompiledRuleSet::getNameNode(const DNSName& name)
+{
+  size_t node = 0;
+  const auto labels = name.getRawLabels();
+  for (auto label = labels.crbegin(); label != labels.crend(); ++label) {
+    node = getNameChild(node, *label);
+  }
+  return node;
+}
+
+void CompiledRuleSet::addSuffixes(const SuffixMatchTree<bool>& tree, size_t node, size_t idx)
+{
+  if (tree.endNode) {
+    d_nameNodes.at(node).d_suffixRules.push_back(idx);
+  }
+  for (const auto& child : tree.children) {
+    addSuffixes(child, getNameChild(node, child.d_name), idx);
+  }
+}
+
+void CompiledRuleSet::addNetmask(const Netmask& nm, bool source, bool positive, size_t idx)
+{
+  const ComboAddress& network = nm.getNetwork();
+  const bool v4 = network.isIPv4();
+  const uint8_t* addr = v4 ? reinterpret_cast<const uint8_t*>(&network.sin4.sin_addr.s_addr) : network.sin6.sin6_addr.s6_addr;
+  const uint8_t bits = std::min(nm.getBits(), static_cast<uint8_t>(v4 ? 32 : 128));
+
+  size_t node = getAddressRoot(source, v4);
+  for (uint8_t depth = 0; depth < bits; depth++) {
+    const uint8_t bit = (addr[depth / 8] >> (7 - (depth % 8))) & 1;
+    size_t child = d_addressNodes.at(node).d_children[bit];
+    if (child == 0) {
+      child = d_addressNodes.size();
+      d_addressNodes.emplace_back();
+      d_addressNodes.at(node).d_children[bit] = child;
+    }
+    node = child;
+  }
+
+  d_addressNodes.at(node).d_entries.push_back({ idx, positive });
+  if (source) {
+    d_hasSourceRules = true;
+  }
+  else {
+    d_hasDestinationRules = true;
+  }
+}
+
+CompiledRuleSet::CompiledRuleSet(const std::vector<DNSDistRuleAction>& rules): d_nameNodes(1), d_addressNodes(4)
+{
+  d_rules.reserve(rules.size());
+
+  for (size_t idx = 0; idx < rules.size(); idx++) {
+    const auto& rule = rules.at(idx).d_rule;
+    d_rules.push_back(rule);
+
+    if (!isIndexable(*rule)) {
+      d_generic.push_back(idx);
+      continue;
+    }
+
+    const auto& type = typeid(*rule);
+    if (type == typeid(QNameRule) || type == typeid(QNameSetRule) || type == typeid(SuffixMatchNodeRule)) {
+      d_hasNameRules = true;
+    }
+
+    if (type == typeid(AllRule)) {
+      d_always.push_back(idx);
+    }
+    else if (type == typeid(QNameRule)) {
+      d_nameNodes.at(getNameNode(dynamic_cast<const QNameRule&>(*rule).getQName())).d_exactRules.push_back(idx);
+    }
+    else if (type == typeid(QNameSetRule)) {
+      for (const auto& name : dynamic_cast<const QNameSetRule&>(*rule).getNames()) {
+        if (!name.empty()) {
+          d_nameNodes.at(getNameNode(name)).d_exactRules.push_back(idx);
+        }
+      }
+    }
+    else if (type == typeid(SuffixMatchNodeRule)) {
+      addSuffixes(dynamic_cast<const SuffixMatchNodeRule&>(*rule).getSuffixes().d_tree, 0, idx);
+    }
+    else if (type == typeid(NetmaskGroupRule)) {
+      const auto& nmgRule = dynamic_cast<const NetmaskGroupRule&>(*rule);
+      std::vector<std::string> entries;
+      nmgRule.getNetmaskGroup().toStringVector(&entries);
+      for (const auto& entry : entries) {
+        const bool negated = !entry.empty() && entry.at(0) == '!';
+        addNetmask(Netmask(negated ? entry.substr(1) : entry), nmgRule.isSource(), !negated, idx);
+      }
+    }
+    else if (type == typeid(QTypeRule)) {
+      const uint16_t qtype = dynamic_cast<const QTypeRule&>(*rule).getQType();
+      d_qtypeRules[qtype].push_back(idx);
+      d_qtypes.set(qtype);
+    }
+  }
+
+  d_seen.resize(rules.size(), 0);
+  d_hits.reserve(rules.size());
+}
+
+void CompiledRuleSet::lookupName(const DNSName& qname) const
+{
+  const auto& storage = qname.getStorage();
+  if (storage.empty()) {
+    return;
+  }
+
+  /* offsets of the labels in the wire representation of the name */
+  size_t offsets[128];
+  size_t count = 0;
+  for (size_t pos = 0; pos < storage.size() && storage[pos] != 0 && count < sizeof(offsets) / sizeof(*offsets); pos += 1 + static_cast<uint8_t>(storage[pos])) {
+    offsets[count++] = pos;
+  }
+
+  const NameNode* node = &d_nameNodes.front();
+  d_hits.insert(d_hits.end(), node->d_suffixRules.cbegin(), node->d_suffixRules.cend());
+
+  while (count > 0) {
+    const size_t offset = offsets[--count];
+    const char* label = &storage[offset + 1];
+    const size_t labelLen = static_cast<uint8_t>(storage[offset]);
+
+    const auto& children = node->d_children;
+    auto it = std::lower_bound(children.cbegin(), children.cend(), label, [labelLen](const std::pair<std::string, size_t>& child, const char* l) {
+      return compareLabels(child.first.data(), child.first.size(), l, labelLen) < 0;
+    });
+    if (it == children.cend() || compareLabels(it->first.data(), it->first.size(), label, labelLen) != 0) {
+      return;
+    }
+
+    node = &d_nameNodes[it->second];
+    d_hits.insert(d_hits.end(), node->d_suffixRules.cbegin(), node->d_suffixRules.cend());
+  }
+
+  d_hits.insert(d_hits.end(), node->d_exactRules.cbegin(), node->d_exactRules.cend());
+}
+
+void CompiledRuleSet::lookupAddress(const ComboAddress& addr, bool source) const
+{
+  if (addr.sin4.sin_family != AF_INET && addr.sin4.sin_family != AF_INET6) {
+    return;
+  }
+
+  const bool v4 = addr.isIPv4();
+  const uint8_t* bytes = v4 ? reinterpret_cast<const uint8_t*>(&addr.sin4.sin_addr.s_addr) : addr.sin6.sin6_addr.s6_addr;
+  const uint8_t bits = v4 ? 32 : 128;
+
+  d_addressPath.clear();
+  const AddressNode* node = &d_addressNodes[getAddressRoot(source, v4)];
+  for (uint8_t depth = 0; ; depth++) {
+    if (!node->d_entries.empty()) {
+      d_addressPath.push_back(node);
+    }
+    if (depth >= bits) {
+      break;
+    }
+    const size_t child = node->d_children[(bytes[depth / 8] >> (7 - (depth % 8))) & 1];
+    if (child == 0) {
+      break;
+    }
+    node = &d_addressNodes[child];
+  }
+
+  if (++d_seenGeneration == 0) {
+    std::fill(d_seen.begin(), d_seen.end(), 0);
+    d_seenGeneration = 1;
+  }
+
+  /* the most specific entry of a rule decides, like NetmaskGroup::match() does */
+  for (auto it = d_addressPath.crbegin(); it != d_addressPath.crend(); ++it) {
+    for (const auto& entry : (*it)->d_entries) {
+      if (d_seen[entry.first] == d_seenGeneration) {
+        continue;
+      }
+      d_seen[entry.first] = d_seenGeneration;
+      if (entry.second) {
+        d_hits.push_back(entry.first);
+      }
+    }
+  }
+}
+
+void CompiledRuleSet::lookup(const DNSQuestion& dq) const
+{
+  d_hits.assign(d_always.cbegin(), d_always.cend());
+
+  if (d_hasNameRules) {
+    lookupName(*dq.qname);
+  }
+
+  if (d_qtypes.test(dq.qtype)) {
+    const auto& rules = d_qtypeRules.at(dq.qtype);
+    d_hits.insert(d_hits.end(), rules.cbegin(), rules.cend());
+  }
+
+  if (d_hasSourceRules && dq.remote != nullptr) {
+    lookupAddress(*dq.remote, true);
+  }
+
+  if (d_hasDestinationRules && dq.local != nullptr) {
+    lookupAddress(*dq.local, false);
+  }
+
+  if (d_hits.size() > 1) {
+    std::sort(d_hits.begin(), d_hits.end());
+    d_hits.erase(std::unique(d_hits.begin(), d_hits.end()), d_hits.end());
+  }
+}
@@ -0,0 +1,139 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <bitset>
+#include <unordered_map>
+#include <vector>
+
+#include "dnsdist.hh"
+
+/* Compiled version of a list of query rules. The rules whose outcome only depends on
+   the qname, qtype, source or destination address of the query (QNameRule, QNameSetRule,
+   SuffixMatchNodeRule, NetmaskGroupRule, QTypeRule and AllRule) are merged into a single
+   suffix trie, a binary netmask tree per direction and address family and a qtype bitmap,
+   so that all of them can be checked in one pass over the qname and the addresses.
+   The remaining rules are still evaluated one by one, but only when the processing
+   actually reaches them, in the order of the list, so the first-match semantics and the
+   side effects of the actions on the following rules are preserved.
+
+   A compiled set keeps some scratch space for the lookups, so it must not be shared
+   between threads: each thread compiles its own copy. */
+class CompiledRuleSet
+{
+public:
+  CompiledRuleSet(const std::vector<DNSDistRuleAction>& rules);
+
+  /* whether this rule can be handled by the index instead of calling matches() */
+  static bool isIndexable(const DNSRule& rule);
+
+  /* calls 'visitor' with the index of every rule matching the query, in order,
+     until it returns true */
+  template<typename F> void forEachMatch(const DNSQuestion& dq, const F& visitor) const
+  {
+    lookup(dq);
+
+    auto hit = d_hits.cbegin();
+    auto generic = d_generic.cbegin();
+    while (hit != d_hits.cend() || generic != d_generic.cend()) {
+      size_t idx;
+      if (generic != d_generic.cend() && (hit == d_hits.cend() || *generic < *hit)) {
+        idx = *generic;
+        ++generic;
+        const auto& rule = d_rules[idx];
+        ++rule->d_evaluations;
+        if (!rule->matches(&dq)) {
+          continue;
+        }
+      }
+      else {
+        idx = *hit;
+        ++hit;
+      }
+
+      if (visitor(idx)) {
+        return;
+      }
+    }
+  }
+
+  size_t size() const
+  {
+    return d_rules.size();
+  }
+
+  size_t getNumberOfIndexedRules() const
+  {
+    return d_rules.size() - d_generic.size();
+  }
+
+private:
+  struct NameNode
+  {
+    /* lowercase label and index of the child node, sorted by label */
+    std::vector<std::pair<std::string, size_t>> d_children;
+    /* rules matching this name and everything below it */
+    std::vector<size_t> d_suffixRules;
+    /* rules matching only this exact name */
+    std::vector<size_t> d_exactRules;
+  };
+
+  struct AddressNode
+  {
+    /* 0 means no child, since the roots can never be a child */
+    size_t d_children[2]{0, 0};
+    /* index of the rule, and false for a negated entry */
+    std::vector<std::pair<size_t, bool>> d_entries;
+  };
+
+  size_t getNameChild(size_t parent, const std::string& label);
+  size_t getNameNode(const DNSName& name);
+  void addSuffixes(const SuffixMatchTree<bool>& tree, size_t node, size_t idx);
+  void addNetmask(const Netmask& nm, bool source, bool positive, size_t idx);
+  void lookup(const DNSQuestion& dq) const;
+  void lookupName(const DNSName& qname) const;
+  void lookupAddress(const ComboAddress& addr, bool source) const;
+
+  static size_t getAddressRoot(bool source, bool v4)
+  {
+    return (source ? 0 : 2) + (v4 ? 0 : 1);
+  }
+
+  std::vector<std::shared_ptr<DNSRule>> d_rules;
+  /* rules that are not indexed, in order */
+  std::vector<size_t> d_generic;
+  /* rules always matching */
+  std::vector<size_t> d_always;
+  std::vector<NameNode> d_nameNodes;
+  std::vector<AddressNode> d_addressNodes;
+  std::unordered_map<uint16_t, std::vector<size_t>> d_qtypeRules;
+  std::bitset<65536> d_qtypes;
+  bool d_hasNameRules{false};
+  bool d_hasSourceRules{false};
+  bool d_hasDestinationRules{false};
+
+  /* scratch space for the lookups */
+  mutable std::vector<size_t> d_hits;
+  mutable std::vector<const AddressNode*> d_addressPath;
+  mutable std::vector<uint32_t> d_seen;
+  mutable uint32_t d_seenGeneration{0};
+};
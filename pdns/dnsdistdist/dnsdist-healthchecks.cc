@@ -0,0 +1,364 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dnsdist-healthchecks.hh"
+#include "dnswriter.hh"
+#include "dolog.hh"
+#include "gettime.hh"
+#include "sstuff.hh"
+
+struct HealthCheckData
+{
+  HealthCheckData(FDMultiplexer& mplexer, const std::shared_ptr<DownstreamState>& ds, DNSName&& checkName, uint16_t checkType, uint16_t checkClass, uint16_t queryID, bool initial): d_ds(ds), d_mplexer(mplexer), d_udpSocket(ds->remote.sin4.sin_family, SOCK_DGRAM), d_checkName(std::move(checkName)), d_checkType(checkType), d_checkClass(checkClass), d_queryID(queryID), d_initial(initial)
+  {
+  }
+
+  const std::shared_ptr<DownstreamState> d_ds;
+  FDMultiplexer& d_mplexer;
+  Socket d_udpSocket;
+  DNSName d_checkName;
+  StopWatch d_elapsed{false};
+  uint16_t d_checkType;
+  uint16_t d_checkClass;
+  uint16_t d_queryID;
+  bool d_initial;
+};
+
+void updateHealthCheckResult(const std::shared_ptr<DownstreamState>& dss, bool initial, bool newState)
+{
+  if (initial) {
+    warnlog("Marking downstream %s as '%s'", dss->getNameWithAddr(), newState ? "up" : "down");
+    dss->upStatus = newState;
+    return;
+  }
+
+  if (newState) {
+    /* check succeeded */
+    dss->currentCheckFailures = 0;
+
+    if (!dss->upStatus) {
+      /* we were marked as down */
+      dss->consecutiveSuccessfulChecks++;
+      if (dss->consecutiveSuccessfulChecks < dss->minRiseSuccesses) {
+        /* if we need more than one successful check to rise
+           and we didn't reach the threshold yet,
+           let's stay down */
+        newState = false;
+      }
+    }
+  }
+  else {
+    /* check failed */
+    dss->consecutiveSuccessfulChecks = 0;
+
+    if (dss->upStatus) {
+      /* we are currently up */
+      dss->currentCheckFailures++;
+      if (dss->currentCheckFailures < dss->maxCheckFailures) {
+        /* we need more than one failure to be marked as down,
+           and we did not reach the threshold yet, let's stay down */
+        newState = true;
+      }
+    }
+  }
+
+  if(newState != dss->upStatus) {
+    warnlog("Marking downstream %s as '%s'", dss->getNameWithAddr(), newState ? "up" : "down");
+
+    if (newState && !dss->connected) {
+      newState = dss->reconnect();
+
+      if (dss->connected && !dss->threadStarted.test_and_set()) {
+        dss->tid = std::thread(responderThread, dss);
+      }
+    }
+
+    dss->upStatus = newState;
+    dss->currentCheckFailures = 0;
+    dss->consecutiveSuccessfulChecks = 0;
+    /* the timeouts that happened before the change should not trigger a lazy health check */
+    dss->lazyHealthCheckLast.queries = dss->queries.load();
+    dss->lazyHealthCheckLast.reuseds = dss->reuseds.load();
+    if (g_snmpAgent && g_snmpTrapsEnabled) {
+      g_snmpAgent->sendBackendStatusChangeTrap(dss);
+    }
+  }
+}
+
+static bool handleResponse(const HealthCheckData& data, const std::string& reply, const ComboAddress& from)
+{
+  const auto& ds = data.d_ds;
+
+  /* we are using a connected socket but hey.. */
+  if (from != ds->remote) {
+    if (g_verboseHealthChecks)
+      infolog("Invalid health check response received from %s, expecting one from %s", from.toStringWithPort(), ds->remote.toStringWithPort());
+    return false;
+  }
+
+  const dnsheader * responseHeader = reinterpret_cast<const dnsheader *>(reply.c_str());
+
+  if (reply.size() < sizeof(*responseHeader)) {
+    if (g_verboseHealthChecks)
+      infolog("Invalid health check response of size %d from backend %s, expecting at least %d", reply.size(), ds->getNameWithAddr(), sizeof(*responseHeader));
+    return false;
+  }
+
+  if (responseHeader->id != data.d_queryID) {
+    if (g_verboseHealthChecks)
+      infolog("Invalid health check response id %d from backend %s, expecting %d", responseHeader->id, ds->getNameWithAddr(), data.d_queryID);
+    return false;
+  }
+
+  if (!responseHeader->qr) {
+    if (g_verboseHealthChecks)
+      infolog("Invalid health check response from backend %s, expecting QR to be set", ds->getNameWithAddr());
+    return false;
+  }
+
+  if (responseHeader->rcode == RCode::ServFail) {
+    if (g_verboseHealthChecks)
+      infolog("Backend %s responded to health check with ServFail", ds->getNameWithAddr());
+    return false;
+  }
+
+  if (ds->mustResolve && (responseHeader->rcode == RCode::NXDomain || responseHeader->rcode == RCode::Refused)) {
+    if (g_verboseHealthChecks)
+      infolog("Backend %s responded to health check with %s while mustResolve is set", ds->getNameWithAddr(), responseHeader->rcode == RCode::NXDomain ? "NXDomain" : "Refused");
+    return false;
+  }
+
+  uint16_t receivedType;
+  uint16_t receivedClass;
+  DNSName receivedName(reply.c_str(), reply.size(), sizeof(dnsheader), false, &receivedType, &receivedClass);
+
+  if (receivedName != data.d_checkName || receivedType != data.d_checkType || receivedClass != data.d_checkClass) {
+    if (g_verboseHealthChecks)
+      infolog("Backend %s responded to health check with an invalid qname (%s vs %s), qtype (%s vs %s) or qclass (%d vs %d)", ds->getNameWithAddr(), receivedName.toLogString(), data.d_checkName.toLogString(), QType(receivedType).getName(), QType(data.d_checkType).getName(), receivedClass, data.d_checkClass);
+    return false;
+  }
+
+  return true;
+}
+
+static void healthCheckUDPCallback(int fd, FDMultiplexer::funcparam_t& param)
+{
+  /* removing the descriptor from the multiplexer invalidates 'param' */
+  auto data = boost::any_cast<std::shared_ptr<HealthCheckData>>(param);
+  data->d_mplexer.removeReadFD(fd);
+  data->d_ds->checkInProgress = false;
+
+  bool result = false;
+  try {
+    string reply;
+    ComboAddress from;
+    data->d_udpSocket.recvFrom(reply, from);
+    result = handleResponse(*data, reply, from);
+  }
+  catch(const std::exception& e) {
+    if (g_verboseHealthChecks)
+      infolog("Error checking the health of backend %s: %s", data->d_ds->getNameWithAddr(), e.what());
+  }
+  catch(...) {
+    if (g_verboseHealthChecks)
+      infolog("Unknown exception while checking the health of backend %s", data->d_ds->getNameWithAddr());
+  }
+
+  if (result) {
+    data->d_ds->checkLatencyUsec = data->d_elapsed.udiff();
+  }
+
+  updateHealthCheckResult(data->d_ds, data->d_initial, result);
+}
+
+bool queueHealthCheck(FDMultiplexer& mplexer, const std::shared_ptr<DownstreamState>& ds, bool initial)
+try
+{
+  DNSName checkName = ds->checkName;
+  uint16_t checkType = ds->checkType.getCode();
+  uint16_t checkClass = ds->checkClass;
+  dnsheader checkHeader;
+  memset(&checkHeader, 0, sizeof(checkHeader));
+
+  checkHeader.qdcount = htons(1);
+  checkHeader.id = getRandomDNSID();
+
+  checkHeader.rd = true;
+  if (ds->setCD) {
+    checkHeader.cd = true;
+  }
+
+  if (ds->checkFunction) {
+    std::lock_guard<std::mutex> lock(g_luamutex);
+    auto ret = ds->checkFunction(checkName, checkType, checkClass, &checkHeader);
+    checkName = std::get<0>(ret);
+    checkType = std::get<1>(ret);
+    checkClass = std::get<2>(ret);
+  }
+
+  vector<uint8_t> packet;
+  DNSPacketWriter dpw(packet, checkName, checkType, checkClass);
+  dnsheader * requestHeader = dpw.getHeader();
+  *requestHeader = checkHeader;
+  const uint16_t queryID = checkHeader.id;
+
+  auto data = std::make_shared<HealthCheckData>(mplexer, ds, std::move(checkName), checkType, checkClass, queryID, initial);
+  Socket& sock = data->d_udpSocket;
+  sock.setNonBlocking();
+  if (!IsAnyAddress(ds->sourceAddr)) {
+    sock.setReuseAddr();
+    if (!ds->sourceItfName.empty()) {
+#ifdef SO_BINDTODEVICE
+      int res = setsockopt(sock.getHandle(), SOL_SOCKET, SO_BINDTODEVICE, ds->sourceItfName.c_str(), ds->sourceItfName.length());
+      if (res != 0 && g_verboseHealthChecks) {
+        infolog("Error settting SO_BINDTODEVICE on the health check socket for backend '%s': %s", ds->getNameWithAddr(), stringerror());
+      }
+#endif
+    }
+    sock.bind(ds->sourceAddr);
+  }
+  sock.connect(ds->remote);
+  data->d_elapsed.start();
+  ssize_t sent = udpClientSendRequestToBackend(ds, sock.getHandle(), reinterpret_cast<char*>(&packet[0]), packet.size(), true);
+  if (sent < 0) {
+    int ret = errno;
+    if (g_verboseHealthChecks)
+      infolog("Error while sending a health check query to backend %s: %d", ds->getNameWithAddr(), ret);
+    return false;
+  }
+
+  struct timeval ttd;
+  gettimeofday(&ttd, nullptr);
+  ttd.tv_sec += ds->checkTimeout / 1000; /* ms to seconds */
+  ttd.tv_usec += (ds->checkTimeout % 1000) * 1000; /* remaining ms to us */
+  if (ttd.tv_usec >= 1000000) {
+    ttd.tv_sec++;
+    ttd.tv_usec -= 1000000;
+  }
+
+  mplexer.addReadFD(sock.getHandle(), &healthCheckUDPCallback, data, &ttd);
+  ds->checkInProgress = true;
+
+  return true;
+}
+catch(const std::exception& e)
+{
+  if (g_verboseHealthChecks)
+    infolog("Error checking the health of backend %s: %s", ds->getNameWithAddr(), e.what());
+  return false;
+}
+catch(...)
+{
+  if (g_verboseHealthChecks)
+    infolog("Unknown exception while checking the health of backend %s", ds->getNameWithAddr());
+  return false;
+}
+
+/* in lazy mode, a backend that is up is only checked when enough of the queries sent to it since the last
+   time we looked have timed out, or while a previous check has failed without reaching the failure threshold yet */
+static bool lazyHealthCheckNeeded(DownstreamState& ds)
+{
+  const uint64_t queries = ds.queries.load();
+  const uint64_t reuseds = ds.reuseds.load();
+  const uint64_t newQueries = queries - ds.lazyHealthCheckLast.queries;
+  const uint64_t newTimeouts = reuseds - ds.lazyHealthCheckLast.reuseds;
+  ds.lazyHealthCheckLast.queries = queries;
+  ds.lazyHealthCheckLast.reuseds = reuseds;
+
+  if (ds.currentCheckFailures > 0) {
+    return true;
+  }
+
+  if (newQueries == 0 || newQueries < ds.lazyHealthCheckMinSampleCount) {
+    return false;
+  }
+
+  return (newTimeouts * 100) >= (newQueries * ds.lazyHealthCheckThreshold);
+}
+
+static unsigned int msecUntil(const struct timespec& now, const struct timespec& then)
+{
+  if (!(now < then)) {
+    return 0;
+  }
+  return static_cast<unsigned int>((then.tv_sec - now.tv_sec) * 1000 + (then.tv_nsec - now.tv_nsec) / 1000000);
+}
+
+unsigned int queueDueHealthChecks(FDMultiplexer& mplexer, const servers_t& servers, const struct timespec& now)
+{
+  unsigned int nextDue = std::numeric_limits<unsigned int>::max();
+
+  for (const auto& dss : servers) {
+    if (dss->availability != DownstreamState::Availability::Auto || dss->checkInProgress) {
+      continue;
+    }
+
+    if (now < dss->nextCheck) {
+      nextDue = std::min(nextDue, msecUntil(now, dss->nextCheck));
+      continue;
+    }
+
+    unsigned int interval = dss->checkInterval;
+    bool needed = true;
+    if (dss->healthCheckMode == DownstreamState::HealthCheckMode::Lazy) {
+      if (dss->upStatus) {
+        needed = lazyHealthCheckNeeded(*dss);
+      }
+      else {
+        interval = dss->lazyHealthCheckFailedInterval;
+      }
+    }
+
+    dss->nextCheck = now;
+    dss->nextCheck.tv_sec += interval / 1000;
+    dss->nextCheck.tv_nsec += (interval % 1000) * 1000000;
+    if (dss->nextCheck.tv_nsec >= 1000000000) {
+      dss->nextCheck.tv_sec++;
+      dss->nextCheck.tv_nsec -= 1000000000;
+    }
+    nextDue = std::min(nextDue, interval);
+
+    if (needed && !queueHealthCheck(mplexer, dss)) {
+      updateHealthCheckResult(dss, false, false);
+    }
+  }
+
+  return nextDue;
+}
+
+void handleQueuedHealthChecks(FDMultiplexer& mplexer, int timeout)
+{
+  struct timeval now;
+  mplexer.run(&now, timeout);
+
+  auto timeouts = mplexer.getTimeouts(now);
+  for (const auto& entry : timeouts) {
+    auto data = boost::any_cast<std::shared_ptr<HealthCheckData>>(entry.second);
+    mplexer.removeReadFD(entry.first);
+    data->d_ds->checkInProgress = false;
+
+    if (g_verboseHealthChecks)
+      infolog("Timeout while waiting for the health check response from backend %s", data->d_ds->getNameWithAddr());
+
+    updateHealthCheckResult(data->d_ds, data->d_initial, false);
+  }
+}
@@ -0,0 +1,39 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include "dnsdist.hh"
+#include "mplexer.hh"
+
+/* The health checks are sent asynchronously: every due query is sent right away over its own
+   non-blocking socket registered with the multiplexer, and the responses and timeouts are
+   handled as events, so a slow or dead backend does not delay the checks of the other ones. */
+
+/* sends a health check query to that backend, returns false if it could not be sent.
+   The result of an 'initial' check is applied right away, without the usual rise and fall thresholds */
+bool queueHealthCheck(FDMultiplexer& mplexer, const std::shared_ptr<DownstreamState>& ds, bool initial=false);
+/* sends the health check queries that are due, according to the interval and mode of each backend,
+   and returns the number of milliseconds until the next one is */
+unsigned int queueDueHealthChecks(FDMultiplexer& mplexer, const servers_t& servers, const struct timespec& now);
+/* waits up to 'timeout' milliseconds for the responses to the queued health checks, then handles the ones that timed out */
+void handleQueuedHealthChecks(FDMultiplexer& mplexer, int timeout);
+void updateHealthCheckResult(const std::shared_ptr<DownstreamState>& dss, bool initial, bool newState);
@@ -0,0 +1,115 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cmath>
+
+#include "dnsdist-histogram.hh"
+
+const unsigned int LatencyHistogram::s_subBucketBits;
+const uint64_t LatencyHistogram::s_subBucketCount;
+const unsigned int LatencyHistogram::s_maxExponent;
+const size_t LatencyHistogram::s_numberOfBuckets;
+const size_t LatencyHistogram::s_numberOfShards;
+std::atomic<size_t> LatencyHistogram::s_nextShardIdx{0};
+
+uint64_t LatencyHistogram::getBucketLowerBound(size_t idx)
+{
+  if (idx < 2 * s_subBucketCount) {
+    return idx;
+  }
+  const size_t shift = (idx / s_subBucketCount) - 1;
+  return (s_subBucketCount + (idx % s_subBucketCount)) << shift;
+}
+
+uint64_t LatencyHistogram::getBucketHighestValue(size_t idx)
+{
+  if (idx < 2 * s_subBucketCount) {
+    return idx;
+  }
+  const size_t shift = (idx / s_subBucketCount) - 1;
+  return getBucketLowerBound(idx) + (static_cast<uint64_t>(1) << shift) - 1;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::getSnapshot() const
+{
+  Snapshot result;
+  for (const auto& entry : d_shards) {
+    const Shard* shard = entry.load(std::memory_order_acquire);
+    if (shard == nullptr) {
+      continue;
+    }
+    for (size_t idx = 0; idx < s_numberOfBuckets; idx++) {
+      const uint64_t count = shard->d_buckets[idx].load(std::memory_order_relaxed);
+      result.d_buckets[idx] += count;
+      result.d_count += count;
+    }
+    result.d_sum += shard->d_sum.load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+uint64_t LatencyHistogram::Snapshot::getPercentile(double percentile) const
+{
+  if (d_count == 0) {
+    return 0;
+  }
+
+  percentile = std::min(std::max(percentile, 0.0), 100.0);
+  const uint64_t target = std::max(static_cast<uint64_t>(std::ceil(d_count * percentile / 100.0)), static_cast<uint64_t>(1));
+  uint64_t seen = 0;
+  for (size_t idx = 0; idx < d_buckets.size(); idx++) {
+    seen += d_buckets[idx];
+    if (seen >= target) {
+      return getBucketHighestValue(idx);
+    }
+  }
+  return getBucketHighestValue(d_buckets.size() - 1);
+}
+
+uint64_t LatencyHistogram::Snapshot::getCountUpTo(uint64_t usec) const
+{
+  uint64_t result = 0;
+  for (size_t idx = 0; idx < d_buckets.size() && getBucketHighestValue(idx) <= usec; idx++) {
+    result += d_buckets[idx];
+  }
+  return result;
+}
+
+void LatencyHistogram::Snapshot::add(const Snapshot& rhs)
+{
+  for (size_t idx = 0; idx < d_buckets.size(); idx++) {
+    d_buckets[idx] += rhs.d_buckets[idx];
+  }
+  d_count += rhs.d_count;
+  d_sum += rhs.d_sum;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::Snapshot::getDelta(const Snapshot& previous) const
+{
+  Snapshot result;
+  for (size_t idx = 0; idx < d_buckets.size(); idx++) {
+    result.d_buckets[idx] = d_buckets[idx] - previous.d_buckets[idx];
+  }
+  result.d_count = d_count - previous.d_count;
+  result.d_sum = d_sum - previous.d_sum;
+  return result;
+}
@@ -0,0 +1,160 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/* HDR-style log-linear histogram of latencies, in microseconds.
+   Values below 2 * s_subBucketCount get their own bucket, then every power of two
+   is split into s_subBucketCount linear sub-buckets, so that the relative error is
+   below 1/s_subBucketCount (about 3%) over the whole range. Values of 2^s_maxExponent
+   microseconds (about 67s) and more end up in the last bucket.
+
+   Every thread records into its own shard of counters, allocated on first use,
+   using relaxed atomic operations and without any lock. Readers merge the shards
+   into a Snapshot. */
+class LatencyHistogram
+{
+public:
+  static const unsigned int s_subBucketBits = 5;
+  static const uint64_t s_subBucketCount = 1 << s_subBucketBits;
+  static const unsigned int s_maxExponent = 26;
+  static const size_t s_numberOfBuckets = 2 * s_subBucketCount + (s_maxExponent - s_subBucketBits - 1) * s_subBucketCount;
+
+  class Snapshot
+  {
+  public:
+    Snapshot(): d_buckets(s_numberOfBuckets, 0)
+    {
+    }
+
+    uint64_t getCount() const
+    {
+      return d_count;
+    }
+
+    /* in microseconds */
+    uint64_t getSum() const
+    {
+      return d_sum;
+    }
+
+    /* returns the highest value of the bucket holding the requested percentile,
+       in microseconds, or 0 if nothing has been recorded */
+    uint64_t getPercentile(double percentile) const;
+    /* number of values lower than or equal to 'usec', rounded to the bucket boundaries */
+    uint64_t getCountUpTo(uint64_t usec) const;
+
+    void add(const Snapshot& rhs);
+    /* what has been recorded since 'previous', an older snapshot of the same histogram, was taken */
+    Snapshot getDelta(const Snapshot& previous) const;
+
+  private:
+    friend class LatencyHistogram;
+
+    std::vector<uint64_t> d_buckets;
+    uint64_t d_count{0};
+    uint64_t d_sum{0};
+  };
+
+  LatencyHistogram()
+  {
+    for (auto& shard : d_shards) {
+      shard.store(nullptr);
+    }
+  }
+
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  ~LatencyHistogram()
+  {
+    for (auto& shard : d_shards) {
+      delete shard.load();
+    }
+  }
+
+  void record(uint64_t usec)
+  {
+    Shard& shard = getShard();
+    shard.d_buckets[getBucketIndex(usec)].fetch_add(1, std::memory_order_relaxed);
+    shard.d_sum.fetch_add(usec, std::memory_order_relaxed);
+  }
+
+  Snapshot getSnapshot() const;
+
+  static size_t getBucketIndex(uint64_t usec)
+  {
+    if (usec < 2 * s_subBucketCount) {
+      return usec;
+    }
+    if (usec >= (static_cast<uint64_t>(1) << s_maxExponent)) {
+      return s_numberOfBuckets - 1;
+    }
+    const unsigned int exponent = 63 - __builtin_clzll(usec);
+    const unsigned int shift = exponent - s_subBucketBits;
+    return 2 * s_subBucketCount + (shift - 1) * s_subBucketCount + ((usec >> shift) - s_subBucketCount);
+  }
+
+  static uint64_t getBucketLowerBound(size_t idx);
+  /* the highest value that ends up in that bucket */
+  static uint64_t getBucketHighestValue(size_t idx);
+
+private:
+  struct Shard
+  {
+    Shard()
+    {
+      for (auto& bucket : d_buckets) {
+        bucket.store(0);
+      }
+    }
+
+    std::atomic<uint64_t> d_buckets[s_numberOfBuckets];
+    std::atomic<uint64_t> d_sum{0};
+  };
+
+  static const size_t s_numberOfShards = 32;
+
+  Shard& getShard()
+  {
+    static thread_local const size_t t_shardIdx = s_nextShardIdx++ % s_numberOfShards;
+    Shard* shard = d_shards[t_shardIdx].load(std::memory_order_acquire);
+    if (shard == nullptr) {
+      Shard* newShard = new Shard();
+      if (d_shards[t_shardIdx].compare_exchange_strong(shard, newShard)) {
+        shard = newShard;
+      }
+      else {
+        /* another thread sharing the same index was faster */
+        delete newShard;
+      }
+    }
+    return *shard;
+  }
+
+  static std::atomic<size_t> s_nextShardIdx;
+
+  std::atomic<Shard*> d_shards[s_numberOfShards];
+};
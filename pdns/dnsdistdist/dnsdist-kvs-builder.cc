@@ -0,0 +1,166 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "config.h"
+
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+
+#include "dnsdist-perfecthash.hh"
+#include "dnsname.hh"
+
+/* Builds a database usable by newPerfectHashKVStore() from a text file holding one entry per line,
+   the key and the value being separated by the first run of spaces or tabs */
+
+static void usage()
+{
+  std::cerr<<"Usage: dnsdist-kvs-builder [--keys names|text-names|raw] <input file, or - for stdin> <output file>"<<std::endl;
+  std::cerr<<std::endl;
+  std::cerr<<"Each line of the input file holds a key and an optional value, separated by spaces or tabs."<<std::endl;
+  std::cerr<<"Empty lines and lines starting with a '#' are ignored."<<std::endl;
+  std::cerr<<"  --keys names       keys are DNS names, stored in lowercase DNS wire format (default)"<<std::endl;
+  std::cerr<<"  --keys text-names  keys are DNS names, stored in lowercase plain text with a trailing dot"<<std::endl;
+  std::cerr<<"  --keys raw         keys are stored as they are"<<std::endl;
+}
+
+int main(int argc, char** argv)
+try
+{
+  enum class KeyFormat { Names, TextNames, Raw };
+  KeyFormat keyFormat = KeyFormat::Names;
+
+  static const struct option longopts[]={
+    {"keys", required_argument, 0, 'k'},
+    {"help", no_argument, 0, 'h'},
+    {0,0,0,0}
+  };
+
+  for (;;) {
+    int c = getopt_long(argc, argv, "hk:", longopts, nullptr);
+    if (c == -1) {
+      break;
+    }
+    switch (c) {
+    case 'k':
+      if (std::string(optarg) == "names") {
+        keyFormat = KeyFormat::Names;
+      }
+      else if (std::string(optarg) == "text-names") {
+        keyFormat = KeyFormat::TextNames;
+      }
+      else if (std::string(optarg) == "raw") {
+        keyFormat = KeyFormat::Raw;
+      }
+      else {
+        usage();
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'h':
+      usage();
+      return EXIT_SUCCESS;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (argc - optind != 2) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  const std::string inputFile(argv[optind]);
+  const std::string outputFile(argv[optind + 1]);
+
+  std::ifstream inputStream;
+  if (inputFile != "-") {
+    inputStream.open(inputFile);
+    if (!inputStream) {
+      std::cerr<<"Unable to open input file '"<<inputFile<<"'"<<std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::istream& input = inputFile == "-" ? std::cin : inputStream;
+
+  PerfectHashDBWriter writer(keyFormat == KeyFormat::Names ? PerfectHashDB::s_flagNameKeys : 0);
+  std::string line;
+  size_t lineNumber = 0;
+  while (std::getline(input, line)) {
+    lineNumber++;
+    if (!line.empty() && line.at(line.size() - 1) == '\r') {
+      line.resize(line.size() - 1);
+    }
+    if (line.empty() || line.at(0) == '#') {
+      continue;
+    }
+
+    const auto keyEnd = line.find_first_of(" \t");
+    std::string key = line.substr(0, keyEnd);
+    std::string value;
+    if (keyEnd != std::string::npos) {
+      const auto valueStart = line.find_first_not_of(" \t", keyEnd);
+      if (valueStart != std::string::npos) {
+        value = line.substr(valueStart);
+      }
+    }
+
+    try {
+      switch (keyFormat) {
+      case KeyFormat::Names:
+        key = DNSName(key).toDNSStringLC();
+        break;
+      case KeyFormat::TextNames:
+        key = DNSName(key).makeLowerCase().toStringRootDot();
+        break;
+      case KeyFormat::Raw:
+        break;
+      }
+    }
+    catch (const std::exception& e) {
+      std::cerr<<"Invalid name '"<<key<<"' on line "<<lineNumber<<": "<<e.what()<<std::endl;
+      return EXIT_FAILURE;
+    }
+
+    writer.addEntry(key, value);
+  }
+
+  if (input.bad()) {
+    std::cerr<<"Error reading the input file '"<<inputFile<<"'"<<std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const size_t entries = writer.size();
+  const size_t duplicates = writer.write(outputFile);
+  std::cout<<"Wrote "<<(entries - duplicates)<<" entries to '"<<outputFile<<"'";
+  if (duplicates > 0) {
+    std::cout<<", skipped "<<duplicates<<" duplicate key(s)";
+  }
+  std::cout<<std::endl;
+
+  return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+  std::cerr<<"Error: "<<e.what()<<std::endl;
+  return EXIT_FAILURE;
+}
@@ -23,8 +23,19 @@
 #include "dnsdist-kvs.hh"
 #include "dolog.hh"
 
+#include <algorithm>
 #include <sys/stat.h>
 
+bool KeyValueLookupKey::lookup(KeyValueStore& kvs, const DNSQuestion& dq, std::string* value)
+{
+  for (const auto& key : getKeys(dq)) {
+    if (value != nullptr ? kvs.getValue(key, *value) : kvs.keyExists(key)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 std::vector<std::string> KeyValueLookupKeySourceIP::getKeys(const ComboAddress& addr)
 {
   std::vector<std::string> result;
@@ -68,6 +79,20 @@ std::vector<std::string> KeyValueLookupKeySuffix::getKeys(const DNSName& qname)
   return result;
 }
 
+bool KeyValueLookupKeySuffix::lookup(KeyValueStore& kvs, const DNSName& qname, std::string* value)
+{
+  if (d_wireFormat && kvs.supportsSuffixLookups()) {
+    return kvs.lookupSuffix(qname, d_minLabels, value);
+  }
+
+  for (const auto& key : getKeys(qname)) {
+    if (value != nullptr ? kvs.getValue(key, *value) : kvs.keyExists(key)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 #ifdef HAVE_LMDB
 
 bool LMDBKVStore::getValue(const std::string& key, std::string& value)
@@ -224,3 +249,217 @@ bool CDBKVStore::keyExists(const std::string& key)
 }
 
 #endif /* HAVE_CDB */
+
+thread_local std::vector<PerfectHashKVStore::CachedDB> PerfectHashKVStore::t_cachedDBs;
+thread_local uint64_t PerfectHashKVStore::t_cachedDBsEpoch{0};
+std::atomic<uint64_t> PerfectHashKVStore::s_nextStoreID{0};
+std::atomic<uint64_t> PerfectHashKVStore::s_cachedDBsEpoch{0};
+
+PerfectHashKVStore::PerfectHashKVStore(const std::string& fname, time_t refreshDelay): d_fname(fname), d_storeID(s_nextStoreID++), d_refreshDelay(refreshDelay)
+{
+  d_refreshing.clear();
+
+  time_t now = time(nullptr);
+  if (d_refreshDelay > 0) {
+    d_nextCheck = now + d_refreshDelay;
+  }
+
+  refreshDBIfNeeded(now);
+}
+
+PerfectHashKVStore::~PerfectHashKVStore()
+{
+  /* the cached entries have to be expired before the other threads are told to look at them */
+  d_generation.reset();
+  ++s_cachedDBsEpoch;
+}
+
+bool PerfectHashKVStore::reload(const struct stat& st)
+{
+  /* the database is immutable, a new version is written to a different file which then replaces the existing one,
+     so we can map it without holding the lock */
+  auto newDB = std::make_shared<const PerfectHashDB>(d_fname);
+  {
+    std::lock_guard<std::mutex> lock(d_lock);
+    d_db = std::move(newDB);
+    d_mtime = st.st_mtime;
+    d_inode = st.st_ino;
+    ++(*d_generation);
+  }
+  ++s_cachedDBsEpoch;
+  return true;
+}
+
+bool PerfectHashKVStore::reload()
+{
+  struct stat st;
+  if (stat(d_fname.c_str(), &st) == 0) {
+    try {
+      return reload(st);
+    }
+    catch (const std::exception& e) {
+      warnlog("Error while reloading perfect hash database '%s': %s", d_fname, e.what());
+      return false;
+    }
+  }
+  else {
+    warnlog("Error while retrieving the last modification time of perfect hash database '%s': %s", d_fname, stringerror());
+    return false;
+  }
+}
+
+void PerfectHashKVStore::refreshDBIfNeeded(time_t now)
+{
+  if (d_refreshing.test_and_set()) {
+    /* someone else is already refreshing */
+    return;
+  }
+
+  try {
+    struct stat st;
+    if (stat(d_fname.c_str(), &st) == 0) {
+      bool changed = false;
+      {
+        std::lock_guard<std::mutex> lock(d_lock);
+        changed = st.st_ino != d_inode || st.st_mtime > d_mtime;
+      }
+      if (changed) {
+        try {
+          reload(st);
+        }
+        catch (const std::exception& e) {
+          /* keep using the existing version, if any */
+          warnlog("Error while reloading perfect hash database '%s': %s", d_fname, e.what());
+        }
+      }
+    }
+    else {
+      warnlog("Error while retrieving the last modification time of perfect hash database '%s': %s", d_fname, stringerror());
+    }
+    d_nextCheck = now + d_refreshDelay;
+    d_refreshing.clear();
+  }
+  catch(...) {
+    d_refreshing.clear();
+    throw;
+  }
+}
+
+void PerfectHashKVStore::pruneCachedDBs()
+{
+  t_cachedDBs.erase(std::remove_if(t_cachedDBs.begin(), t_cachedDBs.end(), [](const CachedDB& cached) {
+        const auto generation = cached.d_storeGeneration.lock();
+        return !generation || generation->load() != cached.d_generation;
+      }), t_cachedDBs.end());
+}
+
+const PerfectHashDB* PerfectHashKVStore::getDB()
+{
+  if (d_refreshDelay > 0) {
+    time_t now = time(nullptr);
+    if (now >= d_nextCheck) {
+      refreshDBIfNeeded(now);
+    }
+  }
+
+  const uint64_t epoch = s_cachedDBsEpoch.load();
+  if (epoch != t_cachedDBsEpoch) {
+    pruneCachedDBs();
+    t_cachedDBsEpoch = epoch;
+  }
+
+  const uint64_t generation = d_generation->load();
+  for (auto& cached : t_cachedDBs) {
+    if (cached.d_storeID == d_storeID) {
+      if (cached.d_generation != generation) {
+        std::lock_guard<std::mutex> lock(d_lock);
+        cached.d_db = d_db;
+        cached.d_generation = d_generation->load();
+      }
+      return cached.d_db.get();
+    }
+  }
+
+  CachedDB cached;
+  {
+    std::lock_guard<std::mutex> lock(d_lock);
+    cached.d_db = d_db;
+    cached.d_generation = d_generation->load();
+  }
+  cached.d_storeGeneration = d_generation;
+  cached.d_storeID = d_storeID;
+  t_cachedDBs.push_back(std::move(cached));
+  return t_cachedDBs.back().d_db.get();
+}
+
+bool PerfectHashKVStore::getValue(const std::string& key, std::string& value)
+{
+  try {
+    const auto db = getDB();
+    return db != nullptr && db->find(key, value);
+  }
+  catch(const std::exception& e) {
+    warnlog("Error while looking up key '%s' from perfect hash database '%s': %s", key, d_fname, e.what());
+  }
+  return false;
+}
+
+bool PerfectHashKVStore::keyExists(const std::string& key)
+{
+  try {
+    const auto db = getDB();
+    return db != nullptr && db->exists(key.c_str(), key.size());
+  }
+  catch(const std::exception& e) {
+    warnlog("Error while looking up key '%s' from perfect hash database '%s': %s", key, d_fname, e.what());
+  }
+  return false;
+}
+
+bool PerfectHashKVStore::lookupSuffix(const DNSName& name, size_t minLabels, std::string* value)
+{
+  if (name.empty() || name.isRoot()) {
+    return false;
+  }
+
+  try {
+    const auto db = getDB();
+    if (db == nullptr) {
+      return false;
+    }
+
+    /* every suffix of a name in wire format is the tail of that name, so we only need
+       to lowercase it once and we can then do the lookups without building the keys */
+    const auto& storage = name.getStorage();
+    char lowered[256];
+    const size_t len = std::min(storage.size(), sizeof(lowered));
+    for (size_t idx = 0; idx < len; idx++) {
+      lowered[idx] = dns_tolower(storage[idx]);
+    }
+
+    size_t labelsCount = name.countLabels();
+    if (labelsCount < minLabels) {
+      return false;
+    }
+    /* like KeyValueLookupKeySuffix::getKeys(), the root is never looked up, even when minLabels is 0 */
+    const size_t minimum = std::max(minLabels, static_cast<size_t>(1));
+
+    size_t pos = 0;
+    while (pos < len && labelsCount >= minimum) {
+      const char* valuePtr = nullptr;
+      size_t valueLen = 0;
+      if (db->find(&lowered[pos], len - pos, value != nullptr ? &valuePtr : nullptr, &valueLen)) {
+        if (value != nullptr) {
+          value->assign(valuePtr, valueLen);
+        }
+        return true;
+      }
+      pos += static_cast<uint8_t>(lowered[pos]) + 1;
+      labelsCount--;
+    }
+  }
+  catch(const std::exception& e) {
+    warnlog("Error while looking up the suffixes of '%s' from perfect hash database '%s': %s", name, d_fname, e.what());
+  }
+  return false;
+}
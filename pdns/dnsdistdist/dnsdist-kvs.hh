@@ -23,6 +23,8 @@
 
 #include "dnsdist.hh"
 
+class KeyValueStore;
+
 class KeyValueLookupKey
 {
 public:
@@ -31,6 +33,8 @@ public:
   }
   virtual std::vector<std::string> getKeys(const DNSQuestion&) = 0;
   virtual std::string toString() const = 0;
+  /* looks up the keys into the store until one is found, setting 'value' to the corresponding value if it's not null */
+  virtual bool lookup(KeyValueStore& kvs, const DNSQuestion& dq, std::string* value);
 };
 
 class KeyValueLookupKeySourceIP: public KeyValueLookupKey
@@ -96,6 +100,13 @@ public:
     return getKeys(*dq.qname);
   }
 
+  bool lookup(KeyValueStore& kvs, const DNSName& qname, std::string* value);
+
+  bool lookup(KeyValueStore& kvs, const DNSQuestion& dq, std::string* value) override
+  {
+    return lookup(kvs, *dq.qname, value);
+  }
+
   std::string toString() const override
   {
     if (d_minLabels > 0) {
@@ -149,6 +160,19 @@ public:
   {
     return false;
   }
+
+  /* whether the store can look up all the suffixes of a name, in wire format, without building every key */
+  virtual bool supportsSuffixLookups() const
+  {
+    return false;
+  }
+
+  /* returns true if one the suffixes of 'name', in lowercase wire format and with at least 'minLabels' labels, exists,
+     starting with the longest one, and sets 'value' to the corresponding value if it's not null */
+  virtual bool lookupSuffix(const DNSName& name, size_t minLabels, std::string* value)
+  {
+    return false;
+  }
 };
 
 #ifdef HAVE_LMDB
@@ -199,4 +223,56 @@ private:
   std::atomic_flag d_refreshing;
 };
 
-#endif /* HAVE_LMDB */
+#endif /* HAVE_CDB */
+
+#include "dnsdist-perfecthash.hh"
+
+class PerfectHashKVStore: public KeyValueStore
+{
+public:
+  PerfectHashKVStore(const std::string& fname, time_t refreshDelay);
+  ~PerfectHashKVStore();
+
+  bool keyExists(const std::string& key) override;
+  bool getValue(const std::string& key, std::string& value) override;
+  bool reload() override;
+  bool supportsSuffixLookups() const override
+  {
+    return true;
+  }
+  bool lookupSuffix(const DNSName& name, size_t minLabels, std::string* value) override;
+
+private:
+  struct CachedDB
+  {
+    std::shared_ptr<const PerfectHashDB> d_db;
+    /* expires when the store is destroyed */
+    std::weak_ptr<const std::atomic<uint64_t>> d_storeGeneration;
+    uint64_t d_storeID;
+    uint64_t d_generation;
+  };
+
+  /* returns the database to use from this thread, without taking a lock unless it has been reloaded */
+  const PerfectHashDB* getDB();
+  /* releases the databases of this thread belonging to stores that have been destroyed or reloaded since */
+  static void pruneCachedDBs();
+  void refreshDBIfNeeded(time_t now);
+  bool reload(const struct stat& st);
+
+  static thread_local std::vector<CachedDB> t_cachedDBs;
+  static thread_local uint64_t t_cachedDBsEpoch;
+  static std::atomic<uint64_t> s_nextStoreID;
+  /* bumped whenever a store is reloaded or destroyed, so that the threads know they have to prune their cached databases */
+  static std::atomic<uint64_t> s_cachedDBsEpoch;
+
+  std::mutex d_lock;
+  std::shared_ptr<const PerfectHashDB> d_db{nullptr};
+  std::string d_fname;
+  const uint64_t d_storeID;
+  std::shared_ptr<std::atomic<uint64_t>> d_generation{std::make_shared<std::atomic<uint64_t>>(0)};
+  std::atomic<time_t> d_nextCheck{0};
+  time_t d_refreshDelay{0};
+  time_t d_mtime{0};
+  ino_t d_inode{0};
+  std::atomic_flag d_refreshing;
+};
@@ -57,6 +57,13 @@ void setupLuaBindingsKVS(bool client)
   });
 #endif /* HAVE_CDB */
 
+  g_lua.writeFunction("newPerfectHashKVStore", [client](const std::string& fname, boost::optional<time_t> refreshDelay) {
+    if (client) {
+      return std::shared_ptr<KeyValueStore>(nullptr);
+    }
+    return std::shared_ptr<KeyValueStore>(new PerfectHashKVStore(fname, refreshDelay ? *refreshDelay : 0));
+  });
+
   g_lua.registerFunction<std::string(std::shared_ptr<KeyValueStore>::*)(const boost::variant<ComboAddress, DNSName, std::string>, boost::optional<bool> wireFormat)>("lookup", [](std::shared_ptr<KeyValueStore>& kvs, const boost::variant<ComboAddress, DNSName, std::string> keyVar, boost::optional<bool> wireFormat) {
     std::string result;
     if (!kvs) {
@@ -96,10 +103,8 @@ void setupLuaBindingsKVS(bool client)
     }
 
     KeyValueLookupKeySuffix lookup(minLabels ? *minLabels : 0, wireFormat ? *wireFormat : true);
-    for (const auto& key : lookup.getKeys(dn)) {
-      if (kvs->getValue(key, result)) {
-        return result;
-      }
+    if (!lookup.lookup(*kvs, dn, &result)) {
+      result.clear();
     }
 
     return result;
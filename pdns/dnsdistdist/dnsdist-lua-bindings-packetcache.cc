@@ -30,7 +30,7 @@
 void setupLuaBindingsPacketCache()
 {
   /* PacketCache */
-  g_lua.writeFunction("newPacketCache", [](size_t maxEntries, boost::optional<std::unordered_map<std::string, boost::variant<bool, size_t>>> vars) {
+  g_lua.writeFunction("newPacketCache", [](size_t maxEntries, boost::optional<std::unordered_map<std::string, boost::variant<bool, size_t, std::string>>> vars) {
 
       bool keepStaleData = false;
       size_t maxTTL = 86400;
@@ -42,6 +42,8 @@ void setupLuaBindingsPacketCache()
       bool dontAge = false;
       bool deferrableInsertLock = true;
       bool ecsParsing = false;
+      std::string sharedMemoryPath;
+      size_t sharedMemorySlotSize = SharedPacketCacheStore::s_defaultSlotSize;
 
       if (vars) {
 
@@ -77,6 +79,14 @@ void setupLuaBindingsPacketCache()
           ecsParsing = boost::get<bool>((*vars)["parseECS"]);
         }
 
+        if (vars->count("sharedMemoryPath")) {
+          sharedMemoryPath = boost::get<std::string>((*vars)["sharedMemoryPath"]);
+        }
+
+        if (vars->count("sharedMemorySlotSize")) {
+          sharedMemorySlotSize = boost::get<size_t>((*vars)["sharedMemorySlotSize"]);
+        }
+
         if (vars->count("staleTTL")) {
           staleTTL = boost::get<size_t>((*vars)["staleTTL"]);
         }
@@ -90,6 +100,10 @@ void setupLuaBindingsPacketCache()
 
       res->setKeepStaleData(keepStaleData);
 
+      if (!sharedMemoryPath.empty()) {
+        res->enableSharedMemory(sharedMemoryPath, sharedMemorySlotSize);
+      }
+
       return res;
     });
   g_lua.registerFunction("toString", &DNSDistPacketCache::toString);
@@ -0,0 +1,110 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "dnsdist-maglev.hh"
+#include "misc.hh"
+
+const size_t MaglevTable::npos;
+
+MaglevTable::MaglevTable(const std::vector<Backend>& backends, size_t size): d_numberOfBackends(backends.size())
+{
+  if (size < 2) {
+    throw std::runtime_error("The size of a Maglev table should be at least 2");
+  }
+  if (backends.size() >= std::numeric_limits<uint16_t>::max()) {
+    throw std::runtime_error("Too many backends for a Maglev table");
+  }
+
+  uint32_t maxWeight = 0;
+  for (const auto& backend : backends) {
+    maxWeight = std::max(maxWeight, backend.weight);
+  }
+  if (maxWeight == 0) {
+    return;
+  }
+
+  struct Permutation
+  {
+    size_t offset;
+    size_t skip;
+    size_t next;
+  };
+  /* the weights are normalised against the largest one: every turn, a backend earns its
+     weight in credits and claims at most one slot when it has earned 'maxWeight' of them,
+     so the heaviest backend claims exactly one slot per turn and a very large weight can
+     never grab a whole chunk of the table at once */
+  std::vector<uint64_t> credits(backends.size(), 0);
+  std::vector<Permutation> permutations;
+  permutations.reserve(backends.size());
+  for (const auto& backend : backends) {
+    const uint32_t first = burtle(reinterpret_cast<const unsigned char*>(&backend.seed), sizeof(backend.seed), 0);
+    const uint32_t second = burtle(reinterpret_cast<const unsigned char*>(&backend.seed), sizeof(backend.seed), 0x5bd1e995);
+    permutations.push_back({first % size, (second % (size - 1)) + 1, 0});
+  }
+
+  const uint16_t unset = std::numeric_limits<uint16_t>::max();
+  std::vector<uint16_t> entries(size, unset);
+  size_t filled = 0;
+
+  while (filled < size) {
+    for (size_t idx = 0; idx < backends.size() && filled < size; idx++) {
+      credits[idx] += backends[idx].weight;
+      if (credits[idx] < maxWeight) {
+        continue;
+      }
+      credits[idx] -= maxWeight;
+
+      auto& permutation = permutations[idx];
+      /* find the next free slot in the preference list of this backend, which covers
+         every slot when the size is a prime number. Otherwise we fall back to a linear
+         scan once the list has been exhausted */
+      size_t slot;
+      do {
+        if (permutation.next < size) {
+          slot = (permutation.offset + permutation.next * permutation.skip) % size;
+        }
+        else {
+          slot = (permutation.offset + permutation.next) % size;
+        }
+        permutation.next++;
+      }
+      while (entries[slot] != unset);
+
+      entries[slot] = static_cast<uint16_t>(idx);
+      filled++;
+    }
+  }
+
+  d_entries = std::move(entries);
+}
+
+std::vector<size_t> MaglevTable::getDistribution() const
+{
+  std::vector<size_t> result(d_numberOfBackends, 0);
+  for (const auto entry : d_entries) {
+    result.at(entry)++;
+  }
+  return result;
+}
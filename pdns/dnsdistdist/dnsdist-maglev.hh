@@ -0,0 +1,96 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/* Maglev consistent hashing lookup table (Eisenbud et al., NSDI 2016).
+   Every backend gets a permutation of the table's slots derived from its own seed,
+   and the backends take turns claiming their next free slot until the table is full.
+   The heaviest backend claims one slot per turn, the others proportionally fewer
+   according to their weight. A lookup is then a single access, and
+   adding or removing a backend only moves a small fraction of the slots.
+   The table holds indexes into the list of backends it was built from. */
+class MaglevTable
+{
+public:
+  struct Backend
+  {
+    /* identifies the backend, so that it keeps most of its slots when the others change */
+    uint32_t seed;
+    uint32_t weight;
+  };
+
+  static const size_t npos = std::numeric_limits<size_t>::max();
+
+  /* 'size' should be a prime number, much larger than the number of backends */
+  MaglevTable(const std::vector<Backend>& backends, size_t size = 65537);
+
+  /* returns the index of the backend owning the slot for that hash if 'isUsable'
+     returns true for it. Otherwise the other slots are probed, in an order derived from
+     the hash, so that the slots of an unusable backend are spread over the remaining ones
+     while the other backends keep theirs. Returns npos if nothing usable was found after
+     'maxProbes' attempts */
+  template<typename F> size_t lookup(uint32_t hash, const F& isUsable, size_t maxProbes = 32) const
+  {
+    if (d_entries.empty()) {
+      return npos;
+    }
+
+    const size_t size = d_entries.size();
+    size_t pos = hash % size;
+    size_t idx = d_entries[pos];
+    if (isUsable(idx)) {
+      return idx;
+    }
+
+    const size_t step = ((hash >> 16) | (hash << 16)) % (size - 1) + 1;
+    for (size_t probe = 0; probe < maxProbes; probe++) {
+      pos = (pos + step) % size;
+      idx = d_entries[pos];
+      if (isUsable(idx)) {
+        return idx;
+      }
+    }
+
+    return npos;
+  }
+
+  size_t size() const
+  {
+    return d_entries.size();
+  }
+
+  size_t getNumberOfBackends() const
+  {
+    return d_numberOfBackends;
+  }
+
+  /* number of slots owned by each backend */
+  std::vector<size_t> getDistribution() const;
+
+private:
+  std::vector<uint16_t> d_entries;
+  size_t d_numberOfBackends{0};
+};
@@ -0,0 +1,608 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dnsdist-packetring.hh"
+
+#ifdef HAVE_PACKET_RING
+
+#include <map>
+#include <mutex>
+
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+
+#include "dolog.hh"
+#include "misc.hh"
+
+static const size_t s_ethernetHeaderSize = 14;
+static const size_t s_vlanTagSize = 4;
+static const size_t s_ipv4HeaderSize = 20;
+static const size_t s_ipv6HeaderSize = 40;
+static const size_t s_udpHeaderSize = 8;
+/* large enough to hold any acceptable query, plus room for EDNS, ECS or a self-generated response */
+static const size_t s_bufferSize = 4096;
+static const unsigned int s_rxBlockSize = 1 << 20;
+static const unsigned int s_rxBlocksCount = 16;
+static const unsigned int s_rxFrameSize = 2048;
+/* how long the kernel waits before handing us a block that is not full, in milliseconds */
+static const unsigned int s_rxBlockTimeout = 1;
+static const unsigned int s_txBlockSize = 1 << 16;
+static const unsigned int s_txBlocksCount = 16;
+
+static uint16_t readUInt16(const uint8_t* data)
+{
+  return (static_cast<uint16_t>(data[0]) << 8) | data[1];
+}
+
+static void writeUInt16(uint8_t* data, uint16_t value)
+{
+  data[0] = value >> 8;
+  data[1] = value & 0xff;
+}
+
+static uint32_t checksumAdd(uint32_t sum, const uint8_t* data, size_t len)
+{
+  for (size_t idx = 0; idx + 1 < len; idx += 2) {
+    sum += readUInt16(data + idx);
+  }
+  if (len % 2) {
+    sum += static_cast<uint16_t>(data[len - 1]) << 8;
+  }
+  return sum;
+}
+
+static uint16_t checksumFinish(uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum & 0xffff;
+}
+
+bool PacketRingFrontend::parseFrame(const uint8_t* frame, size_t frameLen, const ComboAddress& local, Query& query)
+{
+  if (frameLen < s_ethernetHeaderSize) {
+    return false;
+  }
+
+  query.frame = frame;
+  size_t pos = 2 * ETH_ALEN;
+  uint16_t etherType = readUInt16(frame + pos);
+
+  if (etherType == ETH_P_8021Q || etherType == ETH_P_8021AD) {
+    /* the tag has not been stripped by the NIC */
+    if (frameLen < s_ethernetHeaderSize + s_vlanTagSize) {
+      return false;
+    }
+    query.hasVLAN = true;
+    query.vlanTPID = etherType;
+    query.vlanTCI = readUInt16(frame + pos + 2);
+    pos += s_vlanTagSize;
+    etherType = readUInt16(frame + pos);
+  }
+  pos += 2;
+
+  const uint8_t* udp = nullptr;
+  size_t available = 0;
+
+  /* we don't verify the checksums: the kernel already does for the frames it delivers
+     to the UDP socket, and locally generated frames (veth) usually don't have one yet */
+  if (etherType == ETH_P_IP) {
+    if (local.sin4.sin_family != AF_INET || frameLen < pos + s_ipv4HeaderSize) {
+      return false;
+    }
+    const uint8_t* ip = frame + pos;
+    size_t ihl = (ip[0] & 0x0f) * 4;
+    if ((ip[0] >> 4) != 4 || ihl < s_ipv4HeaderSize || ip[9] != IPPROTO_UDP) {
+      return false;
+    }
+    /* fragments can't be handled here */
+    if (readUInt16(ip + 6) & 0x3fff) {
+      return false;
+    }
+    size_t totalLen = readUInt16(ip + 2);
+    /* the frame might be padded */
+    if (totalLen < ihl || frameLen < pos + totalLen) {
+      return false;
+    }
+
+    query.remote.reset();
+    query.remote.sin4.sin_family = AF_INET;
+    memcpy(&query.remote.sin4.sin_addr.s_addr, ip + 12, 4);
+    query.local.reset();
+    query.local.sin4.sin_family = AF_INET;
+    memcpy(&query.local.sin4.sin_addr.s_addr, ip + 16, 4);
+
+    udp = ip + ihl;
+    available = totalLen - ihl;
+  }
+  else if (etherType == ETH_P_IPV6) {
+    if (local.sin4.sin_family != AF_INET6 || frameLen < pos + s_ipv6HeaderSize) {
+      return false;
+    }
+    const uint8_t* ip = frame + pos;
+    /* we don't follow extension headers */
+    if ((ip[0] >> 4) != 6 || ip[6] != IPPROTO_UDP) {
+      return false;
+    }
+    size_t payloadLen = readUInt16(ip + 4);
+    if (frameLen < pos + s_ipv6HeaderSize + payloadLen) {
+      return false;
+    }
+
+    query.remote.reset();
+    query.remote.sin6.sin6_family = AF_INET6;
+    memcpy(&query.remote.sin6.sin6_addr.s6_addr, ip + 8, 16);
+    query.local.reset();
+    query.local.sin6.sin6_family = AF_INET6;
+    memcpy(&query.local.sin6.sin6_addr.s6_addr, ip + 24, 16);
+
+    udp = ip + s_ipv6HeaderSize;
+    available = payloadLen;
+  }
+  else {
+    return false;
+  }
+
+  if (available < s_udpHeaderSize) {
+    return false;
+  }
+
+  size_t udpLen = readUInt16(udp + 4);
+  if (udpLen < s_udpHeaderSize || udpLen > available) {
+    return false;
+  }
+
+  /* ports are kept in network byte order */
+  memcpy(&query.remote.sin4.sin_port, udp, 2);
+  memcpy(&query.local.sin4.sin_port, udp + 2, 2);
+
+  if (query.local.sin4.sin_port != local.sin4.sin_port) {
+    return false;
+  }
+
+  if (!IsAnyAddress(local) && !ComboAddress::addressOnlyEqual()(query.local, local)) {
+    return false;
+  }
+
+  query.payload = udp + s_udpHeaderSize;
+  query.payloadLen = udpLen - s_udpHeaderSize;
+
+  return true;
+}
+
+size_t PacketRingFrontend::buildResponseFrame(const Query& query, const char* response, uint16_t responseLen, uint8_t* out, size_t outSize)
+{
+  const bool v4 = query.local.isIPv4();
+  const size_t ethLen = s_ethernetHeaderSize + (query.hasVLAN ? s_vlanTagSize : 0);
+  const size_t ipLen = v4 ? s_ipv4HeaderSize : s_ipv6HeaderSize;
+  const size_t udpLen = s_udpHeaderSize + responseLen;
+  const size_t total = ethLen + ipLen + udpLen;
+
+  if (total > outSize || (v4 && (ipLen + udpLen) > 0xffff) || (!v4 && udpLen > 0xffff)) {
+    return 0;
+  }
+
+  /* swap the MAC addresses */
+  memcpy(out, query.frame + ETH_ALEN, ETH_ALEN);
+  memcpy(out + ETH_ALEN, query.frame, ETH_ALEN);
+  size_t pos = 2 * ETH_ALEN;
+  if (query.hasVLAN) {
+    writeUInt16(out + pos, query.vlanTPID);
+    writeUInt16(out + pos + 2, query.vlanTCI);
+    pos += s_vlanTagSize;
+  }
+  writeUInt16(out + pos, v4 ? ETH_P_IP : ETH_P_IPV6);
+  pos += 2;
+
+  uint8_t* ip = out + pos;
+  uint8_t* udp = ip + ipLen;
+  uint32_t sum = 0;
+
+  if (v4) {
+    ip[0] = 0x45;
+    ip[1] = 0;
+    writeUInt16(ip + 2, ipLen + udpLen);
+    /* id, don't fragment */
+    writeUInt16(ip + 4, 0);
+    writeUInt16(ip + 6, 0x4000);
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    writeUInt16(ip + 10, 0);
+    memcpy(ip + 12, &query.local.sin4.sin_addr.s_addr, 4);
+    memcpy(ip + 16, &query.remote.sin4.sin_addr.s_addr, 4);
+    writeUInt16(ip + 10, checksumFinish(checksumAdd(0, ip, s_ipv4HeaderSize)));
+    /* pseudo-header */
+    sum = checksumAdd(sum, ip + 12, 8);
+  }
+  else {
+    ip[0] = 0x60;
+    ip[1] = 0;
+    ip[2] = 0;
+    ip[3] = 0;
+    writeUInt16(ip + 4, udpLen);
+    ip[6] = IPPROTO_UDP;
+    ip[7] = 64;
+    memcpy(ip + 8, &query.local.sin6.sin6_addr.s6_addr, 16);
+    memcpy(ip + 24, &query.remote.sin6.sin6_addr.s6_addr, 16);
+    /* pseudo-header */
+    sum = checksumAdd(sum, ip + 8, 32);
+  }
+  sum += IPPROTO_UDP;
+  sum += udpLen;
+
+  memcpy(udp, &query.local.sin4.sin_port, 2);
+  memcpy(udp + 2, &query.remote.sin4.sin_port, 2);
+  writeUInt16(udp + 4, udpLen);
+  writeUInt16(udp + 6, 0);
+  memcpy(udp + s_udpHeaderSize, response, responseLen);
+
+  uint16_t udpChecksum = checksumFinish(checksumAdd(sum, udp, udpLen));
+  /* a zero checksum means 'no checksum', which is not even allowed over IPv6 */
+  writeUInt16(udp + 6, udpChecksum == 0 ? 0xffff : udpChecksum);
+
+  return total;
+}
+
+static void attachClassicFilter(int fd, struct sock_filter* code, unsigned short len)
+{
+  struct sock_fprog prog;
+  prog.len = len;
+  prog.filter = code;
+  if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) != 0) {
+    throw std::runtime_error("Error attaching a filter to socket: " + stringerror());
+  }
+}
+
+void setUDPSocketDropAllFilter(int fd)
+{
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_RET | BPF_K, 0)
+  };
+  attachClassicFilter(fd, code, sizeof(code) / sizeof(*code));
+}
+
+void PacketRingFrontend::attachFrameFilter(int fd, uint16_t port)
+{
+  /* only keep unfragmented UDP datagrams to our port, the remaining checks are done in parseFrame().
+     X holds the size of the 802.1Q or 802.1ad tag, if the NIC did not strip it */
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),                    /* 0: ethertype */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_8021Q, 3, 0),    /* 1: tagged, go to 5 */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_8021AD, 2, 0),   /* 2: tagged, go to 5 */
+    BPF_STMT(BPF_LDX | BPF_W | BPF_IMM, 0),                    /* 3: X = 0 */
+    BPF_JUMP(BPF_JMP | BPF_JA, 2, 0, 0),                       /* 4: jump to 7 */
+    BPF_STMT(BPF_LDX | BPF_W | BPF_IMM, s_vlanTagSize),        /* 5: X = tag size */
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 12),                    /* 6: ethertype after the tag */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 11),      /* 7: IPv4, else 19 */
+    BPF_STMT(BPF_LD | BPF_B | BPF_IND, 23),                    /* 8: protocol */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 15),   /* 9: UDP, else drop */
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 20),                    /* 10: flags and fragment offset */
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, 13, 0),       /* 11: fragment, drop */
+    BPF_STMT(BPF_LD | BPF_B | BPF_IND, 14),                    /* 12: version and IHL */
+    BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x0f),                 /* 13 */
+    BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 2),                    /* 14: IPv4 header size */
+    BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),                    /* 15: plus the tag size */
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),                           /* 16 */
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),                    /* 17: destination port */
+    BPF_JUMP(BPF_JMP | BPF_JA, 4, 0, 0),                       /* 18: jump to 23 */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IPV6, 0, 5),     /* 19: IPv6, else drop */
+    BPF_STMT(BPF_LD | BPF_B | BPF_IND, 20),                    /* 20: next header */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 3),    /* 21: UDP, else drop */
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 56),                    /* 22: destination port */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1),           /* 23: our port, else drop */
+    BPF_STMT(BPF_RET | BPF_K, 0x40000),                        /* 24: accept */
+    BPF_STMT(BPF_RET | BPF_K, 0)                               /* 25: drop */
+  };
+  attachClassicFilter(fd, code, sizeof(code) / sizeof(*code));
+}
+
+/* every packet socket bound to an interface gets a copy of each frame, so the rings receiving the
+   queries to the same address (several frontends with reusePort) need to be in the same fanout group
+   for each query to be handled only once. The group ID is allocated by the kernel for the first ring */
+static std::mutex s_fanoutGroupsLock;
+static std::map<std::pair<std::string, ComboAddress>, uint16_t> s_fanoutGroups;
+
+void PacketRingFrontend::joinFanoutGroup()
+{
+  std::lock_guard<std::mutex> lock(s_fanoutGroupsLock);
+  const auto key = std::make_pair(d_interface, d_local);
+  auto existing = s_fanoutGroups.find(key);
+
+#ifdef PACKET_FANOUT_FLAG_UNIQUEID
+  if (existing != s_fanoutGroups.end()) {
+    int fanout = (PACKET_FANOUT_HASH << 16) | existing->second;
+    if (setsockopt(d_rxFD, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) != 0) {
+      throw std::runtime_error("Error joining the fanout group of the packet rings for " + d_local.toStringWithPort() + " on interface '" + d_interface + "': " + stringerror());
+    }
+    return;
+  }
+
+  int fanout = (PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_UNIQUEID) << 16;
+  if (setsockopt(d_rxFD, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) != 0) {
+    throw std::runtime_error("Error creating the fanout group of the packet rings for " + d_local.toStringWithPort() + " on interface '" + d_interface + "': " + stringerror());
+  }
+
+  socklen_t fanoutLen = sizeof(fanout);
+  if (getsockopt(d_rxFD, SOL_PACKET, PACKET_FANOUT, &fanout, &fanoutLen) != 0) {
+    throw std::runtime_error("Error getting the fanout group of the packet rings for " + d_local.toStringWithPort() + " on interface '" + d_interface + "': " + stringerror());
+  }
+  s_fanoutGroups[key] = fanout & 0xffff;
+#else
+  /* without a way to get a group ID that no other process is using, only one ring per address is allowed */
+  if (existing != s_fanoutGroups.end()) {
+    throw std::runtime_error("Only one packet ring can be used for " + d_local.toStringWithPort() + " on interface '" + d_interface + "' with this kernel");
+  }
+  s_fanoutGroups[key] = 0;
+#endif
+}
+
+PacketRingFrontend::PacketRingFrontend(const std::string& interface, const ComboAddress& local): d_interface(interface), d_local(local), d_rxBlockSize(s_rxBlockSize), d_rxBlocksCount(s_rxBlocksCount)
+{
+  unsigned int ifIndex = if_nametoindex(interface.c_str());
+  if (ifIndex == 0) {
+    throw std::runtime_error("Unable to find the index of interface '" + interface + "': " + stringerror());
+  }
+
+  d_rxFD = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+  if (d_rxFD < 0) {
+    throw std::runtime_error("Error creating the packet socket for interface '" + interface + "': " + stringerror());
+  }
+
+  try {
+    int one = 1;
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, interface.c_str(), sizeof(ifr.ifr_name) - 1);
+    if (ioctl(d_rxFD, SIOCGIFMTU, &ifr) == 0 && ifr.ifr_mtu > 0) {
+      d_mtu = ifr.ifr_mtu;
+    }
+
+    attachFrameFilter(d_rxFD, ntohs(d_local.sin4.sin_port));
+
+#ifdef PACKET_IGNORE_OUTGOING
+    /* not fatal, we check the packet type anyway */
+    setsockopt(d_rxFD, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+
+    int version = TPACKET_V3;
+    if (setsockopt(d_rxFD, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+      throw std::runtime_error("Error setting TPACKET_V3 on the packet socket: " + stringerror());
+    }
+
+    struct tpacket_req3 rxReq;
+    memset(&rxReq, 0, sizeof(rxReq));
+    rxReq.tp_block_size = d_rxBlockSize;
+    rxReq.tp_block_nr = d_rxBlocksCount;
+    rxReq.tp_frame_size = s_rxFrameSize;
+    rxReq.tp_frame_nr = (d_rxBlockSize * d_rxBlocksCount) / s_rxFrameSize;
+    rxReq.tp_retire_blk_tov = s_rxBlockTimeout;
+    if (setsockopt(d_rxFD, SOL_PACKET, PACKET_RX_RING, &rxReq, sizeof(rxReq)) != 0) {
+      throw std::runtime_error("Error setting up the RX ring on the packet socket: " + stringerror());
+    }
+
+    d_rxRingSize = static_cast<size_t>(d_rxBlockSize) * d_rxBlocksCount;
+    void* rx = mmap(nullptr, d_rxRingSize, PROT_READ | PROT_WRITE, MAP_SHARED, d_rxFD, 0);
+    if (rx == MAP_FAILED) {
+      throw std::runtime_error("Error mapping the RX ring of the packet socket: " + stringerror());
+    }
+    d_rxRing = reinterpret_cast<uint8_t*>(rx);
+
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifIndex;
+    if (bind(d_rxFD, reinterpret_cast<struct sockaddr*>(&sll), sizeof(sll)) != 0) {
+      throw std::runtime_error("Error binding the packet socket to interface '" + interface + "': " + stringerror());
+    }
+
+    joinFanoutGroup();
+
+    /* the sending socket uses a protocol of 0 so that it never receives anything */
+    d_txFD = socket(AF_PACKET, SOCK_RAW, 0);
+    if (d_txFD < 0) {
+      throw std::runtime_error("Error creating the sending packet socket for interface '" + interface + "': " + stringerror());
+    }
+
+    version = TPACKET_V2;
+    if (setsockopt(d_txFD, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+      throw std::runtime_error("Error setting TPACKET_V2 on the sending packet socket: " + stringerror());
+    }
+
+#ifdef PACKET_QDISC_BYPASS
+    /* not fatal, this is only an optimization */
+    setsockopt(d_txFD, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+#endif
+
+    d_txFrameSize = s_rxFrameSize;
+    while (d_txFrameSize < (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll)) + s_ethernetHeaderSize + s_vlanTagSize + d_mtu && d_txFrameSize < s_txBlockSize) {
+      d_txFrameSize *= 2;
+    }
+    d_txFramesCount = (s_txBlockSize / d_txFrameSize) * s_txBlocksCount;
+
+    struct tpacket_req txReq;
+    memset(&txReq, 0, sizeof(txReq));
+    txReq.tp_block_size = s_txBlockSize;
+    txReq.tp_block_nr = s_txBlocksCount;
+    txReq.tp_frame_size = d_txFrameSize;
+    txReq.tp_frame_nr = d_txFramesCount;
+    if (setsockopt(d_txFD, SOL_PACKET, PACKET_TX_RING, &txReq, sizeof(txReq)) != 0) {
+      throw std::runtime_error("Error setting up the TX ring on the sending packet socket: " + stringerror());
+    }
+
+    d_txRingSize = static_cast<size_t>(s_txBlockSize) * s_txBlocksCount;
+    void* tx = mmap(nullptr, d_txRingSize, PROT_READ | PROT_WRITE, MAP_SHARED, d_txFD, 0);
+    if (tx == MAP_FAILED) {
+      throw std::runtime_error("Error mapping the TX ring of the sending packet socket: " + stringerror());
+    }
+    d_txRing = reinterpret_cast<uint8_t*>(tx);
+
+    sll.sll_protocol = 0;
+    if (bind(d_txFD, reinterpret_cast<struct sockaddr*>(&sll), sizeof(sll)) != 0) {
+      throw std::runtime_error("Error binding the sending packet socket to interface '" + interface + "': " + stringerror());
+    }
+  }
+  catch (...) {
+    if (d_txRing) {
+      munmap(d_txRing, d_txRingSize);
+    }
+    if (d_txFD >= 0) {
+      close(d_txFD);
+    }
+    if (d_rxRing) {
+      munmap(d_rxRing, d_rxRingSize);
+    }
+    close(d_rxFD);
+    throw;
+  }
+}
+
+PacketRingFrontend::~PacketRingFrontend()
+{
+  munmap(d_txRing, d_txRingSize);
+  close(d_txFD);
+  munmap(d_rxRing, d_rxRingSize);
+  close(d_rxFD);
+}
+
+void PacketRingFrontend::flushResponses()
+{
+  if (d_pendingResponses == 0) {
+    return;
+  }
+
+  /* a single system call for all the frames queued since the last flush */
+  if (send(d_txFD, nullptr, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    vinfolog("Error sending responses from the packet ring on %s: %s", d_interface, stringerror());
+  }
+  d_pendingResponses = 0;
+}
+
+bool PacketRingFrontend::queueResponse(const Query& query, const char* response, uint16_t responseLen)
+{
+  auto* hdr = reinterpret_cast<struct tpacket2_hdr*>(d_txRing + d_txPos * d_txFrameSize);
+  auto status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+  if (status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT) {
+    /* let the kernel catch up */
+    flushResponses();
+    status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+    if (status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT) {
+      return false;
+    }
+  }
+
+  const size_t dataOffset = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+  uint8_t* data = reinterpret_cast<uint8_t*>(hdr) + dataOffset;
+  size_t frameLen = buildResponseFrame(query, response, responseLen, data, d_txFrameSize - dataOffset);
+  if (frameLen == 0 || frameLen > s_ethernetHeaderSize + (query.hasVLAN ? s_vlanTagSize : 0) + d_mtu) {
+    return false;
+  }
+
+  hdr->tp_len = frameLen;
+  __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+  d_txPos = (d_txPos + 1) % d_txFramesCount;
+  ++d_pendingResponses;
+  ++d_ringResponses;
+
+  if (d_pendingResponses >= d_txFramesCount / 2) {
+    flushResponses();
+  }
+
+  return true;
+}
+
+void PacketRingFrontend::run(const handler_t& handler, int fallbackFD)
+{
+  char buffer[s_bufferSize];
+  unsigned int blockIdx = 0;
+  struct pollfd pfd;
+  pfd.fd = d_rxFD;
+  pfd.events = POLLIN | POLLERR;
+
+  for (;;) {
+    auto* desc = reinterpret_cast<struct tpacket_block_desc*>(d_rxRing + static_cast<size_t>(blockIdx) * d_rxBlockSize);
+
+    if ((__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+      flushResponses();
+      pfd.revents = 0;
+      poll(&pfd, 1, -1);
+      continue;
+    }
+
+    const uint32_t count = desc->hdr.bh1.num_pkts;
+    auto* pkt = reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<uint8_t*>(desc) + desc->hdr.bh1.offset_to_first_pkt);
+
+    for (uint32_t idx = 0; idx < count; idx++, pkt = reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<uint8_t*>(pkt) + pkt->tp_next_offset)) {
+      const auto* sll = reinterpret_cast<const struct sockaddr_ll*>(reinterpret_cast<const uint8_t*>(pkt) + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+      if (sll->sll_pkttype == PACKET_OUTGOING) {
+        continue;
+      }
+
+      ++d_frames;
+      Query query;
+      if (pkt->tp_snaplen != pkt->tp_len || !parseFrame(reinterpret_cast<const uint8_t*>(pkt) + pkt->tp_mac, pkt->tp_snaplen, d_local, query) || query.payloadLen > sizeof(buffer)) {
+        ++d_ignoredFrames;
+        continue;
+      }
+
+      if (pkt->tp_status & TP_STATUS_VLAN_VALID) {
+        /* the tag has been stripped, we need to put it back */
+        query.hasVLAN = true;
+        query.vlanTCI = pkt->hv1.tp_vlan_tci;
+#ifdef TP_STATUS_VLAN_TPID_VALID
+        query.vlanTPID = (pkt->tp_status & TP_STATUS_VLAN_TPID_VALID) ? pkt->hv1.tp_vlan_tpid : ETH_P_8021Q;
+#else
+        query.vlanTPID = ETH_P_8021Q;
+#endif
+      }
+
+      memcpy(buffer, query.payload, query.payloadLen);
+      uint16_t len = query.payloadLen;
+
+      if (!handler(query, buffer, len, sizeof(buffer))) {
+        continue;
+      }
+
+      if (!queueResponse(query, buffer, len)) {
+        /* too large for a single frame, or the ring is full: let the kernel deal with it */
+        ++d_fallbackResponses;
+        sendfromto(fallbackFD, buffer, len, 0, query.local, query.remote);
+      }
+    }
+
+    __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    blockIdx = (blockIdx + 1) % d_rxBlocksCount;
+    flushResponses();
+  }
+}
+
+#endif /* HAVE_PACKET_RING */
@@ -0,0 +1,122 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#ifdef __linux__
+#include <linux/if_packet.h>
+#endif
+
+#include "iputils.hh"
+
+#if defined(__linux__) && defined(TPACKET3_HDRLEN)
+#define HAVE_PACKET_RING 1
+#endif
+
+/* Receives the UDP queries sent to a frontend from a memory-mapped AF_PACKET
+   ring (TPACKET_V3) attached to a network interface, instead of reading them
+   one by one from the UDP socket, and sends the immediate responses (cache hits,
+   self-generated answers) via a memory-mapped TX ring (TPACKET_V2), kicking the
+   kernel once per block of queries instead of once per response.
+
+   The rings of the frontends sharing the same address (reusePort) are put in the
+   same fanout group, so that every query is received by only one of them.
+
+   The kernel still delivers the queries to the UDP socket of the frontend, which
+   is kept around to send the responses coming from a backend, so a filter
+   dropping everything is attached to that socket.
+*/
+class PacketRingFrontend : boost::noncopyable
+{
+public:
+  struct Query
+  {
+    ComboAddress remote;
+    ComboAddress local;
+    /* start of the Ethernet header */
+    const uint8_t* frame{nullptr};
+    const uint8_t* payload{nullptr};
+    uint16_t payloadLen{0};
+    uint16_t vlanTCI{0};
+    uint16_t vlanTPID{0};
+    bool hasVLAN{false};
+  };
+
+  /* the handler gets the query, a buffer large enough to process it holding a copy of the payload,
+     and returns true if a response of length 'len' is ready to be sent right away from that buffer */
+  typedef std::function<bool(const Query& query, char* buffer, uint16_t& len, size_t bufferSize)> handler_t;
+
+  PacketRingFrontend(const std::string& interface, const ComboAddress& local);
+  ~PacketRingFrontend();
+
+  /* never returns */
+  void run(const handler_t& handler, int fallbackFD);
+
+  /* returns false if the query is not an Ethernet frame holding an unfragmented UDP datagram
+     to 'local' (the address is not checked if 'local' is an ANY address) */
+  static bool parseFrame(const uint8_t* frame, size_t frameLen, const ComboAddress& local, Query& query);
+  /* attaches the filter used on the packet socket, keeping only the frames holding an unfragmented
+     UDP datagram to 'port', with or without a VLAN tag */
+  static void attachFrameFilter(int fd, uint16_t port);
+  /* builds a frame holding 'response' as a reply to 'query', returns its size or 0 if it does not fit into outSize */
+  static size_t buildResponseFrame(const Query& query, const char* response, uint16_t responseLen, uint8_t* out, size_t outSize);
+
+  const std::string& getInterface() const
+  {
+    return d_interface;
+  }
+
+  std::atomic<uint64_t> d_frames{0};
+  std::atomic<uint64_t> d_ignoredFrames{0};
+  std::atomic<uint64_t> d_ringResponses{0};
+  std::atomic<uint64_t> d_fallbackResponses{0};
+
+private:
+  void joinFanoutGroup();
+  bool queueResponse(const Query& query, const char* response, uint16_t responseLen);
+  void flushResponses();
+
+  const std::string d_interface;
+  const ComboAddress d_local;
+  uint8_t* d_rxRing{nullptr};
+  uint8_t* d_txRing{nullptr};
+  size_t d_rxRingSize{0};
+  size_t d_txRingSize{0};
+  size_t d_txFrameSize{0};
+  size_t d_txFramesCount{0};
+  size_t d_txPos{0};
+  size_t d_pendingResponses{0};
+  size_t d_mtu{1500};
+  unsigned int d_rxBlockSize{0};
+  unsigned int d_rxBlocksCount{0};
+  int d_rxFD{-1};
+  int d_txFD{-1};
+};
+
+/* attach a filter dropping everything to a UDP socket, so that the kernel does not queue
+   the queries we are already receiving via the packet ring */
+void setUDPSocketDropAllFilter(int fd);
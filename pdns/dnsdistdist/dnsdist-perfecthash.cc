@@ -0,0 +1,509 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dnsdist-perfecthash.hh"
+#include "misc.hh"
+
+struct PerfectHashDBHeader
+{
+  char d_magic[8];
+  uint32_t d_byteOrder;
+  uint32_t d_flags;
+  uint64_t d_seed;
+  uint64_t d_entries;
+  uint64_t d_buckets;
+  uint64_t d_tableSize;
+  uint64_t d_dataSize;
+  uint64_t d_reserved;
+};
+
+static_assert(sizeof(PerfectHashDBHeader) == 64, "the size of the perfect hash database header should be 64 bytes");
+
+static const char s_magic[8] = { 'D', 'D', 'P', 'H', 'K', 'V', 'S', '1' };
+static const uint32_t s_byteOrder = 0x01020304;
+/* average number of keys per bucket, larger values make the pilots table smaller but the build slower */
+static const uint64_t s_keysPerBucket = 5;
+/* give up on a seed and try another one after that many pilots for a single bucket */
+static const uint32_t s_maxPilot = 1 << 24;
+static const uint64_t s_initialSeed = 0x2545f4914f6cdd1dULL;
+static const size_t s_maxSeedAttempts = 32;
+
+static inline uint64_t mix64(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline uint64_t hashKey(const char* key, size_t keyLen, uint64_t seed)
+{
+  uint64_t h = seed ^ (keyLen * 0x9e3779b97f4a7c15ULL);
+  while (keyLen >= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, key, sizeof(word));
+    h = mix64(h ^ word);
+    key += sizeof(word);
+    keyLen -= sizeof(word);
+  }
+  uint64_t word = 0;
+  memcpy(&word, key, keyLen);
+  return mix64(h ^ word ^ 0x5bd1e995ULL);
+}
+
+static inline uint64_t getBucket(uint64_t hash, uint64_t buckets)
+{
+  /* buckets is lower than 2^32 so this can't overflow */
+  return ((hash >> 32) * buckets) >> 32;
+}
+
+static inline uint64_t getPosition(uint64_t hash, uint32_t pilot, uint64_t seed, uint64_t tableSize)
+{
+  return (hash ^ mix64(pilot ^ seed)) % tableSize;
+}
+
+static inline uint64_t getTableSize(uint64_t entries)
+{
+  /* one percent of free slots makes placing the last buckets much faster */
+  return entries + (entries / 100) + 1;
+}
+
+static inline size_t alignTo8(size_t value)
+{
+  return (value + 7) & ~static_cast<size_t>(7);
+}
+
+PerfectHashDB::PerfectHashDB(const std::string& fname)
+{
+  int fd = open(fname.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Error opening perfect hash database '" + fname + "': " + stringerror());
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int err = errno;
+    close(fd);
+    throw std::runtime_error("Error getting the size of perfect hash database '" + fname + "': " + stringerror(err));
+  }
+
+  if (st.st_size < static_cast<off_t>(sizeof(PerfectHashDBHeader))) {
+    close(fd);
+    throw std::runtime_error("Perfect hash database '" + fname + "' is too small");
+  }
+
+  d_mappingSize = st.st_size;
+  void* mapping = mmap(nullptr, d_mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  int err = errno;
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    throw std::runtime_error("Error mapping perfect hash database '" + fname + "': " + stringerror(err));
+  }
+  d_mapping = mapping;
+
+  const char* base = reinterpret_cast<const char*>(d_mapping);
+  PerfectHashDBHeader header;
+  memcpy(&header, base, sizeof(header));
+
+  try {
+    if (memcmp(header.d_magic, s_magic, sizeof(s_magic)) != 0) {
+      throw std::runtime_error("invalid magic value");
+    }
+    if (header.d_byteOrder != s_byteOrder) {
+      throw std::runtime_error("it has been built on a host of a different endianness");
+    }
+    if (header.d_entries >= std::numeric_limits<uint32_t>::max() || header.d_buckets >= std::numeric_limits<uint32_t>::max()) {
+      throw std::runtime_error("invalid number of entries or buckets");
+    }
+    if (header.d_buckets == 0 || header.d_tableSize != getTableSize(header.d_entries)) {
+      throw std::runtime_error("invalid table size");
+    }
+
+    d_seed = header.d_seed;
+    d_entries = header.d_entries;
+    d_buckets = header.d_buckets;
+    d_tableSize = header.d_tableSize;
+    d_flags = header.d_flags;
+
+    size_t pilotsOffset = sizeof(header);
+    size_t remapOffset = alignTo8(pilotsOffset + d_buckets * sizeof(uint32_t));
+    size_t remapSize = d_tableSize - d_entries;
+    size_t slotsOffset = alignTo8(remapOffset + remapSize * sizeof(uint32_t));
+    size_t dataOffset = slotsOffset + d_entries * sizeof(uint64_t);
+
+    if (dataOffset > d_mappingSize || header.d_dataSize != (d_mappingSize - dataOffset)) {
+      throw std::runtime_error("invalid size");
+    }
+
+    d_pilots = reinterpret_cast<const uint32_t*>(base + pilotsOffset);
+    d_remap = reinterpret_cast<const uint32_t*>(base + remapOffset);
+    d_slots = reinterpret_cast<const uint64_t*>(base + slotsOffset);
+    d_data = base + dataOffset;
+    d_dataSize = header.d_dataSize;
+  }
+  catch (const std::exception& e) {
+    munmap(d_mapping, d_mappingSize);
+    throw std::runtime_error("Invalid perfect hash database '" + fname + "': " + e.what());
+  }
+}
+
+PerfectHashDB::~PerfectHashDB()
+{
+  if (d_mapping != nullptr) {
+    munmap(d_mapping, d_mappingSize);
+  }
+}
+
+bool PerfectHashDB::find(const char* key, size_t keyLen, const char** value, size_t* valueLen) const
+{
+  if (d_entries == 0) {
+    return false;
+  }
+
+  const uint64_t hash = hashKey(key, keyLen, d_seed);
+  const uint64_t bucket = getBucket(hash, d_buckets);
+  uint64_t pos = getPosition(hash, d_pilots[bucket], d_seed, d_tableSize);
+  if (pos >= d_entries) {
+    pos = d_remap[pos - d_entries];
+    if (pos >= d_entries) {
+      return false;
+    }
+  }
+
+  const uint64_t offset = d_slots[pos];
+  uint32_t recordKeyLen;
+  uint32_t recordValueLen;
+  if (offset > d_dataSize || (d_dataSize - offset) < (sizeof(recordKeyLen) + sizeof(recordValueLen))) {
+    return false;
+  }
+
+  const char* record = d_data + offset;
+  memcpy(&recordKeyLen, record, sizeof(recordKeyLen));
+  memcpy(&recordValueLen, record + sizeof(recordKeyLen), sizeof(recordValueLen));
+  record += sizeof(recordKeyLen) + sizeof(recordValueLen);
+
+  const uint64_t remaining = d_dataSize - offset - sizeof(recordKeyLen) - sizeof(recordValueLen);
+  if (recordKeyLen != keyLen || remaining < (static_cast<uint64_t>(recordKeyLen) + recordValueLen)) {
+    return false;
+  }
+
+  if (memcmp(record, key, keyLen) != 0) {
+    return false;
+  }
+
+  if (value != nullptr) {
+    *value = record + recordKeyLen;
+    *valueLen = recordValueLen;
+  }
+
+  return true;
+}
+
+void PerfectHashDBWriter::addEntry(const std::string& key, const std::string& value)
+{
+  if (key.size() > std::numeric_limits<uint32_t>::max() || value.size() > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("Key or value too large to be added to a perfect hash database");
+  }
+  if (d_entries.size() >= (std::numeric_limits<uint32_t>::max() - 1)) {
+    throw std::runtime_error("Too many entries for a perfect hash database");
+  }
+
+  Entry entry;
+  entry.d_offset = d_arena.size();
+  entry.d_hash = 0;
+  entry.d_keyLen = key.size();
+  entry.d_valueLen = value.size();
+  d_arena.append(key);
+  d_arena.append(value);
+  d_entries.push_back(entry);
+}
+
+/* fills 'order' with the indexes of the entries to write (duplicates excluded),
+   'positions' with the position in the table of each of these entries, in the same order,
+   and 'pilots' with the pilot of every bucket.
+   Returns false if the seed can't be used, either because two different keys have
+   the same hash or because we could not find a pilot for a bucket. */
+bool PerfectHashDBWriter::computePlacement(uint64_t seed, std::vector<uint32_t>& pilots, std::vector<uint64_t>& positions, std::vector<size_t>& order, size_t& duplicates)
+{
+  for (auto& entry : d_entries) {
+    entry.d_hash = hashKey(&d_arena.at(entry.d_offset), entry.d_keyLen, seed);
+  }
+
+  std::vector<size_t> sorted(d_entries.size());
+  for (size_t idx = 0; idx < sorted.size(); idx++) {
+    sorted[idx] = idx;
+  }
+  std::sort(sorted.begin(), sorted.end(), [this](size_t a, size_t b) {
+      if (d_entries[a].d_hash != d_entries[b].d_hash) {
+        return d_entries[a].d_hash < d_entries[b].d_hash;
+      }
+      return a < b;
+    });
+
+  /* detect the duplicate keys (keeping the first one added) and the hash collisions */
+  order.clear();
+  order.reserve(sorted.size());
+  duplicates = 0;
+  for (size_t idx = 0; idx < sorted.size(); idx++) {
+    const auto& entry = d_entries[sorted[idx]];
+    if (!order.empty()) {
+      const auto& previous = d_entries[order.back()];
+      if (previous.d_hash == entry.d_hash) {
+        if (previous.d_keyLen == entry.d_keyLen && memcmp(&d_arena.at(previous.d_offset), &d_arena.at(entry.d_offset), entry.d_keyLen) == 0) {
+          ++duplicates;
+          continue;
+        }
+        return false;
+      }
+    }
+    order.push_back(sorted[idx]);
+  }
+  sorted.clear();
+  sorted.shrink_to_fit();
+
+  /* write the entries in the order they were added, which makes the data part of the file deterministic */
+  std::sort(order.begin(), order.end());
+
+  const uint64_t entries = order.size();
+  const uint64_t buckets = std::max(static_cast<uint64_t>(1), (entries + s_keysPerBucket - 1) / s_keysPerBucket);
+  const uint64_t tableSize = getTableSize(entries);
+
+  /* group the keys by bucket */
+  std::vector<uint32_t> bucketStart(buckets + 1, 0);
+  for (const auto idx : order) {
+    ++bucketStart.at(getBucket(d_entries[idx].d_hash, buckets) + 1);
+  }
+  size_t largestBucket = 0;
+  for (size_t bucket = 0; bucket < buckets; bucket++) {
+    largestBucket = std::max(largestBucket, static_cast<size_t>(bucketStart[bucket + 1]));
+    bucketStart[bucket + 1] += bucketStart[bucket];
+  }
+  /* indexes into 'order' */
+  std::vector<uint32_t> keysByBucket(entries);
+  {
+    std::vector<uint32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+    for (size_t idx = 0; idx < order.size(); idx++) {
+      auto bucket = getBucket(d_entries[order[idx]].d_hash, buckets);
+      keysByBucket[fill[bucket]++] = idx;
+    }
+  }
+
+  /* place the largest buckets first, they are the hardest ones */
+  std::vector<std::vector<uint32_t>> bucketsBySize(largestBucket + 1);
+  for (size_t bucket = 0; bucket < buckets; bucket++) {
+    auto size = bucketStart[bucket + 1] - bucketStart[bucket];
+    if (size > 0) {
+      bucketsBySize[size].push_back(bucket);
+    }
+  }
+
+  pilots.assign(buckets, 0);
+  positions.assign(entries, 0);
+  std::vector<bool> taken(tableSize, false);
+  std::vector<uint64_t> candidates;
+  candidates.reserve(largestBucket);
+
+  for (size_t size = largestBucket; size > 0; size--) {
+    for (const auto bucket : bucketsBySize[size]) {
+      bool placed = false;
+      for (uint32_t pilot = 0; pilot < s_maxPilot && !placed; pilot++) {
+        candidates.clear();
+        placed = true;
+        for (auto keyIdx = bucketStart[bucket]; keyIdx < bucketStart[bucket + 1]; keyIdx++) {
+          auto pos = getPosition(d_entries[order[keysByBucket[keyIdx]]].d_hash, pilot, seed, tableSize);
+          if (taken[pos] || std::find(candidates.begin(), candidates.end(), pos) != candidates.end()) {
+            placed = false;
+            break;
+          }
+          candidates.push_back(pos);
+        }
+
+        if (placed) {
+          pilots[bucket] = pilot;
+          for (size_t idx = 0; idx < candidates.size(); idx++) {
+            taken[candidates[idx]] = true;
+            positions[keysByBucket[bucketStart[bucket] + idx]] = candidates[idx];
+          }
+        }
+      }
+
+      if (!placed) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static void writeAll(int fd, const void* data, size_t size)
+{
+  const char* ptr = reinterpret_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t res = ::write(fd, ptr, size);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Error writing the perfect hash database: " + stringerror());
+    }
+    ptr += res;
+    size -= res;
+  }
+}
+
+size_t PerfectHashDBWriter::write(const std::string& fname)
+{
+  std::vector<uint32_t> pilots;
+  std::vector<uint64_t> positions;
+  std::vector<size_t> order;
+  size_t duplicates = 0;
+  uint64_t seed = s_initialSeed;
+  bool placed = false;
+
+  for (size_t attempt = 0; attempt < s_maxSeedAttempts; attempt++) {
+    seed = mix64(s_initialSeed + attempt);
+    if (computePlacement(seed, pilots, positions, order, duplicates)) {
+      placed = true;
+      break;
+    }
+  }
+
+  if (!placed) {
+    throw std::runtime_error("Unable to find a perfect hash function for the " + std::to_string(d_entries.size()) + " entries of '" + fname + "'");
+  }
+
+  const uint64_t entries = order.size();
+  const uint64_t tableSize = getTableSize(entries);
+
+  /* remap the positions past the number of entries to the free slots, so that the slots table is minimal */
+  std::vector<uint32_t> remap(tableSize - entries, 0);
+  {
+    std::vector<bool> taken(entries, false);
+    for (const auto pos : positions) {
+      if (pos < entries) {
+        taken[pos] = true;
+      }
+    }
+    uint64_t freeSlot = 0;
+    for (const auto pos : positions) {
+      if (pos < entries) {
+        continue;
+      }
+      while (taken[freeSlot]) {
+        freeSlot++;
+      }
+      remap[pos - entries] = freeSlot;
+      taken[freeSlot] = true;
+    }
+  }
+
+  std::vector<uint64_t> slots(entries, 0);
+  uint64_t dataSize = 0;
+  for (size_t idx = 0; idx < order.size(); idx++) {
+    const auto& entry = d_entries[order[idx]];
+    auto pos = positions[idx];
+    if (pos >= entries) {
+      pos = remap[pos - entries];
+    }
+    slots[pos] = dataSize;
+    dataSize += sizeof(entry.d_keyLen) + sizeof(entry.d_valueLen) + entry.d_keyLen + entry.d_valueLen;
+  }
+
+  PerfectHashDBHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.d_magic, s_magic, sizeof(header.d_magic));
+  header.d_byteOrder = s_byteOrder;
+  header.d_flags = d_flags;
+  header.d_seed = seed;
+  header.d_entries = entries;
+  header.d_buckets = pilots.size();
+  header.d_tableSize = tableSize;
+  header.d_dataSize = dataSize;
+
+  std::string tmpName = fname + ".XXXXXX";
+  int fd = mkstemp(&tmpName.at(0));
+  if (fd < 0) {
+    throw std::runtime_error("Error creating a temporary file to write the perfect hash database '" + fname + "': " + stringerror());
+  }
+
+  try {
+    static const char padding[8] = { 0 };
+    writeAll(fd, &header, sizeof(header));
+    size_t written = sizeof(header);
+    writeAll(fd, pilots.data(), pilots.size() * sizeof(uint32_t));
+    written += pilots.size() * sizeof(uint32_t);
+    writeAll(fd, padding, alignTo8(written) - written);
+    written = alignTo8(written);
+    writeAll(fd, remap.data(), remap.size() * sizeof(uint32_t));
+    written += remap.size() * sizeof(uint32_t);
+    writeAll(fd, padding, alignTo8(written) - written);
+    writeAll(fd, slots.data(), slots.size() * sizeof(uint64_t));
+
+    std::string buffer;
+    buffer.reserve(1024 * 1024);
+    for (const auto idx : order) {
+      const auto& entry = d_entries[idx];
+      buffer.append(reinterpret_cast<const char*>(&entry.d_keyLen), sizeof(entry.d_keyLen));
+      buffer.append(reinterpret_cast<const char*>(&entry.d_valueLen), sizeof(entry.d_valueLen));
+      buffer.append(d_arena, entry.d_offset, entry.d_keyLen + entry.d_valueLen);
+      if (buffer.size() >= 1024 * 1024) {
+        writeAll(fd, buffer.data(), buffer.size());
+        buffer.clear();
+      }
+    }
+    writeAll(fd, buffer.data(), buffer.size());
+
+    if (fchmod(fd, 0644) != 0 || fsync(fd) != 0) {
+      throw std::runtime_error("Error syncing the perfect hash database '" + fname + "': " + stringerror());
+    }
+    if (close(fd) != 0) {
+      fd = -1;
+      throw std::runtime_error("Error closing the perfect hash database '" + fname + "': " + stringerror());
+    }
+    fd = -1;
+
+    if (rename(tmpName.c_str(), fname.c_str()) != 0) {
+      throw std::runtime_error("Error moving the perfect hash database to '" + fname + "': " + stringerror());
+    }
+  }
+  catch (...) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    unlink(tmpName.c_str());
+    throw;
+  }
+
+  return duplicates;
+}
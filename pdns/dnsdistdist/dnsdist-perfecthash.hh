@@ -0,0 +1,134 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+/* An immutable key-value database stored in a single file, meant to be
+   memory-mapped and looked up without any locking.
+
+   Keys are placed using a minimal perfect hash function built with the
+   'hash and displace' method: keys are split into buckets, and every
+   bucket is assigned a 'pilot' value such that all the keys of all the
+   buckets end up in distinct slots of a table slightly larger than the
+   number of keys. Slots past the number of keys are then remapped to the
+   free ones, so that the slots table holds exactly one entry per key.
+   A lookup costs a hash, a read of the pilot, a read of the slot and
+   a comparison of the key stored in the corresponding record.
+
+   The file is written in host byte order and can only be used on a host
+   of the same endianness.
+*/
+class PerfectHashDB : public boost::noncopyable
+{
+public:
+  /* the keys are DNS names in lowercase wire format */
+  static const uint32_t s_flagNameKeys = 1;
+
+  /* maps the file, throws a std::runtime_error if it is not a valid database */
+  PerfectHashDB(const std::string& fname);
+  ~PerfectHashDB();
+
+  /* 'value' points into the mapped file, and is only valid as long as this object lives */
+  bool find(const char* key, size_t keyLen, const char** value, size_t* valueLen) const;
+
+  bool find(const std::string& key, std::string& value) const
+  {
+    const char* valuePtr = nullptr;
+    size_t valueLen = 0;
+    if (!find(key.c_str(), key.size(), &valuePtr, &valueLen)) {
+      return false;
+    }
+    value.assign(valuePtr, valueLen);
+    return true;
+  }
+
+  bool exists(const char* key, size_t keyLen) const
+  {
+    return find(key, keyLen, nullptr, nullptr);
+  }
+
+  uint64_t size() const
+  {
+    return d_entries;
+  }
+
+  bool hasNameKeys() const
+  {
+    return d_flags & s_flagNameKeys;
+  }
+
+private:
+  const char* d_data{nullptr};
+  size_t d_dataSize{0};
+  void* d_mapping{nullptr};
+  size_t d_mappingSize{0};
+  const uint32_t* d_pilots{nullptr};
+  const uint32_t* d_remap{nullptr};
+  const uint64_t* d_slots{nullptr};
+  uint64_t d_seed{0};
+  uint64_t d_entries{0};
+  uint64_t d_buckets{0};
+  uint64_t d_tableSize{0};
+  uint32_t d_flags{0};
+};
+
+class PerfectHashDBWriter : public boost::noncopyable
+{
+public:
+  PerfectHashDBWriter(uint32_t flags = 0): d_flags(flags)
+  {
+  }
+
+  void addEntry(const std::string& key, const std::string& value);
+
+  /* builds the database and writes it to a temporary file, then atomically
+     renames it to 'fname' so that readers never see a partial database.
+     When the same key has been added several times, the first value is kept.
+     Returns the number of duplicate keys that have been skipped,
+     throws a std::runtime_error on failure */
+  size_t write(const std::string& fname);
+
+  size_t size() const
+  {
+    return d_entries.size();
+  }
+
+private:
+  struct Entry
+  {
+    uint64_t d_offset;
+    uint64_t d_hash;
+    uint32_t d_keyLen;
+    uint32_t d_valueLen;
+  };
+
+  bool computePlacement(uint64_t seed, std::vector<uint32_t>& pilots, std::vector<uint64_t>& positions, std::vector<size_t>& order, size_t& duplicates);
+
+  /* keys and values, one after the other */
+  std::string d_arena;
+  std::vector<Entry> d_entries;
+  uint32_t d_flags;
+};
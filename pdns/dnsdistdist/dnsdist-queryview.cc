@@ -0,0 +1 @@
+../dnsdist-queryview.cc
\ No newline at end of file
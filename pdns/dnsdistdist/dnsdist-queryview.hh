@@ -0,0 +1 @@
+../dnsdist-queryview.hh
\ No newline at end of file
@@ -208,6 +208,14 @@ public:
     }
     return ret + d_nmg.toString();
   }
+  const NetmaskGroup& getNetmaskGroup() const
+  {
+    return d_nmg;
+  }
+  bool isSource() const
+  {
+    return d_src;
+  }
 private:
   bool d_src;
   bool d_quiet;
@@ -578,6 +586,10 @@ public:
     else
       return "qname in "+d_smn.toString();
   }
+  const SuffixMatchNode& getSuffixes() const
+  {
+    return d_smn;
+  }
 private:
   SuffixMatchNode d_smn;
   bool d_quiet;
@@ -598,6 +610,10 @@ public:
   {
     return "qname=="+d_qname.toString();
   }
+  const DNSName& getQName() const
+  {
+    return d_qname;
+  }
 private:
   DNSName d_qname;
 };
@@ -615,6 +631,9 @@ public:
         ss << "qname in DNSNameSet(" << qname_idx.size() << " FQDNs)";
         return ss.str();
     }
+    const DNSNameSet& getNames() const {
+        return qname_idx;
+    }
 private:
     DNSNameSet qname_idx;
 };
@@ -634,6 +653,10 @@ public:
     QType qt(d_qtype);
     return "qtype=="+qt.getName();
   }
+  uint16_t getQType() const
+  {
+    return d_qtype;
+  }
 private:
   uint16_t d_qtype;
 };
@@ -1100,14 +1123,7 @@ public:
 
   bool matches(const DNSQuestion* dq) const override
   {
-    std::vector<std::string> keys = d_key->getKeys(*dq);
-    for (const auto& key : keys) {
-      if (d_kvs->keyExists(key) == true) {
-        return true;
-      }
-    }
-
-    return false;
+    return d_key->lookup(*d_kvs, *dq, nullptr);
   }
 
   string toString() const override
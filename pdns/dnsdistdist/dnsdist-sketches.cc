@@ -0,0 +1,220 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dnsdist-sketches.hh"
+
+std::atomic<uint64_t> DynBlockSketches::s_nextId{1};
+
+DynBlockSketches::DynBlockSketches(size_t capacity, size_t window): d_capacity(capacity), d_window(window), d_id(s_nextId++)
+{
+  if (capacity == 0 || window == 0) {
+    throw std::runtime_error("The capacity and window of the dynamic block sketches should be greater than 0");
+  }
+}
+
+void DynBlockSketches::ShardHandle::release()
+{
+  /* the sketches, and thus the shard, might already be gone */
+  auto registry = d_registry.lock();
+  if (registry && d_shard != nullptr) {
+    std::lock_guard<std::mutex> lock(registry->d_lock);
+    d_shard->d_inUse = false;
+  }
+  d_registry.reset();
+  d_shard = nullptr;
+  d_sketchesId = 0;
+}
+
+DynBlockSketches::Shard* DynBlockSketches::acquireShard()
+{
+  std::lock_guard<std::mutex> lock(d_registry->d_lock);
+  for (auto& shard : d_registry->d_shards) {
+    if (!shard->d_inUse) {
+      shard->d_inUse = true;
+      return shard.get();
+    }
+  }
+
+  auto shard = std::unique_ptr<Shard>(new Shard());
+  shard->d_buckets.reserve(d_window);
+  for (size_t bucket = 0; bucket < d_window; bucket++) {
+    shard->d_buckets.emplace_back(d_capacity);
+  }
+  shard->d_inUse = true;
+  d_registry->d_shards.push_back(std::move(shard));
+  return d_registry->d_shards.back().get();
+}
+
+DynBlockSketches::Shard& DynBlockSketches::getShard()
+{
+  /* identified by a unique ID instead of its address so that a new object at the
+     same address does not get the shard of a destroyed one */
+  static thread_local ShardHandle t_handle;
+  if (t_handle.d_sketchesId != d_id) {
+    t_handle.release();
+    t_handle.d_shard = acquireShard();
+    t_handle.d_registry = d_registry;
+    t_handle.d_sketchesId = d_id;
+  }
+  return *t_handle.d_shard;
+}
+
+std::vector<DynBlockSketches::Shard*> DynBlockSketches::getShards() const
+{
+  std::vector<Shard*> shards;
+  std::lock_guard<std::mutex> lock(d_registry->d_lock);
+  shards.reserve(d_registry->d_shards.size());
+  for (const auto& shard : d_registry->d_shards) {
+    shards.push_back(shard.get());
+  }
+  return shards;
+}
+
+template<typename F> void DynBlockSketches::update(const F& updater)
+{
+  auto& own = getShard();
+  {
+    std::unique_lock<std::mutex> lock(own.d_lock, std::try_to_lock);
+    if (lock.owns_lock()) {
+      updater(own);
+      return;
+    }
+  }
+
+  {
+    /* our shard is being merged, which locks one shard at a time, so another one is very likely free */
+    std::lock_guard<std::mutex> registryLock(d_registry->d_lock);
+    for (auto& shard : d_registry->d_shards) {
+      if (shard.get() == &own) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(shard->d_lock, std::try_to_lock);
+      if (lock.owns_lock()) {
+        updater(*shard);
+        return;
+      }
+    }
+  }
+
+  /* out of luck, let's just wait */
+  std::lock_guard<std::mutex> lock(own.d_lock);
+  updater(own);
+}
+
+DynBlockSketches::Bucket* DynBlockSketches::getBucket(Shard& shard, time_t second)
+{
+  auto& bucket = shard.d_buckets[second % d_window];
+  if (bucket.d_second > second) {
+    /* older than the window, don't overwrite more recent data */
+    return nullptr;
+  }
+  if (bucket.d_second != second) {
+    bucket.d_queries.clear();
+    bucket.d_qtypes.clear();
+    bucket.d_responseBytes.clear();
+    bucket.d_rcodes.clear();
+    bucket.d_second = second;
+  }
+  return &bucket;
+}
+
+void DynBlockSketches::insertQuery(const struct timespec& when, const ComboAddress& requestor, uint16_t qtype)
+{
+  update([this, &when, &requestor, qtype](Shard& shard) {
+      auto bucket = getBucket(shard, when.tv_sec);
+      if (bucket == nullptr) {
+        return;
+      }
+      bucket->d_queries.add({requestor, 0}, 1);
+      bucket->d_qtypes.add({requestor, qtype}, 1);
+    });
+}
+
+void DynBlockSketches::insertResponse(const struct timespec& when, const ComboAddress& requestor, uint8_t rcode, unsigned int size)
+{
+  update([this, &when, &requestor, rcode, size](Shard& shard) {
+      auto bucket = getBucket(shard, when.tv_sec);
+      if (bucket == nullptr) {
+        return;
+      }
+      bucket->d_responseBytes.add({requestor, 0}, size);
+      bucket->d_rcodes.add({requestor, rcode}, 1);
+    });
+}
+
+void DynBlockSketches::clear()
+{
+  for (auto shard : getShards()) {
+    std::lock_guard<std::mutex> lock(shard->d_lock);
+    for (auto& bucket : shard->d_buckets) {
+      bucket.d_queries.clear();
+      bucket.d_qtypes.clear();
+      bucket.d_responseBytes.clear();
+      bucket.d_rcodes.clear();
+      bucket.d_second = 0;
+    }
+  }
+}
+
+unsigned int DynBlockSketches::getCounts(Type type, uint16_t value, const struct timespec& now, unsigned int seconds, counts_t& counts)
+{
+  if (seconds == 0 || seconds > d_window) {
+    seconds = d_window;
+  }
+  /* like the rings, we consider everything that happened during the last 'seconds' seconds,
+     the current one included, so 'seconds' buckets in total */
+  const time_t cutOff = now.tv_sec - seconds + 1;
+  const bool checkValue = type == Type::QTypes || type == Type::RCodes;
+
+  for (const auto shard : getShards()) {
+    std::lock_guard<std::mutex> lock(shard->d_lock);
+    for (const auto& bucket : shard->d_buckets) {
+      if (bucket.d_second < cutOff || bucket.d_second > now.tv_sec) {
+        continue;
+      }
+
+      const summary_t* summary = nullptr;
+      switch (type) {
+      case Type::Queries:
+        summary = &bucket.d_queries;
+        break;
+      case Type::QTypes:
+        summary = &bucket.d_qtypes;
+        break;
+      case Type::ResponseBytes:
+        summary = &bucket.d_responseBytes;
+        break;
+      case Type::RCodes:
+        summary = &bucket.d_rcodes;
+        break;
+      }
+
+      summary->visit([&counts, checkValue, value](const summary_t::Entry& entry) {
+          if ((!checkValue || entry.key.value == value) && entry.count > entry.error) {
+            counts[entry.key.requestor] += entry.count - entry.error;
+          }
+        });
+    }
+  }
+
+  return seconds;
+}
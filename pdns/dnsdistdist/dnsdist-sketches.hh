@@ -0,0 +1,244 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include "iputils.hh"
+
+/* Space-Saving summary of the heaviest keys of a stream, tracking at most 'capacity' keys
+   (Metwally, Agrawal and El Abbadi). When a new key arrives and the summary is full, it
+   replaces the key with the smallest count and inherits that count, which is recorded as
+   the maximum overestimation ('error') of the new key. A key whose real count is larger
+   than total / capacity is guaranteed to be present. */
+template<typename K, class Hash, class Equal>
+class SpaceSavingSummary
+{
+public:
+  struct Entry
+  {
+    K key;
+    uint64_t count;
+    uint64_t error;
+  };
+
+  SpaceSavingSummary(size_t capacity): d_capacity(capacity)
+  {
+  }
+
+  void add(const K& key, uint64_t weight)
+  {
+    auto& byKey = d_entries.template get<KeyTag>();
+    auto it = byKey.find(key);
+    if (it != byKey.end()) {
+      byKey.modify(it, [weight](Entry& entry) { entry.count += weight; });
+      return;
+    }
+
+    if (d_entries.size() < d_capacity) {
+      d_entries.insert({key, weight, 0});
+      return;
+    }
+
+    /* evict the smallest one */
+    auto& byCount = d_entries.template get<CountTag>();
+    auto smallest = byCount.begin();
+    if (smallest == byCount.end()) {
+      return;
+    }
+    const uint64_t previous = smallest->count;
+    byCount.modify(smallest, [&key, weight, previous](Entry& entry) {
+        entry.key = key;
+        entry.count = previous + weight;
+        entry.error = previous;
+      });
+  }
+
+  template<typename F> void visit(const F& visitor) const
+  {
+    for (const auto& entry : d_entries) {
+      visitor(entry);
+    }
+  }
+
+  void clear()
+  {
+    d_entries.clear();
+  }
+
+  size_t size() const
+  {
+    return d_entries.size();
+  }
+
+private:
+  struct KeyTag {};
+  struct CountTag {};
+  typedef boost::multi_index_container<Entry,
+                                       boost::multi_index::indexed_by <
+                                         boost::multi_index::hashed_unique<boost::multi_index::tag<KeyTag>, boost::multi_index::member<Entry, K, &Entry::key>, Hash, Equal>,
+                                         boost::multi_index::ordered_non_unique<boost::multi_index::tag<CountTag>, boost::multi_index::member<Entry, uint64_t, &Entry::count> >
+                                         >
+                                       > container_t;
+
+  container_t d_entries;
+  size_t d_capacity;
+};
+
+/* Per-client heavy-hitter sketches fed when a query or a response is inserted into the
+   rings, so that the dynamic block rules can be evaluated at a cost depending on the size of
+   the sketches instead of the size of the rings. Each sketch covers one second, and we keep
+   'window' of them. Every thread inserting gets its own shard, regardless of the number of
+   shards of the rings. The lock of a shard is only held by another thread while the shard is
+   merged or cleared, in which case the insertion goes to another shard that is not. */
+class DynBlockSketches
+{
+public:
+  struct Key
+  {
+    ComboAddress requestor;
+    /* qtype or rcode, 0 for the query and response bytes sketches */
+    uint16_t value;
+  };
+
+  struct KeyHash
+  {
+    uint32_t operator()(const Key& key) const
+    {
+      return ComboAddress::addressOnlyHash()(key.requestor) ^ key.value;
+    }
+  };
+
+  struct KeyEqual
+  {
+    bool operator()(const Key& lhs, const Key& rhs) const
+    {
+      return lhs.value == rhs.value && ComboAddress::addressOnlyEqual()(lhs.requestor, rhs.requestor);
+    }
+  };
+
+  typedef SpaceSavingSummary<Key, KeyHash, KeyEqual> summary_t;
+  typedef std::unordered_map<ComboAddress, uint64_t, ComboAddress::addressOnlyHash, ComboAddress::addressOnlyEqual> counts_t;
+
+  enum class Type : uint8_t { Queries, QTypes, ResponseBytes, RCodes };
+
+  DynBlockSketches(size_t capacity, size_t window);
+
+  void insertQuery(const struct timespec& when, const ComboAddress& requestor, uint16_t qtype);
+  void insertResponse(const struct timespec& when, const ComboAddress& requestor, uint8_t rcode, unsigned int size);
+
+  /* merges the sketches of that type covering the last 'seconds' seconds before 'now',
+     the whole window if 'seconds' is 0 or larger than the window. For QTypes and RCodes, only
+     the entries for 'value' are considered. The counts are lower bounds, so that a client
+     is never blocked because it inherited the count of an evicted one.
+     Returns the number of seconds actually covered */
+  unsigned int getCounts(Type type, uint16_t value, const struct timespec& now, unsigned int seconds, counts_t& counts);
+
+  void clear();
+
+  size_t getWindow() const
+  {
+    return d_window;
+  }
+
+  size_t getCapacity() const
+  {
+    return d_capacity;
+  }
+
+  /* the number of shards allocated so far, which is the largest number of threads
+     that have been inserting at the same time */
+  size_t getNumberOfShards() const
+  {
+    std::lock_guard<std::mutex> lock(d_registry->d_lock);
+    return d_registry->d_shards.size();
+  }
+
+private:
+  struct Bucket
+  {
+    Bucket(size_t capacity): d_queries(capacity), d_qtypes(capacity), d_responseBytes(capacity), d_rcodes(capacity)
+    {
+    }
+
+    summary_t d_queries;
+    summary_t d_qtypes;
+    summary_t d_responseBytes;
+    summary_t d_rcodes;
+    time_t d_second{0};
+  };
+
+  struct Shard
+  {
+    std::vector<Bucket> d_buckets;
+    std::mutex d_lock;
+    /* whether a thread is currently using this shard, protected by the lock of the registry */
+    bool d_inUse{false};
+  };
+
+  /* the shards of a thread that exited are kept, along with their content, and handed over
+     to the next thread needing one */
+  struct ShardsRegistry
+  {
+    std::vector<std::unique_ptr<Shard>> d_shards;
+    std::mutex d_lock;
+  };
+
+  /* the shard of the last DynBlockSketches object a thread inserted into, released when the thread exits */
+  struct ShardHandle
+  {
+    ~ShardHandle()
+    {
+      release();
+    }
+
+    void release();
+
+    std::weak_ptr<ShardsRegistry> d_registry;
+    Shard* d_shard{nullptr};
+    uint64_t d_sketchesId{0};
+  };
+
+  Shard& getShard();
+  Shard* acquireShard();
+  std::vector<Shard*> getShards() const;
+  /* calls 'updater' with a locked shard, preferably the one of this thread */
+  template<typename F> void update(const F& updater);
+  /* returns nullptr if that second is already out of the window */
+  Bucket* getBucket(Shard& shard, time_t second);
+
+  static std::atomic<uint64_t> s_nextId;
+
+  std::shared_ptr<ShardsRegistry> d_registry{std::make_shared<ShardsRegistry>()};
+  const size_t d_capacity;
+  const size_t d_window;
+  const uint64_t d_id;
+};
@@ -155,6 +155,9 @@ latex_logo = '_static/powerdns-logo-trans.png'
 man_pages = [
     ('manpages/dnsdist.1', 'dnsdist',
      'A DNS and DoS aware, scriptable loadbalancer',
+     [author], 1),
+    ('manpages/dnsdist-kvs-builder.1', 'dnsdist-kvs-builder',
+     'Build a perfect hash key value store database for dnsdist',
      [author], 1)
 ]
 
@@ -6,6 +6,7 @@
 
 #include <errno.h>
 #include <iostream>
+#include <mutex>
 #include <thread>
 
 #include <boost/algorithm/string.hpp>
@@ -35,17 +36,21 @@ using namespace std;
    If the operator has configured multiple IP addresses to listen on,
    we launch multiple h2o listener threads. We can hook in to multiple
    URLs though on the same IP. There is no SNI yet (I think).
+   A single frontend can also be served by several h2o threads, each
+   with its own event loop and its own SO_REUSEPORT listening socket,
+   sharing the same TLS context (and therefore the same session tickets).
 
    h2o is event driven, so we get callbacks if a new DNS query arrived.
-   When it does, we do some minimal parsing on it, and send it on to the
-   dnsdist worker thread which we also launched.
-
-   This dnsdist worker thread injects the query into the normal dnsdist flow
-   (as a datagram over a socketpair). The response also goes back over a
-   (different) socketpair, where we pick it up and deliver it back to h2o.
-
-   For coordination, we use the h2o socket multiplexer, which is sensitive to our
-   socketpair too.
+   When it does, we do some minimal parsing on it, then run it through the
+   normal dnsdist rules and packet cache right away, from the h2o thread.
+   Self-generated answers, cache hits and errors are sent back directly.
+
+   Only the queries that need to be forwarded to a backend leave the h2o thread.
+   Their responses (or timeouts) are pushed to the response queue of the
+   thread the query came from, which is drained from the h2o event loop.
+   A byte is written to a pipe, to wake up the event loop, only when the
+   queue goes from empty to non-empty, so there is no per-query syscall
+   under load.
 */
 
 /* h2o notes.
@@ -59,36 +64,53 @@ using namespace std;
 class DOHAcceptContext
 {
 public:
-  DOHAcceptContext()
+  DOHAcceptContext(size_t numberOfThreads): d_h2o_accept_ctxs(numberOfThreads)
   {
-    memset(&d_h2o_accept_ctx, 0, sizeof(d_h2o_accept_ctx));
+    for (auto& ctx : d_h2o_accept_ctxs) {
+      memset(&ctx, 0, sizeof(ctx));
+    }
     d_rotatingTicketsKey.clear();
   }
   DOHAcceptContext(const DOHAcceptContext&) = delete;
   DOHAcceptContext& operator=(const DOHAcceptContext&) = delete;
 
-  h2o_accept_ctx_t* get()
+  /* the native accept context holds a pointer to the h2o context
+     of the thread, so we need one per thread */
+  h2o_accept_ctx_t* get(size_t threadIndex)
+  {
+    ++d_refcnt;
+    return &d_h2o_accept_ctxs.at(threadIndex);
+  }
+
+  void acquire()
   {
     ++d_refcnt;
-    return &d_h2o_accept_ctx;
   }
 
   void release()
   {
     if (--d_refcnt == 0) {
-      SSL_CTX_free(d_h2o_accept_ctx.ssl_ctx);
-      d_h2o_accept_ctx.ssl_ctx = nullptr;
+      SSL_CTX_free(d_sslCtx);
+      d_sslCtx = nullptr;
       delete this;
     }
   }
 
-  void decrementConcurrentConnections()
+  void setSSLContext(SSL_CTX* sslCtx)
   {
-    if (d_cs != nullptr) {
-      --d_cs->tcpCurrentConnections;
+    d_sslCtx = sslCtx;
+    for (auto& ctx : d_h2o_accept_ctxs) {
+      ctx.ssl_ctx = sslCtx;
     }
   }
 
+  void setThreadContext(size_t threadIndex, h2o_context_t* h2oCtx, h2o_hostconf_t** hosts)
+  {
+    auto& ctx = d_h2o_accept_ctxs.at(threadIndex);
+    ctx.ctx = h2oCtx;
+    ctx.hosts = hosts;
+  }
+
   time_t getNextTicketsKeyRotation() const
   {
     return d_ticketsKeyNextRotation;
@@ -159,11 +181,11 @@ public:
   std::map<int, std::string> d_ocspResponses;
   std::unique_ptr<OpenSSLTLSTicketKeysRing> d_ticketKeys{nullptr};
   std::unique_ptr<FILE, int(*)(FILE*)> d_keyLogFile{nullptr, fclose};
-  ClientState* d_cs{nullptr};
   time_t d_ticketsKeyRotationDelay{0};
 
 private:
-  h2o_accept_ctx_t d_h2o_accept_ctx;
+  std::vector<h2o_accept_ctx_t> d_h2o_accept_ctxs;
+  SSL_CTX* d_sslCtx{nullptr};
   std::atomic<uint64_t> d_refcnt{1};
   time_t d_ticketsKeyNextRotation{0};
   std::atomic_flag d_rotatingTicketsKey;
@@ -171,22 +193,93 @@ private:
 
 // we create one of these per thread, and pass around a pointer to it
 // through the bowels of h2o
-struct DOHServerConfig
+struct DOHThreadContext
 {
-  DOHServerConfig(uint32_t idleTimeout): accept_ctx(new DOHAcceptContext)
+  DOHThreadContext(size_t index_): index(index_)
   {
-    if(socketpair(AF_LOCAL, SOCK_DGRAM, 0, dohquerypair) < 0) {
-      unixDie("Creating a socket pair for DNS over HTTPS");
+    if (pipe(d_responsesPipe) < 0) {
+      unixDie("Creating a pipe for DNS over HTTPS");
+    }
+
+    if (!setNonBlocking(d_responsesPipe[0]) || !setNonBlocking(d_responsesPipe[1])) {
+      close(d_responsesPipe[0]);
+      close(d_responsesPipe[1]);
+      unixDie("Setting the DNS over HTTPS pipe non-blocking");
     }
+  }
+  DOHThreadContext(const DOHThreadContext&) = delete;
+  DOHThreadContext& operator=(const DOHThreadContext&) = delete;
 
-    if (socketpair(AF_LOCAL, SOCK_DGRAM, 0, dohresponsepair) < 0) {
-      close(dohquerypair[0]);
-      close(dohquerypair[1]);
-      unixDie("Creating a socket pair for DNS over HTTPS");
+  /* can be called from any thread, takes ownership of one reference to the DOHUnit */
+  void queueResponse(DOHUnit* du)
+  {
+    bool wakeUp = false;
+    {
+      std::lock_guard<std::mutex> lock(d_responsesLock);
+      wakeUp = d_responses.empty();
+      d_responses.push_back(du);
     }
 
+    /* if the queue was not empty, the h2o thread has already been woken up
+       and has not picked up the queue yet */
+    if (wakeUp) {
+      const char data = 0;
+      if (write(d_responsesPipe[1], &data, sizeof(data)) != sizeof(data) && errno != EAGAIN && errno != EWOULDBLOCK) {
+        /* a full pipe is fine, it means that a wake up is already pending */
+        warnlog("Error waking up the DoH thread: %s", strerror(errno));
+      }
+    }
+  }
+
+  /* called from the h2o thread, replaces the content of 'responses' by the queued responses */
+  void getResponses(std::vector<DOHUnit*>& responses)
+  {
+    responses.clear();
+
+    /* empty the pipe first, so that a response queued after we took the queue
+       will wake us up again */
+    char buffer[64];
+    while (read(d_responsesPipe[0], buffer, sizeof(buffer)) > 0) {
+    }
+
+    std::lock_guard<std::mutex> lock(d_responsesLock);
+    responses.swap(d_responses);
+  }
+
+  int getWakeUpFD() const
+  {
+    return d_responsesPipe[0];
+  }
+
+  LocalHolders holders;
+  h2o_context_t h2o_ctx;
+  /* only accessed from the h2o thread */
+  std::vector<DOHUnit*> pendingResponses;
+  ClientState* cs{nullptr};
+  std::shared_ptr<DOHFrontend> df{nullptr};
+  const size_t index;
+
+private:
+  std::mutex d_responsesLock;
+  std::vector<DOHUnit*> d_responses;
+  int d_responsesPipe[2]{-1,-1};
+};
+
+/* the context of the DoH thread we are running in, if any */
+static thread_local DOHThreadContext* t_threadContext{nullptr};
+
+// we create one of these per frontend, shared by all its threads
+struct DOHServerConfig
+{
+  DOHServerConfig(uint32_t idleTimeout, size_t numberOfThreads): accept_ctx(new DOHAcceptContext(numberOfThreads))
+  {
     h2o_config_init(&h2o_config);
     h2o_config.http2.idle_timeout = idleTimeout * 1000;
+
+    threads.reserve(numberOfThreads);
+    for (size_t idx = 0; idx < numberOfThreads; idx++) {
+      threads.push_back(std::unique_ptr<DOHThreadContext>(new DOHThreadContext(idx)));
+    }
   }
   DOHServerConfig(const DOHServerConfig&) = delete;
   DOHServerConfig& operator=(const DOHServerConfig&) = delete;
@@ -198,14 +291,10 @@ struct DOHServerConfig
     }
   }
 
-  LocalHolders holders;
   h2o_globalconf_t h2o_config;
-  h2o_context_t h2o_ctx;
+  std::vector<std::unique_ptr<DOHThreadContext>> threads;
   DOHAcceptContext* accept_ctx{nullptr};
-  ClientState* cs{nullptr};
-  std::shared_ptr<DOHFrontend> df{nullptr};
-  int dohquerypair[2]{-1,-1};
-  int dohresponsepair[2]{-1,-1};
+  std::atomic<size_t> nextThread{0};
 };
 
 void handleDOHTimeout(DOHUnit* oldDU)
@@ -217,19 +306,21 @@ void handleDOHTimeout(DOHUnit* oldDU)
 /* we are about to erase an existing DU */
   oldDU->status_code = 502;
 
-  /* increase the ref counter before sending the pointer */
-  oldDU->get();
-  if (send(oldDU->rsock, &oldDU, sizeof(oldDU), 0) != sizeof(oldDU)) {
-    oldDU->release();
-  }
-  oldDU->release();
-  oldDU = nullptr;
+  /* the reference held by the IDS is passed to the response queue */
+  queueDOHUnitResponse(oldDU);
+}
+
+void queueDOHUnitResponse(DOHUnit* du)
+{
+  du->threadCtx->queueResponse(du);
 }
 
 static void on_socketclose(void *data)
 {
   DOHAcceptContext* ctx = reinterpret_cast<DOHAcceptContext*>(data);
-  ctx->decrementConcurrentConnections();
+  if (t_threadContext != nullptr) {
+    --t_threadContext->cs->tcpCurrentConnections;
+  }
   ctx->release();
 }
 
@@ -345,8 +436,9 @@ static void handleResponse(DOHFrontend& df, st_h2o_req_t* req, uint16_t statusCo
 }
 
 /*
-   this function calls 'return -1' to drop a query without sending it
-   caller should make sure HTTPS thread hears of that
+   this function calls 'return -1' to drop a query without sending it,
+   returns 1 if the response is ready to be sent right away,
+   and 0 if the query has been passed to a backend
 */
 static int processDOHQuery(DOHUnit* du)
 {
@@ -355,13 +447,13 @@ static int processDOHQuery(DOHUnit* du)
   bool duRefCountIncremented = false;
   try {
     if(!du->req) {
-      // we got closed meanwhile. XXX small race condition here
+      // we got closed meanwhile
       return -1;
     }
     remote = du->remote;
-    DOHServerConfig* dsc = reinterpret_cast<DOHServerConfig*>(du->req->conn->ctx->storage.entries[0].data);
-    auto& holders = dsc->holders;
-    ClientState& cs = *dsc->cs;
+    DOHThreadContext* threadCtx = du->threadCtx;
+    auto& holders = threadCtx->holders;
+    ClientState& cs = *threadCtx->cs;
 
     if (du->query.size() < sizeof(dnsheader)) {
       ++g_stats.nonCompliantQueries;
@@ -417,12 +509,7 @@ static int processDOHQuery(DOHUnit* du)
       if (du->response.empty()) {
         du->response = std::string(reinterpret_cast<char*>(dq.dh), dq.len);
       }
-      /* increase the ref counter before sending the pointer */
-      du->get();
-      if (send(du->rsock, &du, sizeof(du), 0) != sizeof(du)) {
-        du->release();
-      }
-      return 0;
+      return 1;
     }
 
     if (result != ProcessQueryResult::PassToBackend) {
@@ -438,7 +525,6 @@ static int processDOHQuery(DOHUnit* du)
     ComboAddress dest = du->dest;
     unsigned int idOffset = (ss->idOffset++) % ss->idStates.size();
     IDState* ids = &ss->idStates[idOffset];
-    ids->age = 0;
     DOHUnit* oldDU = nullptr;
     if (ids->isInUse()) {
       /* that means that the state was in use, possibly with an allocated
@@ -522,7 +608,7 @@ static int processDOHQuery(DOHUnit* du)
     vinfolog("Got query for %s|%s from %s (https), relayed to %s", ids->qname.toString(), QType(ids->qtype).getName(), remote.toStringWithPort(), ss->getName());
   }
   catch(const std::exception& e) {
-    vinfolog("Got an error in DOH question thread while parsing a query from %s, id %d: %s", remote.toStringWithPort(), queryId, e.what());
+    vinfolog("Got an error in the DoH thread while processing a query from %s, id %d: %s", remote.toStringWithPort(), queryId, e.what());
     du->status_code = 500;
     return -1;
   }
@@ -537,16 +623,16 @@ static void on_response_ready_cb(struct st_h2o_filter_t *self, h2o_req_t *req, h
     return;
   }
 
-  DOHServerConfig* dsc = reinterpret_cast<DOHServerConfig*>(req->conn->ctx->storage.entries[0].data);
+  DOHThreadContext* threadCtx = reinterpret_cast<DOHThreadContext*>(req->conn->ctx->storage.entries[0].data);
 
   DOHFrontend::HTTPVersionStats* stats = nullptr;
   if (req->version < 0x200) {
     /* HTTP 1.x */
-    stats = &dsc->df->d_http1Stats;
+    stats = &threadCtx->df->d_http1Stats;
   }
   else {
     /* HTTP 2.0 */
-    stats = &dsc->df->d_http2Stats;
+    stats = &threadCtx->df->d_http2Stats;
   }
 
   switch (req->res.status) {
@@ -603,9 +689,23 @@ static void on_generator_dispose(void *_self)
   }
 }
 
-/* We allocate a DOHUnit and send it to dnsdistclient() function in the doh client thread
-   via a pipe */
-static void doh_dispatch_query(DOHServerConfig* dsc, h2o_handler_t* self, h2o_req_t* req, std::string&& query, const ComboAddress& local, const ComboAddress& remote)
+/* sends the response held by the DOHUnit, if the HTTP request is still alive */
+static void sendDOHUnitResponse(DOHUnit* du)
+{
+  if(!du->req) { // it got killed in flight
+//    cout << "du "<<(void*)du<<" came back from dnsdist, but it was killed"<<endl;
+    return;
+  }
+
+  *du->self = nullptr; // so we don't clean up again in on_generator_dispose
+
+  const auto& df = du->threadCtx->df;
+  handleResponse(*df, du->req, du->status_code, du->response, df->d_customResponseHeaders, du->contentType, true);
+}
+
+/* We allocate a DOHUnit and process it right away, from the DoH thread.
+   Only queries that need to be sent to a backend will leave this thread */
+static void doh_dispatch_query(DOHThreadContext* threadCtx, h2o_handler_t* self, h2o_req_t* req, std::string&& query, const ComboAddress& local, const ComboAddress& remote)
 {
   try {
     uint16_t qtype;
@@ -615,22 +715,39 @@ static void doh_dispatch_query(DOHServerConfig* dsc, h2o_handler_t* self, h2o_re
     du->req = req;
     du->dest = local;
     du->remote = remote;
-    du->rsock = dsc->dohresponsepair[0];
+    du->threadCtx = threadCtx;
     du->query = std::move(query);
     du->qtype = qtype;
     du->self = reinterpret_cast<DOHUnit**>(h2o_mem_alloc_shared(&req->pool, sizeof(*self), on_generator_dispose));
     auto ptr = du.release();
     *(ptr->self) = ptr;
-    try  {
-      if(send(dsc->dohquerypair[0], &ptr, sizeof(ptr), 0) != sizeof(ptr)) {
-        ptr->release();
-        ptr = nullptr;
-        h2o_send_error_500(req, "Internal Server Error", "Internal Server Error", 0);
-      }
+
+    // if there was no EDNS, we add it with a large buffer size
+    // so we can use UDP to talk to the backend.
+    auto dh = const_cast<struct dnsheader*>(reinterpret_cast<const struct dnsheader*>(ptr->query.c_str()));
+
+    if(!dh->arcount) {
+      std::string res;
+      generateOptRR(std::string(), res, 4096, 0, false);
+
+      ptr->query += res;
+      dh = const_cast<struct dnsheader*>(reinterpret_cast<const struct dnsheader*>(ptr->query.c_str())); // may have reallocated
+      dh->arcount = htons(1);
+      ptr->ednsAdded = true;
     }
-    catch(...) {
-      ptr->release();
+    else {
+      // we leave existing EDNS in place
+    }
+
+    int result = processDOHQuery(ptr);
+    if (result != 0) {
+      if (result < 0) {
+        ptr->status_code = 500;
+      }
+      sendDOHUnitResponse(ptr);
     }
+    /* if the query has been passed to a backend, the IDS now holds a reference */
+    ptr->release();
   }
   catch(const std::exception& e) {
     vinfolog("Had error parsing DoH DNS packet from %s: %s", remote.toStringWithPort(), e.what());
@@ -655,9 +772,9 @@ try
   ComboAddress local;
   h2o_socket_getpeername(sock, reinterpret_cast<struct sockaddr*>(&remote));
   h2o_socket_getsockname(sock, reinterpret_cast<struct sockaddr*>(&local));
-  DOHServerConfig* dsc = reinterpret_cast<DOHServerConfig*>(req->conn->ctx->storage.entries[0].data);
+  DOHThreadContext* threadCtx = reinterpret_cast<DOHThreadContext*>(req->conn->ctx->storage.entries[0].data);
 
-  auto& holders = dsc->holders;
+  auto& holders = threadCtx->holders;
   if (!holders.acl->match(remote)) {
     ++g_stats.aclDrops;
     vinfolog("Query from %s (DoH) dropped because of ACL", remote.toStringWithPort());
@@ -666,48 +783,48 @@ try
   }
 
   if (h2o_socket_get_ssl_session_reused(sock) == 0) {
-    ++dsc->cs->tlsNewSessions;
+    ++threadCtx->cs->tlsNewSessions;
   }
   else {
-    ++dsc->cs->tlsResumptions;
+    ++threadCtx->cs->tlsResumptions;
   }
 
   if(auto tlsversion = h2o_socket_get_ssl_protocol_version(sock)) {
     if(!strcmp(tlsversion, "TLSv1.0"))
-      ++dsc->cs->tls10queries;
+      ++threadCtx->cs->tls10queries;
     else if(!strcmp(tlsversion, "TLSv1.1"))
-      ++dsc->cs->tls11queries;
+      ++threadCtx->cs->tls11queries;
     else if(!strcmp(tlsversion, "TLSv1.2"))
-      ++dsc->cs->tls12queries;
+      ++threadCtx->cs->tls12queries;
     else if(!strcmp(tlsversion, "TLSv1.3"))
-      ++dsc->cs->tls13queries;
+      ++threadCtx->cs->tls13queries;
     else
-      ++dsc->cs->tlsUnknownqueries;
+      ++threadCtx->cs->tlsUnknownqueries;
   }
 
   string path(req->path.base, req->path.len);
 
-  for (const auto& entry : dsc->df->d_responsesMap) {
+  for (const auto& entry : threadCtx->df->d_responsesMap) {
     if (entry->matches(path)) {
       const auto& customHeaders = entry->getHeaders();
-      handleResponse(*dsc->df, req, entry->getStatusCode(), entry->getContent(), customHeaders ? *customHeaders : dsc->df->d_customResponseHeaders, std::string(), false);
+      handleResponse(*threadCtx->df, req, entry->getStatusCode(), entry->getContent(), customHeaders ? *customHeaders : threadCtx->df->d_customResponseHeaders, std::string(), false);
       return 0;
     }
   }
 
   if (h2o_memis(req->method.base, req->method.len, H2O_STRLIT("POST"))) {
-    ++dsc->df->d_postqueries;
+    ++threadCtx->df->d_postqueries;
     if(req->version >= 0x0200)
-      ++dsc->df->d_http2Stats.d_nbQueries;
+      ++threadCtx->df->d_http2Stats.d_nbQueries;
     else
-      ++dsc->df->d_http1Stats.d_nbQueries;
+      ++threadCtx->df->d_http1Stats.d_nbQueries;
 
     std::string query;
     /* We reserve at least 512 additional bytes to be able to add EDNS, but we also want
        at least s_maxPacketCacheEntrySize bytes to be able to fill the answer from the packet cache */
     query.reserve(std::max(req->entity.len + 512, s_maxPacketCacheEntrySize));
     query.assign(req->entity.base, req->entity.len);
-    doh_dispatch_query(dsc, self, req, std::move(query), local, remote);
+    doh_dispatch_query(threadCtx, self, req, std::move(query), local, remote);
   }
   else if(req->query_at != SIZE_MAX && (req->path.len - req->query_at > 5)) {
     auto pos = path.find("?dns=");
@@ -736,30 +853,30 @@ try
       decoded.reserve(std::max(estimate + 512, s_maxPacketCacheEntrySize));
       if(B64Decode(sdns, decoded) < 0) {
         h2o_send_error_400(req, "Bad Request", "Unable to decode BASE64-URL", 0);
-        ++dsc->df->d_badrequests;
+        ++threadCtx->df->d_badrequests;
         return 0;
       }
       else {
-        ++dsc->df->d_getqueries;
+        ++threadCtx->df->d_getqueries;
         if(req->version >= 0x0200)
-          ++dsc->df->d_http2Stats.d_nbQueries;
+          ++threadCtx->df->d_http2Stats.d_nbQueries;
         else
-          ++dsc->df->d_http1Stats.d_nbQueries;
+          ++threadCtx->df->d_http1Stats.d_nbQueries;
 
-        doh_dispatch_query(dsc, self, req, std::move(decoded), local, remote);
+        doh_dispatch_query(threadCtx, self, req, std::move(decoded), local, remote);
       }
     }
     else
     {
       vinfolog("HTTP request without DNS parameter: %s", req->path.base);
       h2o_send_error_400(req, "Bad Request", "Unable to find the DNS parameter", 0);
-      ++dsc->df->d_badrequests;
+      ++threadCtx->df->d_badrequests;
       return 0;
     }
   }
   else {
     h2o_send_error_400(req, "Bad Request", "Unable to parse the request", 0);
-    ++dsc->df->d_badrequests;
+    ++threadCtx->df->d_badrequests;
   }
   return 0;
 }
@@ -891,99 +1008,29 @@ void DOHUnit::setHTTPResponse(uint16_t statusCode, const std::string& body_, con
   contentType = contentType_;
 }
 
-/* query has been parsed by h2o, which called doh_handler() in the main DoH thread.
-   In order not to blockfor long, doh_handler() called doh_dispatch_query() which allocated
-   a DOHUnit object and passed it to us */
-static void dnsdistclient(int qsock, int rsock)
-{
-  setThreadName("dnsdist/doh-cli");
-
-  for(;;) {
-    try {
-      DOHUnit* du = nullptr;
-      ssize_t got = recv(qsock, &du, sizeof(du), 0);
-      if (got < 0) {
-        warnlog("Error receiving internal DoH query: %s", strerror(errno));
-        continue;
-      }
-      else if (static_cast<size_t>(got) < sizeof(du)) {
-        continue;
-      }
-
-      // if there was no EDNS, we add it with a large buffer size
-      // so we can use UDP to talk to the backend.
-      auto dh = const_cast<struct dnsheader*>(reinterpret_cast<const struct dnsheader*>(du->query.c_str()));
-
-      if(!dh->arcount) {
-        std::string res;
-        generateOptRR(std::string(), res, 4096, 0, false);
-
-        du->query += res;
-        dh = const_cast<struct dnsheader*>(reinterpret_cast<const struct dnsheader*>(du->query.c_str())); // may have reallocated
-        dh->arcount = htons(1);
-        du->ednsAdded = true;
-      }
-      else {
-        // we leave existing EDNS in place
-      }
-
-      if(processDOHQuery(du) < 0) {
-        du->status_code = 500;
-        /* increase the ref count before sending the pointer */
-        du->get();
-        if(send(du->rsock, &du, sizeof(du), 0) != sizeof(du)) {
-          du->release();     // XXX but now what - will h2o time this out for us?
-        }
-      }
-      du->release();
-    }
-    catch(const std::exception& e) {
-      errlog("Error while processing query received over DoH: %s", e.what());
-    }
-    catch(...) {
-      errlog("Unspecified error while processing query received over DoH");
-    }
-  }
-}
-
 /* called if h2o finds that dnsdist gave us an answer by writing into
-   the dohresponsepair[0] side of the pipe so from:
+   the wake up pipe of this thread, from queueDOHUnitResponse() via:
+   - the responder thread, when a backend sent a response
    - handleDOHTimeout() when we did not get a response fast enough (called
      either from the health check thread (active) or from the frontend ones (reused))
-   - dnsdistclient (error 500 because processDOHQuery() returned a negative value)
-   - processDOHQuery (self-answered queries)
    */
 static void on_dnsdist(h2o_socket_t *listener, const char *err)
 {
-  DOHUnit *du = nullptr;
-  DOHServerConfig* dsc = reinterpret_cast<DOHServerConfig*>(listener->data);
-  ssize_t got = recv(dsc->dohresponsepair[1], &du, sizeof(du), 0);
-
-  if (got < 0) {
-    warnlog("Error reading a DOH internal response: %s", strerror(errno));
-    return;
-  }
-  else if (static_cast<size_t>(got) != sizeof(du)) {
-    return;
-  }
+  DOHThreadContext* threadCtx = reinterpret_cast<DOHThreadContext*>(listener->data);
+  auto& responses = threadCtx->pendingResponses;
+  threadCtx->getResponses(responses);
 
-  if(!du->req) { // it got killed in flight
-//    cout << "du "<<(void*)du<<" came back from dnsdist, but it was killed"<<endl;
+  for (auto du : responses) {
+    sendDOHUnitResponse(du);
     du->release();
-    return;
   }
-
-  *du->self = nullptr; // so we don't clean up again in on_generator_dispose
-
-  handleResponse(*dsc->df, du->req, du->status_code, du->response, dsc->df->d_customResponseHeaders, du->contentType, true);
-
-  du->release();
+  responses.clear();
 }
 
 /* called when a TCP connection has been accepted, the TLS session has not been established */
 static void on_accept(h2o_socket_t *listener, const char *err)
 {
-  DOHServerConfig* dsc = reinterpret_cast<DOHServerConfig*>(listener->data);
+  DOHThreadContext* threadCtx = reinterpret_cast<DOHThreadContext*>(listener->data);
   h2o_socket_t *sock = nullptr;
 
   if (err != nullptr) {
@@ -998,19 +1045,20 @@ static void on_accept(h2o_socket_t *listener, const char *err)
   h2o_socket_getpeername(sock, reinterpret_cast<struct sockaddr*>(&remote));
   //  cout<<"New HTTP accept for client "<<remote.toStringWithPort()<<": "<< listener->data << endl;
 
-  sock->data = dsc;
+  sock->data = threadCtx;
   sock->on_close.cb = on_socketclose;
-  auto accept_ctx = dsc->accept_ctx->get();
-  sock->on_close.data = dsc->accept_ctx;
-  ++dsc->df->d_httpconnects;
-  ++dsc->cs->tcpCurrentConnections;
-  h2o_accept(accept_ctx, sock);
+  auto acceptCtx = threadCtx->df->d_dsc->accept_ctx;
+  auto nativeCtx = acceptCtx->get(threadCtx->index);
+  sock->on_close.data = acceptCtx;
+  ++threadCtx->df->d_httpconnects;
+  ++threadCtx->cs->tcpCurrentConnections;
+  h2o_accept(nativeCtx, sock);
 }
 
-static int create_listener(const ComboAddress& addr, std::shared_ptr<DOHServerConfig>& dsc, int fd)
+static int create_listener(const ComboAddress& addr, DOHThreadContext& threadCtx, int fd)
 {
-  auto sock = h2o_evloop_socket_create(dsc->h2o_ctx.loop, fd, H2O_SOCKET_FLAG_DONT_READ);
-  sock->data = dsc.get();
+  auto sock = h2o_evloop_socket_create(threadCtx.h2o_ctx.loop, fd, H2O_SOCKET_FLAG_DONT_READ);
+  sock->data = &threadCtx;
   h2o_socket_read_start(sock, on_accept);
 
   return 0;
@@ -1035,12 +1083,13 @@ static int ticket_key_callback(SSL *s, unsigned char keyName[TLS_TICKETS_KEY_NAM
   ctx->handleTicketsKeyRotation();
 
   auto ret = libssl_ticket_key_callback(s, *ctx->d_ticketKeys, keyName, iv, ectx, hctx, enc);
-  if (enc == 0) {
+  /* the handshake is done from the DoH thread the connection has been accepted by */
+  if (enc == 0 && t_threadContext != nullptr) {
     if (ret == 0) {
-      ++ctx->d_cs->tlsUnknownTicketKey;
+      ++t_threadContext->cs->tlsUnknownTicketKey;
     }
     else if (ret == 2) {
-      ++ctx->d_cs->tlsInactiveTicketKey;
+      ++t_threadContext->cs->tlsInactiveTicketKey;
     }
   }
 
@@ -1083,30 +1132,26 @@ static void setupTLSContext(DOHAcceptContext& acceptCtx,
     acceptCtx.loadTicketsKeys(tlsConfig.d_ticketKeyFile);
   }
 
-  auto nativeCtx = acceptCtx.get();
-  nativeCtx->ssl_ctx = ctx.release();
-  acceptCtx.release();
+  acceptCtx.setSSLContext(ctx.release());
 }
 
-static void setupAcceptContext(DOHAcceptContext& ctx, DOHServerConfig& dsc, bool setupTLS)
+static void setupAcceptContext(DOHAcceptContext& ctx, DOHServerConfig& dsc, DOHFrontend& df, bool setupTLS)
 {
-  auto nativeCtx = ctx.get();
-  nativeCtx->ctx = &dsc.h2o_ctx;
-  nativeCtx->hosts = dsc.h2o_config.hosts;
-  ctx.d_ticketsKeyRotationDelay = dsc.df->d_tlsConfig.d_ticketsKeyRotationDelay;
+  for (const auto& threadCtx : dsc.threads) {
+    ctx.setThreadContext(threadCtx->index, &threadCtx->h2o_ctx, dsc.h2o_config.hosts);
+  }
+  ctx.d_ticketsKeyRotationDelay = df.d_tlsConfig.d_ticketsKeyRotationDelay;
 
-  if (setupTLS && !dsc.df->d_tlsConfig.d_certKeyPairs.empty()) {
+  if (setupTLS && !df.d_tlsConfig.d_certKeyPairs.empty()) {
     try {
       setupTLSContext(ctx,
-                      dsc.df->d_tlsConfig,
-                      dsc.df->d_tlsCounters);
+                      df.d_tlsConfig,
+                      df.d_tlsCounters);
     }
     catch (const std::runtime_error& e) {
-      throw std::runtime_error("Error setting up TLS context for DoH listener on '" + dsc.df->d_local.toStringWithPort() + "': " + e.what());
+      throw std::runtime_error("Error setting up TLS context for DoH listener on '" + df.d_local.toStringWithPort() + "': " + e.what());
     }
   }
-  ctx.d_cs = dsc.cs;
-  ctx.release();
 }
 
 void DOHFrontend::rotateTicketsKey(time_t now)
@@ -1149,8 +1194,8 @@ size_t DOHFrontend::getTicketsKeysCount() const
 
 void DOHFrontend::reloadCertificates()
 {
-  auto newAcceptContext = std::unique_ptr<DOHAcceptContext>(new DOHAcceptContext());
-  setupAcceptContext(*newAcceptContext, *d_dsc, true);
+  auto newAcceptContext = std::unique_ptr<DOHAcceptContext>(new DOHAcceptContext(d_dsc->threads.size()));
+  setupAcceptContext(*newAcceptContext, *d_dsc, *this, true);
   DOHAcceptContext* oldCtx = d_dsc->accept_ctx;
   d_dsc->accept_ctx = newAcceptContext.release();
   oldCtx->release();
@@ -1158,20 +1203,25 @@ void DOHFrontend::reloadCertificates()
 
 void DOHFrontend::setup()
 {
+  if (d_dsc) {
+    /* all the threads of this frontend share the same configuration */
+    return;
+  }
+
   registerOpenSSLUser();
 
-  d_dsc = std::make_shared<DOHServerConfig>(d_idleTimeout);
+  d_dsc = std::make_shared<DOHServerConfig>(d_idleTimeout, d_numberOfThreads);
+  d_dsc->h2o_config.server_name = h2o_iovec_init(d_serverTokens.c_str(), d_serverTokens.size());
 
-  if  (!d_tlsConfig.d_certKeyPairs.empty()) {
-    try {
-      setupTLSContext(*d_dsc->accept_ctx,
-                      d_tlsConfig,
-                      d_tlsCounters);
-    }
-    catch (const std::runtime_error& e) {
-      throw std::runtime_error("Error setting up TLS context for DoH listener on '" + d_local.toStringWithPort() + "': " + e.what());
-    }
+  // I wonder if this registers an IP address.. I think it does
+  // this may mean we need to actually register a site "name" here and not the IP address
+  h2o_hostconf_t *hostconf = h2o_config_register_host(&d_dsc->h2o_config, h2o_iovec_init(d_local.toString().c_str(), d_local.toString().size()), 65535);
+
+  for(const auto& url : d_urls) {
+    register_handler(hostconf, url.c_str(), doh_handler);
   }
+
+  setupAcceptContext(*d_dsc->accept_ctx, *d_dsc, *this, true);
 }
 
 // this is the entrypoint from dnsdist.cc
@@ -1180,45 +1230,38 @@ try
 {
   std::shared_ptr<DOHFrontend>& df = cs->dohFrontend;
   auto& dsc = df->d_dsc;
-  dsc->cs = cs;
-  dsc->df = cs->dohFrontend;
-  dsc->h2o_config.server_name = h2o_iovec_init(df->d_serverTokens.c_str(), df->d_serverTokens.size());
-
+  size_t threadIndex = dsc->nextThread++;
+  if (threadIndex >= dsc->threads.size()) {
+    throw std::runtime_error("too many threads for the DoH frontend on " + df->d_local.toStringWithPort());
+  }
 
-  std::thread dnsdistThread(dnsdistclient, dsc->dohquerypair[1], dsc->dohresponsepair[0]);
-  dnsdistThread.detach(); // gets us better error reporting
+  auto& threadCtx = *dsc->threads.at(threadIndex);
+  threadCtx.cs = cs;
+  threadCtx.df = cs->dohFrontend;
+  t_threadContext = &threadCtx;
 
   setThreadName("dnsdist/doh");
-  // I wonder if this registers an IP address.. I think it does
-  // this may mean we need to actually register a site "name" here and not the IP address
-  h2o_hostconf_t *hostconf = h2o_config_register_host(&dsc->h2o_config, h2o_iovec_init(df->d_local.toString().c_str(), df->d_local.toString().size()), 65535);
-
-  for(const auto& url : df->d_urls) {
-    register_handler(hostconf, url.c_str(), doh_handler);
-  }
 
-  h2o_context_init(&dsc->h2o_ctx, h2o_evloop_create(), &dsc->h2o_config);
+  h2o_context_init(&threadCtx.h2o_ctx, h2o_evloop_create(), &dsc->h2o_config);
 
-  // in this complicated way we insert the DOHServerConfig pointer in there
-  h2o_vector_reserve(nullptr, &dsc->h2o_ctx.storage, 1);
-  dsc->h2o_ctx.storage.entries[0].data = dsc.get();
-  ++dsc->h2o_ctx.storage.size;
+  // in this complicated way we insert the DOHThreadContext pointer in there
+  h2o_vector_reserve(nullptr, &threadCtx.h2o_ctx.storage, 1);
+  threadCtx.h2o_ctx.storage.entries[0].data = &threadCtx;
+  ++threadCtx.h2o_ctx.storage.size;
 
-  auto sock = h2o_evloop_socket_create(dsc->h2o_ctx.loop, dsc->dohresponsepair[1], H2O_SOCKET_FLAG_DONT_READ);
-  sock->data = dsc.get();
+  auto sock = h2o_evloop_socket_create(threadCtx.h2o_ctx.loop, threadCtx.getWakeUpFD(), H2O_SOCKET_FLAG_DONT_READ);
+  sock->data = &threadCtx;
 
   // this listens to responses from dnsdist to turn into http responses
   h2o_socket_read_start(sock, on_dnsdist);
 
-  setupAcceptContext(*dsc->accept_ctx, *dsc, false);
-
-  if (create_listener(df->d_local, dsc, cs->tcpFD) != 0) {
+  if (create_listener(df->d_local, threadCtx, cs->tcpFD) != 0) {
     throw std::runtime_error("DOH server failed to listen on " + df->d_local.toStringWithPort() + ": " + strerror(errno));
   }
 
   bool stop = false;
   do {
-    int result = h2o_evloop_run(dsc->h2o_ctx.loop, INT32_MAX);
+    int result = h2o_evloop_run(threadCtx.h2o_ctx.loop, INT32_MAX);
     if (result == -1) {
       if (errno != EINTR) {
         errlog("Error in the DoH event loop: %s", strerror(errno));
@@ -1242,4 +1285,8 @@ void handleDOHTimeout(DOHUnit* oldDU)
 {
 }
 
+void queueDOHUnitResponse(DOHUnit* du)
+{
+}
+
 #endif /* HAVE_DNS_OVER_HTTPS */
@@ -0,0 +1,94 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "bpf-filter.hh"
+#include "misc.hh"
+
+BOOST_AUTO_TEST_SUITE(bpf_filter_cc)
+
+#ifdef HAVE_XDP_FILTER
+
+static XDPFilter::Entry makeEntry(uint32_t qps, uint32_t burst, const boost::optional<struct timespec>& until)
+{
+  XDPFilter::Entry entry;
+  entry.d_netmask = Netmask("192.0.2.0/24");
+  entry.d_until = until;
+  entry.d_qps = qps;
+  entry.d_burst = burst;
+  return entry;
+}
+
+BOOST_AUTO_TEST_CASE(test_XDPFilter_ShouldReplace_SameParameters) {
+  struct timespec sooner{1000, 0};
+  struct timespec later{2000, 0};
+
+  /* a block only gets its duration extended */
+  auto block = makeEntry(0, 0, sooner);
+  BOOST_CHECK(!XDPFilter::shouldReplace(block, 0, 0, later));
+  BOOST_REQUIRE(block.d_until);
+  BOOST_CHECK_EQUAL(block.d_until->tv_sec, later.tv_sec);
+  /* but never shortened */
+  BOOST_CHECK(!XDPFilter::shouldReplace(block, 0, 0, sooner));
+  BOOST_CHECK_EQUAL(block.d_until->tv_sec, later.tv_sec);
+
+  /* same for a rate-limit */
+  auto rateLimit = makeEntry(10, 20, sooner);
+  BOOST_CHECK(!XDPFilter::shouldReplace(rateLimit, 10, 20, later));
+  BOOST_REQUIRE(rateLimit.d_until);
+  BOOST_CHECK_EQUAL(rateLimit.d_until->tv_sec, later.tv_sec);
+  BOOST_CHECK(!XDPFilter::shouldReplace(rateLimit, 10, 20, sooner));
+  BOOST_CHECK_EQUAL(rateLimit.d_until->tv_sec, later.tv_sec);
+}
+
+BOOST_AUTO_TEST_CASE(test_XDPFilter_ShouldReplace_SwitchingModes) {
+  struct timespec sooner{1000, 0};
+  struct timespec later{2000, 0};
+
+  /* a block replaces a rate-limit, whichever expires first */
+  auto rateLimit = makeEntry(10, 10, later);
+  BOOST_CHECK(XDPFilter::shouldReplace(rateLimit, 0, 0, sooner));
+  rateLimit = makeEntry(10, 10, sooner);
+  BOOST_CHECK(XDPFilter::shouldReplace(rateLimit, 0, 0, later));
+
+  /* a rate-limit does not replace, nor extend, a block */
+  auto block = makeEntry(0, 0, sooner);
+  BOOST_CHECK(!XDPFilter::shouldReplace(block, 10, 10, later));
+  BOOST_REQUIRE(block.d_until);
+  BOOST_CHECK_EQUAL(block.d_until->tv_sec, sooner.tv_sec);
+  BOOST_CHECK_EQUAL(block.d_qps, 0U);
+  block = makeEntry(0, 0, later);
+  BOOST_CHECK(!XDPFilter::shouldReplace(block, 10, 10, sooner));
+  BOOST_CHECK_EQUAL(block.d_until->tv_sec, later.tv_sec);
+
+  /* a rate-limit with different parameters replaces the existing one */
+  rateLimit = makeEntry(10, 10, later);
+  BOOST_CHECK(XDPFilter::shouldReplace(rateLimit, 20, 20, sooner));
+  BOOST_CHECK(XDPFilter::shouldReplace(rateLimit, 10, 20, sooner));
+}
+
+BOOST_AUTO_TEST_CASE(test_XDPFilter_ShouldReplace_Static) {
+  struct timespec until{1000, 0};
+
+  /* a static entry is not overridden by a dynamic one, whatever the mode */
+  auto staticBlock = makeEntry(0, 0, boost::none);
+  BOOST_CHECK(!XDPFilter::shouldReplace(staticBlock, 0, 0, until));
+  BOOST_CHECK(!XDPFilter::shouldReplace(staticBlock, 10, 10, until));
+  BOOST_CHECK(!staticBlock.d_until);
+  auto staticRateLimit = makeEntry(10, 10, boost::none);
+  BOOST_CHECK(!XDPFilter::shouldReplace(staticRateLimit, 0, 0, until));
+  BOOST_CHECK(!staticRateLimit.d_until);
+
+  /* but a static entry replaces any existing one, switching modes included */
+  auto block = makeEntry(0, 0, until);
+  BOOST_CHECK(XDPFilter::shouldReplace(block, 10, 10, boost::none));
+  BOOST_CHECK(XDPFilter::shouldReplace(block, 0, 0, boost::none));
+  BOOST_CHECK(XDPFilter::shouldReplace(staticBlock, 10, 10, boost::none));
+  BOOST_CHECK(XDPFilter::shouldReplace(staticRateLimit, 0, 0, boost::none));
+}
+
+#endif /* HAVE_XDP_FILTER */
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,170 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist-compiled-rules.hh"
+#include "dnsdist-rules.hh"
+
+static void addRule(std::vector<DNSDistRuleAction>& rules, std::shared_ptr<DNSRule> rule)
+{
+  DNSDistRuleAction ra;
+  ra.d_rule = rule;
+  ra.d_creationOrder = rules.size();
+  rules.push_back(ra);
+}
+
+static std::vector<size_t> getMatches(const CompiledRuleSet& compiled, const DNSQuestion& dq, size_t stopAt = std::numeric_limits<size_t>::max())
+{
+  std::vector<size_t> result;
+  compiled.forEachMatch(dq, [&result, stopAt](size_t idx) {
+    result.push_back(idx);
+    return idx == stopAt;
+  });
+  return result;
+}
+
+static std::vector<size_t> getLinearMatches(const std::vector<DNSDistRuleAction>& rules, const DNSQuestion& dq)
+{
+  std::vector<size_t> result;
+  for (size_t idx = 0; idx < rules.size(); idx++) {
+    if (rules.at(idx).d_rule->matches(&dq)) {
+      result.push_back(idx);
+    }
+  }
+  return result;
+}
+
+static std::shared_ptr<DNSRule> makeNotQTypeRule(uint16_t qtype)
+{
+  std::shared_ptr<DNSRule> rule = std::make_shared<QTypeRule>(qtype);
+  return std::make_shared<NotRule>(rule);
+}
+
+struct TestQuery
+{
+  TestQuery(const std::string& name, uint16_t type, const std::string& remote, const std::string& local = "192.0.2.53:53"): qname(name), rem(remote), lc(local), dq(&qname, type, QClass::IN, qname.wirelength(), &lc, &rem, &dh, 0, 0, false, &queryTime)
+  {
+    memset(&dh, 0, sizeof(dh));
+  }
+
+  DNSName qname;
+  ComboAddress rem;
+  ComboAddress lc;
+  struct dnsheader dh;
+  struct timespec queryTime{0, 0};
+  DNSQuestion dq;
+};
+
+BOOST_AUTO_TEST_SUITE(test_dnsdistcompiledrules_cc)
+
+BOOST_AUTO_TEST_CASE(test_Indexing) {
+  std::vector<DNSDistRuleAction> rules;
+  SuffixMatchNode smn;
+  smn.add(DNSName("example.com."));
+  smn.add(DNSName("sub.example.com."));
+  addRule(rules, std::make_shared<SuffixMatchNodeRule>(smn));
+  addRule(rules, std::make_shared<QNameRule>(DNSName("www.powerdns.com.")));
+  NetmaskGroup nmg;
+  nmg.addMask("192.0.2.0/24");
+  nmg.addMask("!192.0.2.128/25");
+  nmg.addMask("2001:db8::/32");
+  addRule(rules, std::make_shared<NetmaskGroupRule>(nmg, true));
+  addRule(rules, std::make_shared<QTypeRule>(QType::AAAA));
+  auto generic = makeNotQTypeRule(QType::A);
+  addRule(rules, generic);
+  addRule(rules, std::make_shared<AllRule>());
+
+  CompiledRuleSet compiled(rules);
+  BOOST_CHECK_EQUAL(compiled.size(), rules.size());
+  BOOST_CHECK_EQUAL(compiled.getNumberOfIndexedRules(), rules.size() - 1);
+  BOOST_CHECK(!CompiledRuleSet::isIndexable(*generic));
+
+  {
+    TestQuery query("WWW.Sub.Example.COM.", QType::A, "192.0.2.1");
+    BOOST_CHECK(getMatches(compiled, query.dq) == std::vector<size_t>({ 0, 2, 5 }));
+    /* the visitor stops the processing */
+    BOOST_CHECK(getMatches(compiled, query.dq, 2) == std::vector<size_t>({ 0, 2 }));
+  }
+
+  {
+    TestQuery query("www.powerdns.com.", QType::AAAA, "192.0.2.200");
+    BOOST_CHECK(getMatches(compiled, query.dq) == std::vector<size_t>({ 1, 3, 4, 5 }));
+  }
+
+  {
+    /* exact match only */
+    TestQuery query("a.www.powerdns.com.", QType::AAAA, "[2001:db8::1]:42");
+    BOOST_CHECK(getMatches(compiled, query.dq) == std::vector<size_t>({ 2, 3, 4, 5 }));
+  }
+
+  /* only the generic rule has been evaluated, and not when the processing stopped before it */
+  BOOST_CHECK_EQUAL(generic->d_evaluations, 3U);
+  for (const auto& ra : rules) {
+    if (ra.d_rule != generic) {
+      BOOST_CHECK_EQUAL(ra.d_rule->d_evaluations, 0U);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_SameAsLinear) {
+  std::vector<DNSDistRuleAction> rules;
+  const std::vector<std::string> names = { ".", "com.", "example.com.", "www.example.com.", "example.net.", "a.b.example.net.", "powerdns.org." };
+  const std::vector<std::string> masks = { "0.0.0.0/0", "10.0.0.0/8", "10.1.0.0/16", "10.1.2.0/24", "10.1.2.3/32", "::/0", "2001:db8::/32", "2001:db8:1::/48" };
+  const std::vector<uint16_t> qtypes = { QType::A, QType::AAAA, QType::MX, QType::ANY };
+
+  for (size_t idx = 0; idx < 200; idx++) {
+    switch (random() % 6) {
+    case 0:
+      addRule(rules, std::make_shared<QNameRule>(DNSName(names.at(random() % names.size()))));
+      break;
+    case 1: {
+      DNSNameSet set;
+      set.insert(DNSName(names.at(random() % names.size())));
+      set.insert(DNSName(names.at(random() % names.size())));
+      addRule(rules, std::make_shared<QNameSetRule>(set));
+      break;
+    }
+    case 2: {
+      SuffixMatchNode smn;
+      smn.add(DNSName(names.at(random() % names.size())));
+      smn.add(DNSName(names.at(random() % names.size())));
+      addRule(rules, std::make_shared<SuffixMatchNodeRule>(smn));
+      break;
+    }
+    case 3: {
+      NetmaskGroup nmg;
+      for (size_t count = 0; count < 3; count++) {
+        nmg.addMask((random() % 2 ? "!" : "") + masks.at(random() % masks.size()));
+      }
+      addRule(rules, std::make_shared<NetmaskGroupRule>(nmg, random() % 2));
+      break;
+    }
+    case 4:
+      addRule(rules, std::make_shared<QTypeRule>(qtypes.at(random() % qtypes.size())));
+      break;
+    default:
+      addRule(rules, makeNotQTypeRule(qtypes.at(random() % qtypes.size())));
+      break;
+    }
+  }
+
+  CompiledRuleSet compiled(rules);
+
+  const std::vector<std::string> qnames = { ".", "com.", "COM.", "example.com.", "www.Example.com.", "a.www.example.com.", "example.net.", "b.example.net.", "a.B.example.net.", "x.a.b.example.net.", "powerdns.com.", "powerdns.org." };
+  const std::vector<std::string> addresses = { "10.1.2.3", "10.1.2.4", "10.1.3.1", "10.2.0.1", "192.0.2.1", "[2001:db8::1]:53", "[2001:db8:1::1]:53", "[2001:db9::1]:53" };
+
+  for (const auto& qname : qnames) {
+    for (const auto qtype : qtypes) {
+      for (const auto& remote : addresses) {
+        for (const auto& local : addresses) {
+          TestQuery query(qname, qtype, remote, local);
+          BOOST_CHECK(getMatches(compiled, query.dq) == getLinearMatches(rules, query.dq));
+        }
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,7 @@
 Rings g_rings;
 GlobalStateHolder<NetmaskTree<DynBlock>> g_dynblockNMG;
 GlobalStateHolder<SuffixMatchTree<DynBlock>> g_dynblockSMT;
+DNSAction::Action g_dynBlockAction = DNSAction::Action::Drop;
 
 BOOST_AUTO_TEST_SUITE(dnsdistdynblocks_hh)
 
@@ -544,4 +545,122 @@ BOOST_AUTO_TEST_CASE(test_DynBlockRulesGroup_Ranges) {
 
 }
 
+BOOST_AUTO_TEST_CASE(test_DynBlockRulesGroup_Sketches) {
+  dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  DNSName qname("rings.powerdns.com.");
+  ComboAddress requestor1("192.0.2.1");
+  ComboAddress requestor2("192.0.2.2");
+  ComboAddress backend("192.0.2.42");
+  uint16_t qtype = QType::AAAA;
+  uint16_t size = 42;
+  unsigned int responseTime = 100 * 1000; /* 100ms */
+  struct timespec now;
+  gettime(&now);
+  NetmaskTree<DynBlock> emptyNMG;
+
+  size_t numberOfSeconds = 10;
+  size_t blockDuration = 60;
+  const auto action = DNSAction::Action::Drop;
+  const std::string reason = "Exceeded rate";
+
+  g_rings.enableSketches(16, numberOfSeconds);
+  BOOST_REQUIRE(g_rings.getSketches() != nullptr);
+
+  DynBlockRulesGroup dbrg;
+  dbrg.setQuiet(true);
+
+  /* block above 50 qps, 50 ServFail/s and 5000 bytes/s for numberOfSeconds seconds, no warning */
+  dbrg.setQueryRate(50, 0, numberOfSeconds, reason, blockDuration, action);
+  dbrg.setRCodeRate(RCode::ServFail, 50, 0, numberOfSeconds, reason, blockDuration, action);
+  dbrg.setResponseByteRate(5000, 0, numberOfSeconds, reason, blockDuration, action);
+
+  {
+    /* 45 qps from a given client over the last 10s, spread over 10 seconds,
+       along with a lot of light clients filling the sketches */
+    g_rings.clear();
+    g_dynblockNMG.setState(emptyNMG);
+
+    for (size_t second = 0; second < numberOfSeconds; second++) {
+      struct timespec when = now;
+      when.tv_sec -= second;
+      for (size_t idx = 0; idx < 45; idx++) {
+        g_rings.insertQuery(when, requestor1, qname, qtype, size, dh);
+      }
+      for (uint16_t idx = 0; idx < 100; idx++) {
+        ComboAddress light("198.51.100.0");
+        light.sin4.sin_addr.s_addr = htonl(ntohl(light.sin4.sin_addr.s_addr) + idx);
+        g_rings.insertQuery(when, light, qname, qtype, size, dh);
+      }
+    }
+
+    dbrg.apply(now);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 0U);
+  }
+
+  {
+    /* just above 50 qps from a given client in the last 10s, still with a lot of light clients */
+    g_rings.clear();
+    g_dynblockNMG.setState(emptyNMG);
+
+    for (size_t second = 0; second < numberOfSeconds; second++) {
+      struct timespec when = now;
+      when.tv_sec -= second;
+      for (size_t idx = 0; idx < (second == 0 ? 51 : 50); idx++) {
+        g_rings.insertQuery(when, requestor1, qname, qtype, size, dh);
+      }
+      for (uint16_t idx = 0; idx < 100; idx++) {
+        ComboAddress light("198.51.100.0");
+        light.sin4.sin_addr.s_addr = htonl(ntohl(light.sin4.sin_addr.s_addr) + idx);
+        g_rings.insertQuery(when, light, qname, qtype, size, dh);
+      }
+    }
+
+    dbrg.apply(now);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 1U);
+    BOOST_CHECK(g_dynblockNMG.getLocal()->lookup(requestor1) != nullptr);
+    const auto& block = g_dynblockNMG.getLocal()->lookup(requestor1)->second;
+    BOOST_CHECK_EQUAL(block.reason, reason);
+    BOOST_CHECK_EQUAL(static_cast<size_t>(block.until.tv_sec), now.tv_sec + blockDuration);
+    BOOST_CHECK(block.action == action);
+  }
+
+  {
+    /* just above 50 ServFail/s from one client, and 5001 bytes/s from another one */
+    g_rings.clear();
+    g_dynblockNMG.setState(emptyNMG);
+
+    dh.rcode = RCode::ServFail;
+    for (size_t idx = 0; idx < 50 * numberOfSeconds + 1; idx++) {
+      g_rings.insertResponse(now, requestor1, qname, qtype, responseTime, 1, dh, backend);
+    }
+    dh.rcode = RCode::NoError;
+    g_rings.insertResponse(now, requestor2, qname, qtype, responseTime, 5000 * numberOfSeconds + 1, dh, backend);
+
+    dbrg.apply(now);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 2U);
+    BOOST_CHECK(g_dynblockNMG.getLocal()->lookup(requestor1) != nullptr);
+    BOOST_CHECK(g_dynblockNMG.getLocal()->lookup(requestor2) != nullptr);
+  }
+
+  {
+    /* entries older than the rule's period are not taken into account */
+    g_rings.clear();
+    g_dynblockNMG.setState(emptyNMG);
+
+    struct timespec old = now;
+    old.tv_sec -= numberOfSeconds + 1;
+    for (size_t idx = 0; idx < 50 * numberOfSeconds + 1; idx++) {
+      g_rings.insertQuery(old, requestor1, qname, qtype, size, dh);
+    }
+
+    dbrg.apply(now);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 0U);
+  }
+
+  g_rings.clear();
+  g_rings.enableSketches(0, 0);
+  BOOST_CHECK(g_rings.getSketches() == nullptr);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
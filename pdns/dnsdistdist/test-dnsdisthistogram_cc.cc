@@ -0,0 +1,119 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist-histogram.hh"
+
+BOOST_AUTO_TEST_SUITE(test_dnsdisthistogram_cc)
+
+BOOST_AUTO_TEST_CASE(test_Buckets) {
+  /* every value lands in a bucket whose bounds contain it, the buckets are contiguous
+     and the relative error stays within the configured precision */
+  size_t previousIdx = 0;
+  for (uint64_t value = 0; value < (static_cast<uint64_t>(1) << LatencyHistogram::s_maxExponent); value += 1 + value / 1000) {
+    const size_t idx = LatencyHistogram::getBucketIndex(value);
+    BOOST_REQUIRE_LT(idx, LatencyHistogram::s_numberOfBuckets);
+    BOOST_REQUIRE_GE(idx, previousIdx);
+    BOOST_REQUIRE_LE(LatencyHistogram::getBucketLowerBound(idx), value);
+    BOOST_REQUIRE_GE(LatencyHistogram::getBucketHighestValue(idx), value);
+    const uint64_t width = LatencyHistogram::getBucketHighestValue(idx) - LatencyHistogram::getBucketLowerBound(idx);
+    BOOST_REQUIRE_LE(width * LatencyHistogram::s_subBucketCount, value);
+    previousIdx = idx;
+  }
+
+  for (size_t idx = 1; idx < LatencyHistogram::s_numberOfBuckets; idx++) {
+    BOOST_REQUIRE_EQUAL(LatencyHistogram::getBucketLowerBound(idx), LatencyHistogram::getBucketHighestValue(idx - 1) + 1);
+  }
+
+  BOOST_CHECK_EQUAL(LatencyHistogram::getBucketIndex(0), 0U);
+  BOOST_CHECK_EQUAL(LatencyHistogram::getBucketIndex(std::numeric_limits<uint64_t>::max()), LatencyHistogram::s_numberOfBuckets - 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_Percentiles) {
+  LatencyHistogram histo;
+  auto snapshot = histo.getSnapshot();
+  BOOST_CHECK_EQUAL(snapshot.getCount(), 0U);
+  BOOST_CHECK_EQUAL(snapshot.getPercentile(99), 0U);
+
+  /* 1 to 10000 usec */
+  for (uint64_t value = 1; value <= 10000; value++) {
+    histo.record(value);
+  }
+
+  snapshot = histo.getSnapshot();
+  BOOST_CHECK_EQUAL(snapshot.getCount(), 10000U);
+  BOOST_CHECK_EQUAL(snapshot.getSum(), 10000U * 10001U / 2);
+
+  for (const double percentile : { 1.0, 50.0, 90.0, 99.0, 99.9 }) {
+    const double expected = percentile * 100;
+    const double got = snapshot.getPercentile(percentile);
+    BOOST_CHECK_GE(got, expected);
+    BOOST_CHECK_LE(got, expected * (1.0 + 1.0 / LatencyHistogram::s_subBucketCount));
+  }
+  BOOST_CHECK_EQUAL(snapshot.getPercentile(0), 1U);
+  BOOST_CHECK_GE(snapshot.getPercentile(100), 10000U);
+
+  BOOST_CHECK_EQUAL(snapshot.getCountUpTo(0), 0U);
+  BOOST_CHECK_EQUAL(snapshot.getCountUpTo(63), 63U);
+  BOOST_CHECK_LE(snapshot.getCountUpTo(1000), 1000U);
+  BOOST_CHECK_GE(snapshot.getCountUpTo(1000), 1000U - 1000U / LatencyHistogram::s_subBucketCount);
+  BOOST_CHECK_EQUAL(snapshot.getCountUpTo(1000000), 10000U);
+
+  /* the tail is not hidden by the bulk of the values */
+  for (size_t idx = 0; idx < 500; idx++) {
+    histo.record(2000000);
+  }
+  const auto withTail = histo.getSnapshot();
+  BOOST_CHECK_GE(withTail.getPercentile(99), 2000000U);
+  BOOST_CHECK_LE(withTail.getPercentile(50), 6000U);
+
+  /* only what has been recorded since the first snapshot */
+  const auto delta = withTail.getDelta(snapshot);
+  BOOST_CHECK_EQUAL(delta.getCount(), 500U);
+  BOOST_CHECK_EQUAL(delta.getSum(), 500U * 2000000U);
+  BOOST_CHECK_GE(delta.getPercentile(1), 2000000U);
+
+  LatencyHistogram::Snapshot merged;
+  merged.add(snapshot);
+  merged.add(delta);
+  BOOST_CHECK_EQUAL(merged.getCount(), withTail.getCount());
+  BOOST_CHECK_EQUAL(merged.getSum(), withTail.getSum());
+  BOOST_CHECK_EQUAL(merged.getPercentile(99), withTail.getPercentile(99));
+}
+
+BOOST_AUTO_TEST_CASE(test_Concurrent) {
+  LatencyHistogram histo;
+  const size_t numberOfThreads = 8;
+  const size_t perThread = 100000;
+
+  std::vector<std::thread> threads;
+  for (size_t idx = 0; idx < numberOfThreads; idx++) {
+    threads.push_back(std::thread([&histo, idx]() {
+      for (size_t count = 0; count < perThread; count++) {
+        histo.record(idx * 1024 + count % 1024);
+      }
+    }));
+  }
+
+  /* reading while the other threads are recording */
+  uint64_t previousCount = 0;
+  for (size_t idx = 0; idx < 10; idx++) {
+    const auto snapshot = histo.getSnapshot();
+    BOOST_CHECK_GE(snapshot.getCount(), previousCount);
+    previousCount = snapshot.getCount();
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  const auto snapshot = histo.getSnapshot();
+  BOOST_CHECK_EQUAL(snapshot.getCount(), numberOfThreads * perThread);
+  BOOST_CHECK_EQUAL(snapshot.getCountUpTo(1023), perThread);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
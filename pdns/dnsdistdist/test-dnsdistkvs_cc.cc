@@ -309,4 +309,117 @@ BOOST_AUTO_TEST_CASE(test_CDB) {
 }
 #endif /* HAVE_CDB */
 
+BOOST_AUTO_TEST_CASE(test_PerfectHash) {
+
+  DNSName qname("powerdns.com.");
+  DNSName plaintextDomain("powerdns.org.");
+  uint16_t qtype = QType::A;
+  uint16_t qclass = QClass::IN;
+  ComboAddress lc("192.0.2.1:53");
+  ComboAddress rem("192.0.2.128:42");
+  struct dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  size_t bufferSize = 0;
+  size_t queryLen = 0;
+  bool isTcp = false;
+  struct timespec queryRealTime;
+  gettime(&queryRealTime, true);
+
+  DNSQuestion dq(&qname, qtype, qclass, qname.wirelength(), &lc, &rem, &dh, bufferSize, queryLen, isTcp, &queryRealTime);
+
+  char db[] = "/tmp/test_phkvs.XXXXXX";
+  {
+    int fd = mkstemp(db);
+    BOOST_REQUIRE(fd >= 0);
+    close(fd);
+    PerfectHashDBWriter writer(PerfectHashDB::s_flagNameKeys);
+    writer.addEntry(std::string(reinterpret_cast<const char*>(&rem.sin4.sin_addr.s_addr), sizeof(rem.sin4.sin_addr.s_addr)), "this is the value for the remote addr");
+    writer.addEntry(qname.toDNSStringLC(), "this is the value for the qname");
+    writer.addEntry(plaintextDomain.toStringRootDot(), "this is the value for the plaintext domain");
+    writer.addEntry(g_rootdnsname.toDNSStringLC(), "this is the value for the root");
+    /* the first value is kept */
+    writer.addEntry(qname.toDNSStringLC(), "this is a duplicate");
+    BOOST_CHECK_EQUAL(writer.write(db), 1U);
+  }
+
+  auto phkvs = std::unique_ptr<KeyValueStore>(new PerfectHashKVStore(db, 0));
+  doKVSChecks(phkvs, lc, rem, dq, plaintextDomain);
+
+  /* destroying another store drops its database from the cache of this thread, without affecting ours */
+  {
+    PerfectHashKVStore other(db, 0);
+    BOOST_CHECK(other.keyExists(qname.toDNSStringLC()));
+  }
+  BOOST_CHECK(phkvs->keyExists(qname.toDNSStringLC()));
+
+  /* suffix lookups done directly by the store should give the same results than the generic ones */
+  {
+    const DNSName subdomain = DNSName("sub.SUB") + qname;
+    std::string value;
+    KeyValueLookupKeySuffix lookupKey(0, true);
+    BOOST_CHECK(lookupKey.lookup(*phkvs, subdomain, &value));
+    BOOST_CHECK_EQUAL(value, "this is the value for the qname");
+    BOOST_CHECK(lookupKey.lookup(*phkvs, subdomain, nullptr));
+    BOOST_CHECK(!lookupKey.lookup(*phkvs, DNSName("not-powerdns.com."), nullptr));
+    BOOST_CHECK(!lookupKey.lookup(*phkvs, DNSName("com."), nullptr));
+    BOOST_CHECK(!lookupKey.lookup(*phkvs, g_rootdnsname, nullptr));
+    /* the root is not one of the suffixes looked up, even with minLabels set to 0 */
+    for (const auto& key : lookupKey.getKeys(DNSName("not-powerdns.com."))) {
+      BOOST_CHECK(key != g_rootdnsname.toDNSStringLC());
+    }
+
+    /* at least 3 labels, so powerdns.com is never looked up */
+    KeyValueLookupKeySuffix threeLabels(3, true);
+    BOOST_CHECK(!threeLabels.lookup(*phkvs, subdomain, nullptr));
+    /* at least 2 labels */
+    KeyValueLookupKeySuffix twoLabels(2, true);
+    BOOST_CHECK(twoLabels.lookup(*phkvs, subdomain, nullptr));
+    BOOST_CHECK(twoLabels.lookup(*phkvs, qname, nullptr));
+
+    /* plain text lookups are not done by the store itself */
+    KeyValueLookupKeySuffix plaintext(0, false);
+    value.clear();
+    BOOST_CHECK(plaintext.lookup(*phkvs, DNSName("sub") + plaintextDomain, &value));
+    BOOST_CHECK_EQUAL(value, "this is the value for the plaintext domain");
+  }
+
+  /* replace the database with a larger one and reload it */
+  {
+    PerfectHashDBWriter writer;
+    for (size_t idx = 0; idx < 10000; idx++) {
+      writer.addEntry(std::to_string(idx), "value " + std::to_string(idx));
+    }
+    BOOST_CHECK_EQUAL(writer.write(db), 0U);
+  }
+
+  BOOST_CHECK(phkvs->reload());
+  for (size_t idx = 0; idx < 10000; idx++) {
+    std::string value;
+    BOOST_REQUIRE(phkvs->getValue(std::to_string(idx), value));
+    BOOST_CHECK_EQUAL(value, "value " + std::to_string(idx));
+  }
+  BOOST_CHECK(!phkvs->keyExists("10000"));
+  BOOST_CHECK(!phkvs->keyExists(qname.toDNSStringLC()));
+
+  /* empty database */
+  {
+    PerfectHashDBWriter writer;
+    BOOST_CHECK_EQUAL(writer.write(db), 0U);
+  }
+  BOOST_CHECK(phkvs->reload());
+  BOOST_CHECK(!phkvs->keyExists("0"));
+
+  /* an invalid database is refused, and the existing one is kept */
+  {
+    FILE* fp = fopen(db, "w");
+    BOOST_REQUIRE(fp != nullptr);
+    fputs("not a database", fp);
+    fclose(fp);
+  }
+  BOOST_CHECK(!phkvs->reload());
+  BOOST_CHECK_THROW(PerfectHashDB invalid(db), std::runtime_error);
+
+  unlink(db);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,134 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist-maglev.hh"
+
+BOOST_AUTO_TEST_SUITE(test_dnsdistmaglev_cc)
+
+static std::vector<MaglevTable::Backend> getBackends(size_t count, uint32_t firstSeed = 0, uint32_t weight = 1)
+{
+  std::vector<MaglevTable::Backend> backends;
+  for (size_t idx = 0; idx < count; idx++) {
+    backends.push_back({static_cast<uint32_t>(firstSeed + idx), weight});
+  }
+  return backends;
+}
+
+BOOST_AUTO_TEST_CASE(test_Distribution) {
+  const size_t numberOfBackends = 60;
+  MaglevTable table(getBackends(numberOfBackends));
+  BOOST_CHECK_EQUAL(table.size(), 65537U);
+  BOOST_CHECK_EQUAL(table.getNumberOfBackends(), numberOfBackends);
+
+  const auto distribution = table.getDistribution();
+  BOOST_REQUIRE_EQUAL(distribution.size(), numberOfBackends);
+  const double expected = 65537.0 / numberOfBackends;
+  for (const auto count : distribution) {
+    /* Maglev guarantees that the difference between two backends is at most one slot per turn */
+    BOOST_CHECK_GE(count, expected - 1);
+    BOOST_CHECK_LE(count, expected + 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_Weights) {
+  auto backends = getBackends(3);
+  backends.at(0).weight = 2;
+  MaglevTable table(backends, 1009);
+
+  const auto distribution = table.getDistribution();
+  BOOST_REQUIRE_EQUAL(distribution.size(), 3U);
+  BOOST_CHECK_GE(distribution.at(0), 2 * distribution.at(1) - 2);
+  BOOST_CHECK_LE(distribution.at(0), 2 * distribution.at(1) + 2);
+  BOOST_CHECK_EQUAL(distribution.at(0) + distribution.at(1) + distribution.at(2), 1009U);
+
+  /* a weight larger than the table must not let a backend claim every slot in a single turn */
+  auto heavy = getBackends(3);
+  heavy.at(0).weight = 2000;
+  heavy.at(1).weight = 1000;
+  heavy.at(2).weight = 1000;
+  MaglevTable heavyTable(heavy, 1009);
+  const auto heavyDistribution = heavyTable.getDistribution();
+  BOOST_REQUIRE_EQUAL(heavyDistribution.size(), 3U);
+  BOOST_CHECK_GE(heavyDistribution.at(0), 503U);
+  BOOST_CHECK_LE(heavyDistribution.at(0), 506U);
+  BOOST_CHECK_GE(heavyDistribution.at(1), 251U);
+  BOOST_CHECK_GE(heavyDistribution.at(2), 251U);
+
+  /* no weight at all, nothing can be selected */
+  MaglevTable empty(getBackends(3, 0, 0), 1009);
+  BOOST_CHECK_EQUAL(empty.lookup(42, [](size_t) { return true; }), MaglevTable::npos);
+  MaglevTable none(std::vector<MaglevTable::Backend>(), 1009);
+  BOOST_CHECK_EQUAL(none.lookup(42, [](size_t) { return true; }), MaglevTable::npos);
+
+  /* not a prime number, every slot should still be assigned */
+  MaglevTable notPrime(getBackends(7), 1000);
+  const auto notPrimeDistribution = notPrime.getDistribution();
+  size_t total = 0;
+  for (const auto count : notPrimeDistribution) {
+    total += count;
+  }
+  BOOST_CHECK_EQUAL(total, 1000U);
+}
+
+BOOST_AUTO_TEST_CASE(test_MinimalDisruption) {
+  const size_t numberOfBackends = 60;
+  const auto backends = getBackends(numberOfBackends);
+  MaglevTable table(backends);
+  const auto always = [](size_t) { return true; };
+
+  /* the same hash always goes to the same backend */
+  for (uint32_t hash = 0; hash < 1000; hash++) {
+    BOOST_CHECK_EQUAL(table.lookup(hash, always), MaglevTable(backends).lookup(hash, always));
+  }
+
+  /* backend 10 is down: only its hashes move, and they are spread over the other ones */
+  const size_t down = 10;
+  const auto notDown = [down](size_t idx) { return idx != down; };
+  std::vector<size_t> moved(numberOfBackends, 0);
+  size_t movedCount = 0;
+  const uint32_t numberOfHashes = 100000;
+  for (uint32_t hash = 0; hash < numberOfHashes; hash++) {
+    const auto before = table.lookup(hash * 2654435761U, always);
+    const auto after = table.lookup(hash * 2654435761U, notDown);
+    BOOST_REQUIRE(after != MaglevTable::npos);
+    BOOST_CHECK(after != down);
+    if (before != down) {
+      BOOST_CHECK_EQUAL(before, after);
+    }
+    else {
+      moved.at(after)++;
+      movedCount++;
+    }
+  }
+  BOOST_CHECK_GT(movedCount, 0U);
+  BOOST_CHECK_LT(movedCount, 2 * numberOfHashes / numberOfBackends);
+  size_t receivers = 0;
+  for (const auto count : moved) {
+    if (count > 0) {
+      receivers++;
+    }
+  }
+  BOOST_CHECK_GT(receivers, numberOfBackends / 2);
+
+  /* removing the last backend from the table only moves a small fraction of the hashes */
+  MaglevTable smaller(getBackends(numberOfBackends - 1));
+  size_t changed = 0;
+  for (uint32_t hash = 0; hash < numberOfHashes; hash++) {
+    const auto before = table.lookup(hash * 2654435761U, always);
+    const auto after = smaller.lookup(hash * 2654435761U, always);
+    if (before != numberOfBackends - 1 && before != after) {
+      changed++;
+    }
+  }
+  BOOST_CHECK_LT(changed, numberOfHashes / 50);
+
+  /* nothing usable */
+  BOOST_CHECK_EQUAL(table.lookup(42, [](size_t) { return false; }), MaglevTable::npos);
+
+  BOOST_CHECK_THROW(MaglevTable(backends, 1), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,262 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "dnsdist-packetring.hh"
+
+#ifdef HAVE_PACKET_RING
+
+static std::vector<uint8_t> buildUDPFrame(const ComboAddress& from, const ComboAddress& to, const std::string& payload, uint16_t vlanTCI = 0)
+{
+  std::vector<uint8_t> frame;
+  const uint8_t dstMAC[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+  const uint8_t srcMAC[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+  frame.insert(frame.end(), dstMAC, dstMAC + sizeof(dstMAC));
+  frame.insert(frame.end(), srcMAC, srcMAC + sizeof(srcMAC));
+  if (vlanTCI != 0) {
+    frame.push_back(0x81);
+    frame.push_back(0x00);
+    frame.push_back(vlanTCI >> 8);
+    frame.push_back(vlanTCI & 0xff);
+  }
+
+  const uint16_t udpLen = 8 + payload.size();
+  if (from.isIPv4()) {
+    frame.push_back(0x08);
+    frame.push_back(0x00);
+    const uint16_t totalLen = 20 + udpLen;
+    const uint8_t ipHeader[] = { 0x45, 0x00, static_cast<uint8_t>(totalLen >> 8), static_cast<uint8_t>(totalLen & 0xff), 0x00, 0x00, 0x40, 0x00, 64, 17, 0x00, 0x00 };
+    frame.insert(frame.end(), ipHeader, ipHeader + sizeof(ipHeader));
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(&from.sin4.sin_addr.s_addr);
+    const uint8_t* dst = reinterpret_cast<const uint8_t*>(&to.sin4.sin_addr.s_addr);
+    frame.insert(frame.end(), src, src + 4);
+    frame.insert(frame.end(), dst, dst + 4);
+  }
+  else {
+    frame.push_back(0x86);
+    frame.push_back(0xdd);
+    const uint8_t ipHeader[] = { 0x60, 0x00, 0x00, 0x00, static_cast<uint8_t>(udpLen >> 8), static_cast<uint8_t>(udpLen & 0xff), 17, 64 };
+    frame.insert(frame.end(), ipHeader, ipHeader + sizeof(ipHeader));
+    const uint8_t* src = from.sin6.sin6_addr.s6_addr;
+    const uint8_t* dst = to.sin6.sin6_addr.s6_addr;
+    frame.insert(frame.end(), src, src + 16);
+    frame.insert(frame.end(), dst, dst + 16);
+  }
+
+  const uint8_t* srcPort = reinterpret_cast<const uint8_t*>(&from.sin4.sin_port);
+  const uint8_t* dstPort = reinterpret_cast<const uint8_t*>(&to.sin4.sin_port);
+  frame.insert(frame.end(), srcPort, srcPort + 2);
+  frame.insert(frame.end(), dstPort, dstPort + 2);
+  frame.push_back(udpLen >> 8);
+  frame.push_back(udpLen & 0xff);
+  /* no checksum */
+  frame.push_back(0);
+  frame.push_back(0);
+  frame.insert(frame.end(), payload.begin(), payload.end());
+
+  return frame;
+}
+
+static uint16_t computeChecksum(const uint8_t* data, size_t len, uint32_t sum = 0)
+{
+  for (size_t idx = 0; idx + 1 < len; idx += 2) {
+    sum += (static_cast<uint16_t>(data[idx]) << 8) | data[idx + 1];
+  }
+  if (len % 2) {
+    sum += static_cast<uint16_t>(data[len - 1]) << 8;
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum & 0xffff;
+}
+
+/* the classic BPF filters apply to any socket, so we can check what goes through over a socket pair */
+static bool passesFrameFilter(const std::vector<uint8_t>& frame, uint16_t port)
+{
+  int fds[2];
+  BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds), 0);
+  PacketRingFrontend::attachFrameFilter(fds[1], port);
+  BOOST_REQUIRE_EQUAL(send(fds[0], frame.data(), frame.size(), 0), static_cast<ssize_t>(frame.size()));
+  std::vector<uint8_t> received(frame.size() + 1);
+  ssize_t got = recv(fds[1], received.data(), received.size(), MSG_DONTWAIT);
+  close(fds[0]);
+  close(fds[1]);
+  return got == static_cast<ssize_t>(frame.size());
+}
+
+BOOST_AUTO_TEST_SUITE(test_dnsdistpacketring_cc)
+
+BOOST_AUTO_TEST_CASE(test_ParseAndBuildIPv4) {
+  const ComboAddress local("192.0.2.1:53");
+  const ComboAddress remote("192.0.2.42:4242");
+  const std::string payload("this is the query");
+  const std::string response("this is the response, a bit larger");
+
+  auto frame = buildUDPFrame(remote, local, payload);
+  /* Ethernet padding should be ignored */
+  frame.resize(frame.size() + 6, 0);
+
+  PacketRingFrontend::Query query;
+  BOOST_REQUIRE(PacketRingFrontend::parseFrame(frame.data(), frame.size(), local, query));
+  BOOST_CHECK_EQUAL(query.remote.toStringWithPort(), remote.toStringWithPort());
+  BOOST_CHECK_EQUAL(query.local.toStringWithPort(), local.toStringWithPort());
+  BOOST_CHECK(!query.hasVLAN);
+  BOOST_REQUIRE_EQUAL(query.payloadLen, payload.size());
+  BOOST_CHECK_EQUAL(std::string(reinterpret_cast<const char*>(query.payload), query.payloadLen), payload);
+
+  /* an ANY address matches as well */
+  BOOST_CHECK(PacketRingFrontend::parseFrame(frame.data(), frame.size(), ComboAddress("0.0.0.0:53"), query));
+  /* but not a different address, port or family */
+  BOOST_CHECK(!PacketRingFrontend::parseFrame(frame.data(), frame.size(), ComboAddress("192.0.2.2:53"), query));
+  BOOST_CHECK(!PacketRingFrontend::parseFrame(frame.data(), frame.size(), ComboAddress("192.0.2.1:5353"), query));
+  BOOST_CHECK(!PacketRingFrontend::parseFrame(frame.data(), frame.size(), ComboAddress("[::]:53"), query));
+  /* truncated */
+  BOOST_CHECK(!PacketRingFrontend::parseFrame(frame.data(), 14 + 20 + 8 + payload.size() - 1, local, query));
+
+  BOOST_REQUIRE(PacketRingFrontend::parseFrame(frame.data(), frame.size(), local, query));
+
+  std::vector<uint8_t> out(1500);
+  /* too small */
+  BOOST_CHECK_EQUAL(PacketRingFrontend::buildResponseFrame(query, response.data(), response.size(), out.data(), 14 + 20 + 8 + response.size() - 1), 0U);
+  size_t outLen = PacketRingFrontend::buildResponseFrame(query, response.data(), response.size(), out.data(), out.size());
+  BOOST_REQUIRE_EQUAL(outLen, 14 + 20 + 8 + response.size());
+
+  /* the MAC addresses have been swapped */
+  BOOST_CHECK(memcmp(out.data(), frame.data() + 6, 6) == 0);
+  BOOST_CHECK(memcmp(out.data() + 6, frame.data(), 6) == 0);
+  /* valid IP header checksum */
+  BOOST_CHECK_EQUAL(computeChecksum(out.data() + 14, 20), 0);
+  /* valid UDP checksum, including the pseudo-header */
+  uint32_t pseudo = 17 + 8 + response.size();
+  pseudo += (computeChecksum(out.data() + 14 + 12, 8) ^ 0xffff);
+  BOOST_CHECK_EQUAL(computeChecksum(out.data() + 14 + 20, 8 + response.size(), pseudo), 0);
+
+  /* and it's a valid frame from the local address to the remote one */
+  PacketRingFrontend::Query parsedResponse;
+  BOOST_REQUIRE(PacketRingFrontend::parseFrame(out.data(), outLen, remote, parsedResponse));
+  BOOST_CHECK_EQUAL(parsedResponse.remote.toStringWithPort(), local.toStringWithPort());
+  BOOST_CHECK_EQUAL(parsedResponse.local.toStringWithPort(), remote.toStringWithPort());
+  BOOST_CHECK_EQUAL(std::string(reinterpret_cast<const char*>(parsedResponse.payload), parsedResponse.payloadLen), response);
+}
+
+BOOST_AUTO_TEST_CASE(test_ParseAndBuildIPv6VLAN) {
+  const ComboAddress local("[2001:db8::1]:53");
+  const ComboAddress remote("[2001:db8::42]:4242");
+  const std::string payload("this is the query");
+  const std::string response("this is the response");
+
+  auto frame = buildUDPFrame(remote, local, payload, 42);
+
+  PacketRingFrontend::Query query;
+  BOOST_REQUIRE(PacketRingFrontend::parseFrame(frame.data(), frame.size(), ComboAddress("[::]:53"), query));
+  BOOST_CHECK_EQUAL(query.remote.toStringWithPort(), remote.toStringWithPort());
+  BOOST_CHECK_EQUAL(query.local.toStringWithPort(), local.toStringWithPort());
+  BOOST_CHECK(query.hasVLAN);
+  BOOST_CHECK_EQUAL(query.vlanTCI, 42);
+  BOOST_CHECK_EQUAL(std::string(reinterpret_cast<const char*>(query.payload), query.payloadLen), payload);
+  BOOST_CHECK(!PacketRingFrontend::parseFrame(frame.data(), frame.size(), ComboAddress("0.0.0.0:53"), query));
+
+  BOOST_REQUIRE(PacketRingFrontend::parseFrame(frame.data(), frame.size(), local, query));
+  std::vector<uint8_t> out(1500);
+  size_t outLen = PacketRingFrontend::buildResponseFrame(query, response.data(), response.size(), out.data(), out.size());
+  BOOST_REQUIRE_EQUAL(outLen, 18 + 40 + 8 + response.size());
+  /* the tag is still there */
+  BOOST_CHECK_EQUAL(out.at(12), 0x81);
+  BOOST_CHECK_EQUAL(out.at(13), 0x00);
+  BOOST_CHECK_EQUAL(out.at(15), 42);
+
+  uint32_t pseudo = 17 + 8 + response.size();
+  pseudo += (computeChecksum(out.data() + 18 + 8, 32) ^ 0xffff);
+  BOOST_CHECK_EQUAL(computeChecksum(out.data() + 18 + 40, 8 + response.size(), pseudo), 0);
+
+  PacketRingFrontend::Query parsedResponse;
+  BOOST_REQUIRE(PacketRingFrontend::parseFrame(out.data(), outLen, remote, parsedResponse));
+  BOOST_CHECK_EQUAL(parsedResponse.remote.toStringWithPort(), local.toStringWithPort());
+  BOOST_CHECK_EQUAL(parsedResponse.vlanTCI, 42);
+  BOOST_CHECK_EQUAL(std::string(reinterpret_cast<const char*>(parsedResponse.payload), parsedResponse.payloadLen), response);
+}
+
+BOOST_AUTO_TEST_CASE(test_ParseInvalid) {
+  const ComboAddress local("192.0.2.1:53");
+  const ComboAddress remote("192.0.2.42:4242");
+  PacketRingFrontend::Query query;
+
+  auto frame = buildUDPFrame(remote, local, "query");
+  BOOST_CHECK(PacketRingFrontend::parseFrame(frame.data(), frame.size(), local, query));
+
+  /* fragment */
+  auto fragment = frame;
+  fragment.at(14 + 6) = 0x20;
+  BOOST_CHECK(!PacketRingFrontend::parseFrame(fragment.data(), fragment.size(), local, query));
+
+  /* not UDP */
+  auto tcp = frame;
+  tcp.at(14 + 9) = 6;
+  BOOST_CHECK(!PacketRingFrontend::parseFrame(tcp.data(), tcp.size(), local, query));
+
+  /* UDP length larger than the IP payload */
+  auto udpLen = frame;
+  udpLen.at(14 + 20 + 5) += 1;
+  BOOST_CHECK(!PacketRingFrontend::parseFrame(udpLen.data(), udpLen.size(), local, query));
+
+  /* not IP */
+  auto arp = frame;
+  arp.at(12) = 0x08;
+  arp.at(13) = 0x06;
+  BOOST_CHECK(!PacketRingFrontend::parseFrame(arp.data(), arp.size(), local, query));
+
+  BOOST_CHECK(!PacketRingFrontend::parseFrame(frame.data(), 10, local, query));
+}
+
+BOOST_AUTO_TEST_CASE(test_FrameFilter) {
+  const ComboAddress local4("192.0.2.1:53");
+  const ComboAddress remote4("192.0.2.42:4242");
+  const ComboAddress local6("[2001:db8::1]:53");
+  const ComboAddress remote6("[2001:db8::42]:4242");
+
+  for (const uint16_t vlanTCI : { 0, 42 }) {
+    const size_t ipOffset = 14 + (vlanTCI != 0 ? 4 : 0);
+
+    auto frame = buildUDPFrame(remote4, local4, "query", vlanTCI);
+    BOOST_CHECK(passesFrameFilter(frame, 53));
+    /* not our port */
+    BOOST_CHECK(!passesFrameFilter(frame, 5300));
+
+    /* fragment */
+    auto fragment = frame;
+    fragment.at(ipOffset + 6) = 0x20;
+    BOOST_CHECK(!passesFrameFilter(fragment, 53));
+
+    /* not UDP */
+    auto tcp = frame;
+    tcp.at(ipOffset + 9) = 6;
+    BOOST_CHECK(!passesFrameFilter(tcp, 53));
+
+    /* IPv4 options, the destination port is further away */
+    auto options = frame;
+    options.at(ipOffset) = 0x46;
+    const uint8_t nop[] = { 0x01, 0x01, 0x01, 0x01 };
+    options.insert(options.begin() + ipOffset + 20, nop, nop + sizeof(nop));
+    BOOST_CHECK(passesFrameFilter(options, 53));
+
+    auto frame6 = buildUDPFrame(remote6, local6, "query", vlanTCI);
+    BOOST_CHECK(passesFrameFilter(frame6, 53));
+    BOOST_CHECK(!passesFrameFilter(frame6, 5300));
+
+    /* not IP */
+    auto arp = frame;
+    arp.at(ipOffset - 2) = 0x08;
+    arp.at(ipOffset - 1) = 0x06;
+    BOOST_CHECK(!passesFrameFilter(arp, 53));
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif /* HAVE_PACKET_RING */
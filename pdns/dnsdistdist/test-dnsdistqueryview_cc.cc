@@ -0,0 +1,83 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist-queryview.hh"
+#include "dnswriter.hh"
+
+BOOST_AUTO_TEST_SUITE(test_dnsdistqueryview_cc)
+
+BOOST_AUTO_TEST_CASE(test_ParseQuery) {
+  const DNSName qname("wWw.PowerDNS.com.");
+  std::vector<uint8_t> query;
+  DNSPacketWriter pw(query, qname, QType::AAAA, QClass::IN, 0);
+  pw.getHeader()->rd = 1;
+  pw.addOpt(4096, 0, 0);
+  pw.commit();
+
+  DNSQueryView view;
+  BOOST_REQUIRE(view.parse(reinterpret_cast<const char*>(query.data()), query.size()));
+  BOOST_CHECK_EQUAL(view.getQType(), QType::AAAA);
+  BOOST_CHECK_EQUAL(view.getQClass(), QClass::IN);
+  BOOST_CHECK_EQUAL(view.getQNameWireLength(), qname.wirelength());
+  BOOST_CHECK_EQUAL(view.getConsumed(), qname.wirelength() + 4);
+  BOOST_CHECK(view.getHeader()->rd);
+  /* the case is preserved */
+  BOOST_CHECK_EQUAL(std::string(view.getQNameWire(), view.getQNameWireLength()), qname.toDNSString());
+  BOOST_CHECK_EQUAL(view.getQName().toString(), qname.toString());
+
+  /* the hash does not depend on the case */
+  const std::string lowered = toLower(qname.toDNSString());
+  BOOST_CHECK_EQUAL(view.getQNameHash(), burtle(reinterpret_cast<const unsigned char*>(lowered.data()), lowered.size(), 0));
+  BOOST_CHECK_EQUAL(view.getQNameHash(), DNSQueryView::hashQName(lowered.data(), lowered.size()));
+
+  auto name = view.releaseQName();
+  BOOST_CHECK(name == qname);
+}
+
+BOOST_AUTO_TEST_CASE(test_HashLowercasing) {
+  /* every possible byte value, in every position of a word */
+  for (size_t offset = 0; offset < 8; offset++) {
+    std::string raw(offset, 'x');
+    for (unsigned int c = 0; c < 256; c++) {
+      raw.push_back(static_cast<char>(c));
+    }
+    raw.resize(255);
+    const std::string lowered = toLower(raw);
+    BOOST_CHECK_EQUAL(DNSQueryView::hashQName(raw.data(), raw.size()), burtle(reinterpret_cast<const unsigned char*>(lowered.data()), lowered.size(), 0));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_ParseInvalid) {
+  const DNSName qname("powerdns.com.");
+  std::vector<uint8_t> query;
+  DNSPacketWriter pw(query, qname, QType::A, QClass::IN, 0);
+  pw.commit();
+
+  DNSQueryView view;
+  BOOST_REQUIRE(view.parse(reinterpret_cast<const char*>(query.data()), query.size()));
+
+  /* truncated */
+  for (size_t len = 0; len < query.size(); len++) {
+    BOOST_CHECK(!view.parse(reinterpret_cast<const char*>(query.data()), len));
+  }
+
+  /* no question */
+  auto empty = query;
+  empty.at(5) = 0;
+  BOOST_CHECK(!view.parse(reinterpret_cast<const char*>(empty.data()), empty.size()));
+
+  /* compression pointer */
+  auto compressed = query;
+  compressed.at(sizeof(dnsheader)) = 0xc0;
+  BOOST_CHECK(!view.parse(reinterpret_cast<const char*>(compressed.data()), compressed.size()));
+
+  /* label going past the end of the packet */
+  auto overflow = query;
+  overflow.at(sizeof(dnsheader)) = 63;
+  BOOST_CHECK(!view.parse(reinterpret_cast<const char*>(overflow.data()), overflow.size()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -271,4 +271,269 @@ BOOST_AUTO_TEST_CASE(test_Rings_Threaded) {
 #endif
 }
 
+BOOST_AUTO_TEST_CASE(test_SingleWriterRing) {
+  SingleWriterRing<uint64_t> ring(4);
+  BOOST_CHECK_EQUAL(ring.capacity(), 4U);
+  BOOST_CHECK_EQUAL(ring.size(), 0U);
+
+  for (uint64_t idx = 0; idx < 3; idx++) {
+    ring.push([idx](uint64_t& entry) { entry = idx; });
+  }
+  BOOST_CHECK_EQUAL(ring.size(), 3U);
+  std::vector<uint64_t> entries;
+  ring.visit([&entries](uint64_t entry) { entries.push_back(entry); });
+  BOOST_CHECK(entries == std::vector<uint64_t>({0, 1, 2}));
+
+  /* wrap around, the oldest ones are overwritten */
+  for (uint64_t idx = 3; idx < 10; idx++) {
+    ring.push([idx](uint64_t& entry) { entry = idx; });
+  }
+  BOOST_CHECK_EQUAL(ring.size(), 4U);
+  entries.clear();
+  ring.visit([&entries](uint64_t entry) { entries.push_back(entry); });
+  BOOST_CHECK(entries == std::vector<uint64_t>({6, 7, 8, 9}));
+
+  ring.clear();
+  BOOST_CHECK_EQUAL(ring.size(), 0U);
+  entries.clear();
+  ring.visit([&entries](uint64_t entry) { entries.push_back(entry); });
+  BOOST_CHECK(entries.empty());
+
+  ring.push([](uint64_t& entry) { entry = 42; });
+  BOOST_CHECK_EQUAL(ring.size(), 1U);
+  ring.visit([&entries](uint64_t entry) { entries.push_back(entry); });
+  BOOST_CHECK(entries == std::vector<uint64_t>({42}));
+}
+
+BOOST_AUTO_TEST_CASE(test_Rings_PerThread) {
+  const size_t maxEntries = 100;
+  const size_t numberOfShards = 4;
+  Rings rings(maxEntries, numberOfShards);
+  rings.setPerThreadRings(true);
+  BOOST_CHECK(rings.hasPerThreadRings());
+
+  dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  dh.id = htons(4242);
+  dh.rcode = RCode::NXDomain;
+  DNSName qname("rings.powerdns.com.");
+  ComboAddress requestor("192.0.2.1:4242");
+  ComboAddress server("192.0.2.42:53");
+  uint16_t qtype = QType::AAAA;
+  uint16_t size = 42;
+  unsigned int latency = 100;
+  struct timespec now;
+  gettime(&now);
+
+  BOOST_CHECK_EQUAL(rings.getNumberOfThreadRings(), 0U);
+
+  /* this thread gets a ring of maxEntries / numberOfShards entries */
+  for (size_t idx = 0; idx < maxEntries; idx++) {
+    rings.insertQuery(now, requestor, qname, qtype, size, dh);
+  }
+  rings.insertResponse(now, requestor, qname, qtype, latency, size, dh, server);
+  /* an empty name, as used for actively discovered timeouts without a name */
+  rings.insertResponse(now, requestor, DNSName(), qtype, std::numeric_limits<unsigned int>::max(), 0, dh, server);
+
+  BOOST_CHECK_EQUAL(rings.getNumberOfThreadRings(), 1U);
+  BOOST_CHECK_EQUAL(rings.getNumberOfQueryEntries(), maxEntries / numberOfShards);
+  BOOST_CHECK_EQUAL(rings.getNumberOfResponseEntries(), 2U);
+
+  size_t queries = 0;
+  rings.forEachQuery([&](const Rings::Query& entry) {
+      queries++;
+      BOOST_CHECK_EQUAL(entry.name, qname);
+      BOOST_CHECK_EQUAL(entry.qtype, qtype);
+      BOOST_CHECK_EQUAL(entry.size, size);
+      BOOST_CHECK_EQUAL(entry.dh.id, dh.id);
+      BOOST_CHECK_EQUAL(entry.when.tv_sec, now.tv_sec);
+      BOOST_CHECK_EQUAL(entry.requestor.toStringWithPort(), requestor.toStringWithPort());
+    });
+  BOOST_CHECK_EQUAL(queries, maxEntries / numberOfShards);
+
+  std::vector<Rings::Response> responses;
+  rings.forEachResponse([&responses](const Rings::Response& entry) {
+      responses.push_back(entry);
+    });
+  BOOST_REQUIRE_EQUAL(responses.size(), 2U);
+  BOOST_CHECK_EQUAL(responses.at(0).name, qname);
+  BOOST_CHECK_EQUAL(responses.at(0).usec, latency);
+  BOOST_CHECK_EQUAL(responses.at(0).dh.rcode, RCode::NXDomain);
+  BOOST_CHECK_EQUAL(responses.at(0).ds.toStringWithPort(), server.toStringWithPort());
+  BOOST_CHECK(responses.at(1).name.empty());
+
+  BOOST_CHECK_EQUAL(rings.numDistinctRequestors(), 1U);
+
+  /* another thread gets its own rings */
+  std::thread writer([&rings, &now, &requestor, &qname, qtype, size, &dh]() {
+      rings.insertQuery(now, requestor, qname, qtype, size, dh);
+    });
+  writer.join();
+  BOOST_CHECK_EQUAL(rings.getNumberOfThreadRings(), 2U);
+  BOOST_CHECK_EQUAL(rings.getNumberOfQueryEntries(), (maxEntries / numberOfShards) + 1);
+
+  /* the rings of the exited thread are handed over to the next one, entries included */
+  std::thread secondWriter([&rings, &now, &requestor, &qname, qtype, size, &dh]() {
+      rings.insertQuery(now, requestor, qname, qtype, size, dh);
+    });
+  secondWriter.join();
+  BOOST_CHECK_EQUAL(rings.getNumberOfThreadRings(), 2U);
+  BOOST_CHECK_EQUAL(rings.getNumberOfQueryEntries(), (maxEntries / numberOfShards) + 2);
+
+  rings.clear();
+  BOOST_CHECK_EQUAL(rings.getNumberOfQueryEntries(), 0U);
+  BOOST_CHECK_EQUAL(rings.getNumberOfResponseEntries(), 0U);
+  queries = 0;
+  rings.forEachQuery([&queries](const Rings::Query&) { queries++; });
+  BOOST_CHECK_EQUAL(queries, 0U);
+
+  /* a new Rings object does not get the rings of this one */
+  Rings other(maxEntries, numberOfShards);
+  other.setPerThreadRings(true);
+  other.insertQuery(now, requestor, qname, qtype, size, dh);
+  BOOST_CHECK_EQUAL(other.getNumberOfQueryEntries(), 1U);
+  BOOST_CHECK_EQUAL(rings.getNumberOfQueryEntries(), 0U);
+
+  /* the qname can be inserted in wire format, with or without per-thread rings */
+  const auto& wire = qname.getStorage();
+  for (bool perThread : { true, false }) {
+    Rings wireRings(maxEntries, numberOfShards);
+    wireRings.setPerThreadRings(perThread);
+    wireRings.insertQuery(now, requestor, wire.data(), wire.size(), qtype, size, dh);
+    BOOST_CHECK_EQUAL(wireRings.getNumberOfQueryEntries(), 1U);
+    wireRings.forEachQuery([&](const Rings::Query& entry) {
+        BOOST_CHECK_EQUAL(entry.name, qname);
+        BOOST_CHECK_EQUAL(entry.qtype, qtype);
+      });
+  }
+}
+
+static void perThreadRingReaderThread(Rings& rings, std::atomic<bool>& done, size_t numberOfEntries, const DNSName& qname)
+{
+  size_t iterationsDone = 0;
+
+  while (done == false) {
+    size_t numberOfQueries = 0;
+    size_t numberOfResponses = 0;
+    bool valid = true;
+
+    rings.forEachQuery([&](const Rings::Query& c) {
+        numberOfQueries++;
+        if (c.name != qname) {
+          valid = false;
+        }
+      });
+    rings.forEachResponse([&](const Rings::Response& c) {
+        numberOfResponses++;
+        if (c.name != qname) {
+          valid = false;
+        }
+      });
+
+    if (!valid) {
+      cerr<<"Invalid entry!"<<endl;
+      return;
+    }
+    BOOST_CHECK_LE(numberOfQueries, numberOfEntries);
+    BOOST_CHECK_LE(numberOfResponses, numberOfEntries);
+    iterationsDone++;
+    usleep(10000);
+  }
+
+  BOOST_CHECK_GT(iterationsDone, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(test_Rings_PerThread_Threaded) {
+  size_t numberOfEntries = 100000;
+  size_t numberOfWriterThreads = 4;
+  size_t entriesPerThread = numberOfEntries / numberOfWriterThreads;
+
+  struct timespec now;
+  gettime(&now);
+  dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  DNSName qname("rings.powerdns.com.");
+  ComboAddress requestor("192.0.2.1");
+  ComboAddress server("192.0.2.42");
+  unsigned int latency = 100;
+  uint16_t qtype = QType::AAAA;
+  uint16_t size = 42;
+
+  Rings rings(numberOfEntries, numberOfWriterThreads);
+  rings.setPerThreadRings(true);
+  Rings::Query query({now, requestor, qname, size, qtype, dh});
+  Rings::Response response({now, requestor, qname, qtype, latency, size, dh, server});
+
+  std::atomic<bool> done(false);
+  std::vector<std::thread> writerThreads;
+  std::thread readerThread(perThreadRingReaderThread, std::ref(rings), std::ref(done), numberOfEntries, std::cref(qname));
+
+  for (size_t idx = 0; idx < numberOfWriterThreads; idx++) {
+    writerThreads.push_back(std::thread(ringWriterThread, std::ref(rings), entriesPerThread * 10, query, response));
+  }
+
+  for (auto& t : writerThreads) {
+    t.join();
+  }
+
+  done = true;
+  readerThread.join();
+
+  /* every writer got its own ring, now full */
+  BOOST_CHECK_EQUAL(rings.getNumberOfThreadRings(), numberOfWriterThreads);
+  BOOST_CHECK_EQUAL(rings.getNumberOfQueryEntries(), numberOfEntries);
+  BOOST_CHECK_EQUAL(rings.getNumberOfResponseEntries(), numberOfEntries);
+}
+
+BOOST_AUTO_TEST_CASE(test_Rings_PerThread_MoreThreadsThanShards) {
+  const size_t maxEntries = 100;
+  const size_t numberOfShards = 4;
+  const size_t numberOfWriterThreads = numberOfShards + 1;
+  const size_t entriesPerThread = maxEntries / numberOfShards;
+
+  struct timespec now;
+  gettime(&now);
+  dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  DNSName qname("rings.powerdns.com.");
+  ComboAddress requestor("192.0.2.1");
+  uint16_t qtype = QType::AAAA;
+  uint16_t size = 42;
+
+  Rings rings(maxEntries, numberOfShards);
+  rings.setPerThreadRings(true);
+
+  /* keep all the writers alive until every one of them has filled its rings */
+  std::atomic<size_t> filled(0);
+  std::vector<std::thread> writerThreads;
+  for (size_t idx = 0; idx < numberOfWriterThreads; idx++) {
+    writerThreads.push_back(std::thread([&]() {
+        for (size_t entry = 0; entry < entriesPerThread; entry++) {
+          rings.insertQuery(now, requestor, qname, qtype, size, dh);
+        }
+        filled++;
+        while (filled < numberOfWriterThreads) {
+          std::this_thread::yield();
+        }
+      }));
+  }
+
+  for (auto& t : writerThreads) {
+    t.join();
+  }
+
+  /* each thread got capacity / numberOfShards entries, so the total exceeds the capacity */
+  BOOST_CHECK_EQUAL(rings.getNumberOfThreadRings(), numberOfWriterThreads);
+  BOOST_CHECK_EQUAL(rings.getNumberOfQueryEntries(), numberOfWriterThreads * entriesPerThread);
+  BOOST_CHECK_GT(rings.getNumberOfQueryEntries(), maxEntries);
+
+  /* the writers are gone, their rings are reused instead of allocating new ones */
+  std::thread writer([&]() {
+      rings.insertQuery(now, requestor, qname, qtype, size, dh);
+    });
+  writer.join();
+  BOOST_CHECK_EQUAL(rings.getNumberOfThreadRings(), numberOfWriterThreads);
+  BOOST_CHECK_EQUAL(rings.getNumberOfQueryEntries(), numberOfWriterThreads * entriesPerThread);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
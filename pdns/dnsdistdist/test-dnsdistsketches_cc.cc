@@ -0,0 +1,218 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include <thread>
+
+#include "dnsdist-sketches.hh"
+#include "dnsparser.hh"
+#include "gettime.hh"
+
+BOOST_AUTO_TEST_SUITE(test_dnsdistsketches_cc)
+
+BOOST_AUTO_TEST_CASE(test_SpaceSaving) {
+  SpaceSavingSummary<int, std::hash<int>, std::equal_to<int>> summary(3);
+
+  summary.add(1, 10);
+  summary.add(2, 5);
+  summary.add(3, 1);
+  summary.add(1, 1);
+  BOOST_CHECK_EQUAL(summary.size(), 3U);
+
+  /* evicts 3, the smallest one */
+  summary.add(4, 2);
+  BOOST_CHECK_EQUAL(summary.size(), 3U);
+
+  std::map<int, std::pair<uint64_t, uint64_t>> entries;
+  summary.visit([&entries](const decltype(summary)::Entry& entry) {
+      entries[entry.key] = { entry.count, entry.error };
+    });
+  BOOST_REQUIRE_EQUAL(entries.size(), 3U);
+  BOOST_CHECK(entries.count(3) == 0);
+  BOOST_CHECK_EQUAL(entries.at(1).first, 11U);
+  BOOST_CHECK_EQUAL(entries.at(1).second, 0U);
+  BOOST_CHECK_EQUAL(entries.at(2).first, 5U);
+  BOOST_CHECK_EQUAL(entries.at(2).second, 0U);
+  /* 4 inherited the count of 3 */
+  BOOST_CHECK_EQUAL(entries.at(4).first, 3U);
+  BOOST_CHECK_EQUAL(entries.at(4).second, 1U);
+
+  summary.clear();
+  BOOST_CHECK_EQUAL(summary.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_SpaceSavingHeavyHitters) {
+  const size_t capacity = 10;
+  SpaceSavingSummary<int, std::hash<int>, std::equal_to<int>> summary(capacity);
+
+  /* one heavy key hidden in a stream of 10000 distinct ones */
+  for (int idx = 0; idx < 10000; idx++) {
+    summary.add(idx + 1, 1);
+    if (idx % 4 == 0) {
+      summary.add(0, 1);
+    }
+  }
+
+  bool found = false;
+  summary.visit([&found](const decltype(summary)::Entry& entry) {
+      if (entry.key == 0) {
+        found = true;
+        BOOST_CHECK_GE(entry.count, 2500U);
+        BOOST_CHECK_LE(entry.count - entry.error, 2500U);
+      }
+    });
+  BOOST_CHECK(found);
+  BOOST_CHECK_EQUAL(summary.size(), capacity);
+}
+
+BOOST_AUTO_TEST_CASE(test_DynBlockSketches) {
+  DynBlockSketches sketches(8, 10);
+  const ComboAddress requestor1("192.0.2.1");
+  const ComboAddress requestor2("2001:db8::1");
+  struct timespec now;
+  gettime(&now);
+
+  for (size_t second = 20; second > 0; second--) {
+    struct timespec when = now;
+    when.tv_sec -= second - 1;
+    sketches.insertQuery(when, requestor1, QType::A);
+    sketches.insertQuery(when, requestor2, QType::AAAA);
+    sketches.insertQuery(when, requestor2, QType::AAAA);
+    sketches.insertResponse(when, requestor1, RCode::ServFail, 100);
+  }
+
+  DynBlockSketches::counts_t counts;
+  /* only the last 5 seconds, the current one included */
+  BOOST_CHECK_EQUAL(sketches.getCounts(DynBlockSketches::Type::Queries, 0, now, 5, counts), 5U);
+  BOOST_REQUIRE_EQUAL(counts.size(), 2U);
+  BOOST_CHECK_EQUAL(counts.at(requestor1), 5U);
+  BOOST_CHECK_EQUAL(counts.at(requestor2), 10U);
+
+  /* the whole window when asked for more than that, older seconds have been overwritten */
+  counts.clear();
+  BOOST_CHECK_EQUAL(sketches.getCounts(DynBlockSketches::Type::Queries, 0, now, 60, counts), 10U);
+  BOOST_CHECK_EQUAL(counts.at(requestor1), 10U);
+  BOOST_CHECK_EQUAL(counts.at(requestor2), 20U);
+
+  counts.clear();
+  sketches.getCounts(DynBlockSketches::Type::QTypes, QType::AAAA, now, 10, counts);
+  BOOST_REQUIRE_EQUAL(counts.size(), 1U);
+  BOOST_CHECK_EQUAL(counts.at(requestor2), 20U);
+
+  counts.clear();
+  sketches.getCounts(DynBlockSketches::Type::RCodes, RCode::NXDomain, now, 10, counts);
+  BOOST_CHECK_EQUAL(counts.size(), 0U);
+  sketches.getCounts(DynBlockSketches::Type::RCodes, RCode::ServFail, now, 10, counts);
+  BOOST_CHECK_EQUAL(counts.at(requestor1), 10U);
+
+  counts.clear();
+  sketches.getCounts(DynBlockSketches::Type::ResponseBytes, 0, now, 10, counts);
+  BOOST_CHECK_EQUAL(counts.at(requestor1), 1000U);
+
+  /* going back in time does not overwrite the newer entries */
+  struct timespec old = now;
+  old.tv_sec -= 10;
+  sketches.insertQuery(old, requestor1, QType::A);
+  counts.clear();
+  sketches.getCounts(DynBlockSketches::Type::Queries, 0, now, 10, counts);
+  BOOST_CHECK_EQUAL(counts.at(requestor1), 10U);
+
+  sketches.clear();
+  counts.clear();
+  sketches.getCounts(DynBlockSketches::Type::Queries, 0, now, 10, counts);
+  BOOST_CHECK_EQUAL(counts.size(), 0U);
+
+  BOOST_CHECK_THROW(DynBlockSketches(0, 10), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_DynBlockSketchesWindowBoundary) {
+  DynBlockSketches sketches(8, 10);
+  const ComboAddress requestor1("192.0.2.1");
+  const ComboAddress requestor2("192.0.2.2");
+  struct timespec now;
+  gettime(&now);
+
+  /* requestor1 was seen at the start of the last 3 seconds, requestor2 one second before that */
+  struct timespec when = now;
+  when.tv_sec -= 2;
+  sketches.insertQuery(when, requestor1, QType::A);
+  when.tv_sec -= 1;
+  sketches.insertQuery(when, requestor2, QType::A);
+
+  DynBlockSketches::counts_t counts;
+  BOOST_CHECK_EQUAL(sketches.getCounts(DynBlockSketches::Type::Queries, 0, now, 3, counts), 3U);
+  BOOST_REQUIRE_EQUAL(counts.size(), 1U);
+  BOOST_CHECK_EQUAL(counts.at(requestor1), 1U);
+
+  counts.clear();
+  sketches.getCounts(DynBlockSketches::Type::Queries, 0, now, 2, counts);
+  BOOST_CHECK_EQUAL(counts.size(), 0U);
+
+  counts.clear();
+  sketches.getCounts(DynBlockSketches::Type::Queries, 0, now, 4, counts);
+  BOOST_CHECK_EQUAL(counts.size(), 2U);
+
+  /* only the current second */
+  sketches.insertQuery(now, requestor2, QType::A);
+  counts.clear();
+  sketches.getCounts(DynBlockSketches::Type::Queries, 0, now, 1, counts);
+  BOOST_REQUIRE_EQUAL(counts.size(), 1U);
+  BOOST_CHECK_EQUAL(counts.at(requestor2), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(test_DynBlockSketchesPerThread) {
+  DynBlockSketches sketches(8, 10);
+  const ComboAddress requestor("192.0.2.1");
+  const size_t numberOfWriterThreads = 4;
+  const size_t insertionsPerThread = 10000;
+  struct timespec now;
+  gettime(&now);
+
+  /* merge while the writers are inserting, so that some of them find their shard locked */
+  std::atomic<bool> done(false);
+  std::thread reader([&sketches, &done, &now]() {
+      while (!done) {
+        DynBlockSketches::counts_t counts;
+        sketches.getCounts(DynBlockSketches::Type::Queries, 0, now, 10, counts);
+      }
+    });
+
+  /* keep all the writers alive until every one of them is done, so that they all get their own shard */
+  std::atomic<size_t> finished(0);
+  std::vector<std::thread> writers;
+  for (size_t idx = 0; idx < numberOfWriterThreads; idx++) {
+    writers.push_back(std::thread([&]() {
+        for (size_t count = 0; count < insertionsPerThread; count++) {
+          sketches.insertQuery(now, requestor, QType::A);
+        }
+        finished++;
+        while (finished < numberOfWriterThreads) {
+          std::this_thread::yield();
+        }
+      }));
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  done = true;
+  reader.join();
+
+  BOOST_CHECK_EQUAL(sketches.getNumberOfShards(), numberOfWriterThreads);
+  DynBlockSketches::counts_t counts;
+  sketches.getCounts(DynBlockSketches::Type::Queries, 0, now, 10, counts);
+  BOOST_CHECK_EQUAL(counts.at(requestor), numberOfWriterThreads * insertionsPerThread);
+
+  /* the shard of an exited thread is reused, along with its content */
+  std::thread writer([&sketches, &now, &requestor]() {
+      sketches.insertQuery(now, requestor, QType::A);
+    });
+  writer.join();
+  BOOST_CHECK_EQUAL(sketches.getNumberOfShards(), numberOfWriterThreads);
+  counts.clear();
+  sketches.getCounts(DynBlockSketches::Type::Queries, 0, now, 10, counts);
+  BOOST_CHECK_EQUAL(counts.at(requestor), numberOfWriterThreads * insertionsPerThread + 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
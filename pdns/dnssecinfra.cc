@@ -500,17 +500,20 @@ string hashQNameWithSalt(const NSEC3PARAMRecordContent& ns3prc, const DNSName& q
 
 string hashQNameWithSalt(const std::string& salt, unsigned int iterations, const DNSName& qname)
 {
-  unsigned int times = iterations;
   unsigned char hash[20];
   string toHash(qname.toDNSStringLC());
-
-  for(;;) {
-    toHash.append(salt);
+  toHash.append(salt);
+  SHA1((unsigned char*)toHash.c_str(), toHash.length(), hash);
+
+  // every further iteration hashes the previous digest followed by the salt: keep
+  // the salt in place and only overwrite the digest part of the buffer
+  toHash.assign((char*)hash, sizeof(hash));
+  toHash.append(salt);
+  for(unsigned int times = iterations; times > 0; times--) {
     SHA1((unsigned char*)toHash.c_str(), toHash.length(), hash);
-    toHash.assign((char*)hash, sizeof(hash));
-    if(!times--)
-      break;
+    toHash.replace(0, sizeof(hash), (char*)hash, sizeof(hash));
   }
+  toHash.resize(sizeof(hash));
   return toHash;
 }
 
@@ -31,15 +31,129 @@
 #include "lock.hh"
 #include "arguments.hh"
 #include "statbag.hh"
+#include <mutex>
+#include <boost/functional/hash.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
 extern StatBag S;
 
-static pthread_rwlock_t g_signatures_lock = PTHREAD_RWLOCK_INITIALIZER;
-typedef map<pair<string, string>, string> signaturecache_t;
-static signaturecache_t g_signatures;
-static int g_cacheweekno;
-
 const static std::set<uint16_t> g_KSKSignedQTypes {QType::DNSKEY, QType::CDS, QType::CDNSKEY};
 AtomicCounter* g_signatureCount;
+static AtomicCounter* g_signatureCacheHits;
+static AtomicCounter* g_signatureCacheMisses;
+static AtomicCounter* g_signatureCacheEvictions;
+
+/* Signatures are cached per key and RRset, independently of their validity period: a signature
+   made last week keeps being served until it gets close to its expiration. Each entry is refreshed
+   at a random point of a two days window, so that the re-signing is spread out instead of every
+   signature being made again as soon as the week changes.
+   The cache is split into shards, each one with its own lock and its own LRU list. */
+class SignatureCache
+{
+public:
+  typedef pair<string, string> key_t;
+
+  SignatureCache(size_t shardsCount): d_shards(shardsCount)
+  {
+  }
+
+  bool get(const key_t& key, time_t now, RRSIGRecordContent& rrc)
+  {
+    auto& shard = getShard(key);
+    std::lock_guard<std::mutex> lock(shard.d_mutex);
+    auto& idx = shard.d_map.get<KeyTag>();
+    auto it = idx.find(key);
+    if (it == idx.end() || it->d_refresh <= now) {
+      return false;
+    }
+
+    rrc.d_signature = it->d_signature;
+    rrc.d_siginception = it->d_inception;
+    rrc.d_sigexpire = it->d_expire;
+    /* most recently used entries go to the back */
+    auto& sidx = shard.d_map.get<SequenceTag>();
+    sidx.relocate(sidx.end(), shard.d_map.project<SequenceTag>(it));
+    return true;
+  }
+
+  /* returns the number of entries evicted to make room */
+  size_t insert(const key_t& key, const RRSIGRecordContent& rrc, size_t maxEntries)
+  {
+    Entry entry;
+    entry.d_key = key;
+    entry.d_signature = rrc.d_signature;
+    entry.d_inception = rrc.d_siginception;
+    entry.d_expire = rrc.d_sigexpire;
+    entry.d_refresh = rrc.d_sigexpire - 7*86400 + dns_random(2*86400);
+
+    const size_t maxPerShard = std::max(maxEntries / d_shards.size(), static_cast<size_t>(1));
+    size_t evicted = 0;
+    auto& shard = getShard(key);
+    std::lock_guard<std::mutex> lock(shard.d_mutex);
+    auto& idx = shard.d_map.get<KeyTag>();
+    auto it = idx.find(key);
+    if (it != idx.end()) {
+      idx.replace(it, entry);
+      return 0;
+    }
+
+    auto& sidx = shard.d_map.get<SequenceTag>();
+    while (!sidx.empty() && sidx.size() >= maxPerShard) {
+      sidx.pop_front();
+      evicted++;
+    }
+    sidx.push_back(std::move(entry));
+    return evicted;
+  }
+
+  size_t size()
+  {
+    size_t result = 0;
+    for (auto& shard : d_shards) {
+      std::lock_guard<std::mutex> lock(shard.d_mutex);
+      result += shard.d_map.size();
+    }
+    return result;
+  }
+
+private:
+  struct Entry
+  {
+    key_t d_key;
+    string d_signature;
+    time_t d_refresh;
+    uint32_t d_inception;
+    uint32_t d_expire;
+  };
+
+  struct KeyTag {};
+  struct SequenceTag {};
+  typedef multi_index_container<
+    Entry,
+    indexed_by <
+      hashed_unique<tag<KeyTag>, member<Entry, key_t, &Entry::d_key>, boost::hash<key_t> >,
+      sequenced<tag<SequenceTag> >
+    >
+  > cache_t;
+
+  struct Shard
+  {
+    std::mutex d_mutex;
+    cache_t d_map;
+  };
+
+  Shard& getShard(const key_t& key)
+  {
+    /* the second part of the key is already a digest */
+    return d_shards[boost::hash<string>()(key.second) % d_shards.size()];
+  }
+
+  vector<Shard> d_shards;
+};
+
+static SignatureCache g_signatures(64);
 
 static std::string getLookupKey(const std::string& msg)
 {
@@ -53,43 +167,43 @@ static std::string getLookupKey(const std::string& msg)
 
 static void fillOutRRSIG(DNSSECPrivateKey& dpk, const DNSName& signQName, RRSIGRecordContent& rrc, vector<shared_ptr<DNSRecordContent> >& toSign)
 {
-  if(!g_signatureCount)
-    g_signatureCount = S.getPointer("signatures");
+  /* several threads might be signing at once right after startup */
+  static std::once_flag s_countersResolved;
+  std::call_once(s_countersResolved, []() {
+      g_signatureCacheHits = S.getPointer("signature-cache-hit");
+      g_signatureCacheMisses = S.getPointer("signature-cache-miss");
+      g_signatureCacheEvictions = S.getPointer("signature-cache-evictions");
+      g_signatureCount = S.getPointer("signatures");
+    });
 
   DNSKEYRecordContent drc = dpk.getDNSKEY();
   const std::shared_ptr<DNSCryptoKeyEngine> rc = dpk.getKey();
   rrc.d_tag = drc.getTag();
   rrc.d_algorithm = drc.d_algorithm;
 
-  string msg=getMessageForRRSET(signQName, rrc, toSign); // this is what we will hash & sign
-  pair<string, string> lookup(rc->getPubKeyHash(), getLookupKey(msg));  // this hash is a memory saving exercise
+  /* the validity period is left out of the lookup key, a cached signature comes with its own */
+  const uint32_t inception = rrc.d_siginception;
+  const uint32_t expire = rrc.d_sigexpire;
+  rrc.d_siginception = 0;
+  rrc.d_sigexpire = 0;
+  SignatureCache::key_t lookup(rc->getPubKeyHash(), getLookupKey(getMessageForRRSET(signQName, rrc, toSign)));  // this hash is a memory saving exercise
+  rrc.d_siginception = inception;
+  rrc.d_sigexpire = expire;
 
-  bool doCache=1;
-  if(doCache)
-  {
-    ReadLock l(&g_signatures_lock);
-    signaturecache_t::const_iterator iter = g_signatures.find(lookup);
-    if(iter != g_signatures.end()) {
-      rrc.d_signature=iter->second;
-      return;
-    }
-    // else cerr<<"Miss!"<<endl;
+  if(g_signatures.get(lookup, time(nullptr), rrc)) {
+    (*g_signatureCacheHits)++;
+    return;
   }
+  (*g_signatureCacheMisses)++;
 
+  string msg=getMessageForRRSET(signQName, rrc, toSign); // this is what we will hash & sign
   rrc.d_signature = rc->sign(msg);
   (*g_signatureCount)++;
-  if(doCache) {
-    /* we add some jitter here so not all your slaves start pruning their caches at the very same millisecond */
-    int weekno = (time(0) - dns_random(3600)) / (86400*7);  // we just spent milliseconds doing a signature, microsecond more won't kill us
-    const static int maxcachesize=::arg().asNum("max-signature-cache-entries", INT_MAX);
-
-    WriteLock l(&g_signatures_lock);
-    if(g_cacheweekno < weekno || g_signatures.size() >= (uint) maxcachesize) {  // blunt but effective (C) Habbie, mind04
-      g_log<<Logger::Warning<<"Cleared signature cache."<<endl;
-      g_signatures.clear();
-      g_cacheweekno = weekno;
-    }
-    g_signatures[lookup] = rrc.d_signature;
+
+  const static size_t maxcachesize=::arg().asNum("max-signature-cache-entries", INT_MAX);
+  size_t evicted = g_signatures.insert(lookup, rrc, maxcachesize);
+  if(evicted) {
+    (*g_signatureCacheEvictions) += evicted;
   }
 }
 
@@ -106,8 +220,6 @@ static int getRRSIGsForRRSET(DNSSECKeeper& dk, const DNSName& signer, const DNSN
 
   rrc.d_labels=signQName.countLabels()-signQName.isWildcard();
   rrc.d_originalttl=signTTL; 
-  rrc.d_siginception=startOfWeek - 7*86400; // XXX should come from zone metadata
-  rrc.d_sigexpire=startOfWeek + 14*86400;
   rrc.d_signer = signer;
   rrc.d_tag = 0;
 
@@ -125,6 +237,9 @@ static int getRRSIGsForRRSET(DNSSECKeeper& dk, const DNSName& signer, const DNSN
       continue;
     }
 
+    // a cached signature might come with the validity period of a previous week, reset it for each key
+    rrc.d_siginception=startOfWeek - 7*86400; // XXX should come from zone metadata
+    rrc.d_sigexpire=startOfWeek + 14*86400;
     fillOutRRSIG(keymeta.first, signQName, rrc, toSign);
     rrcs.push_back(rrc);
   }
@@ -169,7 +284,6 @@ static void addSignature(DNSSECKeeper& dk, UeberBackend& db, const DNSName& sign
 
 uint64_t signatureCacheSize(const std::string& str)
 {
-  ReadLock l(&g_signatures_lock);
   return g_signatures.size();
 }
 
@@ -3,6 +3,7 @@
 #include "libssl.hh"
 
 struct DOHServerConfig;
+struct DOHThreadContext;
 
 class DOHResponseMapEntry
 {
@@ -53,6 +54,7 @@ struct DOHFrontend
   ComboAddress d_local;
 
   uint32_t d_idleTimeout{30};             // HTTP idle timeout in seconds
+  size_t d_numberOfThreads{1};            // number of h2o event loops (threads), each one with its own listening socket
   std::vector<std::string> d_urls;
 
   std::atomic<uint64_t> d_httpconnects{0};   // number of TCP/IP connections established
@@ -163,15 +165,16 @@ struct DOHUnit
   st_h2o_req_t* req{nullptr};
   DOHUnit** self{nullptr};
   std::string contentType;
+  /* the DoH thread this query has been received by, which
+     will send the response */
+  DOHThreadContext* threadCtx{nullptr};
   std::atomic<uint64_t> d_refcnt{1};
-  int rsock;
   uint16_t qtype;
   /* the status_code is set from
-     processDOHQuery() (which is executed in
-     the DOH client thread) so that the correct
-     response can be sent in on_dnsdist(),
-     after the DOHUnit has been passed back to
-     the main DoH thread.
+     processDOHQuery() or when a timeout occurs,
+     so that the correct response can be sent,
+     possibly from on_dnsdist() after the DOHUnit
+     has been passed back to the DoH thread.
   */
   uint16_t status_code{200};
   bool ednsAdded{false};
@@ -187,3 +190,6 @@ struct DOHUnit
 #endif /* HAVE_DNS_OVER_HTTPS  */
 
 void handleDOHTimeout(DOHUnit* oldDU);
+/* passes a DOHUnit holding a response back to the DoH thread it was received by,
+   taking ownership of one reference */
+void queueDOHUnitResponse(DOHUnit* du);
@@ -0,0 +1,137 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+/**
+   A bounded multi-producer multi-consumer queue, without any lock.
+
+   Every cell carries a sequence number telling whether it is ready to be written to
+   or read from for the current lap around the ring. Producers and consumers reserve a
+   position with a compare-and-swap on their own index, then publish the cell by bumping
+   its sequence number, so they never wait on each other except when the queue is full
+   or empty.
+
+   push() and pop() never block and return false when the queue is full, respectively empty.
+   Note that pop() might also return false while a push() to the position it is waiting on is
+   still in progress, even if later cells have already been published.
+*/
+template <class T>
+class MPMCQueue
+{
+public:
+  MPMCQueue(size_t capacity): d_mask(roundUpToPowerOfTwo(capacity) - 1), d_cells(new Cell[d_mask + 1])
+  {
+    for (size_t idx = 0; idx <= d_mask; idx++) {
+      d_cells[idx].d_sequence.store(idx, std::memory_order_relaxed);
+    }
+  }
+
+  MPMCQueue(const MPMCQueue&) = delete;
+  MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+  bool push(T&& value)
+  {
+    size_t pos = d_pushPos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &d_cells[pos & d_mask];
+      const size_t seq = cell->d_sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (d_pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (diff < 0) {
+        /* the consumers have not caught up with the previous lap yet */
+        return false;
+      }
+      else {
+        pos = d_pushPos.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->d_value = std::move(value);
+    cell->d_sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T& value)
+  {
+    size_t pos = d_popPos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &d_cells[pos & d_mask];
+      const size_t seq = cell->d_sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (d_popPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (diff < 0) {
+        return false;
+      }
+      else {
+        pos = d_popPos.load(std::memory_order_relaxed);
+      }
+    }
+
+    value = std::move(cell->d_value);
+    cell->d_sequence.store(pos + d_mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t capacity() const
+  {
+    return d_mask + 1;
+  }
+
+private:
+  static size_t roundUpToPowerOfTwo(size_t value)
+  {
+    if (value == 0) {
+      throw std::runtime_error("The capacity of a MPMCQueue should be larger than 0");
+    }
+    size_t result = 1;
+    while (result < value) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  struct Cell
+  {
+    std::atomic<size_t> d_sequence;
+    T d_value;
+  };
+
+  /* keep the two indexes on separate cache lines, they are written by different threads */
+  std::atomic<size_t> d_pushPos{0};
+  char d_padding[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> d_popPos{0};
+  const size_t d_mask;
+  std::unique_ptr<Cell[]> d_cells;
+};
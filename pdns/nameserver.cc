@@ -289,43 +289,36 @@ UDPNameserver::UDPNameserver( bool additional_socket )
     g_log<<Logger::Critical<<"PDNS is deaf and mute! Not listening on any interfaces"<<endl;    
 }
 
-void UDPNameserver::send(DNSPacket& p)
+static void fillAnswerMSGHdr(DNSPacket& p, const string& buffer, ComboAddress* remote, struct msghdr* msgh, struct iovec* iov, cmsgbuf_aligned* cbuf)
 {
-  string buffer=p.getString();
-  g_rs.submitResponse(p, true);
-
-  struct msghdr msgh;
-  struct iovec iov;
-  cmsgbuf_aligned cbuf;
+  fillMSGHdr(msgh, iov, cbuf, 0, (char*)buffer.c_str(), buffer.length(), remote);
 
-  fillMSGHdr(&msgh, &iov, &cbuf, 0, (char*)buffer.c_str(), buffer.length(), &p.d_remote);
-
-  msgh.msg_control=NULL;
+  msgh->msg_control=NULL;
   if(p.d_anyLocal) {
-    addCMsgSrcAddr(&msgh, &cbuf, p.d_anyLocal.get_ptr(), 0);
+    addCMsgSrcAddr(msgh, cbuf, p.d_anyLocal.get_ptr(), 0);
   }
   DLOG(g_log<<Logger::Notice<<"Sending a packet to "<< p.getRemote() <<" ("<< buffer.length()<<" octets)"<<endl);
   if(buffer.length() > p.getMaxReplyLen()) {
     g_log<<Logger::Error<<"Weird, trying to send a message that needs truncation, "<< buffer.length()<<" > "<<p.getMaxReplyLen()<<". Question was for "<<p.qdomain<<"|"<<p.qtype.getName()<<endl;
   }
-  if(sendmsg(p.getSocket(), &msgh, 0) < 0)
-    g_log<<Logger::Error<<"Error sending reply with sendmsg (socket="<<p.getSocket()<<", dest="<<p.d_remote.toStringWithPort()<<"): "<<stringerror()<<endl;
 }
 
-bool UDPNameserver::receive(DNSPacket& packet, std::string& buffer)
+void UDPNameserver::send(DNSPacket& p)
 {
-  ComboAddress remote;
-  extern StatBag S;
-  ssize_t len=-1;
-  Utility::sock_t sock=-1;
+  string buffer=p.getString();
+  g_rs.submitResponse(p, true);
 
   struct msghdr msgh;
   struct iovec iov;
   cmsgbuf_aligned cbuf;
 
-  remote.sin6.sin6_family=AF_INET6; // make sure it is big enough
-  fillMSGHdr(&msgh, &iov, &cbuf, sizeof(cbuf), &buffer.at(0), buffer.size(), &remote);
-  
+  fillAnswerMSGHdr(p, buffer, &p.d_remote, &msgh, &iov, &cbuf);
+  if(sendmsg(p.getSocket(), &msgh, 0) < 0)
+    g_log<<Logger::Error<<"Error sending reply with sendmsg (socket="<<p.getSocket()<<", dest="<<p.d_remote.toStringWithPort()<<"): "<<stringerror()<<endl;
+}
+
+int UDPNameserver::waitForSocket()
+{
   int err;
   vector<struct pollfd> rfds= d_rfds;
 
@@ -333,30 +326,51 @@ bool UDPNameserver::receive(DNSPacket& packet, std::string& buffer)
     pfd.events = POLLIN;
     pfd.revents = 0;
   }
-    
+
   retry:;
-  
+
   err = poll(&rfds[0], rfds.size(), -1);
   if(err < 0) {
     if(errno==EINTR)
       goto retry;
     unixDie("Unable to poll for new UDP events");
   }
-    
+
   for(auto &pfd :  rfds) {
     if(pfd.revents & POLLIN) {
-      sock=pfd.fd;        
-      if((len=recvmsg(sock, &msgh, 0)) < 0 ) {
-        if(errno != EAGAIN)
-          g_log<<Logger::Error<<"recvfrom gave error, ignoring: "<<stringerror()<<endl;
-        return 0;
-      }
-      break;
+      return pfd.fd;
     }
   }
-  if(sock==-1)
-    throw PDNSException("poll betrayed us! (should not happen)");
-  
+
+  throw PDNSException("poll betrayed us! (should not happen)");
+}
+
+bool UDPNameserver::receive(DNSPacket& packet, std::string& buffer)
+{
+  ComboAddress remote;
+  ssize_t len=-1;
+
+  struct msghdr msgh;
+  struct iovec iov;
+  cmsgbuf_aligned cbuf;
+
+  remote.sin6.sin6_family=AF_INET6; // make sure it is big enough
+  fillMSGHdr(&msgh, &iov, &cbuf, sizeof(cbuf), &buffer.at(0), buffer.size(), &remote);
+
+  Utility::sock_t sock=waitForSocket();
+  if((len=recvmsg(sock, &msgh, 0)) < 0 ) {
+    if(errno != EAGAIN)
+      g_log<<Logger::Error<<"recvfrom gave error, ignoring: "<<stringerror()<<endl;
+    return 0;
+  }
+
+  return fillPacket(packet, &msgh, remote, sock, &buffer.at(0), len);
+}
+
+bool UDPNameserver::fillPacket(DNSPacket& packet, struct msghdr* msgh, ComboAddress& remote, int sock, char* data, size_t len)
+{
+  extern StatBag S;
+
   DLOG(g_log<<"Received a packet " << len <<" bytes long from "<< remote.toString()<<endl);
 
   BOOST_STATIC_ASSERT(offsetof(sockaddr_in, sin_port) == offsetof(sockaddr_in6, sin6_port));
@@ -368,19 +382,22 @@ bool UDPNameserver::receive(DNSPacket& packet, std::string& buffer)
   packet.setRemote(&remote);
 
   ComboAddress dest;
-  if(HarvestDestinationAddress(&msgh, &dest)) {
+  if(HarvestDestinationAddress(msgh, &dest)) {
 //    cerr<<"Setting d_anyLocal to '"<<dest.toString()<<"'"<<endl;
     packet.d_anyLocal = dest;
-  }            
+  }
+  else {
+    packet.d_anyLocal = boost::none;
+  }
 
   struct timeval recvtv;
-  if(HarvestTimestamp(&msgh, &recvtv)) {
+  if(HarvestTimestamp(msgh, &recvtv)) {
     packet.d_dt.setTimeval(recvtv);
   }
   else
     packet.d_dt.set(); // timing    
 
-  if(packet.parse(&buffer.at(0), (size_t) len)<0) {
+  if(packet.parse(data, len)<0) {
     S.inc("corrupt-packets");
     S.ringAccount("remotes-corrupt", packet.d_remote);
 
@@ -389,3 +406,111 @@ bool UDPNameserver::receive(DNSPacket& packet, std::string& buffer)
   
   return true;
 }
+
+static struct msghdr& getMSGHdr(struct msghdr& msgh)
+{
+  return msgh;
+}
+
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+static struct msghdr& getMSGHdr(struct mmsghdr& mmsgh)
+{
+  return mmsgh.msg_hdr;
+}
+#endif
+
+UDPBatch::UDPBatch(size_t size): d_entries(size > 0 ? size : 1), d_cbufs(d_entries.size()), d_answerCbufs(d_entries.size()), d_msgs(d_entries.size()), d_answerMsgs(d_entries.size())
+{
+  for(size_t idx = 0; idx < d_entries.size(); idx++) {
+    auto& entry = d_entries[idx];
+    entry.d_query.resize(DNSPacket::s_udpTruncationThreshold);
+    entry.d_remote.sin6.sin6_family=AF_INET6; // make sure it is big enough
+    /* this one is only a template, copied before each receive since the kernel updates the lengths */
+    fillMSGHdr(&entry.d_msgh, &entry.d_iov, &d_cbufs[idx], sizeof(d_cbufs[idx]), &entry.d_query.at(0), entry.d_query.size(), &entry.d_remote);
+  }
+}
+
+size_t UDPNameserver::receive(UDPBatch& batch)
+{
+  Utility::sock_t sock=waitForSocket();
+  batch.d_socket = sock;
+  batch.d_queued = 0;
+
+  for(size_t idx = 0; idx < batch.d_entries.size(); idx++) {
+    getMSGHdr(batch.d_msgs[idx]) = batch.d_entries[idx].d_msgh;
+  }
+
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+  /* the socket is non-blocking, so we get whatever is already there */
+  int got = recvmmsg(sock, batch.d_msgs.data(), batch.d_msgs.size(), MSG_WAITFORONE, nullptr);
+  if(got < 0) {
+    if(errno != EAGAIN)
+      g_log<<Logger::Error<<"recvmmsg gave error, ignoring: "<<stringerror()<<endl;
+    return 0;
+  }
+
+  for(int idx = 0; idx < got; idx++) {
+    batch.d_entries[idx].d_length = batch.d_msgs[idx].msg_len;
+  }
+  return got;
+#else
+  size_t got = 0;
+  while(got < batch.d_entries.size()) {
+    ssize_t len = recvmsg(sock, &batch.d_msgs[got], 0);
+    if(len < 0) {
+      if(errno != EAGAIN)
+        g_log<<Logger::Error<<"recvfrom gave error, ignoring: "<<stringerror()<<endl;
+      break;
+    }
+    batch.d_entries[got].d_length = len;
+    got++;
+  }
+  return got;
+#endif
+}
+
+bool UDPNameserver::parse(UDPBatch& batch, size_t idx, DNSPacket& packet)
+{
+  auto& entry = batch.d_entries.at(idx);
+  return fillPacket(packet, &getMSGHdr(batch.d_msgs[idx]), entry.d_remote, batch.d_socket, &entry.d_query.at(0), entry.d_length);
+}
+
+void UDPNameserver::queue(UDPBatch& batch, DNSPacket& p)
+{
+  if(p.getSocket() != batch.d_socket || batch.d_queued >= batch.d_entries.size()) {
+    send(p);
+    return;
+  }
+
+  /* p might be reused before the batch is flushed, keep our own copy of everything */
+  auto& entry = batch.d_entries[batch.d_queued];
+  entry.d_answer = p.getString();
+  entry.d_answerRemote = p.d_remote;
+  g_rs.submitResponse(p, true);
+
+  fillAnswerMSGHdr(p, entry.d_answer, &entry.d_answerRemote, &getMSGHdr(batch.d_answerMsgs[batch.d_queued]), &entry.d_answerIov, &batch.d_answerCbufs[batch.d_queued]);
+  batch.d_queued++;
+}
+
+void UDPNameserver::flush(UDPBatch& batch)
+{
+  size_t done = 0;
+  while(done < batch.d_queued) {
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+    int sent = sendmmsg(batch.d_socket, &batch.d_answerMsgs[done], batch.d_queued - done, 0);
+    if(sent > 0) {
+      done += sent;
+      continue;
+    }
+#else
+    if(sendmsg(batch.d_socket, &batch.d_answerMsgs[done], 0) >= 0) {
+      done++;
+      continue;
+    }
+#endif
+    /* skip the answer that could not be sent */
+    g_log<<Logger::Error<<"Error sending reply with sendmmsg (socket="<<batch.d_socket<<", dest="<<batch.d_entries[done].d_answerRemote.toStringWithPort()<<"): "<<stringerror()<<endl;
+    done++;
+  }
+  batch.d_queued = 0;
+}
@@ -77,12 +77,61 @@
 #endif
 #endif
 
+/** Buffers used to receive several queries from a socket with a single system call,
+    and to send the answers that are available right away (packet cache hits) in the same way.
+    Each receiver thread has its own. */
+class UDPBatch
+{
+public:
+  UDPBatch(size_t size);
+  UDPBatch(const UDPBatch&) = delete;
+  UDPBatch& operator=(const UDPBatch&) = delete;
+
+  size_t size() const
+  {
+    return d_entries.size();
+  }
+
+private:
+  friend class UDPNameserver;
+
+  struct Entry
+  {
+    std::string d_query;
+    std::string d_answer;
+    ComboAddress d_remote;
+    ComboAddress d_answerRemote;
+    struct msghdr d_msgh;
+    struct iovec d_iov;
+    struct iovec d_answerIov;
+    size_t d_length{0};
+  };
+
+  std::vector<Entry> d_entries;
+  /* not part of Entry, cmsgbuf_aligned can only be the last member of a struct */
+  std::vector<cmsgbuf_aligned> d_cbufs;
+  std::vector<cmsgbuf_aligned> d_answerCbufs;
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+  std::vector<struct mmsghdr> d_msgs;
+  std::vector<struct mmsghdr> d_answerMsgs;
+#else
+  std::vector<struct msghdr> d_msgs;
+  std::vector<struct msghdr> d_answerMsgs;
+#endif
+  int d_socket{-1};
+  size_t d_queued{0};
+};
+
 class UDPNameserver
 {
 public:
   UDPNameserver( bool additional_socket = false );  //!< Opens the socket
   bool receive(DNSPacket& packet, std::string& buffer); //!< call this in a while or for(;;) loop to get packets
   void send(DNSPacket&); //!< send a DNSPacket. Will call DNSPacket::truncate() if over 512 bytes
+  size_t receive(UDPBatch& batch); //!< wait for queries, then read as many as possible from the same socket. Returns the number of queries in the batch
+  bool parse(UDPBatch& batch, size_t idx, DNSPacket& packet); //!< fill packet from the idx-th query of the batch, false if it should be ignored
+  void queue(UDPBatch& batch, DNSPacket& p); //!< like send(), but the answer only goes out on the next flush()
+  void flush(UDPBatch& batch); //!< send all the queued answers of the batch
   inline bool canReusePort() {
 #ifdef SO_REUSEPORT
     return d_can_reuseport;
@@ -99,6 +148,8 @@ private:
   vector<int> d_sockets;
   void bindIPv4();
   void bindIPv6();
+  int waitForSocket();
+  bool fillPacket(DNSPacket& packet, struct msghdr* msgh, ComboAddress& remote, int sock, char* data, size_t len);
   vector<pollfd> d_rfds;
 };
 
@@ -26,8 +26,14 @@
 #include "utility.hh"
 #include "base32.hh"
 #include <string>
+#include <mutex>
 #include <sys/types.h>
 #include <boost/algorithm/string.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
 #include "dnssecinfra.hh"
 #include "dnsseckeeper.hh"
 #include "dns.hh"
@@ -57,6 +63,95 @@ set<string> PacketHandler::s_forwardNotify;
 
 extern string s_programname;
 
+/* NSEC3 owner hashes of the names we have had to deny, so that the closest encloser and the
+   wildcard of a zone are not hashed again, iterations+1 times, for every negative answer.
+   Entries carry the salt and iterations they were made with, a hash made with an older
+   NSEC3PARAM is never returned and gets replaced. The cache is split into shards, each one
+   with its own lock and its own LRU list. */
+class NSEC3HashCache
+{
+public:
+  NSEC3HashCache(size_t shardsCount): d_shards(shardsCount)
+  {
+  }
+
+  bool get(const string& name, const NSEC3PARAMRecordContent& ns3rc, string& hashed)
+  {
+    auto& shard = getShard(name);
+    std::lock_guard<std::mutex> lock(shard.d_mutex);
+    auto& idx = shard.d_map.get<NameTag>();
+    auto it = idx.find(name);
+    if (it == idx.end() || it->d_iterations != ns3rc.d_iterations || it->d_salt != ns3rc.d_salt) {
+      return false;
+    }
+
+    hashed = it->d_hashed;
+    /* most recently used entries go to the back */
+    auto& sidx = shard.d_map.get<SequenceTag>();
+    sidx.relocate(sidx.end(), shard.d_map.project<SequenceTag>(it));
+    return true;
+  }
+
+  void insert(const string& name, const NSEC3PARAMRecordContent& ns3rc, const string& hashed, size_t maxEntries)
+  {
+    Entry entry;
+    entry.d_name = name;
+    entry.d_salt = ns3rc.d_salt;
+    entry.d_hashed = hashed;
+    entry.d_iterations = ns3rc.d_iterations;
+
+    const size_t maxPerShard = std::max(maxEntries / d_shards.size(), static_cast<size_t>(1));
+    auto& shard = getShard(name);
+    std::lock_guard<std::mutex> lock(shard.d_mutex);
+    auto& idx = shard.d_map.get<NameTag>();
+    auto it = idx.find(name);
+    if (it != idx.end()) {
+      idx.replace(it, entry);
+      return;
+    }
+
+    auto& sidx = shard.d_map.get<SequenceTag>();
+    while (!sidx.empty() && sidx.size() >= maxPerShard) {
+      sidx.pop_front();
+    }
+    sidx.push_back(std::move(entry));
+  }
+
+private:
+  struct Entry
+  {
+    string d_name; // lowercase, wire format
+    string d_salt;
+    string d_hashed;
+    uint16_t d_iterations;
+  };
+
+  struct NameTag {};
+  struct SequenceTag {};
+  typedef multi_index_container<
+    Entry,
+    indexed_by <
+      hashed_unique<tag<NameTag>, member<Entry, string, &Entry::d_name>, boost::hash<string> >,
+      sequenced<tag<SequenceTag> >
+    >
+  > cache_t;
+
+  struct Shard
+  {
+    std::mutex d_mutex;
+    cache_t d_map;
+  };
+
+  Shard& getShard(const string& name)
+  {
+    return d_shards[boost::hash<string>()(name) % d_shards.size()];
+  }
+
+  vector<Shard> d_shards;
+};
+
+static NSEC3HashCache g_nsec3Hashes(16);
+
 PacketHandler::PacketHandler():B(s_programname), d_dk(&B)
 {
   ++s_count;
@@ -64,6 +159,12 @@ PacketHandler::PacketHandler():B(s_programname), d_dk(&B)
   d_doExpandALIAS = ::arg().mustDo("expand-alias");
   d_logDNSDetails= ::arg().mustDo("log-dns-details");
   d_doIPv6AdditionalProcessing = ::arg().mustDo("do-ipv6-additional-processing");
+  d_coalesceLookups = ::arg().mustDo("coalesce-lookups");
+  d_maxNSEC3HashCacheEntries = ::arg().asNum("max-nsec3-hash-cache-entries");
+  if(d_maxNSEC3HashCacheEntries) {
+    d_nsec3HashCacheHits = S.getPointer("nsec3-hash-cache-hit");
+    d_nsec3HashCacheMisses = S.getPointer("nsec3-hash-cache-miss");
+  }
   string fname= ::arg()["lua-prequery-script"];
   if(fname.empty())
   {
@@ -86,6 +187,72 @@ PacketHandler::PacketHandler():B(s_programname), d_dk(&B)
   }
 }
 
+/** Fetches, with a single backend call, the records of target and of every name
+    the lookups below may ask for: its ancestors up to the apex, and the wildcard
+    at each of them. */
+void PacketHandler::fillLookupMemo(DNSPacket& p, const SOAData& sd, const DNSName& target)
+{
+  d_memo.clear();
+  d_memoHit = false;
+  d_memoZoneId = sd.domain_id;
+
+  if(!target.isPartOf(sd.qname))
+    return;
+
+  vector<DNSName> names;
+  DNSName name(target);
+  names.push_back(name);
+  while(name != sd.qname && name.chopOff()) {
+    names.push_back(name);
+    names.push_back(g_wildcarddnsname+name);
+  }
+
+  vector<DNSZoneRecord> records;
+  B.lookupNames(names, sd.domain_id, records, &p);
+
+  for(const auto& n : names)
+    d_memo[n]; // no records means the name does not exist
+  for(auto& rr : records) {
+    auto entry = d_memo.find(rr.dr.d_name);
+    if(entry != d_memo.end())
+      entry->second.push_back(std::move(rr));
+  }
+}
+
+void PacketHandler::lookup(const QType& qtype, const DNSName& name, int zoneId, DNSPacket* p)
+{
+  auto entry = d_memo.end();
+  if(zoneId == d_memoZoneId)
+    entry = d_memo.find(name);
+
+  if(entry == d_memo.end()) {
+    d_memoHit = false;
+    B.lookup(qtype, name, zoneId, p);
+    return;
+  }
+
+  d_memoHit = true;
+  d_memoAnswers.clear();
+  d_memoPos = 0;
+  for(const auto& rr : entry->second) {
+    if(qtype.getCode() == QType::ANY || rr.dr.d_type == qtype.getCode()) {
+      d_memoAnswers.push_back(rr);
+      d_memoAnswers.back().dr.d_name = name; // keep the case of the question
+    }
+  }
+}
+
+bool PacketHandler::get(DNSZoneRecord& rr)
+{
+  if(!d_memoHit)
+    return B.get(rr);
+
+  if(d_memoPos == d_memoAnswers.size())
+    return false;
+  rr = d_memoAnswers[d_memoPos++];
+  return true;
+}
+
 UeberBackend *PacketHandler::getBackend()
 {
   return &B;
@@ -127,9 +294,9 @@ bool PacketHandler::addCDNSKEY(DNSPacket& p, std::unique_ptr<DNSPacket>& r, cons
   }
 
   if(::arg().mustDo("direct-dnskey")) {
-    B.lookup(QType(QType::CDNSKEY), p.qdomain, sd.domain_id, &p);
+    lookup(QType(QType::CDNSKEY), p.qdomain, sd.domain_id, &p);
 
-    while(B.get(rr)) {
+    while(get(rr)) {
       rr.dr.d_ttl=sd.default_ttl;
       r->addRecord(rr);
       haveOne=true;
@@ -163,9 +330,9 @@ bool PacketHandler::addDNSKEY(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const
   }
 
   if(::arg().mustDo("direct-dnskey")) {
-    B.lookup(QType(QType::DNSKEY), p.qdomain, sd.domain_id, &p);
+    lookup(QType(QType::DNSKEY), p.qdomain, sd.domain_id, &p);
 
-    while(B.get(rr)) {
+    while(get(rr)) {
       rr.dr.d_ttl=sd.default_ttl;
       r->addRecord(rr);
       haveOne=true;
@@ -213,9 +380,9 @@ bool PacketHandler::addCDS(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const SO
   }
 
   if(::arg().mustDo("direct-dnskey")) {
-    B.lookup(QType(QType::CDS), p.qdomain, sd.domain_id, &p);
+    lookup(QType(QType::CDS), p.qdomain, sd.domain_id, &p);
 
-    while(B.get(rr)) {
+    while(get(rr)) {
       rr.dr.d_ttl=sd.default_ttl;
       r->addRecord(rr);
       haveOne=true;
@@ -307,8 +474,8 @@ vector<DNSZoneRecord> PacketHandler::getBestReferralNS(DNSPacket& p, const SOADa
   do {
     if(subdomain == sd.qname) // stop at SOA
       break;
-    B.lookup(QType(QType::NS), subdomain, sd.domain_id, &p);
-    while(B.get(rr)) {
+    lookup(QType(QType::NS), subdomain, sd.domain_id, &p);
+    while(get(rr)) {
       ret.push_back(rr); // this used to exclude auth NS records for some reason
     }
     if(!ret.empty())
@@ -326,8 +493,8 @@ vector<DNSZoneRecord> PacketHandler::getBestDNAMESynth(DNSPacket& p, const SOADa
   do {
     DLOG(g_log<<"Attempting DNAME lookup for "<<subdomain<<", sd.qname="<<sd.qname<<endl);
 
-    B.lookup(QType(QType::DNAME), subdomain, sd.domain_id, &p);
-    while(B.get(rr)) {
+    lookup(QType(QType::DNAME), subdomain, sd.domain_id, &p);
+    while(get(rr)) {
       ret.push_back(rr);  // put in the original
       rr.dr.d_type = QType::CNAME;
       rr.dr.d_name = prefix + rr.dr.d_name;
@@ -368,11 +535,11 @@ bool PacketHandler::getBestWildcard(DNSPacket& p, const SOAData& sd, const DNSNa
   wildcard=subdomain;
   while( subdomain.chopOff() && !haveSomething )  {
     if (subdomain.empty()) {
-      B.lookup(QType(QType::ANY), g_wildcarddnsname, sd.domain_id, &p);
+      lookup(QType(QType::ANY), g_wildcarddnsname, sd.domain_id, &p);
     } else {
-      B.lookup(QType(QType::ANY), g_wildcarddnsname+subdomain, sd.domain_id, &p);
+      lookup(QType(QType::ANY), g_wildcarddnsname+subdomain, sd.domain_id, &p);
     }
-    while(B.get(rr)) {
+    while(get(rr)) {
 #ifdef HAVE_LUA_RECORDS
       if(rr.dr.d_type == QType::LUA) {
         if(!doLua) {
@@ -411,10 +578,10 @@ bool PacketHandler::getBestWildcard(DNSPacket& p, const SOAData& sd, const DNSNa
     if ( subdomain == sd.qname || haveSomething ) // stop at SOA or result
       break;
 
-    B.lookup(QType(QType::ANY), subdomain, sd.domain_id, &p);
-    if (B.get(rr)) {
+    lookup(QType(QType::ANY), subdomain, sd.domain_id, &p);
+    if (get(rr)) {
       DLOG(g_log<<"No wildcard match, ancestor exists"<<endl);
-      while (B.get(rr)) ;
+      while (get(rr)) ;
       break;
     }
     wildcard=subdomain;
@@ -621,6 +788,24 @@ static bool getNSEC3Hashes(bool narrow, DNSBackend* db, int id, const std::strin
   return ret;
 }
 
+string PacketHandler::hashQNameWithSaltCached(const NSEC3PARAMRecordContent& ns3rc, const DNSName& qname)
+{
+  if(!d_maxNSEC3HashCacheEntries)
+    return hashQNameWithSalt(ns3rc, qname);
+
+  string hashed;
+  const string name = qname.toDNSStringLC();
+  if(g_nsec3Hashes.get(name, ns3rc, hashed)) {
+    (*d_nsec3HashCacheHits)++;
+    return hashed;
+  }
+
+  (*d_nsec3HashCacheMisses)++;
+  hashed = hashQNameWithSalt(ns3rc, qname);
+  g_nsec3Hashes.insert(name, ns3rc, hashed, d_maxNSEC3HashCacheEntries);
+  return hashed;
+}
+
 void PacketHandler::addNSEC3(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const DNSName& target, const DNSName& wildcard, const DNSName& auth, const NSEC3PARAMRecordContent& ns3rc, bool narrow, int mode)
 {
   DLOG(g_log<<"addNSEC3() mode="<<mode<<" auth="<<auth<<" target="<<target<<" wildcard="<<wildcard<<endl);
@@ -644,7 +829,7 @@ void PacketHandler::addNSEC3(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const
   // add matching NSEC3 RR
   if (mode != 3) {
     unhashed=(mode == 0 || mode == 1 || mode == 5) ? target : closest;
-    hashed=hashQNameWithSalt(ns3rc, unhashed);
+    hashed=hashQNameWithSaltCached(ns3rc, unhashed);
     DLOG(g_log<<"1 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl);
 
     getNSEC3Hashes(narrow, sd.db, sd.domain_id,  hashed, false, unhashed, before, after, mode);
@@ -664,7 +849,7 @@ void PacketHandler::addNSEC3(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const
       }
       doNextcloser = true;
       unhashed=closest;
-      hashed=hashQNameWithSalt(ns3rc, unhashed);
+      hashed=hashQNameWithSaltCached(ns3rc, unhashed);
       DLOG(g_log<<"1 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl);
 
       getNSEC3Hashes(narrow, sd.db, sd.domain_id,  hashed, false, unhashed, before, after);
@@ -684,7 +869,7 @@ void PacketHandler::addNSEC3(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const
     }
     while( next.chopOff() && !(next==closest));
 
-    hashed=hashQNameWithSalt(ns3rc, unhashed);
+    hashed=hashQNameWithSaltCached(ns3rc, unhashed);
     DLOG(g_log<<"2 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl);
 
     getNSEC3Hashes(narrow, sd.db,sd.domain_id,  hashed, true, unhashed, before, after);
@@ -696,7 +881,7 @@ void PacketHandler::addNSEC3(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const
   if (mode == 2 || mode == 4) {
     unhashed=g_wildcarddnsname+closest;
 
-    hashed=hashQNameWithSalt(ns3rc, unhashed);
+    hashed=hashQNameWithSaltCached(ns3rc, unhashed);
     DLOG(g_log<<"3 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl);
 
     getNSEC3Hashes(narrow, sd.db, sd.domain_id,  hashed, (mode != 2), unhashed, before, after);
@@ -996,10 +1181,10 @@ void PacketHandler::makeNOError(DNSPacket& p, std::unique_ptr<DNSPacket>& r, con
 bool PacketHandler::addDSforNS(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const SOAData& sd, const DNSName& dsname)
 {
   //cerr<<"Trying to find a DS for '"<<dsname<<"', domain_id = "<<sd.domain_id<<endl;
-  B.lookup(QType(QType::DS), dsname, sd.domain_id, &p);
+  lookup(QType(QType::DS), dsname, sd.domain_id, &p);
   DNSZoneRecord rr;
   bool gotOne=false;
-  while(B.get(rr)) {
+  while(get(rr)) {
     gotOne=true;
     rr.dr.d_place = DNSResourceRecord::AUTHORITY;
     r->addRecord(rr);
@@ -1104,6 +1289,9 @@ std::unique_ptr<DNSPacket> PacketHandler::doQuestion(DNSPacket& p)
   std::unique_ptr<DNSPacket> r{nullptr};
   bool noCache=false;
 
+  d_memo.clear();
+  d_memoHit=false;
+
 #ifdef HAVE_LUA_RECORDS
   bool doLua=g_doLuaRecord;
 #endif
@@ -1263,6 +1451,8 @@ std::unique_ptr<DNSPacket> PacketHandler::doQuestion(DNSPacket& p)
 
     authSet.insert(sd.qname);
     d_dnssec=(p.d_dnssecOk && d_dk.isSecuredZone(sd.qname));
+    if(d_coalesceLookups)
+      fillLookupMemo(p, sd, target);
     doSigs |= d_dnssec;
 
     if(!retargetcount) r->qdomainzone=sd.qname;
@@ -1325,13 +1515,13 @@ std::unique_ptr<DNSPacket> PacketHandler::doQuestion(DNSPacket& p)
 #endif
 
     // see what we get..
-    B.lookup(QType(QType::ANY), target, sd.domain_id, &p);
+    lookup(QType(QType::ANY), target, sd.domain_id, &p);
     rrset.clear();
     haveAlias.trimToLabels(0);
     aliasScopeMask = 0;
     weDone = weRedirected = weHaveUnauth =  false;
     
-    while(B.get(rr)) {
+    while(get(rr)) {
 #ifdef HAVE_LUA_RECORDS
       if(rr.dr.d_type == QType::LUA) {
         if(!doLua)
@@ -81,6 +81,7 @@ private:
   void addNSEC(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const DNSName &target, const DNSName &wildcard, const DNSName& auth, int mode);
   void addNSEC3(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const DNSName &target, const DNSName &wildcard, const DNSName& auth, const NSEC3PARAMRecordContent& nsec3param, bool narrow, int mode);
   void emitNSEC(std::unique_ptr<DNSPacket>& r, const SOAData& sd, const DNSName& name, const DNSName& next, int mode);
+  string hashQNameWithSaltCached(const NSEC3PARAMRecordContent& ns3rc, const DNSName& qname);
   void emitNSEC3(std::unique_ptr<DNSPacket>& r, const SOAData& sd, const NSEC3PARAMRecordContent &ns3rc, const DNSName& unhashed, const string& begin, const string& end, int mode);
   int processUpdate(DNSPacket& p);
   int forwardPacket(const string &msgPrefix, const DNSPacket& p, const DomainInfo& di);
@@ -103,16 +104,32 @@ private:
 
   void tkeyHandler(const DNSPacket& p, std::unique_ptr<DNSPacket>& r); //<! process TKEY record, and adds TKEY record to (r)eply, or error code.
 
+  void fillLookupMemo(DNSPacket& p, const SOAData& sd, const DNSName& target);
+  //! Same as B.lookup() and B.get(), but served from the lookup memo when it holds the name
+  void lookup(const QType& qtype, const DNSName& name, int zoneId, DNSPacket* p);
+  bool get(DNSZoneRecord& rr);
+
   static AtomicCounter s_count;
   static pthread_mutex_t s_rfc2136lock;
   bool d_logDNSDetails;
   bool d_doIPv6AdditionalProcessing;
   bool d_doDNAME;
   bool d_doExpandALIAS;
+  bool d_coalesceLookups;
+  size_t d_maxNSEC3HashCacheEntries;
+  AtomicCounter* d_nsec3HashCacheHits{nullptr};
+  AtomicCounter* d_nsec3HashCacheMisses{nullptr};
   bool d_dnssec;
   std::unique_ptr<AuthLua4> d_pdl;
   std::unique_ptr<AuthLua4> d_update_policy_lua;
 
+  // records of the query name, its ancestors and their wildcards, fetched in one go when coalesce-lookups is set
+  map<DNSName, vector<DNSZoneRecord> > d_memo;
+  vector<DNSZoneRecord> d_memoAnswers;
+  size_t d_memoPos{0};
+  int d_memoZoneId{-1};
+  bool d_memoHit{false};
+
   UeberBackend B; // every thread an own instance
   DNSSECKeeper d_dk; // B is shared with DNSSECKeeper
 };
@@ -7,6 +7,7 @@
 #include "dnswriter.hh"
 #include "dnsrecords.hh"
 #include "iputils.hh"
+#include "zoneparser-tng.hh"
 #include <fstream>
 
 #ifndef RECURSOR
@@ -821,6 +822,38 @@ struct StatRingDNSNameQTypeTest
 };
 
 
+struct ZoneParserTest
+{
+  explicit ZoneParserTest(unsigned int delegations) : d_delegations(delegations)
+  {
+    d_zonedata.push_back("$TTL 86400");
+    d_zonedata.push_back("@ IN SOA ns1.example.com. hostmaster.example.com. 1 3600 600 1209600 3600");
+    for(unsigned int n = 0; n < d_delegations; ++n) {
+      string name="domain"+std::to_string(n);
+      d_zonedata.push_back(name+" IN NS ns1."+name);
+      d_zonedata.push_back(name+" IN NS ns2."+name+".example.com.");
+      d_zonedata.push_back(name+" 3600 IN DS 12345 8 2 3c7d4ec5aec1b2e2eb1b0a9bc5b4a4e3c2c8e6d4b7d2e8c9a6f2a1b3c4d5e6f7");
+      d_zonedata.push_back("ns1."+name+" IN A 192.0.2.1");
+    }
+  }
+
+  string getName() const
+  {
+    return "ZoneParserTNG "+std::to_string(d_delegations)+" delegations";
+  }
+
+  void operator()() const
+  {
+    ZoneParserTNG zpt(d_zonedata, DNSName("example.com"));
+    DNSResourceRecord rr;
+    while(zpt.get(rr))
+      ;
+  }
+
+  vector<string> d_zonedata;
+  unsigned int d_delegations;
+};
+
 struct NetmaskTreeTest
 {
   string getName() const { return "NetmaskTreeTest"; }
@@ -919,6 +952,8 @@ try
 
   doRun(NetmaskTreeTest());
 
+  doRun(ZoneParserTest(1000));
+
 #ifndef RECURSOR
   S.doRings();
 
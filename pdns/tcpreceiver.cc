@@ -48,6 +48,7 @@
 #include "distributor.hh"
 #include "lock.hh"
 #include "logger.hh"
+#include "mplexer.hh"
 #include "arguments.hh"
 
 #include "common_startup.hh"
@@ -78,73 +79,7 @@ unsigned int TCPNameserver::d_maxConnectionDuration;
 std::mutex TCPNameserver::s_clientsCountMutex;
 std::map<ComboAddress,size_t,ComboAddress::addressOnlyLessThan> TCPNameserver::s_clientsCount;
 
-void TCPNameserver::go()
-{
-  g_log<<Logger::Error<<"Creating backend connection for TCP"<<endl;
-  s_P.reset();
-  try {
-    s_P=make_unique<PacketHandler>();
-  }
-  catch(PDNSException &ae) {
-    g_log<<Logger::Error<<"TCP server is unable to launch backends - will try again when questions come in: "<<ae.reason<<endl;
-  }
-  pthread_create(&d_tid, 0, launcher, static_cast<void *>(this));
-}
-
-void *TCPNameserver::launcher(void *data)
-{
-  static_cast<TCPNameserver *>(data)->thread();
-  return 0;
-}
-
-// throws PDNSException if things didn't go according to plan, returns 0 if really 0 bytes were read
-static int readnWithTimeout(int fd, void* buffer, unsigned int n, unsigned int idleTimeout, bool throwOnEOF=true, unsigned int totalTimeout=0)
-{
-  unsigned int bytes=n;
-  char *ptr = (char*)buffer;
-  int ret;
-  time_t start = 0;
-  unsigned int remainingTotal = totalTimeout;
-  if (totalTimeout) {
-    start = time(NULL);
-  }
-  while(bytes) {
-    ret=read(fd, ptr, bytes);
-    if(ret < 0) {
-      if(errno==EAGAIN) {
-        ret=waitForData(fd, (totalTimeout == 0 || idleTimeout <= remainingTotal) ? idleTimeout : remainingTotal);
-        if(ret < 0)
-          throw NetworkError("Waiting for data read");
-        if(!ret)
-          throw NetworkError("Timeout reading data");
-        continue;
-      }
-      else
-        throw NetworkError("Reading data: "+stringerror());
-    }
-    if(!ret) {
-      if(!throwOnEOF && n == bytes)
-        return 0;
-      else
-        throw NetworkError("Did not fulfill read from TCP due to EOF");
-    }
-    
-    ptr += ret;
-    bytes -= ret;
-    if (totalTimeout) {
-      time_t now = time(NULL);
-      unsigned int elapsed = now - start;
-      if (elapsed >= remainingTotal) {
-        throw NetworkError("Timeout while reading data");
-      }
-      start = now;
-      remainingTotal -= elapsed;
-    }
-  }
-  return n;
-}
-
-// ditto
+// throws NetworkError if things didn't go according to plan
 static void writenWithTimeout(int fd, const void *buffer, unsigned int n, unsigned int idleTimeout)
 {
   unsigned int bytes=n;
@@ -200,24 +135,21 @@ void connectWithTimeout(int fd, struct sockaddr* remote, size_t socklen)
   ;
 }
 
-void TCPNameserver::sendPacket(std::unique_ptr<DNSPacket>& p, int outsock)
+void TCPNameserver::appendPacket(std::unique_ptr<DNSPacket>& p, std::string& output)
 {
   g_rs.submitResponse(*p, false);
 
-  uint16_t len=htons(p->getString().length());
-  string buffer((const char*)&len, 2);
-  buffer.append(p->getString());
-  writenWithTimeout(outsock, buffer.c_str(), buffer.length(), d_idleTimeout);
+  const string& packet = p->getString();
+  uint16_t len=htons(packet.length());
+  output.append((const char*)&len, 2);
+  output.append(packet);
 }
 
-
-void TCPNameserver::getQuestion(int fd, char *mesg, int pktlen, const ComboAddress &remote, unsigned int totalTime)
-try
+void TCPNameserver::sendPacket(std::unique_ptr<DNSPacket>& p, int outsock)
 {
-  readnWithTimeout(fd, mesg, pktlen, d_idleTimeout, true, totalTime);
-}
-catch(NetworkError& ae) {
-  throw NetworkError("Error reading DNS data from TCP client "+remote.toString()+": "+ae.what());
+  string buffer;
+  appendPacket(p, buffer);
+  writenWithTimeout(outsock, buffer.c_str(), buffer.length(), d_idleTimeout);
 }
 
 static void incTCPAnswerCount(const ComboAddress& remote)
@@ -229,16 +161,9 @@ static void incTCPAnswerCount(const ComboAddress& remote)
     S.inc("tcp4-answers");
 }
 
-static bool maxConnectionDurationReached(unsigned int maxConnectionDuration, time_t start, unsigned int& remainingTime)
+static bool maxConnectionDurationReached(unsigned int maxConnectionDuration, time_t start)
 {
-  if (maxConnectionDuration) {
-    time_t elapsed = time(NULL) - start;
-    if (elapsed >= maxConnectionDuration) {
-      return true;
-    }
-    remainingTime = maxConnectionDuration - elapsed;
-  }
-  return false;
+  return maxConnectionDuration && time(nullptr) - start >= maxConnectionDuration;
 }
 
 void TCPNameserver::decrementClientCount(const ComboAddress& remote)
@@ -252,173 +177,526 @@ void TCPNameserver::decrementClientCount(const ComboAddress& remote)
   }
 }
 
-void *TCPNameserver::doConnection(void *data)
+/* A client connection. It belongs to exactly one worker at a time, except while a zone transfer
+   is in progress, in which case it is owned by a transfer thread and then handed back to its worker.
+   Destroying it closes the socket and frees the slot it took. */
+struct TCPNameserver::Connection
 {
-  setThreadName("pdns/tcpConnect");
-  std::unique_ptr<DNSPacket> packet;
-  // Fix gcc-4.0 error (on AMD64)
-  int fd=(int)(long)data; // gotta love C (generates a harmless warning on opteron)
-  ComboAddress remote;
-  socklen_t remotelen=sizeof(remote);
-  size_t transactions = 0;
-  time_t start = 0;
-  if (d_maxConnectionDuration) {
-    start = time(NULL);
+  Connection(int fd, const ComboAddress& remote): d_remote(remote), d_fd(fd)
+  {
+    if (d_maxConnectionDuration) {
+      d_start = time(nullptr);
+    }
   }
 
-  pthread_detach(pthread_self());
-  if(getpeername(fd, (struct sockaddr *)&remote, &remotelen) < 0) {
-    g_log<<Logger::Warning<<"Received question from socket which had no remote address, dropping ("<<stringerror()<<")"<<endl;
-    d_connectionroom_sem->post();
+  ~Connection()
+  {
     try {
-      closesocket(fd);
+      closesocket(d_fd);
     }
     catch(const PDNSException& e) {
       g_log<<Logger::Error<<"Error closing TCP socket: "<<e.reason<<endl;
     }
-    return 0;
+    d_connectionroom_sem->post();
+    decrementClientCount(d_remote);
   }
 
-  setNonBlocking(fd);
-  try {
-    int mesgsize=65535;
-    scoped_array<char> mesg(new char[mesgsize]);
-    
-    DLOG(g_log<<"TCP Connection accepted on fd "<<fd<<endl);
-    bool logDNSQueries= ::arg().mustDo("log-dns-queries");
+  /* the AXFR or IXFR query, while the connection is waiting for a transfer thread */
+  std::unique_ptr<DNSPacket> d_transferQuery;
+  /* received but not yet processed, might hold several pipelined queries */
+  std::string d_input;
+  /* answers not yet sent */
+  std::string d_output;
+  size_t d_outputPos{0};
+  ComboAddress d_remote;
+  time_t d_start{0};
+  size_t d_transactions{0};
+  size_t d_worker{0};
+  int d_fd;
+  /* waiting for the socket to be writable, not reading in the meantime */
+  bool d_writing{false};
+  /* the client closed its side or the connection is being dropped, close once everything has been sent */
+  bool d_eof{false};
+};
+
+/* An event loop multiplexing connections. Queries are answered inline using the worker's own
+   PacketHandler, zone transfers are handed to the transfer threads. */
+class TCPNameserver::Worker
+{
+public:
+  Worker(size_t id): d_mplexer(FDMultiplexer::getMultiplexerSilent()), d_id(id)
+  {
+    if (pipe(d_pipe) < 0) {
+      throw PDNSException("Unable to create the pipe of a TCP worker: "+stringerror());
+    }
+    setCloseOnExec(d_pipe[0]);
+    setCloseOnExec(d_pipe[1]);
+  }
+
+  /* can be called from any thread */
+  void dispatch(std::unique_ptr<Connection>&& conn)
+  {
+    conn->d_worker = d_id;
+    Connection* ptr = conn.release();
+    ssize_t sent;
+    do {
+      sent = write(d_pipe[1], &ptr, sizeof(ptr));
+    }
+    while (sent < 0 && errno == EINTR);
+
+    if (sent != sizeof(ptr)) {
+      g_log<<Logger::Error<<"Error passing a TCP connection to worker "<<d_id<<": "<<stringerror()<<endl;
+      delete ptr;
+    }
+  }
+
+  void run()
+  {
+    setThreadName("pdns/tcpWorker");
+    d_mplexer->addReadFD(d_pipe[0], [this](int fd, FDMultiplexer::funcparam_t& param) { handleIncomingConnection(); });
+
+    struct timeval now;
     for(;;) {
-      unsigned int remainingTime = 0;
-      transactions++;
-      if (d_maxTransactionsPerConn && transactions > d_maxTransactionsPerConn) {
-        g_log << Logger::Notice<<"TCP Remote "<< remote <<" exceeded the number of transactions per connection, dropping.";
-        break;
+      d_mplexer->run(&now);
+      expireConnections(now);
+    }
+  }
+
+private:
+  /* enough for a maximum-sized query, plus whatever came after it */
+  static const size_t s_maxInputSize = 2 * (65535 + 2);
+
+  enum class QueryResult { Answered, Drop, Transfer };
+
+  struct timeval getTTD(const Connection& conn) const
+  {
+    struct timeval ttd;
+    memset(&ttd, 0, sizeof(ttd));
+    if (d_idleTimeout) {
+      gettimeofday(&ttd, nullptr);
+      ttd.tv_sec += d_idleTimeout;
+    }
+    if (d_maxConnectionDuration) {
+      time_t limit = conn.d_start + d_maxConnectionDuration;
+      if (ttd.tv_sec == 0 || limit < ttd.tv_sec) {
+        ttd.tv_sec = limit;
+        ttd.tv_usec = 0;
       }
-      if (maxConnectionDurationReached(d_maxConnectionDuration, start, remainingTime)) {
-        g_log << Logger::Notice<<"TCP Remote "<< remote <<" exceeded the maximum TCP connection duration, dropping.";
-        break;
+    }
+    return ttd;
+  }
+
+  void watch(Connection& conn)
+  {
+    struct timeval ttd = getTTD(conn);
+    Connection* ptr = &conn;
+    if (conn.d_writing) {
+      d_mplexer->addWriteFD(conn.d_fd, [this](int fd, FDMultiplexer::funcparam_t& param) { handleWritable(*boost::any_cast<Connection*>(param)); }, ptr, ttd.tv_sec ? &ttd : nullptr);
+    }
+    else {
+      d_mplexer->addReadFD(conn.d_fd, [this](int fd, FDMultiplexer::funcparam_t& param) { handleReadable(*boost::any_cast<Connection*>(param)); }, ptr, ttd.tv_sec ? &ttd : nullptr);
+    }
+  }
+
+  void unwatch(Connection& conn)
+  {
+    if (conn.d_writing) {
+      d_mplexer->removeWriteFD(conn.d_fd);
+    }
+    else {
+      d_mplexer->removeReadFD(conn.d_fd);
+    }
+  }
+
+  void closeConnection(Connection& conn)
+  {
+    unwatch(conn);
+    d_connections.erase(conn.d_fd);
+  }
+
+  void handleIncomingConnection()
+  {
+    Connection* ptr = nullptr;
+    ssize_t got = read(d_pipe[0], &ptr, sizeof(ptr));
+    if (got != sizeof(ptr)) {
+      if (got < 0 && errno == EINTR) {
+        return;
       }
+      g_log<<Logger::Error<<"Error reading a TCP connection from the pipe of worker "<<d_id<<": "<<(got < 0 ? stringerror() : "short read")<<endl;
+      return;
+    }
 
-      uint16_t pktlen;
-      if(!readnWithTimeout(fd, &pktlen, 2, d_idleTimeout, false, remainingTime))
-        break;
-      else
-        pktlen=ntohs(pktlen);
+    std::unique_ptr<Connection> conn(ptr);
+    Connection& ref = *conn;
+    d_connections[ref.d_fd] = std::move(conn);
+    ref.d_writing = false;
+    watch(ref);
 
-      // this check will always be false *if* no one touches
-      // the mesg array. pktlen can be maximum of 65535 as
-      // it is 2 byte unsigned variable. In getQuestion, we 
-      // write to 0 up to pktlen-1 so 65535 is just right. 
+    /* coming back from a transfer, queries pipelined after the transfer one might be waiting */
+    if (!ref.d_input.empty()) {
+      processInput(ref);
+    }
+  }
+
+  void expireConnections(const struct timeval& now)
+  {
+    for (bool writes : { false, true }) {
+      for (const auto& timeout : d_mplexer->getTimeouts(now, writes)) {
+        Connection* conn = boost::any_cast<Connection*>(timeout.second);
+        g_log<<Logger::Info<<"TCP connection from "<<conn->d_remote.toStringWithPort()<<" timed out"<<endl;
+        closeConnection(*conn);
+      }
+    }
+  }
 
-      // do not remove this check as it will catch if someone
-      // decreases the mesg buffer size for some reason. 
-      if(pktlen > mesgsize) {
-        g_log<<Logger::Warning<<"Received an overly large question from "<<remote.toString()<<", dropping"<<endl;
+  void handleReadable(Connection& conn)
+  {
+    char buffer[16384];
+    while (conn.d_input.size() < s_maxInputSize) {
+      ssize_t got = read(conn.d_fd, buffer, sizeof(buffer));
+      if (got > 0) {
+        conn.d_input.append(buffer, got);
+        if (static_cast<size_t>(got) < sizeof(buffer)) {
+          break;
+        }
+        continue;
+      }
+      if (got == 0) {
+        conn.d_eof = true;
         break;
       }
-      
-      if (maxConnectionDurationReached(d_maxConnectionDuration, start, remainingTime)) {
-        g_log << Logger::Notice<<"TCP Remote "<< remote <<" exceeded the maximum TCP connection duration, dropping.";
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
         break;
       }
+      g_log<<Logger::Info<<"Error reading from TCP client "<<conn.d_remote.toStringWithPort()<<": "<<stringerror()<<endl;
+      closeConnection(conn);
+      return;
+    }
 
-      getQuestion(fd, mesg.get(), pktlen, remote, remainingTime);
-      S.inc("tcp-queries");      
-      if(remote.sin4.sin_family == AF_INET6)
-        S.inc("tcp6-queries");
-      else
-        S.inc("tcp4-queries");
+    processInput(conn);
+  }
 
-      packet=make_unique<DNSPacket>(true);
-      packet->setRemote(&remote);
-      packet->d_tcp=true;
-      packet->setSocket(fd);
-      if(packet->parse(mesg.get(), pktlen)<0)
-        break;
-      
-      if(packet->qtype.getCode()==QType::AXFR) {
-        if(doAXFR(packet->qdomain, packet, fd))
-          incTCPAnswerCount(remote);
-        continue;
-      }
+  void handleWritable(Connection& conn)
+  {
+    sendOutput(conn);
+  }
 
-      if(packet->qtype.getCode()==QType::IXFR) {
-        if(doIXFR(packet, fd))
-          incTCPAnswerCount(remote);
-        continue;
+  /* answers every complete query, then tries to send the answers */
+  void processInput(Connection& conn)
+  {
+    size_t pos = 0;
+    try {
+      while (conn.d_input.size() - pos >= 2) {
+        const uint16_t pktlen = (static_cast<uint8_t>(conn.d_input.at(pos)) << 8) + static_cast<uint8_t>(conn.d_input.at(pos + 1));
+        if (conn.d_input.size() - pos - 2 < pktlen) {
+          break;
+        }
+
+        conn.d_transactions++;
+        if (d_maxTransactionsPerConn && conn.d_transactions > d_maxTransactionsPerConn) {
+          g_log << Logger::Notice<<"TCP Remote "<< conn.d_remote <<" exceeded the number of transactions per connection, dropping."<<endl;
+          conn.d_eof = true;
+          break;
+        }
+        if (maxConnectionDurationReached(d_maxConnectionDuration, conn.d_start)) {
+          g_log << Logger::Notice<<"TCP Remote "<< conn.d_remote <<" exceeded the maximum TCP connection duration, dropping."<<endl;
+          conn.d_eof = true;
+          break;
+        }
+
+        QueryResult result = handleQuery(conn, conn.d_input.data() + pos + 2, pktlen);
+        pos += 2 + pktlen;
+
+        if (result == QueryResult::Drop) {
+          /* the answers to the previous queries still go out */
+          conn.d_eof = true;
+          break;
+        }
+        if (result == QueryResult::Transfer) {
+          conn.d_input.erase(0, pos);
+          handOffTransfer(conn);
+          return;
+        }
       }
+    }
+    catch(PDNSException &ae) {
+      d_P.reset(); // on next call, backend will be recycled
+      g_log<<Logger::Error<<"TCP nameserver had error, cycling backend: "<<ae.reason<<endl;
+      closeConnection(conn);
+      return;
+    }
+    catch(std::exception &e) {
+      g_log<<Logger::Error<<"TCP worker dropping connection because of STL error: "<<e.what()<<endl;
+      closeConnection(conn);
+      return;
+    }
 
-      std::unique_ptr<DNSPacket> reply; 
+    if (conn.d_eof) {
+      conn.d_input.clear();
+    }
+    else {
+      conn.d_input.erase(0, pos);
+    }
+    sendOutput(conn);
+  }
+
+  QueryResult handleQuery(Connection& conn, const char* query, uint16_t len)
+  {
+    S.inc("tcp-queries");
+    if(conn.d_remote.sin4.sin_family == AF_INET6)
+      S.inc("tcp6-queries");
+    else
+      S.inc("tcp4-queries");
+
+    auto packet=make_unique<DNSPacket>(true);
+    packet->setRemote(&conn.d_remote);
+    packet->d_tcp=true;
+    packet->setSocket(conn.d_fd);
+    if(packet->parse(query, len)<0)
+      return QueryResult::Drop;
+
+    if(packet->qtype.getCode()==QType::AXFR || packet->qtype.getCode()==QType::IXFR) {
+      conn.d_transferQuery = std::move(packet);
+      return QueryResult::Transfer;
+    }
+
+    if(d_logDNSQueries)  {
+      string remote_text;
+      if(packet->hasEDNSSubnet())
+        remote_text = packet->getRemote().toString() + "<-" + packet->getRealRemote().toString();
+      else
+        remote_text = packet->getRemote().toString();
+      g_log << Logger::Notice<<"TCP Remote "<< remote_text <<" wants '" << packet->qdomain<<"|"<<packet->qtype.getName() <<
+      "', do = " <<packet->d_dnssecOk <<", bufsize = "<< packet->getMaxReplyLen()<<": ";
+    }
+
+    if(PC.enabled()) {
       auto cached = make_unique<DNSPacket>(false);
-      if(logDNSQueries)  {
-        string remote_text;
-        if(packet->hasEDNSSubnet())
-          remote_text = packet->getRemote().toString() + "<-" + packet->getRealRemote().toString();
-        else
-          remote_text = packet->getRemote().toString();
-        g_log << Logger::Notice<<"TCP Remote "<< remote_text <<" wants '" << packet->qdomain<<"|"<<packet->qtype.getName() <<
-        "', do = " <<packet->d_dnssecOk <<", bufsize = "<< packet->getMaxReplyLen()<<": ";
+      if(packet->couldBeCached() && PC.get(*packet, *cached)) { // short circuit - does the PacketCache recognize this question?
+        if(d_logDNSQueries)
+          g_log<<"packetcache HIT"<<endl;
+        cached->setRemote(&packet->d_remote);
+        cached->d.id=packet->d.id;
+        cached->d.rd=packet->d.rd; // copy in recursion desired bit
+        cached->commitD(); // commit d to the packet                        inlined
+
+        appendPacket(cached, conn.d_output); // presigned, don't do it again
+        return QueryResult::Answered;
       }
+      if(d_logDNSQueries)
+        g_log<<"packetcache MISS"<<endl;
+    }
 
-      if(PC.enabled()) {
-        if(packet->couldBeCached() && PC.get(*packet, *cached)) { // short circuit - does the PacketCache recognize this question?
-          if(logDNSQueries)
-            g_log<<"packetcache HIT"<<endl;
-          cached->setRemote(&packet->d_remote);
-          cached->d.id=packet->d.id;
-          cached->d.rd=packet->d.rd; // copy in recursion desired bit
-          cached->commitD(); // commit d to the packet                        inlined
+    if(!d_P) {
+      g_log<<Logger::Error<<"TCP worker "<<d_id<<" is without backend connections, launching"<<endl;
+      d_P=make_unique<PacketHandler>();
+    }
 
-          sendPacket(cached, fd); // presigned, don't do it again
-          continue;
-        }
-        if(logDNSQueries)
-            g_log<<"packetcache MISS"<<endl;
+    std::unique_ptr<DNSPacket> reply = d_P->doQuestion(*packet); // we really need to ask the backend :-)
+    if(!reply)  // unable to write an answer?
+      return QueryResult::Drop;
+
+    appendPacket(reply, conn.d_output);
+    return QueryResult::Answered;
+  }
+
+  /* sends as much as possible without blocking, switching to write mode if the socket is full */
+  void sendOutput(Connection& conn)
+  {
+    while (conn.d_outputPos < conn.d_output.size()) {
+      ssize_t sent = write(conn.d_fd, conn.d_output.data() + conn.d_outputPos, conn.d_output.size() - conn.d_outputPos);
+      if (sent > 0) {
+        conn.d_outputPos += sent;
+        continue;
       }
-      {
-        Lock l(&s_plock);
-        if(!s_P) {
-          g_log<<Logger::Error<<"TCP server is without backend connections, launching"<<endl;
-          s_P=make_unique<PacketHandler>();
+      if (sent < 0 && errno == EINTR) {
+        continue;
+      }
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if (!conn.d_writing) {
+          unwatch(conn);
+          conn.d_writing = true;
+          watch(conn);
         }
-
-        reply= s_P->doQuestion(*packet); // we really need to ask the backend :-)
+        return;
       }
+      g_log<<Logger::Info<<"Error writing to TCP client "<<conn.d_remote.toStringWithPort()<<": "<<(sent < 0 ? stringerror() : "EOF")<<endl;
+      closeConnection(conn);
+      return;
+    }
 
-      if(!reply)  // unable to write an answer?
-        break;
+    conn.d_output.clear();
+    conn.d_outputPos = 0;
 
-      sendPacket(reply, fd);
+    if (conn.d_eof) {
+      closeConnection(conn);
+      return;
+    }
+
+    if (conn.d_writing) {
+      /* back to reading, which also resets the idle timeout */
+      unwatch(conn);
+      conn.d_writing = false;
+      watch(conn);
+      return;
     }
-  }
-  catch(PDNSException &ae) {
-    Lock l(&s_plock);
-    s_P.reset(); // on next call, backend will be recycled
-    g_log<<Logger::Error<<"TCP nameserver had error, cycling backend: "<<ae.reason<<endl;
-  }
-  catch(NetworkError &e) {
-    g_log<<Logger::Info<<"TCP Connection Thread died because of network error: "<<e.what()<<endl;
-  }
 
-  catch(std::exception &e) {
-    g_log<<Logger::Error<<"TCP Connection Thread died because of STL error: "<<e.what()<<endl;
+    /* still reading, only the idle timeout needs to be reset */
+    struct timeval ttd = getTTD(conn);
+    if (ttd.tv_sec) {
+      d_mplexer->setReadTTD(conn.d_fd, ttd, 0);
+    }
   }
-  catch( ... )
+
+  void handOffTransfer(Connection& conn)
   {
-    g_log << Logger::Error << "TCP Connection Thread caught unknown exception." << endl;
+    unwatch(conn);
+    conn.d_writing = false;
+
+    auto it = d_connections.find(conn.d_fd);
+    Connection* ptr = it->second.release();
+    d_connections.erase(it);
+
+    ssize_t sent;
+    do {
+      sent = write(s_transferPipe[1], &ptr, sizeof(ptr));
+    }
+    while (sent < 0 && errno == EINTR);
+
+    if (sent != sizeof(ptr)) {
+      g_log<<Logger::Error<<"Error passing a TCP connection to the transfer threads: "<<stringerror()<<endl;
+      delete ptr;
+    }
   }
-  d_connectionroom_sem->post();
 
+  std::map<int, std::unique_ptr<Connection>> d_connections;
+  std::unique_ptr<FDMultiplexer> d_mplexer;
+  std::unique_ptr<PacketHandler> d_P;
+  const bool d_logDNSQueries{::arg().mustDo("log-dns-queries")};
+  size_t d_id;
+  int d_pipe[2];
+};
+
+std::vector<std::unique_ptr<TCPNameserver::Worker>> TCPNameserver::s_workers;
+int TCPNameserver::s_transferPipe[2] = { -1, -1 };
+
+void TCPNameserver::go()
+{
+  g_log<<Logger::Error<<"Creating backend connection for TCP"<<endl;
+  s_P.reset();
   try {
-    closesocket(fd);
+    s_P=make_unique<PacketHandler>();
   }
-  catch(const PDNSException& e) {
-    g_log<<Logger::Error<<"Error closing TCP socket: "<<e.reason<<endl;
+  catch(PDNSException &ae) {
+    g_log<<Logger::Error<<"TCP server is unable to launch backends - will try again when questions come in: "<<ae.reason<<endl;
+  }
+
+  if(pipe(s_transferPipe) < 0)
+    throw PDNSException("Unable to create the TCP transfer pipe: "+stringerror());
+  setCloseOnExec(s_transferPipe[0]);
+  setCloseOnExec(s_transferPipe[1]);
+
+  pthread_t tid;
+  int err;
+  const size_t numberOfWorkers = std::max(::arg().asNum("tcp-worker-threads"), 1);
+  for(size_t idx = 0; idx < numberOfWorkers; idx++) {
+    s_workers.push_back(std::unique_ptr<Worker>(new Worker(idx)));
+    if((err = pthread_create(&tid, 0, workerLauncher, static_cast<void *>(s_workers.back().get()))))
+      throw PDNSException("Unable to launch a TCP worker thread: "+stringerror(err));
+    pthread_detach(tid);
+  }
+
+  const size_t numberOfTransferThreads = std::max(::arg().asNum("tcp-transfer-threads"), 1);
+  for(size_t idx = 0; idx < numberOfTransferThreads; idx++) {
+    if((err = pthread_create(&tid, 0, transferLauncher, nullptr)))
+      throw PDNSException("Unable to launch a TCP transfer thread: "+stringerror(err));
+    pthread_detach(tid);
   }
-  decrementClientCount(remote);
 
+  pthread_create(&d_tid, 0, launcher, static_cast<void *>(this));
+}
+
+void *TCPNameserver::launcher(void *data)
+{
+  static_cast<TCPNameserver *>(data)->thread();
   return 0;
 }
 
+void *TCPNameserver::workerLauncher(void *data)
+{
+  static_cast<Worker *>(data)->run();
+  return 0;
+}
+
+void *TCPNameserver::transferLauncher(void *data)
+{
+  setThreadName("pdns/tcpTransfer");
+  for(;;) {
+    Connection* ptr = nullptr;
+    ssize_t got = read(s_transferPipe[0], &ptr, sizeof(ptr));
+    if (got != sizeof(ptr)) {
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      g_log<<Logger::Error<<"Error reading a TCP connection from the transfer pipe: "<<(got < 0 ? stringerror() : "short read")<<endl;
+      continue;
+    }
+
+    std::unique_ptr<Connection> conn(ptr);
+    doTransfer(conn);
+    if (conn) {
+      s_workers.at(conn->d_worker)->dispatch(std::move(conn));
+    }
+  }
+  return 0;
+}
+
+/* Streams the zone using blocking writes, then the connection goes back to its worker.
+   Resets conn if the connection should be closed instead. */
+void TCPNameserver::doTransfer(std::unique_ptr<Connection>& conn)
+try
+{
+  /* answers to the queries received before the transfer one go out first */
+  if (conn->d_outputPos < conn->d_output.size()) {
+    writenWithTimeout(conn->d_fd, conn->d_output.data() + conn->d_outputPos, conn->d_output.size() - conn->d_outputPos, d_idleTimeout);
+  }
+  conn->d_output.clear();
+  conn->d_outputPos = 0;
+
+  auto packet = std::move(conn->d_transferQuery);
+  if(packet->qtype.getCode()==QType::AXFR) {
+    if(doAXFR(packet->qdomain, packet, conn->d_fd))
+      incTCPAnswerCount(conn->d_remote);
+  }
+  else {
+    if(doIXFR(packet, conn->d_fd))
+      incTCPAnswerCount(conn->d_remote);
+  }
+}
+catch(PDNSException &ae) {
+  {
+    Lock l(&s_plock);
+    s_P.reset(); // on next call, backend will be recycled
+  }
+  g_log<<Logger::Error<<"TCP nameserver had error, cycling backend: "<<ae.reason<<endl;
+  conn.reset();
+}
+catch(NetworkError &e) {
+  g_log<<Logger::Info<<"TCP transfer to "<<conn->d_remote.toStringWithPort()<<" aborted because of network error: "<<e.what()<<endl;
+  conn.reset();
+}
+catch(std::exception &e) {
+  g_log<<Logger::Error<<"TCP transfer thread caught STL error: "<<e.what()<<endl;
+  conn.reset();
+}
+catch( ... )
+{
+  g_log << Logger::Error << "TCP transfer thread caught unknown exception." << endl;
+  conn.reset();
+}
 
 // call this method with s_plock held!
 bool TCPNameserver::canDoAXFR(std::unique_ptr<DNSPacket>& q)
@@ -1320,7 +1598,7 @@ TCPNameserver::TCPNameserver()
 }
 
 
-//! Start of TCP operations thread, we launch a new thread for each incoming TCP question
+//! Start of TCP operations thread, accepts the incoming connections and spreads them over the workers
 void TCPNameserver::thread()
 {
   setThreadName("pdns/tcpnameser");
@@ -1361,7 +1639,6 @@ void TCPNameserver::thread()
               s_clientsCount[remote]++;
             }
 
-            pthread_t tid;
             d_connectionroom_sem->wait(); // blocks if no connections are available
 
             int room;
@@ -1369,13 +1646,11 @@ void TCPNameserver::thread()
             if(room<1)
               g_log<<Logger::Warning<<"Limit of simultaneous TCP connections reached - raise max-tcp-connections"<<endl;
 
-            int err;
-            if((err = pthread_create(&tid, 0, &doConnection, reinterpret_cast<void*>(fd)))) {
-              g_log<<Logger::Error<<"Error creating thread: "<<stringerror(err)<<endl;
-              d_connectionroom_sem->post();
-              close(fd);
-              decrementClientCount(remote);
-            }
+            setNonBlocking(fd);
+            DLOG(g_log<<"TCP Connection accepted on fd "<<fd<<endl);
+            // from now on, the connection takes care of closing the socket and releasing its slot
+            s_workers.at(d_nextWorker)->dispatch(make_unique<Connection>(fd, remote));
+            d_nextWorker = (d_nextWorker + 1) % s_workers.size();
           }
         }
       }
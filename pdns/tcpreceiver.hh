@@ -49,15 +49,18 @@ public:
   void go();
   unsigned int numTCPConnections();
 private:
+  struct Connection;
+  class Worker;
 
   static void sendPacket(std::unique_ptr<DNSPacket>& p, int outsock);
-  static int readLength(int fd, ComboAddress *remote);
-  static void getQuestion(int fd, char *mesg, int pktlen, const ComboAddress& remote, unsigned int totalTime);
+  static void appendPacket(std::unique_ptr<DNSPacket>& p, std::string& output);
   static int doAXFR(const DNSName &target, std::unique_ptr<DNSPacket>& q, int outsock);
   static int doIXFR(std::unique_ptr<DNSPacket>& q, int outsock);
   static bool canDoAXFR(std::unique_ptr<DNSPacket>& q);
-  static void *doConnection(void *data);
   static void *launcher(void *data);
+  static void *workerLauncher(void *data);
+  static void *transferLauncher(void *data);
+  static void doTransfer(std::unique_ptr<Connection>& conn);
   static void decrementClientCount(const ComboAddress& remote);
   void thread(void);
   static pthread_mutex_t s_plock;
@@ -72,9 +75,14 @@ private:
   static size_t d_maxConnectionsPerClient;
   static unsigned int d_idleTimeout;
   static unsigned int d_maxConnectionDuration;
+  /* event loops multiplexing the connections */
+  static std::vector<std::unique_ptr<Worker>> s_workers;
+  /* connections waiting for a transfer thread, passed as raw pointers */
+  static int s_transferPipe[2];
 
   vector<int>d_sockets;
   vector<struct pollfd> d_prfds;
+  size_t d_nextWorker{0};
 };
 
 #endif /* PDNS_TCPRECEIVER_HH */
@@ -0,0 +1,82 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "auth-zonecache.hh"
+#include "statbag.hh"
+
+extern StatBag S;
+
+BOOST_AUTO_TEST_SUITE(test_auth_zonecache_cc)
+
+static AuthZoneCache::Zone makeZone(const std::string& name, size_t backend, int id)
+{
+  AuthZoneCache::Zone zone;
+  zone.name = DNSName(name);
+  zone.backend = backend;
+  zone.id = id;
+  return zone;
+}
+
+BOOST_AUTO_TEST_CASE(test_best_zone) {
+  AuthZoneCache cache;
+  AuthZoneCache::Zone zone;
+
+  /* disabled by default */
+  cache.replace({makeZone("example.com.", 0, 1)});
+  BOOST_CHECK(!cache.getBestZone(DNSName("www.example.com."), zone));
+  BOOST_CHECK(!cache.needsRefresh(time(nullptr)));
+
+  cache.setRefreshInterval(300);
+  cache.replace({makeZone("example.com.", 0, 1), makeZone("sub.example.com.", 1, 2), makeZone("example.net.", 0, 3)});
+  BOOST_CHECK_EQUAL(cache.size(), 3U);
+  BOOST_CHECK(!cache.needsRefresh(time(nullptr)));
+  BOOST_CHECK(cache.needsRefresh(time(nullptr) + 300));
+
+  BOOST_REQUIRE(cache.getBestZone(DNSName("www.example.com."), zone));
+  BOOST_CHECK_EQUAL(zone.name, DNSName("example.com."));
+  BOOST_CHECK_EQUAL(zone.id, 1);
+
+  BOOST_REQUIRE(cache.getBestZone(DNSName("a.b.SUB.example.com."), zone));
+  BOOST_CHECK_EQUAL(zone.name, DNSName("sub.example.com."));
+  BOOST_CHECK_EQUAL(zone.backend, 1U);
+  BOOST_CHECK_EQUAL(zone.id, 2);
+
+  BOOST_REQUIRE(cache.getBestZone(DNSName("example.net."), zone));
+  BOOST_CHECK_EQUAL(zone.id, 3);
+
+  BOOST_CHECK(!cache.getBestZone(DNSName("com."), zone));
+  BOOST_CHECK(!cache.getBestZone(DNSName("www.example.org."), zone));
+
+  cache.invalidate();
+  BOOST_CHECK_EQUAL(cache.size(), 0U);
+  BOOST_CHECK(cache.needsRefresh(time(nullptr)));
+  BOOST_CHECK(!cache.getBestZone(DNSName("www.example.com."), zone));
+}
+
+BOOST_AUTO_TEST_CASE(test_backend_order) {
+  AuthZoneCache cache;
+  AuthZoneCache::Zone zone;
+  cache.setRefreshInterval(300);
+
+  /* the first backend listing a zone serves it, as without the cache */
+  cache.replace({makeZone("example.com.", 0, 1), makeZone("example.com.", 1, 2), makeZone("sub.example.com.", 1, 3)});
+  BOOST_CHECK_EQUAL(cache.size(), 2U);
+  BOOST_REQUIRE(cache.getBestZone(DNSName("www.example.com."), zone));
+  BOOST_CHECK_EQUAL(zone.backend, 0U);
+  BOOST_CHECK_EQUAL(zone.id, 1);
+  BOOST_REQUIRE(cache.getBestZone(DNSName("www.sub.example.com."), zone));
+  BOOST_CHECK_EQUAL(zone.backend, 1U);
+
+  /* an empty list disables the cache until the next refresh */
+  cache.replace({});
+  BOOST_CHECK_EQUAL(cache.size(), 0U);
+  BOOST_CHECK(!cache.needsRefresh(time(nullptr)));
+  BOOST_CHECK(!cache.getBestZone(DNSName("www.example.com."), zone));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
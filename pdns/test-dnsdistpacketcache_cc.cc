@@ -2,6 +2,8 @@
 #define BOOST_TEST_NO_MAIN
 
 #include <boost/test/unit_test.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 #include "ednscookies.hh"
 #include "ednsoptions.hh"
@@ -10,6 +12,7 @@
 #include "iputils.hh"
 #include "dnswriter.hh"
 #include "dnsdist-cache.hh"
+#include "dnsdist-queryview.hh"
 #include "gettime.hh"
 
 BOOST_AUTO_TEST_SUITE(test_dnsdistpacketcache_cc)
@@ -127,6 +130,71 @@ BOOST_AUTO_TEST_CASE(test_PacketCacheSimple) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_PacketCacheQueryView) {
+  /* lookups done from a DNSQueryView should not need to build the qname */
+  DNSDistPacketCache PC(1000, 86400, 1);
+  struct timespec queryTime;
+  gettime(&queryTime);  // does not have to be accurate ("realTime") in tests
+
+  ComboAddress remote;
+  bool dnssecOK = false;
+  const DNSName name("www.powerdns.com.");
+
+  vector<uint8_t> response;
+  DNSPacketWriter pwR(response, name, QType::A, QClass::IN, 0);
+  pwR.getHeader()->rd = 1;
+  pwR.getHeader()->ra = 1;
+  pwR.getHeader()->qr = 1;
+  pwR.startRecord(name, QType::A, 7200, QClass::IN, DNSResourceRecord::ANSWER);
+  pwR.xfr32BitInt(0x01020304);
+  pwR.commit();
+  uint16_t responseLen = response.size();
+
+  {
+    vector<uint8_t> query;
+    DNSPacketWriter pwQ(query, name, QType::A, QClass::IN, 0);
+    pwQ.getHeader()->rd = 1;
+    DNSQueryView view;
+    BOOST_REQUIRE(view.parse(reinterpret_cast<const char*>(query.data()), query.size()));
+    auto dh = reinterpret_cast<dnsheader*>(query.data());
+    DNSQuestion dq(&view, QType::A, QClass::IN, view.getConsumed(), &remote, &remote, dh, query.size(), query.size(), false, &queryTime);
+    dq.qnameHash = view.getQNameHash();
+
+    char responseBuf[4096];
+    uint16_t responseBufSize = sizeof(responseBuf);
+    uint32_t key = 0;
+    boost::optional<Netmask> subnet;
+    BOOST_CHECK_EQUAL(PC.get(dq, view.getConsumed(), 0, responseBuf, &responseBufSize, &key, subnet, dnssecOK), false);
+    PC.insert(key, subnet, *(getFlagsFromDNSHeader(dh)), dnssecOK, name, QType::A, QClass::IN, reinterpret_cast<const char*>(response.data()), responseLen, false, 0, boost::none);
+    BOOST_CHECK(!dq.qname.isBuilt());
+  }
+
+  {
+    /* different case, same entry */
+    const DNSName upper("WWW.PowerDNS.com.");
+    vector<uint8_t> query;
+    DNSPacketWriter pwQ(query, upper, QType::A, QClass::IN, 0);
+    pwQ.getHeader()->rd = 1;
+    DNSQueryView view;
+    BOOST_REQUIRE(view.parse(reinterpret_cast<const char*>(query.data()), query.size()));
+    DNSQuestion dq(&view, QType::A, QClass::IN, view.getConsumed(), &remote, &remote, reinterpret_cast<dnsheader*>(query.data()), query.size(), query.size(), false, &queryTime);
+    dq.qnameHash = view.getQNameHash();
+
+    char responseBuf[4096];
+    uint16_t responseBufSize = sizeof(responseBuf);
+    uint32_t key = 0;
+    boost::optional<Netmask> subnet;
+    BOOST_CHECK_EQUAL(PC.get(dq, view.getConsumed(), pwQ.getHeader()->id, responseBuf, &responseBufSize, &key, subnet, dnssecOK, 0, true), true);
+    BOOST_CHECK_EQUAL(responseBufSize, responseLen);
+    BOOST_CHECK(!dq.qname.isBuilt());
+    /* the case of the qname is the one from the query */
+    BOOST_CHECK_EQUAL(DNSName(responseBuf, responseBufSize, sizeof(dnsheader), false).toString(), upper.toString());
+  }
+
+  BOOST_CHECK_EQUAL(PC.getHits(), 1U);
+  BOOST_CHECK_EQUAL(PC.getMisses(), 1U);
+}
+
 BOOST_AUTO_TEST_CASE(test_PacketCacheServFailTTL) {
   const size_t maxEntries = 150000;
   DNSDistPacketCache PC(maxEntries, 86400, 1);
@@ -415,7 +483,7 @@ BOOST_AUTO_TEST_CASE(test_PCCollision) {
   boost::optional<Netmask> subnetOut;
   bool dnssecOK = false;
 
-  /* lookup for a query with an ECS value of 10.0.118.46/32,
+  /* lookup for a query with an ECS value of 10.0.229.4/32,
      insert a corresponding response */
   {
     vector<uint8_t> query;
@@ -424,7 +492,7 @@ BOOST_AUTO_TEST_CASE(test_PCCollision) {
     pwQ.getHeader()->id = qid;
     DNSPacketWriter::optvect_t ednsOptions;
     EDNSSubnetOpts opt;
-    opt.source = Netmask("10.0.118.46/32");
+    opt.source = Netmask("10.0.229.4/32");
     ednsOptions.push_back(std::make_pair(EDNSOptionCode::ECS, makeEDNSSubnetOptsString(opt)));
     pwQ.addOpt(512, 0, 0, ednsOptions);
     pwQ.commit();
@@ -460,7 +528,7 @@ BOOST_AUTO_TEST_CASE(test_PCCollision) {
     BOOST_CHECK_EQUAL(subnetOut->toString(), opt.source.toString());
   }
 
-  /* now lookup for the same query with an ECS value of 10.0.123.193/32
+  /* now lookup for the same query with an ECS value of 10.1.36.42/32
      we should get the same key (collision) but no match */
   {
     vector<uint8_t> query;
@@ -469,7 +537,7 @@ BOOST_AUTO_TEST_CASE(test_PCCollision) {
     pwQ.getHeader()->id = qid;
     DNSPacketWriter::optvect_t ednsOptions;
     EDNSSubnetOpts opt;
-    opt.source = Netmask("10.0.123.193/32");
+    opt.source = Netmask("10.1.36.42/32");
     ednsOptions.push_back(std::make_pair(EDNSOptionCode::ECS, makeEDNSSubnetOptsString(opt)));
     pwQ.addOpt(512, 0, 0, ednsOptions);
     pwQ.commit();
@@ -543,4 +611,160 @@ BOOST_AUTO_TEST_CASE(test_PCDNSSECCollision) {
 
 }
 
+BOOST_AUTO_TEST_CASE(test_PacketCacheSharedMemory) {
+  const size_t maxEntries = 1000;
+  const std::string path = "/tmp/dnsdist-test-shm-cache." + std::to_string(getpid());
+  unlink(path.c_str());
+
+  DNSName qname("www.powerdns.com.");
+  uint16_t qtype = QType::A;
+  uint16_t qid = 0x42;
+  uint32_t key = 0;
+  boost::optional<Netmask> subnet;
+  bool dnssecOK = false;
+  ComboAddress remote("192.0.2.1");
+  struct timespec queryTime;
+  gettime(&queryTime);
+
+  vector<uint8_t> query;
+  DNSPacketWriter pwQ(query, qname, qtype, QClass::IN, 0);
+  pwQ.getHeader()->rd = 1;
+  pwQ.getHeader()->id = qid;
+
+  vector<uint8_t> response;
+  DNSPacketWriter pwR(response, qname, qtype, QClass::IN, 0);
+  pwR.getHeader()->rd = 1;
+  pwR.getHeader()->ra = 1;
+  pwR.getHeader()->qr = 1;
+  pwR.getHeader()->id = qid;
+  pwR.startRecord(qname, qtype, 100, QClass::IN, DNSResourceRecord::ANSWER);
+  pwR.xfr32BitInt(0x01020304);
+  pwR.commit();
+
+  try {
+    {
+      DNSDistPacketCache PC(maxEntries, 86400, 1);
+      PC.enableSharedMemory(path, SharedPacketCacheStore::s_defaultSlotSize);
+      BOOST_CHECK(PC.isShared());
+      BOOST_CHECK_EQUAL(PC.getSize(), 0U);
+
+      char responseBuf[4096];
+      uint16_t responseBufSize = sizeof(responseBuf);
+      DNSQuestion dq(&qname, qtype, QClass::IN, 0, &remote, &remote, pwQ.getHeader(), query.size(), query.size(), false, &queryTime);
+      bool found = PC.get(dq, qname.wirelength(), 0, responseBuf, &responseBufSize, &key, subnet, dnssecOK);
+      BOOST_CHECK_EQUAL(found, false);
+      BOOST_CHECK_EQUAL(PC.getMisses(), 1U);
+
+      PC.insert(key, subnet, *(getFlagsFromDNSHeader(pwQ.getHeader())), dnssecOK, qname, qtype, QClass::IN, reinterpret_cast<const char*>(response.data()), response.size(), false, RCode::NoError, boost::none);
+      BOOST_CHECK_EQUAL(PC.getSize(), 1U);
+    }
+
+    /* a second cache using the same file, as another process or a restarted one would */
+    DNSDistPacketCache PC(maxEntries, 86400, 1);
+    PC.enableSharedMemory(path, SharedPacketCacheStore::s_defaultSlotSize);
+    BOOST_CHECK_EQUAL(PC.getSize(), 1U);
+
+    {
+      /* same name, different case */
+      DNSName upperQName("WWW.PowerDNS.com.");
+      vector<uint8_t> upperQuery;
+      DNSPacketWriter pwUQ(upperQuery, upperQName, qtype, QClass::IN, 0);
+      pwUQ.getHeader()->rd = 1;
+      pwUQ.getHeader()->id = qid + 1;
+
+      char responseBuf[4096];
+      uint16_t responseBufSize = sizeof(responseBuf);
+      DNSQuestion dq(&upperQName, qtype, QClass::IN, 0, &remote, &remote, pwUQ.getHeader(), upperQuery.size(), upperQuery.size(), false, &queryTime);
+      bool found = PC.get(dq, upperQName.wirelength(), qid + 1, responseBuf, &responseBufSize, &key, subnet, dnssecOK, 0, true);
+      BOOST_CHECK_EQUAL(found, true);
+      BOOST_REQUIRE_EQUAL(responseBufSize, response.size());
+      /* the ID and the qname come from the query */
+      BOOST_CHECK_EQUAL(reinterpret_cast<const dnsheader*>(responseBuf)->id, qid + 1);
+      BOOST_CHECK_EQUAL(memcmp(responseBuf + sizeof(dnsheader), upperQName.toDNSString().c_str(), upperQName.wirelength()), 0);
+      BOOST_CHECK_EQUAL(memcmp(responseBuf + sizeof(dnsheader) + qname.wirelength(), response.data() + sizeof(dnsheader) + qname.wirelength(), response.size() - sizeof(dnsheader) - qname.wirelength()), 0);
+    }
+
+    {
+      /* same key but TCP, no match */
+      char responseBuf[4096];
+      uint16_t responseBufSize = sizeof(responseBuf);
+      uint32_t tcpKey = 0;
+      DNSQuestion dq(&qname, qtype, QClass::IN, 0, &remote, &remote, pwQ.getHeader(), query.size(), query.size(), true, &queryTime);
+      bool found = PC.get(dq, qname.wirelength(), 0, responseBuf, &responseBufSize, &tcpKey, subnet, dnssecOK);
+      BOOST_CHECK_EQUAL(found, false);
+    }
+
+    BOOST_CHECK_EQUAL(PC.expungeByName(DNSName("powerdns.com."), QType::AAAA, true), 0U);
+    BOOST_CHECK_EQUAL(PC.expungeByName(DNSName("powerdns.com."), QType::ANY, true), 1U);
+    BOOST_CHECK_EQUAL(PC.getSize(), 0U);
+
+    /* a different layout is refused */
+    DNSDistPacketCache otherPC(maxEntries * 2, 86400, 1);
+    BOOST_CHECK_THROW(otherPC.enableSharedMemory(path, SharedPacketCacheStore::s_defaultSlotSize), std::runtime_error);
+  }
+  catch (...) {
+    unlink(path.c_str());
+    throw;
+  }
+
+  unlink(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_PacketCacheSharedMemoryStaleWriter) {
+  const std::string path = "/tmp/dnsdist-test-shm-cache-stale." + std::to_string(getpid());
+  unlink(path.c_str());
+
+  try {
+    const DNSName qname("www.powerdns.com.");
+    const std::string dnsQName = qname.toDNSString();
+    const std::string response(64, 'x');
+    const time_t now = time(nullptr);
+    SharedPacketCacheStore::Entry entry;
+    entry.added = now;
+    entry.validity = now + 3600;
+    entry.qtype = QType::A;
+    entry.qclass = QClass::IN;
+    entry.len = response.size();
+
+    SharedPacketCacheStore store(path, 1, SharedPacketCacheStore::s_defaultSlotSize);
+    BOOST_REQUIRE(store.insert(42, entry, dnsQName, response.c_str()) == SharedPacketCacheStore::InsertResult::Inserted);
+
+    /* map the file ourselves to mark the only slot as locked by a writer that went away,
+       the sequence counter (odd) and the time of the lock being the first 8 bytes of the
+       slot, which follows a 64-byte header */
+    int fd = open(path.c_str(), O_RDWR);
+    BOOST_REQUIRE(fd >= 0);
+    void* addr = mmap(nullptr, 64 + sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    BOOST_REQUIRE(addr != MAP_FAILED);
+    auto slotSeq = reinterpret_cast<std::atomic<uint64_t>*>(reinterpret_cast<char*>(addr) + 64);
+
+    char buffer[4096];
+    SharedPacketCacheStore::Entry found;
+
+    /* recently locked, the writer might still be there */
+    slotSeq->store((static_cast<uint64_t>(now) << 32) | 3);
+    BOOST_CHECK(store.get(42, dnsQName, found, buffer, sizeof(buffer)) == SharedPacketCacheStore::LookupResult::Busy);
+    BOOST_CHECK(store.insert(42, entry, dnsQName, response.c_str()) == SharedPacketCacheStore::InsertResult::Busy);
+    BOOST_CHECK_EQUAL(store.expunge(0), 0U);
+
+    /* locked a long time ago, the slot is taken over and its content, which might be partial, discarded */
+    slotSeq->store((static_cast<uint64_t>(now - SharedPacketCacheStore::s_staleLockDelay - 1) << 32) | 3);
+    BOOST_CHECK(store.get(42, dnsQName, found, buffer, sizeof(buffer)) == SharedPacketCacheStore::LookupResult::Busy);
+    BOOST_CHECK(store.insert(42, entry, dnsQName, response.c_str()) == SharedPacketCacheStore::InsertResult::Inserted);
+    BOOST_CHECK_EQUAL(slotSeq->load() & 1, 0U);
+    BOOST_CHECK(store.get(42, dnsQName, found, buffer, sizeof(buffer)) == SharedPacketCacheStore::LookupResult::Found);
+    BOOST_CHECK_EQUAL(found.len, response.size());
+    BOOST_CHECK_EQUAL(std::string(buffer, found.len), response);
+
+    munmap(addr, 64 + sizeof(uint64_t));
+  }
+  catch (...) {
+    unlink(path.c_str());
+    throw;
+  }
+
+  unlink(path.c_str());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,93 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <thread>
+#include <boost/test/unit_test.hpp>
+#include "mpmcqueue.hh"
+
+BOOST_AUTO_TEST_SUITE(test_mpmcqueue_hh)
+
+BOOST_AUTO_TEST_CASE(test_mpmcqueue_basic) {
+  MPMCQueue<int> queue(3);
+  BOOST_CHECK_EQUAL(queue.capacity(), 4U);
+
+  int value = 0;
+  BOOST_CHECK(!queue.pop(value));
+
+  for (int idx = 0; idx < 4; idx++) {
+    BOOST_CHECK(queue.push(std::move(idx)));
+  }
+  /* full */
+  BOOST_CHECK(!queue.push(42));
+
+  for (int idx = 0; idx < 4; idx++) {
+    BOOST_CHECK(queue.pop(value));
+    BOOST_CHECK_EQUAL(value, idx);
+  }
+  BOOST_CHECK(!queue.pop(value));
+
+  /* second lap around the ring */
+  BOOST_CHECK(queue.push(42));
+  BOOST_CHECK(queue.pop(value));
+  BOOST_CHECK_EQUAL(value, 42);
+
+  BOOST_CHECK_THROW(MPMCQueue<int>(0), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_mpmcqueue_unique_ptr) {
+  MPMCQueue<std::unique_ptr<std::string>> queue(2);
+  BOOST_CHECK(queue.push(std::unique_ptr<std::string>(new std::string("powerdns"))));
+
+  std::unique_ptr<std::string> value;
+  BOOST_CHECK(queue.pop(value));
+  BOOST_REQUIRE(value != nullptr);
+  BOOST_CHECK_EQUAL(*value, "powerdns");
+}
+
+BOOST_AUTO_TEST_CASE(test_mpmcqueue_concurrent) {
+  const size_t numberOfProducers = 4;
+  const size_t numberOfConsumers = 4;
+  const uint64_t perProducer = 100000;
+  MPMCQueue<uint64_t> queue(128);
+  std::atomic<uint64_t> received{0};
+  std::atomic<uint64_t> sum{0};
+
+  std::vector<std::thread> threads;
+  for (size_t idx = 0; idx < numberOfConsumers; idx++) {
+    threads.push_back(std::thread([&queue, &received, &sum, numberOfProducers, perProducer]() {
+      uint64_t value;
+      while (received.load() < numberOfProducers * perProducer) {
+        if (queue.pop(value)) {
+          sum += value;
+          received++;
+        }
+        else {
+          std::this_thread::yield();
+        }
+      }
+    }));
+  }
+
+  for (size_t idx = 0; idx < numberOfProducers; idx++) {
+    threads.push_back(std::thread([&queue, perProducer]() {
+      for (uint64_t value = 1; value <= perProducer; value++) {
+        uint64_t copy = value;
+        while (!queue.push(std::move(copy))) {
+          std::this_thread::yield();
+        }
+      }
+    }));
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  /* every value has been received exactly once */
+  BOOST_CHECK_EQUAL(received.load(), numberOfProducers * perProducer);
+  BOOST_CHECK_EQUAL(sum.load(), numberOfProducers * (perProducer * (perProducer + 1) / 2));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,7 @@
 
 #include <boost/tuple/tuple.hpp>
 
+#include "base32.hh"
 #include "base64.hh"
 #include "dnsseckeeper.hh"
 #include "dnssecinfra.hh"
@@ -256,4 +257,36 @@ BOOST_AUTO_TEST_CASE(test_ed448_signer) {
 }
 #endif /* defined(HAVE_LIBDECAF) || defined(HAVE_LIBCRYPTO_ED448) */
 
+BOOST_AUTO_TEST_CASE(test_hashQNameWithSalt) {
+  /* RFC 5155 Appendix A: salt aabbccdd, 12 additional iterations */
+  const std::vector<std::pair<std::string, std::string>> vectors = {
+    {"example.", "0p9mhaveqvm6t7vbl5lop2u3t2rp3tom"},
+    {"a.example.", "35mthgpgcu1qg68fab165klnsnk3dpvl"},
+    {"ai.example.", "gjeqe526plbf1g8mklp59enfd789njgi"},
+    {"ns1.example.", "2t7b4g4vsa5smi47k61mv5bv1a22bojr"},
+    {"ns2.example.", "q04jkcevqvmu85r014c7dkba38o0ji5r"},
+    {"w.example.", "k8udemvp1j2f7eg6jebps17vp3n8i58h"},
+    {"*.w.example.", "r53bq7cc2uvmubfu5ocmm6pers9tk9en"},
+    {"x.w.example.", "b4um86eghhds6nea196smvmlo4ors995"},
+    {"y.w.example.", "ji6neoaepv8b5o6k4ev33abha8ht9fgc"},
+    {"x.y.w.example.", "2vptu5timamqttgl4luu9kg21e0aor3s"},
+    {"xx.example.", "t644ebqk9bibcna874givr6joj62mlhv"},
+  };
+
+  const std::string salt("\xaa\xbb\xcc\xdd", 4);
+  for (const auto& vector : vectors) {
+    BOOST_CHECK_EQUAL(toBase32Hex(hashQNameWithSalt(salt, 12, DNSName(vector.first))), vector.second);
+  }
+
+  /* the hash is computed on the lowercased name */
+  BOOST_CHECK_EQUAL(toBase32Hex(hashQNameWithSalt(salt, 12, DNSName("X.W.Example."))), "b4um86eghhds6nea196smvmlo4ors995");
+
+  /* no additional iteration and no salt: a single SHA1 of the name */
+  const auto hashed = hashQNameWithSalt(std::string(), 0, DNSName("example."));
+  BOOST_CHECK_EQUAL(hashed.size(), 20U);
+  NSEC3PARAMRecordContent ns3prc;
+  ns3prc.d_iterations = 0;
+  BOOST_CHECK_EQUAL(hashQNameWithSalt(ns3prc, DNSName("example.")), hashed);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -14,6 +14,7 @@
 #include "dnsname.hh"
 #include <fstream>
 #include <cstdlib>
+#include <tuple>
 
 BOOST_AUTO_TEST_SUITE(test_zoneparser_tng_cc)
 
@@ -95,4 +96,39 @@ BOOST_AUTO_TEST_CASE(test_tng_record_generate) {
 
 }
 
+BOOST_AUTO_TEST_CASE(test_tng_record_repeated_owner) {
+  reportAllTypes();
+
+  /* consecutive records for the same owner and type reuse the previous results,
+     make sure a change of $ORIGIN is taken into account */
+  vector<string> zonedata = {
+    "foo 3600 IN NS ns1",
+    "foo 3600 IN ns ns2.example.net.",
+    "$ORIGIN sub.example.com.",
+    "foo 3600 IN NS ns3",
+    "\t3600 IN A 192.0.2.1",
+    "foo 3600 IN A 192.0.2.2",
+    "FOO 3600 IN A 192.0.2.3"
+  };
+  ZoneParserTNG zp(zonedata, DNSName("example.com"));
+
+  vector<std::tuple<string, string, string>> expected = {
+    std::make_tuple("foo.example.com.", "NS", "ns1.example.com"),
+    std::make_tuple("foo.example.com.", "NS", "ns2.example.net"),
+    std::make_tuple("foo.sub.example.com.", "NS", "ns3.sub.example.com"),
+    std::make_tuple("foo.sub.example.com.", "A", "192.0.2.1"),
+    std::make_tuple("foo.sub.example.com.", "A", "192.0.2.2"),
+    std::make_tuple("FOO.sub.example.com.", "A", "192.0.2.3")
+  };
+
+  DNSResourceRecord rr;
+  for (auto const & exp : expected) {
+    BOOST_REQUIRE(zp.get(rr));
+    BOOST_CHECK_EQUAL(rr.qname.toString(), std::get<0>(exp));
+    BOOST_CHECK_EQUAL(rr.qtype.getName(), std::get<1>(exp));
+    BOOST_CHECK_EQUAL(rr.content, std::get<2>(exp));
+  }
+  BOOST_CHECK(!zp.get(rr));
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -48,6 +48,7 @@
 #include "statbag.hh"
 
 extern StatBag S;
+extern AuthZoneCache g_zoneCache;
 
 vector<UeberBackend *>UeberBackend::instances;
 pthread_mutex_t UeberBackend::instances_lock=PTHREAD_MUTEX_INITIALIZER;
@@ -112,6 +113,7 @@ bool UeberBackend::createDomain(const DNSName &domain)
 {
   for(DNSBackend* mydb :  backends) {
     if(mydb->createDomain(domain)) {
+      g_zoneCache.invalidate();
       return true;
     }
   }
@@ -242,6 +244,7 @@ void UeberBackend::reload()
   {
     ( *i )->reload();
   }
+  g_zoneCache.invalidate();
 }
 
 void UeberBackend::rediscover(string *status)
@@ -254,6 +257,7 @@ void UeberBackend::rediscover(string *status)
     if(status) 
       *status+=tmpstr + (i!=backends.begin() ? "\n" : "");
   }
+  g_zoneCache.invalidate();
 }
 
 
@@ -275,8 +279,65 @@ void UeberBackend::getUpdatedMasters(vector<DomainInfo>* domains)
   }
 }
 
+bool UeberBackend::getAuthFromZoneCache(const AuthZoneCache::Zone& zone, SOAData* sd, bool cachedOk)
+{
+  if(zone.backend >= backends.size()) {
+    return false;
+  }
+
+  if(cachedOk && d_cache_ttl) {
+    d_question.qtype = QType::SOA;
+    d_question.qname = zone.name;
+    d_question.zoneId = -1;
+
+    if(cacheHas(d_question, d_answers) == 1 && !d_answers.empty()) {
+      fillSOAData(d_answers[0], *sd);
+      sd->db = 0;
+      sd->qname = zone.name;
+      return true;
+    }
+  }
+
+  if(!backends[zone.backend]->getAuth(zone.name, sd) || sd->qname != zone.name) {
+    return false;
+  }
+
+  if(d_cache_ttl) {
+    d_question.qtype = QType::SOA;
+    d_question.qname = zone.name;
+    d_question.zoneId = -1;
+
+    DNSZoneRecord rr;
+    rr.dr.d_name = sd->qname;
+    rr.dr.d_type = QType::SOA;
+    rr.dr.d_content = makeSOAContent(*sd);
+    rr.dr.d_ttl = sd->ttl;
+    rr.domain_id = sd->domain_id;
+
+    addCache(d_question, {rr});
+  }
+  return true;
+}
+
 bool UeberBackend::getAuth(const DNSName &target, const QType& qtype, SOAData* sd, bool cachedOk)
 {
+  // If the zone cache knows the most specific zone for this name we only have
+  // to fetch its SOA. Otherwise (cache disabled or not loaded yet, a zone
+  // missing from it, or a backend unable to list its zones) we walk the
+  // labels below.
+  AuthZoneCache::Zone zone;
+  if(g_zoneCache.getBestZone(target, zone)) {
+    bool usable = true;
+    if(qtype == QType::DS && zone.name == target) {
+      // DS records live in the parent zone
+      DNSName parent(target);
+      usable = parent.chopOff() && g_zoneCache.getBestZone(parent, zone);
+    }
+    if(usable && getAuthFromZoneCache(zone, sd, cachedOk)) {
+      return true;
+    }
+  }
+
   // A backend can respond to our authority request with the 'best' match it
   // has. For example, when asked for a.b.c.example.com. it might respond with
   // com. We then store that and keep querying the other backends in case one
@@ -540,14 +601,13 @@ UeberBackend::~UeberBackend()
 }
 
 // this handle is more magic than most
-void UeberBackend::lookup(const QType &qtype,const DNSName &qname, int zoneId, DNSPacket *pkt_p)
+void UeberBackend::waitUntilReady()
 {
   if(d_stale) {
     g_log<<Logger::Error<<"Stale ueberbackend received question, signalling that we want to be recycled"<<endl;
     throw PDNSException("We are stale, please recycle");
   }
 
-  DLOG(g_log<<"UeberBackend received question for "<<qtype.getName()<<" of "<<qname<<endl);
   if(!d_go) {
     pthread_mutex_lock(&d_mut);
     while (d_go==false) {
@@ -557,6 +617,12 @@ void UeberBackend::lookup(const QType &qtype,const DNSName &qname, int zoneId, D
     }
     pthread_mutex_unlock(&d_mut);
   }
+}
+
+void UeberBackend::lookup(const QType &qtype,const DNSName &qname, int zoneId, DNSPacket *pkt_p)
+{
+  DLOG(g_log<<"UeberBackend received question for "<<qtype.getName()<<" of "<<qname<<endl);
+  waitUntilReady();
 
   d_domain_id=zoneId;
 
@@ -599,6 +665,65 @@ void UeberBackend::lookup(const QType &qtype,const DNSName &qname, int zoneId, D
   d_handle.parent=this;
 }
 
+void UeberBackend::lookupNames(const vector<DNSName>& names, int zoneId, vector<DNSZoneRecord>& records, DNSPacket *pkt_p)
+{
+  waitUntilReady();
+
+  if(!backends.size()) {
+    g_log<<Logger::Error<<"No database backends available - unable to answer questions."<<endl;
+    d_stale=true; // please recycle us!
+    throw PDNSException("We are stale, please recycle");
+  }
+
+  // the query cache entries are shared with ANY lookups done via lookup()
+  vector<DNSName> remaining;
+  for(const auto& name : names) {
+    d_question.qtype = QType::ANY;
+    d_question.qname = name;
+    d_question.zoneId = zoneId;
+    int cstat = cacheHas(d_question, d_answers);
+    if(cstat < 0) {
+      remaining.push_back(name);
+    }
+    else if(cstat == 1) {
+      records.insert(records.end(), d_answers.begin(), d_answers.end());
+    }
+  }
+
+  for(auto backend = backends.begin(); backend != backends.end() && !remaining.empty(); ++backend) {
+    vector<DNSZoneRecord> found;
+    (*backend)->lookupNames(remaining, zoneId, found, pkt_p);
+
+    map<DNSName, vector<DNSZoneRecord> > byName;
+    for(auto& rr : found) {
+      byName[rr.dr.d_name].push_back(std::move(rr));
+    }
+
+    vector<DNSName> unanswered;
+    for(const auto& name : remaining) {
+      auto answers = byName.find(name);
+      if(answers == byName.end()) {
+        unanswered.push_back(name);
+        continue;
+      }
+      d_question.qtype = QType::ANY;
+      d_question.qname = name;
+      d_question.zoneId = zoneId;
+      addCache(d_question, answers->second);
+      records.insert(records.end(), answers->second.begin(), answers->second.end());
+    }
+    remaining = std::move(unanswered);
+  }
+
+  for(const auto& name : remaining) {
+    d_question.qtype = QType::ANY;
+    d_question.qname = name;
+    d_question.zoneId = zoneId;
+    addNegCache(d_question);
+  }
+  d_answers.clear();
+}
+
 void UeberBackend::getAllDomains(vector<DomainInfo> *domains, bool include_disabled) {
   for (vector<DNSBackend*>::iterator i = backends.begin(); i != backends.end(); ++i )
   {
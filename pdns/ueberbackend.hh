@@ -36,6 +36,7 @@
 #include <boost/utility.hpp>
 #include "dnspacket.hh"
 #include "dnsbackend.hh"
+#include "auth-zonecache.hh"
 
 #include "namespaces.hh"
 
@@ -98,6 +99,9 @@ public:
   };
 
   void lookup(const QType &, const DNSName &qdomain, int zoneId, DNSPacket *pkt_p=nullptr);
+  /** Fetches the records of all types for several names at once, see DNSBackend::lookupNames().
+      For each name, the records come from the first backend having any, as with lookup(). */
+  void lookupNames(const vector<DNSName>& names, int zoneId, vector<DNSZoneRecord>& records, DNSPacket *pkt_p=nullptr);
 
   /** Determines if we are authoritative for a zone, and at what level */
   bool getAuth(const DNSName &target, const QType &qtype, SOAData* sd, bool cachedOk=true);
@@ -158,6 +162,8 @@ private:
   static bool d_go;
   bool d_stale;
 
+  void waitUntilReady(); //!< throws if we are stale, blocks until we get the 'go'
+  bool getAuthFromZoneCache(const AuthZoneCache::Zone& zone, SOAData* sd, bool cachedOk);
   int cacheHas(const Question &q, vector<DNSZoneRecord> &rrs);
   void addNegCache(const Question &q);
   void addCache(const Question &q, const vector<DNSZoneRecord> &rrs);
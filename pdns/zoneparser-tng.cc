@@ -39,14 +39,14 @@
 static string g_INstr("IN");
 
 ZoneParserTNG::ZoneParserTNG(const string& fname, const DNSName& zname, const string& reldir) : d_reldir(reldir), 
-                                                                                               d_zonename(zname), d_defaultttl(3600), 
+                                                                                               d_zonename(zname), d_prevqtype(0), d_defaultttl(3600), 
                                                                                                d_templatecounter(0), d_templatestop(0),
                                                                                                d_templatestep(0), d_havedollarttl(false){
   stackFile(fname);
 }
 
 ZoneParserTNG::ZoneParserTNG(const vector<string> zonedata, const DNSName& zname):
-  d_zonename(zname), d_zonedata(zonedata), d_defaultttl(3600),
+  d_zonename(zname), d_zonedata(zonedata), d_prevqtype(0), d_defaultttl(3600),
   d_templatecounter(0), d_templatestop(0), d_templatestep(0),
   d_havedollarttl(false), d_fromfile(false)
 {
@@ -222,6 +222,28 @@ bool ZoneParserTNG::getTemplateLine()
   return true;
 }
 
+// the characters that are stripped from the start and end of lines and record contents
+static inline bool isZoneBlank(char c)
+{
+  return c==' ' || c=='\t' || c=='\r' || c=='\n' || c=='\x1a';
+}
+
+static void trimZoneBlanks(string& str, bool left=true)
+{
+  string::size_type end = str.size();
+  while(end > 0 && isZoneBlank(str[end-1]))
+    --end;
+  str.resize(end);
+
+  if(left) {
+    string::size_type begin = 0;
+    while(begin < end && isZoneBlank(str[begin]))
+      ++begin;
+    if(begin)
+      str.erase(0, begin);
+  }
+}
+
 void chopComment(string& line)
 {
   if(line.find(';')==string::npos)
@@ -242,6 +264,8 @@ void chopComment(string& line)
 
 bool findAndElide(string& line, char c)
 {
+  if(line.find(c)==string::npos)
+    return false;
   string::size_type pos, len = line.length();
   bool inQuote=false;
   for(pos = 0 ; pos < len; ++pos) {
@@ -289,12 +313,13 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
   if(!getTemplateLine() && !getLine())
     return false;
 
-  boost::trim_right_if(d_line, is_any_of(" \t\r\n\x1a"));
+  trimZoneBlanks(d_line, false);
   if(comment)
     comment->clear();
   if(comment && d_line.find(';') != string::npos)
     *comment = d_line.substr(d_line.find(';'));
-  parts_t parts;
+  parts_t& parts = d_parts; // reused, so the deque does not allocate for every line
+  parts.clear();
   vstringtok(parts, d_line);
 
   if(parts.empty())
@@ -317,6 +342,7 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
     }
     else if(pdns_iequals(command, "$ORIGIN") && parts.size() > 1) {
       d_zonename = DNSName(makeString(d_line, parts[1]));
+      d_prevqnamestr.clear();
     }
     else if(pdns_iequals(command, "$GENERATE") && parts.size() > 2) {
       // $GENERATE 1-127 $ CNAME $.0
@@ -345,6 +371,11 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
   if(dns_isspace(d_line[0])) {
     rr.qname=d_prevqname;
     prevqname=true;
+  }else if(!d_prevqnamestr.empty() && qname==d_prevqnamestr) {
+    // same owner as the previous record, as is common in large zones, no need to parse it again
+    rr.qname=d_prevqname;
+    parts.pop_front();
+    goto haveqname;
   }else {
     rr.qname=DNSName(qname); 
     parts.pop_front();
@@ -356,6 +387,12 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
   else if(!prevqname && !isCanonical(qname))
     rr.qname += d_zonename;
   d_prevqname=rr.qname;
+  if(!prevqname)
+    d_prevqnamestr=qname;
+  else if(qname=="@")
+    d_prevqnamestr.clear();
+
+ haveqname:;
 
   if(parts.empty()) 
     throw exception("Line with too little parts "+getLineOfFile());
@@ -394,10 +431,18 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
     if(haveQTYPE) 
       break;
 
+    if(pdns_iequals(nextpart, d_prevqtypestr)) {
+      rr.qtype=d_prevqtype;
+      haveQTYPE=1;
+      continue;
+    }
+
     try {
       rr.qtype=DNSRecordContent::TypeToNumber(nextpart);
       // cout<<"Got qtype ("<<rr.qtype.getCode()<<")\n";
       haveQTYPE=1;
+      d_prevqtypestr=nextpart;
+      d_prevqtype=rr.qtype.getCode();
       continue;
     }
     catch(...) {
@@ -412,7 +457,7 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
   //  rr.content=d_line.substr(range.first);
   rr.content.assign(d_line, range.first, string::npos);
   chopComment(rr.content);
-  trim_if(rr.content, is_any_of(" \r\n\t\x1a"));
+  trimZoneBlanks(rr.content);
 
   if(rr.content.size()==1 && rr.content[0]=='@')
     rr.content=d_zonename.toString();
@@ -430,8 +475,8 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
           break;
       }
     }
+    trimZoneBlanks(rr.content);
   }
-  trim_if(rr.content, is_any_of(" \r\n\t\x1a"));
 
   vector<string> recparts;
   switch(rr.qtype.getCode()) {
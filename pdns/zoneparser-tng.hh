@@ -63,6 +63,10 @@ private:
   vector<string>::iterator d_zonedataline;
   std::stack<filestate> d_filestates;
   parts_t d_templateparts;
+  parts_t d_parts;
+  string d_prevqnamestr;
+  string d_prevqtypestr;
+  uint16_t d_prevqtype;
   int d_defaultttl;
   uint32_t d_templatecounter, d_templatestop, d_templatestep;
   bool d_havedollarttl;
@@ -0,0 +1,131 @@
+#!/usr/bin/env python
+
+import socket
+import struct
+import time
+
+import dns
+
+from authtests import AuthTest
+
+
+class TestTCP(AuthTest):
+    _tcpIdleTimeout = 2
+
+    _config_template = """
+launch=bind
+tcp-worker-threads=2
+tcp-idle-timeout=%d
+"""
+
+    _config_params = ['_tcpIdleTimeout']
+
+    _zones = {
+        'example.org': """
+example.org.                 3600 IN SOA  {soa}
+example.org.                 3600 IN NS   ns1.example.org.
+example.org.                 3600 IN NS   ns2.example.org.
+ns1.example.org.             3600 IN A    {prefix}.10
+ns2.example.org.             3600 IN A    {prefix}.11
+        """,
+    }
+
+    @classmethod
+    def openTCPConnection(cls, timeout=2.0):
+        sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        sock.settimeout(timeout)
+        sock.connect(("127.0.0.1", cls._authPort))
+        return sock
+
+    @classmethod
+    def sendTCPQueryOverConnection(cls, sock, query):
+        wire = query.to_wire()
+        sock.send(struct.pack("!H", len(wire)) + wire)
+
+    @classmethod
+    def recvExactly(cls, sock, length):
+        data = b''
+        while len(data) < length:
+            chunk = sock.recv(length - len(data))
+            if not chunk:
+                return None
+            data += chunk
+        return data
+
+    @classmethod
+    def recvTCPResponseOverConnection(cls, sock):
+        data = cls.recvExactly(sock, 2)
+        if not data:
+            return None
+        (datalen,) = struct.unpack("!H", data)
+        data = cls.recvExactly(sock, datalen)
+        if not data:
+            return None
+        return dns.message.from_wire(data)
+
+    def isConnectionClosed(self, sock):
+        try:
+            return sock.recv(1) == b''
+        except socket.timeout:
+            return False
+        except socket.error:
+            return True
+
+    def testPipelinedQueries(self):
+        """
+        TCP: Pipelined queries are all answered, in order
+        """
+        names = ['ns1.example.org.', 'ns2.example.org.'] * 10
+        queries = []
+        for idx, name in enumerate(names):
+            query = dns.message.make_query(name, 'A')
+            query.id = idx
+            queries.append(query)
+
+        sock = self.openTCPConnection()
+        try:
+            # send all the queries at once, before reading any response
+            sock.send(b''.join([struct.pack("!H", len(query.to_wire())) + query.to_wire() for query in queries]))
+
+            for idx, name in enumerate(names):
+                res = self.recvTCPResponseOverConnection(sock)
+                self.assertTrue(res)
+                self.assertEqual(res.id, idx)
+                self.assertRcodeEqual(res, dns.rcode.NOERROR)
+                self.assertEqual(res.question[0].name, dns.name.from_text(name))
+                self.assertEqual(len(res.answer), 1)
+        finally:
+            sock.close()
+
+    def testIdleTimeout(self):
+        """
+        TCP: Idle connections are closed after tcp-idle-timeout
+        """
+        sock = self.openTCPConnection(timeout=self._tcpIdleTimeout + 3)
+        try:
+            start = time.time()
+            self.assertTrue(self.isConnectionClosed(sock))
+            self.assertGreaterEqual(time.time() - start, self._tcpIdleTimeout - 1)
+        finally:
+            sock.close()
+
+    def testIdleTimeoutResetByQueries(self):
+        """
+        TCP: Every answered query resets the idle timeout
+        """
+        query = dns.message.make_query('ns1.example.org.', 'A')
+        sock = self.openTCPConnection()
+        try:
+            # keep the connection busy for twice the idle timeout
+            for _ in range(4):
+                self.sendTCPQueryOverConnection(sock, query)
+                res = self.recvTCPResponseOverConnection(sock)
+                self.assertTrue(res)
+                self.assertRcodeEqual(res, dns.rcode.NOERROR)
+                time.sleep(self._tcpIdleTimeout / 2.0)
+
+            # then stay idle
+            sock.settimeout(self._tcpIdleTimeout + 3)
+            self.assertTrue(self.isConnectionClosed(sock))
+        finally:
+            sock.close()
@@ -41,6 +41,8 @@ class DNSDistTest(AssertEqualDNSMessageMixin, unittest.TestCase):
     """
     _dnsDistPort = 5340
     _dnsDistListeningAddr = "127.0.0.1"
+    # set to True when the configuration sets up its own frontends, which -l would replace
+    _skipListeningOnCL = False
     _testServerPort = 5350
     _toResponderQueue = Queue()
     _fromResponderQueue = Queue()
@@ -79,8 +81,9 @@ class DNSDistTest(AssertEqualDNSMessageMixin, unittest.TestCase):
             conf.write("-- Autogenerated by dnsdisttests.py\n")
             conf.write(cls._config_template % params)
 
-        dnsdistcmd = [os.environ['DNSDISTBIN'], '--supervised', '-C', confFile,
-                      '-l', '%s:%d' % (cls._dnsDistListeningAddr, cls._dnsDistPort) ]
+        dnsdistcmd = [os.environ['DNSDISTBIN'], '--supervised', '-C', confFile]
+        if not cls._skipListeningOnCL:
+            dnsdistcmd.extend(['-l', '%s:%d' % (cls._dnsDistListeningAddr, cls._dnsDistPort)])
         for acl in cls._acl:
             dnsdistcmd.extend(['--acl', acl])
         print(' '.join(dnsdistcmd))
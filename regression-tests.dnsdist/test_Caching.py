@@ -2192,3 +2192,95 @@ class TestCachingScopeZeroButNoSubnetcheck(DNSDistTest):
             receivedQuery.id = expectedQuery2.id
             self.checkMessageEDNSWithECS(expectedQuery2, receivedQuery)
             self.checkMessageNoEDNS(receivedResponse, response)
+
+class TestCachingHotCache(DNSDistTest):
+
+    _consoleKey = DNSDistTest.generateConsoleKey()
+    _consoleKeyB64 = base64.b64encode(_consoleKey).decode('ascii')
+    _skipListeningOnCL = True
+    _config_params = ['_consoleKeyB64', '_consolePort', '_dnsDistPort', '_testServerPort']
+    _config_template = """
+    setKey("%s")
+    controlSocket("127.0.0.1:%d")
+    pc = newPacketCache(100, {maxTTL=86400, minTTL=1})
+    getPool(""):setCache(pc)
+    addLocal("127.0.0.1:%d")
+    -- getBind(0) is the UDP frontend, getBind(1) the TCP one
+    getBind(0):setHotCache(pc)
+    newServer{address="127.0.0.1:%d"}
+    """
+
+    def getCacheStat(self, stat):
+        return int(self.sendConsoleCommand("getPool(\"\"):getCache():getStats()[\"%s\"]" % (stat)).strip("\n"))
+
+    def testHotCacheMissCountedOnce(self):
+        """
+        Cache: A miss in the hot cache, which is also the cache of the pool, is only counted once
+        """
+        name = 'miss.hot.cache.tests.powerdns.com.'
+        query = dns.message.make_query(name, 'A', 'IN')
+        response = dns.message.make_response(query)
+        rrset = dns.rrset.from_text(name,
+                                    3600,
+                                    dns.rdataclass.IN,
+                                    dns.rdatatype.A,
+                                    '192.0.2.1')
+        response.answer.append(rrset)
+
+        misses = self.getCacheStat('misses')
+        hits = self.getCacheStat('hits')
+
+        (receivedQuery, receivedResponse) = self.sendUDPQuery(query, response)
+        self.assertTrue(receivedQuery)
+        self.assertTrue(receivedResponse)
+        receivedQuery.id = query.id
+        self.assertEquals(query, receivedQuery)
+        self.assertEquals(response, receivedResponse)
+        self.assertEquals(self.getCacheStat('misses'), misses + 1)
+
+        (_, receivedResponse) = self.sendUDPQuery(query, response=None, useQueue=False)
+        self.assertEquals(receivedResponse, response)
+        self.assertEquals(self.getCacheStat('misses'), misses + 1)
+        self.assertEquals(self.getCacheStat('hits'), hits + 1)
+
+    def testHotCacheBypassesRules(self):
+        """
+        Cache: Queries answered from the hot cache do not go through the rules
+
+        A name that is already in the hot cache keeps being served from it
+        after a rule refusing it has been added, while a name that is not
+        in the cache is refused.
+        """
+        name = 'bypass.hot.cache.tests.powerdns.com.'
+        query = dns.message.make_query(name, 'A', 'IN')
+        response = dns.message.make_response(query)
+        rrset = dns.rrset.from_text(name,
+                                    3600,
+                                    dns.rdataclass.IN,
+                                    dns.rdatatype.A,
+                                    '192.0.2.1')
+        response.answer.append(rrset)
+
+        # fill the cache
+        (receivedQuery, receivedResponse) = self.sendUDPQuery(query, response)
+        self.assertTrue(receivedQuery)
+        self.assertTrue(receivedResponse)
+        receivedQuery.id = query.id
+        self.assertEquals(query, receivedQuery)
+        self.assertEquals(response, receivedResponse)
+
+        self.sendConsoleCommand("addAction(makeRule(\"hot.cache.tests.powerdns.com.\"), RCodeAction(DNSRCode.REFUSED))")
+        try:
+            # still served from the hot cache, the rule is not applied
+            (_, receivedResponse) = self.sendUDPQuery(query, response=None, useQueue=False)
+            self.assertEquals(receivedResponse, response)
+
+            # but the rule is applied to a query that is not in the cache
+            uncachedName = 'uncached.hot.cache.tests.powerdns.com.'
+            uncachedQuery = dns.message.make_query(uncachedName, 'A', 'IN')
+            expectedResponse = dns.message.make_response(uncachedQuery)
+            expectedResponse.set_rcode(dns.rcode.REFUSED)
+            (_, receivedResponse) = self.sendUDPQuery(uncachedQuery, response=None, useQueue=False)
+            self.assertEquals(receivedResponse, expectedResponse)
+        finally:
+            self.sendConsoleCommand("clearRules()")
@@ -175,3 +175,44 @@ class TestHealthCheckCustomFunction(HealthCheckTest):
         time.sleep(1.5)
         self.assertGreater(TestHealthCheckCustomFunction._healthCheckCounter, before)
         self.assertEquals(self.getBackendStatus(), 'up')
+
+class TestHealthCheckSubSecondInterval(HealthCheckTest):
+    # this test suite uses a different responder port
+    # because we need fresh counters
+    _testServerPort = 5386
+
+    _config_template = """
+    setKey("%s")
+    controlSocket("127.0.0.1:%d")
+    srv = newServer{address="127.0.0.1:%d", checkInterval=0.2}
+    """
+
+    def testSubSecondInterval(self):
+        """
+        HealthChecks: Sub-second interval
+        """
+        before = TestHealthCheckSubSecondInterval._healthCheckCounter
+        time.sleep(1.5)
+        self.assertGreaterEqual(TestHealthCheckSubSecondInterval._healthCheckCounter, before + 4)
+        self.assertEquals(self.getBackendStatus(), 'up')
+
+class TestLazyHealthCheck(HealthCheckTest):
+    # this test suite uses a different responder port
+    # because we need fresh counters
+    _testServerPort = 5387
+
+    _config_template = """
+    setKey("%s")
+    controlSocket("127.0.0.1:%d")
+    srv = newServer{address="127.0.0.1:%d", healthCheckMode="lazy"}
+    """
+
+    def testLazy(self):
+        """
+        HealthChecks: Lazy mode does not send checks while queries succeed
+        """
+        self.assertEquals(self.getBackendStatus(), 'up')
+        before = TestLazyHealthCheck._healthCheckCounter
+        time.sleep(1.5)
+        self.assertEquals(TestLazyHealthCheck._healthCheckCounter, before)
+        self.assertEquals(self.getBackendStatus(), 'up')
@@ -522,3 +522,59 @@ class TestRoutingBadWeightWRandom(DNSDistTest):
         """
         # There should be no downstreams
         self.assertTrue(self.sendConsoleCommand("getServer(0)").startswith("Error"))
+
+class TestRoutingLowestLatency(DNSDistTest):
+
+    _testServer2Port = 5351
+    _config_params = ['_testServerPort', '_testServer2Port']
+    _config_template = """
+    setServerPolicy(lowestLatency)
+    s1 = newServer{address="127.0.0.1:%s"}
+    s1:setUp()
+    s2 = newServer{address="127.0.0.1:%s"}
+    s2:setUp()
+    """
+
+    @classmethod
+    def startResponders(cls):
+        print("Launching responders..")
+        cls._UDPResponder = threading.Thread(name='UDP Responder', target=cls.UDPResponder, args=[cls._testServerPort, cls._toResponderQueue, cls._fromResponderQueue])
+        cls._UDPResponder.setDaemon(True)
+        cls._UDPResponder.start()
+        cls._UDPResponder2 = threading.Thread(name='UDP Responder 2', target=cls.UDPResponder, args=[cls._testServer2Port, cls._toResponderQueue, cls._fromResponderQueue])
+        cls._UDPResponder2.setDaemon(True)
+        cls._UDPResponder2.start()
+
+    def testLowestLatency(self):
+        """
+        Routing: LowestLatency
+
+        Send A queries to "lowestlatency.routing.tests.powerdns.com." for a few seconds,
+        so that the latency of both backends gets measured, and check that both
+        of them still get queries instead of the fastest one getting all of them.
+        """
+        numberOfQueries = 100
+        name = 'lowestlatency.routing.tests.powerdns.com.'
+        query = dns.message.make_query(name, 'A', 'IN')
+        response = dns.message.make_response(query)
+        rrset = dns.rrset.from_text(name,
+                                    60,
+                                    dns.rdataclass.IN,
+                                    dns.rdatatype.A,
+                                    '192.0.2.1')
+        response.answer.append(rrset)
+
+        for _ in range(3):
+            for _ in range(numberOfQueries):
+                (receivedQuery, receivedResponse) = self.sendUDPQuery(query, response)
+                receivedQuery.id = query.id
+                self.assertEquals(query, receivedQuery)
+                self.assertEquals(response, receivedResponse)
+            time.sleep(1)
+
+        total = 0
+        for key in ['UDP Responder', 'UDP Responder 2']:
+            self.assertIn(key, self._responsesCounter)
+            self.assertGreater(self._responsesCounter[key], 0)
+            total += self._responsesCounter[key]
+        self.assertEquals(total, 3 * numberOfQueries)
@@ -0,0 +1,64 @@
+#!/usr/bin/env python
+import base64
+import threading
+import time
+import dns
+from dnsdisttests import DNSDistTest
+
+def dropCallback(request):
+    if len(request.question) != 1:
+        return None
+    # answer the health checks, drop everything else
+    if str(request.question[0].name).endswith('a.root-servers.net.'):
+        return dns.message.make_response(request).to_wire()
+    return None
+
+class TestUDPTimeouts(DNSDistTest):
+
+    # this test suite uses a different responder port
+    # because its responder drops the queries
+    _testServerPort = 5420
+    _consoleKey = DNSDistTest.generateConsoleKey()
+    _consoleKeyB64 = base64.b64encode(_consoleKey).decode('ascii')
+    _config_params = ['_consoleKeyB64', '_consolePort', '_testServerPort']
+    _config_template = """
+    setKey("%s")
+    controlSocket("127.0.0.1:%s")
+    setUDPTimeout(1)
+    setUDPTimeoutCheckInterval(50)
+    newServer{address="127.0.0.1:%s"}
+    """
+
+    @classmethod
+    def startResponders(cls):
+        print("Launching responders..")
+
+        cls._UDPResponder = threading.Thread(name='UDP Responder', target=cls.UDPResponder, args=[cls._testServerPort, cls._toResponderQueue, cls._fromResponderQueue, False, dropCallback])
+        cls._UDPResponder.setDaemon(True)
+        cls._UDPResponder.start()
+
+    def testTimeoutDetected(self):
+        """
+        UDP Timeouts: An unanswered query is detected as timed out
+        """
+        name = 'timeout.udp-timeouts.tests.powerdns.com.'
+        query = dns.message.make_query(name, 'A', 'IN')
+
+        before = int(self.sendConsoleCommand("getStatisticsCounters()['downstream-timeouts']"))
+        (_, receivedResponse) = self.sendUDPQuery(query, response=None, useQueue=False, timeout=0.5)
+        self.assertEqual(receivedResponse, None)
+
+        # the UDP timeout is 1s, checked every 50 ms
+        time.sleep(1.5)
+        after = int(self.sendConsoleCommand("getStatisticsCounters()['downstream-timeouts']"))
+        self.assertEqual(after, before + 1)
+        self.assertEqual(int(self.sendConsoleCommand("getServer(0):getOutstanding()")), 0)
+
+    def testInvalidCheckInterval(self):
+        """
+        UDP Timeouts: Out of range check intervals are refused
+        """
+        for value in ['0', '-1', '60001']:
+            result = self.sendConsoleCommand("setUDPTimeoutCheckInterval(" + value + ")")
+            self.assertEqual(result, "The UDP timeout check interval should be between 1 and 60000 milliseconds\n")
+        self.assertEqual(self.sendConsoleCommand("setUDPTimeoutCheckInterval(100)"), "")